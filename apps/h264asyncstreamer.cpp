@@ -0,0 +1,35 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <plog/Init.h>
+#include <plog/Appenders/ConsoleAppender.h>
+#include <plog/Formatters/TxtFormatter.h>
+
+#include "async_v4l2.hpp"
+#include "event_reactor.hpp"
+#include "task.hpp"
+
+Task<void> encode_frames(EventReactor &reactor, AsyncCamera &camera, AsyncEncoder &encoder, std::size_t frames) {
+    for (std::size_t i = 0; i < frames; i++) {
+        auto frame = co_await camera.next();
+        auto nal = co_await encoder.encode(std::move(frame));
+
+        PLOG_INFO << "Encoded frame " << i << " with " << nal.info.bytesused << " bytes";
+    }
+
+    reactor.stop();
+}
+
+int main() {
+    static plog::ConsoleAppender<plog::TxtFormatter> consoleAppender;
+    plog::init(plog::info, &consoleAppender);
+
+    EventReactor reactor;
+    AsyncCamera camera{reactor, "/dev/video0"};
+    AsyncEncoder encoder{reactor, 4};
+
+    co_spawn(encode_frames(reactor, camera, encoder, 10));
+
+    reactor.run();
+}
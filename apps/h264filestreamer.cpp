@@ -2,13 +2,46 @@
 // Copyright (c) 2024 Nico Schmidt
 //
 
+#include <filesystem>
 #include <memory>
+#include <plog/Init.h>
+#include <plog/Log.h>
+#include <plog/Appenders/ConsoleAppender.h>
+#include <plog/Formatters/TxtFormatter.h>
 
-#include "requeing_package.hpp"
+#include "fmp4_muxer.hpp"
+#include "segmented_recorder.hpp"
+#include "trace.hpp"
+#include "uring_file_sink.hpp"
 #include "v4l2_streamer.hpp"
 
-int main() {
-    V4L2Streamer streamer{"/dev/video0", 640, 480};
+int main(int argc, char **argv) {
+    static plog::ConsoleAppender<plog::TxtFormatter> consoleAppender;
+    plog::init(plog::info, &consoleAppender);
+
+    const std::string output_path = argc > 1 ? argv[1] : "output.h264";
+
+    V4L2Streamer streamer{"/dev/video0", 640, 480, 4};
+
+    /* keep fewer writes in flight than the encoder has capture buffers */
+    constexpr std::uint32_t WRITE_QUEUE_DEPTH{4};
+
+    /* a .mp4 path gets a seekable fragmented MP4 with the driver timestamps instead of the raw bitstream, a
+     * directory gets rotating segments */
+    std::shared_ptr<Fmp4Muxer> muxer;
+    std::shared_ptr<SegmentedRecorder> recorder;
+    std::shared_ptr<UringFileSink> sink;
+
+    if (std::filesystem::is_directory(output_path)) {
+        recorder = std::make_shared<SegmentedRecorder>(output_path);
+        streamer.set_sink(recorder);
+    } else if (output_path.ends_with(".mp4")) {
+        muxer = std::make_shared<Fmp4Muxer>(output_path, 640, 480);
+        streamer.set_sink(muxer);
+    } else {
+        sink = std::make_shared<UringFileSink>(output_path, WRITE_QUEUE_DEPTH);
+        streamer.set_sink(sink);
+    }
 
     streamer.start_streaming();
 
@@ -16,6 +49,32 @@ int main() {
         streamer.next_frame();
     }
 
-    std::make_unique<DmaBuf>(0,0,"test");
+    streamer.flush();
+
+    if (muxer) {
+        muxer->flush();
+    } else if (recorder) {
+        recorder->flush();
+    } else {
+        sink->flush();
+    }
 
+    for (std::size_t stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        const auto summary = streamer.latency(static_cast<LatencyStage>(stage)).summary();
+
+        PLOGI << latency_stage_name(static_cast<LatencyStage>(stage)) << ": p50 " << summary.p50_ns / 1000
+              << "us, p99 " << summary.p99_ns / 1000 << "us, p999 " << summary.p999_ns / 1000 << "us, max "
+              << summary.max_ns / 1000 << "us over " << summary.count << " frames";
+    }
+
+    for (std::size_t queue = 0; queue < STREAM_QUEUE_COUNT; queue++) {
+        const auto statistics = streamer.queue_statistics(static_cast<StreamQueue>(queue));
+
+        PLOGI << stream_queue_name(static_cast<StreamQueue>(queue)) << ": " << statistics.buffers << " buffers, "
+              << statistics.dropped << " dropped, " << statistics.errors << " errors, " << statistics.late << " late";
+    }
+
+    if constexpr (SPICAM_TRACE_LEVEL > 0) {
+        trace_dump(output_path + ".trace");
+    }
 }
@@ -0,0 +1,70 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+
+#include "dmabuf.hpp"
+#include "dmabuf_pool.hpp"
+#include "fake_device_backend.hpp"
+
+static void allocate(benchmark::State &state) {
+  const auto size = static_cast<std::uint32_t>(state.range(0));
+
+  for (auto _: state) {
+    auto buffers = allocate_dma_bufs(1, size);
+    benchmark::DoNotOptimize(buffers.front().get_fd());
+  }
+
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+/**
+ * Allocation from the CMA heap of the running kernel, skipped on machines without it.
+ */
+static void BM_AllocateDmaBufsKernel(benchmark::State &state) {
+  if (!std::filesystem::exists("/dev/dma_heap/linux,cma")) {
+    state.SkipWithError("no CMA dma heap");
+    return;
+  }
+
+  allocate(state);
+}
+
+BENCHMARK(BM_AllocateDmaBufsKernel)->RangeMultiplier(4)->Range(4 << 10, 8 << 20);
+
+/**
+ * The memfd backed buffers of the fake backend, the baseline of the allocation path itself.
+ */
+static void BM_AllocateDmaBufsFake(benchmark::State &state) {
+  set_device_backend(std::make_shared<FakeDeviceBackend>());
+
+  allocate(state);
+
+  set_device_backend(nullptr);
+}
+
+BENCHMARK(BM_AllocateDmaBufsFake)->RangeMultiplier(4)->Range(4 << 10, 8 << 20);
+
+static void BM_DmaBufPoolAcquire(benchmark::State &state) {
+  set_device_backend(std::make_shared<FakeDeviceBackend>());
+
+  {
+    const auto size = static_cast<std::size_t>(state.range(0));
+    auto pool = DmaBufPool::create();
+    pool->reserve(1, size);
+
+    for (auto _: state) {
+      auto buffer = pool->acquire(size);
+      benchmark::DoNotOptimize(buffer.get_fd());
+    }
+  }
+
+  set_device_backend(nullptr);
+}
+
+BENCHMARK(BM_DmaBufPoolAcquire)->RangeMultiplier(4)->Range(4 << 10, 8 << 20);
+
+BENCHMARK_MAIN();
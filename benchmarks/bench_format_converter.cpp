@@ -0,0 +1,61 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "format_converter.hpp"
+
+static v4l2_pix_format yuyv_1080p() {
+  v4l2_pix_format format = {};
+  format.width = 1920;
+  format.height = 1080;
+  format.pixelformat = V4L2_PIX_FMT_YUYV;
+  format.bytesperline = 1920 * 2;
+  return format;
+}
+
+/* bytes processed count the YUYV frame read, the report shows the conversion rate in GB/s */
+static void BM_YuyvToNv12Kernels(benchmark::State &state) {
+  const auto kernels = supported_format_kernels();
+  const auto &selected = *kernels.at(state.range(0));
+  const auto format = yuyv_1080p();
+
+  FormatConverter converter{format, V4L2_PIX_FMT_NV12, 1, &selected};
+
+  const std::vector<std::uint8_t> yuyv(format.bytesperline * format.height, 128);
+  std::vector<std::uint8_t> nv12(converter.target_size());
+
+  for (auto _: state) {
+    converter.convert(yuyv.data(), nv12.data());
+    benchmark::ClobberMemory();
+  }
+
+  state.SetLabel(selected.name);
+  state.SetBytesProcessed(state.iterations() * yuyv.size());
+}
+
+static void BM_YuyvToI420Tiles(benchmark::State &state) {
+  const auto format = yuyv_1080p();
+
+  FormatConverter converter{format, V4L2_PIX_FMT_YUV420, static_cast<std::size_t>(state.range(0))};
+
+  const std::vector<std::uint8_t> yuyv(format.bytesperline * format.height, 128);
+  std::vector<std::uint8_t> i420(converter.target_size());
+
+  for (auto _: state) {
+    converter.convert(yuyv.data(), i420.data());
+    benchmark::ClobberMemory();
+  }
+
+  state.SetLabel(converter.kernel_name());
+  state.SetBytesProcessed(state.iterations() * yuyv.size());
+}
+
+BENCHMARK(BM_YuyvToNv12Kernels)->DenseRange(0, static_cast<int>(supported_format_kernels().size()) - 1)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_YuyvToI420Tiles)->Arg(1)->Arg(2)->Arg(4)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,38 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "motion_detector.hpp"
+
+static void BM_MotionDetector1080p(benchmark::State &state, const MotionKernels &kernels) {
+  v4l2_pix_format format = {};
+  format.width = 1920;
+  format.height = 1080;
+  format.pixelformat = V4L2_PIX_FMT_YUYV;
+  format.bytesperline = 1920 * 2;
+
+  MotionDetector detector{MotionDetector::Config{}, &kernels};
+  detector.prepare(format);
+
+  std::vector<std::uint8_t> frames[2] = {
+    std::vector<std::uint8_t>(format.bytesperline * format.height, 60),
+    std::vector<std::uint8_t>(format.bytesperline * format.height, 200),
+  };
+
+  std::size_t frame = 0;
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(detector.process(frames[frame++ & 1].data()).score);
+  }
+
+  state.SetBytesProcessed(state.iterations() * format.bytesperline * format.height);
+}
+
+BENCHMARK_CAPTURE(BM_MotionDetector1080p, scalar, scalar_motion_kernels())->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_MotionDetector1080p, best, best_motion_kernels())->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
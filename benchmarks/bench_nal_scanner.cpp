@@ -0,0 +1,47 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "nal_scanner.hpp"
+
+/* an IDR sized buffer of entropy coded slice data with a start code every 16KiB */
+static std::vector<std::byte> slice_buffer() {
+  std::mt19937 random{1};
+  std::uniform_int_distribution<int> byte{0, 255};
+
+  std::vector<std::byte> bitstream(256 * 1024);
+  for (auto &value : bitstream) {
+    value = static_cast<std::byte>(byte(random));
+  }
+  /* emulation prevention, like the encoder */
+  for (std::size_t i = 0; i + 2 < bitstream.size(); i++) {
+    if (bitstream[i] == std::byte{0} && bitstream[i + 1] == std::byte{0} && bitstream[i + 2] <= std::byte{3}) {
+      bitstream[i + 2] = std::byte{3};
+    }
+  }
+  for (std::size_t offset = 0; offset + 4 < bitstream.size(); offset += 16 * 1024) {
+    bitstream[offset] = bitstream[offset + 1] = bitstream[offset + 2] = std::byte{0};
+    bitstream[offset + 3] = std::byte{1};
+  }
+  return bitstream;
+}
+
+static void BM_IndexNalUnits(benchmark::State &state, const StartCodeSearch &search) {
+  const auto bitstream = slice_buffer();
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(index_nal_units(bitstream, &search).count);
+  }
+
+  state.SetBytesProcessed(state.iterations() * bitstream.size());
+}
+
+BENCHMARK_CAPTURE(BM_IndexNalUnits, memchr, memchr_start_code_search())->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_IndexNalUnits, best, best_start_code_search())->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
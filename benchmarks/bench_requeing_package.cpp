@@ -0,0 +1,151 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "indexed_queue.hpp"
+#include "pooled_package.hpp"
+#include "requeing_package.hpp"
+
+struct Payload {
+  int value;
+};
+
+class PackageQueue : public IIndexedQueue<RequeingPackage<Payload>>,
+                     public std::enable_shared_from_this<PackageQueue> {
+  std::vector<RequeingPackage<Payload>> m_packages;
+
+public:
+  void fill(int count) {
+    for (int i = 0; i < count; i++) {
+      m_packages.push_back(RequeingPackage<Payload>::create(i).with_queue(weak_from_this()));
+    }
+  }
+
+  RequeingPackage<Payload> dequeue() override {
+    auto package = std::move(m_packages.back());
+    m_packages.pop_back();
+    return package;
+  }
+
+  void enqueue(RequeingPackage<Payload> &&package) override {
+    m_packages.push_back(std::move(package));
+  }
+
+  [[nodiscard]] std::size_t size() const { return m_packages.size(); }
+};
+
+static void BM_RequeingPackageCreate(benchmark::State &state) {
+  auto queue = std::make_shared<PackageQueue>();
+
+  for (auto _: state) {
+    {
+      RequeingPackage<Payload> package = RequeingPackage<Payload>::create(1).with_queue(queue);
+      benchmark::DoNotOptimize(package);
+    }
+
+    /* packages of an expired queue are dropped instead of requeued */
+    if (queue->size() == 1024) {
+      state.PauseTiming();
+      queue = std::make_shared<PackageQueue>();
+      state.ResumeTiming();
+    }
+  }
+}
+
+BENCHMARK(BM_RequeingPackageCreate);
+
+static void BM_RequeingPackageMove(benchmark::State &state) {
+  auto queue = std::make_shared<PackageQueue>();
+  queue->fill(1);
+
+  auto package = queue->dequeue();
+
+  for (auto _: state) {
+    auto moved = std::move(package);
+    benchmark::DoNotOptimize(moved);
+    package = std::move(moved);
+  }
+}
+
+BENCHMARK(BM_RequeingPackageMove);
+
+static void BM_RequeingPackageDequeueRequeue(benchmark::State &state) {
+  auto queue = std::make_shared<PackageQueue>();
+  queue->fill(static_cast<int>(state.range(0)));
+
+  for (auto _: state) {
+    auto package = queue->dequeue();
+    benchmark::DoNotOptimize(package.data());
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_RequeingPackageDequeueRequeue)->Arg(1)->Arg(8);
+
+class PayloadPool {
+public:
+  using Package = PooledPackage<Payload, PayloadPool>;
+
+private:
+  std::vector<std::optional<Payload>> m_slots;
+  std::vector<std::uint32_t> m_free;
+  SlotGenerations m_generations;
+
+public:
+  explicit PayloadPool(int count) : m_generations(count) {
+    for (int i = 0; i < count; i++) {
+      m_slots.emplace_back(Payload{i});
+      m_free.push_back(i);
+    }
+  }
+
+  Package dequeue() {
+    const auto index = m_free.back();
+    m_free.pop_back();
+    auto package = Package::create(*this, m_generations.hand_out(index), std::move(*m_slots[index]));
+    m_slots[index].reset();
+    return package;
+  }
+
+  void enqueue(Package &&package) {
+    m_generations.take_back(package.slot());
+    m_slots[package.index()] = package.release();
+    m_free.push_back(package.index());
+  }
+};
+
+static void BM_PooledPackageMove(benchmark::State &state) {
+  PayloadPool pool{1};
+
+  auto package = pool.dequeue();
+
+  for (auto _: state) {
+    auto moved = std::move(package);
+    benchmark::DoNotOptimize(moved);
+    package = std::move(moved);
+  }
+}
+
+BENCHMARK(BM_PooledPackageMove);
+
+static void BM_PooledPackageDequeueRequeue(benchmark::State &state) {
+  PayloadPool pool{static_cast<int>(state.range(0))};
+
+  for (auto _: state) {
+    auto package = pool.dequeue();
+    benchmark::DoNotOptimize(package.data());
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_PooledPackageDequeueRequeue)->Arg(1)->Arg(8);
+
+BENCHMARK_MAIN();
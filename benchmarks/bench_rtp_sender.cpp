@@ -0,0 +1,89 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <random>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fake_device_backend.hpp"
+#include "return_queue.hpp"
+#include "rtp_sender.hpp"
+
+/* SPS, PPS and one slice of the given size without zero bytes */
+static std::vector<std::uint8_t> access_unit(std::size_t slice_size) {
+  std::vector<std::uint8_t> bitstream = {0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1f, 0x95, 0xa8, 0x14,
+                                         0, 0, 0, 1, 0x68, 0xce, 0x38, 0x80,
+                                         0, 0, 0, 1, 0x65};
+
+  std::mt19937 random{1};
+  std::uniform_int_distribution<int> byte{1, 255};
+  for (std::size_t i = 1; i < slice_size; i++) {
+    bitstream.push_back(static_cast<std::uint8_t>(byte(random)));
+  }
+  return bitstream;
+}
+
+/*
+ * Sends one encoded frame per iteration to a loopback socket nobody reads, the reported CPU time is the sender's cost
+ * per frame. Arguments: slice size in bytes, 1 to use segmentation offload.
+ */
+static void BM_RtpSendFrame(benchmark::State &state) {
+  set_device_backend(std::make_shared<FakeDeviceBackend>());
+
+  {
+    const int receiver = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(receiver, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+    socklen_t length = sizeof(address);
+    getsockname(receiver, reinterpret_cast<sockaddr *>(&address), &length);
+
+    RtpSender::Config config;
+    config.gso = state.range(1) != 0;
+    RtpSender sender{"127.0.0.1", ntohs(address.sin_port), config};
+
+    const auto bitstream = access_unit(state.range(0));
+    auto buffers = allocate_dma_bufs(1, static_cast<std::uint32_t>(bitstream.size()));
+    {
+      const DmaBufAccess access{buffers[0], DmaBufAccess::Mode::Write};
+      std::memcpy(access.writable_data().data(), bitstream.data(), bitstream.size());
+    }
+
+    /* the frame requeues its buffer when the sender drops it, the next iteration takes it again */
+    auto queue = std::make_shared<ReturnQueue<RequeingPackage<DmaBuf>>>(1);
+    RequeingPackage<DmaBuf> initial = RequeingPackage<DmaBuf>::create(std::move(buffers[0])).with_queue(queue);
+    queue->enqueue(std::move(initial));
+
+    BufferInfo info{0, {}, static_cast<std::uint32_t>(bitstream.size()), 0, 0};
+    long timestamp_us = 0;
+
+    for (auto _: state) {
+      timestamp_us += 33333;
+      info.timestamp = {timestamp_us / 1000000, timestamp_us % 1000000};
+      sender.consume(EncodedFrame{VideoFrame{queue->dequeue(), info}});
+    }
+
+    state.counters["packets_per_second"] = benchmark::Counter(static_cast<double>(sender.packets_sent()),
+                                                             benchmark::Counter::kIsRate);
+    state.counters["packets_per_frame"] = static_cast<double>(sender.packets_sent()) / state.iterations();
+    state.counters["gso"] = sender.uses_gso();
+    state.SetBytesProcessed(static_cast<std::int64_t>(sender.bytes_sent()));
+    state.SetItemsProcessed(state.iterations());
+
+    close(receiver);
+  }
+
+  set_device_backend(nullptr);
+}
+
+BENCHMARK(BM_RtpSendFrame)->ArgsProduct({{20 * 1024, 150 * 1024}, {0, 1}})->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
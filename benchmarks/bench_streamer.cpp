@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <benchmark/benchmark.h>
+
+#include "exceptions.hpp"
+#include "fake_device_backend.hpp"
+#include "preview_scaler.hpp"
+#include "v4l2_streamer.hpp"
+#include "virtual_device_backend.hpp"
+
+static void stream(benchmark::State &state, std::shared_ptr<ICameraFrameObserver> observer = nullptr) {
+  {
+    V4L2Streamer streamer{"/dev/video0", 640, 480, static_cast<std::size_t>(state.range(0))};
+    if (observer) {
+      streamer.add_camera_observer(std::move(observer));
+    }
+    streamer.start_streaming();
+
+    for (auto _: state) {
+      streamer.next_frame();
+    }
+
+    streamer.flush();
+
+    state.counters["fps"] = benchmark::Counter(static_cast<double>(streamer.frames_encoded()),
+                                               benchmark::Counter::kIsRate);
+    state.counters["p99_us"] = static_cast<double>(
+                                   streamer.latency(LatencyStage::EndToEnd).percentile(99.0)) / 1000.0;
+  }
+
+  set_device_backend(nullptr);
+}
+
+/**
+ * Software overhead of the pipeline, the fake devices complete every buffer at once. The argument is the pipeline
+ * depth.
+ */
+static void BM_StreamerNextFrameFake(benchmark::State &state) {
+  FakeDeviceBackend::Latencies latencies;
+  latencies.frame_interval = std::chrono::nanoseconds{0};
+  latencies.encode = std::chrono::nanoseconds{0};
+
+  set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+
+  stream(state);
+}
+
+BENCHMARK(BM_StreamerNextFrameFake)->Arg(1)->Arg(4)->UseRealTime();
+
+/**
+ * Frame rate with a preview of every frame against a paced camera and encoder, the fps has to match the run without
+ * preview. The second argument is the preview factor, 0 runs without preview.
+ */
+static void BM_StreamerPreview(benchmark::State &state) {
+  FakeDeviceBackend::Latencies latencies;
+  latencies.frame_interval = std::chrono::milliseconds{2};
+  latencies.encode = std::chrono::milliseconds{1};
+
+  set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+
+  std::shared_ptr<PreviewScaler> preview;
+
+  if (state.range(1) != 0) {
+    PreviewScaler::Config config;
+    config.factor = static_cast<std::uint32_t>(state.range(1));
+
+    preview = std::make_shared<PreviewScaler>(config);
+    preview->set_preview_handler([](PreviewScaler::Package &&package) {
+      benchmark::DoNotOptimize(package.data().pixels.data());
+    });
+  }
+
+  stream(state, preview);
+}
+
+BENCHMARK(BM_StreamerPreview)->Args({2, 0})->Args({2, 2})->Args({2, 8})->UseRealTime();
+
+/**
+ * The pipeline on vivid and vicodec, skipped if the drivers are not loaded.
+ */
+static void BM_StreamerNextFrameVirtual(benchmark::State &state) {
+  try {
+    set_device_backend(std::make_shared<VirtualDeviceBackend>());
+  } catch (const DeviceFileError &e) {
+    state.SkipWithError(e.what());
+    return;
+  }
+
+  stream(state);
+}
+
+BENCHMARK(BM_StreamerNextFrameVirtual)->Arg(1)->Arg(4)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,47 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <benchmark/benchmark.h>
+
+#include <linux/videodev2.h>
+
+#include "fake_device_backend.hpp"
+#include "v4l2_operations.hpp"
+#include "v4l2_video_buffer.hpp"
+
+/**
+ * Dequeue and requeue of camera buffers on the fake backend, the argument is the simulated ioctl cost in ns.
+ */
+static void BM_VideoBufferDequeueEnqueue(benchmark::State &state) {
+  FakeDeviceBackend::Latencies latencies;
+  latencies.ioctl = std::chrono::nanoseconds{state.range(0)};
+  latencies.frame_interval = std::chrono::nanoseconds{0};
+
+  set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+
+  {
+    auto camera = std::make_shared<DeviceFileHandle>("/dev/video0");
+    auto fmt = camera->do_file_operation(set_camera_format);
+    auto buffers = V4L2VideoBuffer::create(camera, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_DMABUF,
+                                           fmt.fmt.pix.sizeimage);
+
+    camera->do_file_operation(stream_on_capture);
+
+    for (auto _: state) {
+      /* dropping the frame queues the buffer again */
+      auto frame = buffers->dequeue_frame();
+      benchmark::DoNotOptimize(frame.info);
+    }
+
+    camera->do_file_operation(stream_off_capture);
+  }
+
+  set_device_backend(nullptr);
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_VideoBufferDequeueEnqueue)->Arg(0)->Arg(2000);
+
+BENCHMARK_MAIN();
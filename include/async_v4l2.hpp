@@ -0,0 +1,160 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef ASYNC_V4L2_HPP
+#define ASYNC_V4L2_HPP
+
+#include <coroutine>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "device_file_handle.hpp"
+#include "event_reactor.hpp"
+#include "task.hpp"
+#include "v4l2_video_buffer.hpp"
+#include "video_frame.hpp"
+
+/**
+ * Registers a non-blocking device with an EventReactor and resumes the coroutines waiting for it once the driver
+ * signals readiness. The device is registered edge triggered, so waiters have to retry their DQBUF before suspending
+ * again.
+ *
+ * All coroutines of a device are resumed on the thread running its reactor. To spread many capture/encode flows over
+ * a thread pool, run one reactor per worker thread and create the flows on the reactor of their thread.
+ *
+ * A suspended task may be destroyed, its waiter is unregistered with the awaiter. Every task waiting on the device has
+ * to be destroyed or resumed before the device.
+ */
+class AsyncDevice {
+    /* keyed by a running number, so waiters that suspend again while being resumed wait for the next readiness */
+    using Waiters = std::map<std::uint64_t, std::coroutine_handle<> >;
+
+    std::shared_ptr<DeviceFileHandle> m_device;
+    EventReactor &m_reactor;
+    std::uint64_t m_next_waiter{0};
+    Waiters m_readable_waiters;
+    Waiters m_writable_waiters;
+
+    void on_ready(std::uint32_t events);
+
+    static void resume_waiters(Waiters &waiters);
+
+public:
+    class ReadinessAwaiter {
+        std::uint64_t &m_next_waiter;
+        Waiters &m_waiters;
+        std::optional<std::uint64_t> m_waiter;
+
+    public:
+        ReadinessAwaiter(std::uint64_t &next_waiter, Waiters &waiters)
+            : m_next_waiter(next_waiter), m_waiters(waiters) {
+        }
+
+        ReadinessAwaiter(const ReadinessAwaiter &other) = delete;
+
+        ReadinessAwaiter &operator=(const ReadinessAwaiter &other) = delete;
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            m_waiter = m_next_waiter++;
+            m_waiters.emplace(*m_waiter, handle);
+        }
+
+        void await_resume() noexcept {
+            m_waiter.reset();
+        }
+
+        /* the coroutine frame goes away while it is suspended here */
+        ~ReadinessAwaiter() {
+            if (m_waiter) {
+                m_waiters.erase(*m_waiter);
+            }
+        }
+    };
+
+    AsyncDevice(EventReactor &reactor, std::shared_ptr<DeviceFileHandle> device);
+
+    AsyncDevice(const AsyncDevice &other) = delete;
+
+    AsyncDevice &operator=(const AsyncDevice &other) = delete;
+
+    /* POLLIN: a capture buffer (or an event) is ready to be dequeued */
+    ReadinessAwaiter readable() { return ReadinessAwaiter{m_next_waiter, m_readable_waiters}; }
+
+    /* POLLOUT: an output buffer was consumed by the driver */
+    ReadinessAwaiter writable() { return ReadinessAwaiter{m_next_waiter, m_writable_waiters}; }
+
+    /**
+     * Resumes the waiters of the given events from the reactor, used when a coroutine consumed a readiness edge on
+     * behalf of others.
+     */
+    void wake(std::uint32_t events);
+
+    ~AsyncDevice();
+};
+
+/**
+ * Camera capture queue whose frames are awaited instead of blocking in VIDIOC_DQBUF.
+ *
+ *     auto frame = co_await camera.next();
+ */
+class AsyncCamera {
+    std::shared_ptr<DeviceFileHandle> m_device;
+    AsyncDevice m_async_device;
+    std::shared_ptr<V4L2VideoBuffer> m_buffers;
+
+public:
+    AsyncCamera(EventReactor &reactor, const std::string &camera_device_path);
+
+    /**
+     * Resumes once the camera delivers the next frame, the frame requeues itself to the camera when dropped.
+     */
+    Task<VideoFrame> next();
+
+    ~AsyncCamera();
+};
+
+/**
+ * Memory to memory encoder driven by coroutines. Up to pipeline_depth frames are inside the encoder at once, their
+ * camera buffers are released as soon as the encoder consumed them.
+ *
+ *     auto nal = co_await encoder.encode(std::move(frame));
+ */
+class AsyncEncoder {
+    std::shared_ptr<DeviceFileHandle> m_device;
+    AsyncDevice m_async_device;
+    /* camera frame currently held by each encoder output buffer, indexed by the output buffer index */
+    std::vector<std::optional<VideoFrame> > m_output_slots;
+    std::shared_ptr<V4L2VideoBuffer> m_capture_buffers;
+    /* encoded frames not yet picked up, keyed by the ticket of the encode call they belong to */
+    std::map<std::uint64_t, VideoFrame> m_encoded;
+    std::uint64_t m_next_ticket{0};
+    std::uint64_t m_next_encoded_ticket{0};
+
+    [[nodiscard]] std::optional<std::uint32_t> find_free_output_slot() const;
+
+    /**
+     * @return whether an output buffer was freed, the waiters for a free one are woken then
+     */
+    bool reclaim_output_buffers();
+
+    void collect_encoded_frames();
+
+public:
+    AsyncEncoder(EventReactor &reactor, std::size_t pipeline_depth);
+
+    /**
+     * Queues the frame to the encoder and resumes with the encoded buffer once it is available. Concurrent calls
+     * are completed in the order they were queued.
+     */
+    Task<VideoFrame> encode(VideoFrame frame);
+
+    ~AsyncEncoder();
+};
+
+#endif //ASYNC_V4L2_HPP
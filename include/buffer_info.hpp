@@ -7,12 +7,38 @@
 
 #include <cstdint>
 #include <bits/types/struct_timeval.h>
+#include <linux/videodev2.h>
+
+/**
+ * The moment of the frame a driver timestamp refers to.
+ */
+enum class TimestampSource : std::uint8_t {
+    EndOfFrame,
+    StartOfExposure
+};
 
 struct BufferInfo {
     std::uint32_t index;
     timeval timestamp;
     std::uint32_t bytesused;
     std::uint32_t field;
+    /* V4L2_BUF_FLAG_* reported by the driver, e.g. V4L2_BUF_FLAG_KEYFRAME for encoded buffers */
+    std::uint32_t flags;
+    /* counted by the driver per queue from STREAMON, a gap means the driver dropped frames */
+    std::uint32_t sequence{0};
+
+    /**
+     * Monotonic timestamps are CLOCK_MONOTONIC, copied ones were taken over from the buffer the frame came from.
+     */
+    [[nodiscard]] bool has_monotonic_timestamp() const {
+        return (flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    }
+
+    [[nodiscard]] TimestampSource timestamp_source() const {
+        return (flags & V4L2_BUF_FLAG_TSTAMP_SRC_MASK) == V4L2_BUF_FLAG_TSTAMP_SRC_SOE
+                   ? TimestampSource::StartOfExposure
+                   : TimestampSource::EndOfFrame;
+    }
 };
 
 #endif //BUFFER_INFO_HPP
@@ -0,0 +1,76 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef CAMERA_FRAME_OBSERVER_HPP
+#define CAMERA_FRAME_OBSERVER_HPP
+
+#include <cstdint>
+#include <vector>
+#include <linux/videodev2.h>
+
+#include "buffer_info.hpp"
+#include "dmabuf.hpp"
+#include "requeing_package.hpp"
+
+/**
+ * Reads the raw camera frames of a V4L2Streamer, e.g. for analysis or previews.
+ *
+ * The streamer calls the observer on its thread right after the frame was queued to the encoder, so the observer
+ * runs in parallel to the encode instead of in front of it. The encoder reads the same buffer at that time, the
+ * observer may only read it as well and only during the call.
+ */
+class ICameraFrameObserver {
+public:
+    virtual ~ICameraFrameObserver() = default;
+
+    /**
+     * Called once with the negotiated camera format before the first frame.
+     */
+    virtual void prepare([[maybe_unused]] const v4l2_pix_format &format) {
+    }
+
+    virtual void observe(const DmaBuf &buffer, const BufferInfo &info) = 0;
+};
+
+/**
+ * Keeps a camera buffer, identified by its index, away from the driver. The buffer is requeued to the camera once
+ * the encoder is done with it and the hold was dropped, which may happen on any thread.
+ */
+using CameraFrameHold = RequeingPackage<std::uint32_t>;
+
+/**
+ * Keeps raw camera frames beyond the call, e.g. to share them with other processes. Unlike an observer the sink may
+ * read the buffer as long as it holds the frame, but every held frame is a camera buffer less for the driver: a sink
+ * has to drop its holds quickly and must never hold more than a few at once.
+ */
+class ICameraFrameSink {
+public:
+    virtual ~ICameraFrameSink() = default;
+
+    /**
+     * Called once with the negotiated camera format and the camera buffers, the position of a buffer is its index.
+     * The pointers are only valid during the call.
+     */
+    virtual void prepare([[maybe_unused]] const v4l2_pix_format &format,
+                         [[maybe_unused]] const std::vector<const DmaBuf *> &buffers) {
+    }
+
+    virtual void consume(CameraFrameHold &&hold, const BufferInfo &info) = 0;
+
+    /**
+     * Readable when held frames may be ready to go back, -1 if the sink only drops holds on other threads. A blocking
+     * streamer whose camera buffers are all held waits on it and then calls service().
+     */
+    [[nodiscard]] virtual int release_fd() const {
+        return -1;
+    }
+
+    /**
+     * Drops the holds the sink is done with, called from the streaming thread.
+     */
+    virtual void service() {
+    }
+};
+
+#endif //CAMERA_FRAME_OBSERVER_HPP
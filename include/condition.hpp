@@ -5,6 +5,7 @@
 #ifndef LOG_ASSERT_HPP
 #define LOG_ASSERT_HPP
 
+#include <cassert>
 #include <plog/Log.h>
 
 #ifndef NDEBUG
@@ -0,0 +1,57 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef DEVICE_BACKEND_HPP
+#define DEVICE_BACKEND_HPP
+
+#include <memory>
+#include <string>
+
+/**
+ * Every device access of the library, opening video devices and dma heaps as well as all their ioctls, goes through
+ * the installed backend. The kernel backend forwards to the system calls, the others make the pipeline run without
+ * the Raspberry Pi camera and encoder, see VirtualDeviceBackend and FakeDeviceBackend.
+ *
+ * Dma buffers are plain file descriptors in every backend, they are mapped and closed directly.
+ */
+class IDeviceBackend {
+public:
+    virtual ~IDeviceBackend() = default;
+
+    /**
+     * @return the file descriptor or -1 with errno set
+     */
+    virtual int open(const std::string &path, int flags) = 0;
+
+    virtual int close(int fd) = 0;
+
+    /**
+     * @return the ioctl result, -1 with errno set on failure
+     */
+    virtual int ioctl(int fd, unsigned long request, void *arg) = 0;
+};
+
+class KernelDeviceBackend : public IDeviceBackend {
+public:
+    int open(const std::string &path, int flags) override;
+
+    int close(int fd) override;
+
+    int ioctl(int fd, unsigned long request, void *arg) override;
+};
+
+/**
+ * The backend used by the whole process, the kernel backend unless another one was installed.
+ */
+IDeviceBackend &device_backend();
+
+std::shared_ptr<IDeviceBackend> shared_device_backend();
+
+/**
+ * Installs the backend for the whole process, nullptr restores the kernel backend. Install it before the first
+ * device is opened, devices keep the backend they were opened with only for closing.
+ */
+void set_device_backend(std::shared_ptr<IDeviceBackend> backend);
+
+#endif //DEVICE_BACKEND_HPP
@@ -6,16 +6,20 @@
 #define DEVICE_FILE_HANDLE_HPP
 
 #include <fcntl.h>
-#include <unistd.h>
+#include <memory>
+#include <string>
 
+#include "device_backend.hpp"
 #include "exceptions.hpp"
 
 class DeviceFileHandle {
     int fd;
+    /* the backend the device was opened with */
+    std::shared_ptr<IDeviceBackend> m_backend;
 
 public:
-    explicit DeviceFileHandle(const std::string &path, int flags = O_RDWR) {
-        int cam_fd = open(path.c_str(), flags, 0);
+    explicit DeviceFileHandle(const std::string &path, int flags = O_RDWR) : m_backend(shared_device_backend()) {
+        int cam_fd = m_backend->open(path, flags);
 
         if (cam_fd == -1) {
             throw DeviceFileError{"Failed to open device file at path " + path};
@@ -27,7 +31,8 @@ public:
     DeviceFileHandle(const DeviceFileHandle &other) = delete;
 
     DeviceFileHandle(DeviceFileHandle &&other) noexcept
-        : fd(other.fd) {
+        : fd(other.fd), m_backend(std::move(other.m_backend)) {
+        other.fd = -1;
     }
 
     DeviceFileHandle &operator=(const DeviceFileHandle &other) = delete;
@@ -35,7 +40,11 @@ public:
     DeviceFileHandle &operator=(DeviceFileHandle &&other) noexcept {
         if (this == &other)
             return *this;
+        if (fd != -1)
+            m_backend->close(fd);
         fd = other.fd;
+        m_backend = std::move(other.m_backend);
+        other.fd = -1;
         return *this;
     }
 
@@ -45,7 +54,8 @@ public:
     }
 
     virtual ~DeviceFileHandle() {
-        close(fd);
+        if (fd != -1)
+            m_backend->close(fd);
     }
 };
 
@@ -6,12 +6,28 @@
 #define DMABUF_H_
 
 #include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
 #include <plog/Log.h>
 
+class DmaBufPool;
+
+/**
+ * A dma buffer allocated from a dma heap. The CPU mapping is only created on the first call to get_map(), buffers
+ * that are only passed between devices by fd are never mapped. CPU access should go through a DmaBufAccess guard.
+ */
 class DmaBuf {
-    int m_fd{0};
-    void *m_map{nullptr};
+    int m_fd{-1};
+    mutable void *m_map{nullptr};
     std::size_t m_size{0};
+    /* pool the buffer was acquired from, it is returned there instead of being freed */
+    std::weak_ptr<DmaBufPool> m_pool;
+
+    void release() noexcept;
+
+    friend class DmaBufPool;
 
 public:
     DmaBuf(int heap_fd, size_t size, const std::string &name = {});
@@ -19,9 +35,10 @@ public:
     DmaBuf(const DmaBuf &other) = delete;
 
     DmaBuf(DmaBuf &&other) noexcept
-        : m_fd(other.m_fd),
-          m_map(other.m_map),
-          m_size(other.m_size) {
+        : m_fd(std::exchange(other.m_fd, -1)),
+          m_map(std::exchange(other.m_map, nullptr)),
+          m_size(std::exchange(other.m_size, 0)),
+          m_pool(std::move(other.m_pool)) {
     }
 
     DmaBuf & operator=(const DmaBuf &other) = delete;
@@ -29,22 +46,81 @@ public:
     DmaBuf & operator=(DmaBuf &&other) noexcept {
         if (this == &other)
             return *this;
-        m_fd = other.m_fd;
-        m_map = other.m_map;
-        m_size = other.m_size;
+        release();
+        m_fd = std::exchange(other.m_fd, -1);
+        m_map = std::exchange(other.m_map, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_pool = std::move(other.m_pool);
         return *this;
     }
 
     [[nodiscard]] int get_fd() const;
 
+    /**
+     * Maps the buffer on first use.
+     */
     [[nodiscard]] void *get_map() const;
 
+    [[nodiscard]] bool is_mapped() const;
+
     [[nodiscard]] std::size_t get_size() const;
 
     ~DmaBuf();
 };
 
 
+/**
+ * Scoped CPU access to a dma buffer. Brackets the access with DMA_BUF_IOCTL_SYNC in the given direction, so caches
+ * are only invalidated for reads and only flushed for writes.
+ */
+class DmaBufAccess {
+public:
+    enum class Mode {
+        Read,
+        Write,
+        ReadWrite
+    };
+
+private:
+    int m_fd{-1};
+    std::byte *m_map{nullptr};
+    std::size_t m_size{0};
+    Mode m_mode;
+
+    void end_access() noexcept;
+
+public:
+    DmaBufAccess(const DmaBuf &buffer, Mode mode);
+
+    DmaBufAccess(const DmaBufAccess &other) = delete;
+
+    DmaBufAccess(DmaBufAccess &&other) noexcept
+        : m_fd(std::exchange(other.m_fd, -1)),
+          m_map(std::exchange(other.m_map, nullptr)),
+          m_size(std::exchange(other.m_size, 0)),
+          m_mode(other.m_mode) {
+    }
+
+    DmaBufAccess &operator=(const DmaBufAccess &other) = delete;
+
+    DmaBufAccess &operator=(DmaBufAccess &&other) noexcept {
+        if (this == &other)
+            return *this;
+        end_access();
+        m_fd = std::exchange(other.m_fd, -1);
+        m_map = std::exchange(other.m_map, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_mode = other.m_mode;
+        return *this;
+    }
+
+    [[nodiscard]] std::span<const std::byte> data() const { return {m_map, m_size}; }
+
+    [[nodiscard]] std::span<std::byte> writable_data() const;
+
+    ~DmaBufAccess();
+};
+
 [[nodiscard]] std::vector<DmaBuf> allocate_dma_bufs(std::uint32_t num_bufs, std::uint32_t bufsize);
 
 #endif
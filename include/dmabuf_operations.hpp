@@ -28,11 +28,15 @@
 #define DMABUF_OPERATIONS_HPP
 
 #include <cstdint>
+#include <linux/dma-buf.h>
 
 std::uint32_t dmabuf_heap_alloc(int heap_fd, const char *name, std::size_t size);
 
-int dmabuf_sync_start(int buf_fd);
+/**
+ * @param direction DMA_BUF_SYNC_READ, DMA_BUF_SYNC_WRITE or DMA_BUF_SYNC_RW
+ */
+int dmabuf_sync_start(int buf_fd, std::uint64_t direction = DMA_BUF_SYNC_RW);
 
-int dmabuf_sync_stop(int buf_fd);
+int dmabuf_sync_stop(int buf_fd, std::uint64_t direction = DMA_BUF_SYNC_RW);
 
 #endif //DMABUF_OPERATIONS_HPP
@@ -0,0 +1,80 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef DMABUF_POOL_HPP
+#define DMABUF_POOL_HPP
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "device_file_handle.hpp"
+#include "dmabuf.hpp"
+
+/**
+ * Long lived pool of dma buffers.
+ *
+ * The heap device stays open for the lifetime of the pool and buffers are recycled by size class instead of being
+ * freed, so rebuilding a pipeline (restart, format change) does not allocate and map fresh CMA memory again. A buffer
+ * acquired from the pool returns to it when it is destroyed, as long as the pool is still alive.
+ */
+class DmaBufPool : public std::enable_shared_from_this<DmaBufPool> {
+public:
+    enum class Heap {
+        /* physically contiguous, required by devices without an IOMMU */
+        Cma,
+        /* page allocated, for devices with an IOMMU and for CPU only buffers */
+        System
+    };
+
+private:
+    DeviceFileHandle m_heap;
+    mutable std::mutex m_mutex;
+    /* free buffers by size class */
+    std::map<std::size_t, std::vector<DmaBuf> > m_free;
+    std::uint32_t m_allocated{0};
+
+    explicit DmaBufPool(Heap heap);
+
+    DmaBuf allocate(std::size_t size_class);
+
+    void recycle(DmaBuf &&buffer) noexcept;
+
+    friend class DmaBuf;
+
+public:
+    static std::shared_ptr<DmaBufPool> create(Heap heap = Heap::Cma);
+
+    /**
+     * Sizes are rounded up to pages below 64KiB and to quarter powers of two above, which bounds the waste to 25%
+     * while letting slightly different formats share buffers.
+     */
+    static std::size_t size_class(std::size_t size);
+
+    /**
+     * Hands out a recycled buffer of the size class of size or allocates a new one. get_size() of the buffer
+     * returns the size of its class.
+     */
+    DmaBuf acquire(std::size_t size);
+
+    std::vector<DmaBuf> acquire(std::uint32_t num_bufs, std::size_t size);
+
+    /**
+     * Pre-warms the pool so that num_bufs buffers of the size class of size are available without allocating.
+     */
+    void reserve(std::uint32_t num_bufs, std::size_t size);
+
+    /**
+     * Frees every buffer that is currently not in use.
+     */
+    void trim();
+
+    [[nodiscard]] std::size_t free_buffers() const;
+
+    static const char *heap_path(Heap heap);
+};
+
+#endif //DMABUF_POOL_HPP
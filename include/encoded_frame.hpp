@@ -0,0 +1,50 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef ENCODED_FRAME_HPP
+#define ENCODED_FRAME_HPP
+
+#include <cstddef>
+#include <span>
+#include <linux/videodev2.h>
+
+#include "latency_tracker.hpp"
+#include "video_frame.hpp"
+
+/**
+ * Read-only view on an encoded buffer of the encoder capture queue. The bitstream is read straight from the mapped
+ * dma buffer, the buffer goes back to the encoder once the frame is dropped. The frame holds read access on the
+ * buffer for its whole lifetime.
+ */
+class EncodedFrame {
+    VideoFrame m_frame;
+    /* declared after the frame so the access ends before the buffer is requeued */
+    DmaBufAccess m_access;
+    /* destroyed first, the release is taken when the sink drops the frame */
+    SinkRelease m_release;
+
+public:
+    explicit EncodedFrame(VideoFrame &&frame, SinkRelease release = {})
+        : m_frame(std::move(frame)),
+          m_access(m_frame.buffer.data(), DmaBufAccess::Mode::Read),
+          m_release(std::move(release)) {
+    }
+
+    /**
+     * The encoded bitstream, exactly bytesused bytes of the mapped buffer.
+     */
+    [[nodiscard]] std::span<const std::byte> data() const {
+        return m_access.data().first(m_frame.info.bytesused);
+    }
+
+    [[nodiscard]] timeval timestamp() const { return m_frame.info.timestamp; }
+
+    [[nodiscard]] bool is_keyframe() const { return m_frame.info.flags & V4L2_BUF_FLAG_KEYFRAME; }
+
+    [[nodiscard]] const BufferInfo &info() const { return m_frame.info; }
+
+    [[nodiscard]] const DmaBuf &buffer() const { return m_frame.buffer.data(); }
+};
+
+#endif //ENCODED_FRAME_HPP
@@ -0,0 +1,30 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef ENCODED_SINK_HPP
+#define ENCODED_SINK_HPP
+
+#include <vector>
+
+#include "encoded_frame.hpp"
+
+/**
+ * Consumer of the encoded bitstream. A sink may keep the frame as long as it needs the data and may drop it on any
+ * thread, the encoder buffer is requeued by the thread driving the streamer after the sink dropped it.
+ */
+class IEncodedSink {
+public:
+    virtual ~IEncodedSink() = default;
+
+    /**
+     * Called once with the encoder buffers before the first frame, so a sink can register their mappings. The
+     * pointers are only valid during the call.
+     */
+    virtual void prepare([[maybe_unused]] const std::vector<const DmaBuf *> &buffers) {
+    }
+
+    virtual void consume(EncodedFrame &&frame) = 0;
+};
+
+#endif //ENCODED_SINK_HPP
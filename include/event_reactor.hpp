@@ -0,0 +1,93 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef EVENT_REACTOR_HPP
+#define EVENT_REACTOR_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Single threaded readiness reactor on top of epoll.
+ *
+ * Non-blocking device file descriptors are registered together with the events they are interested in
+ * (EPOLLIN / EPOLLOUT / EPOLLPRI). The handler of a file descriptor is invoked from run_once() with the events
+ * that are actually pending, so DQBUF/QBUF are only issued once the driver has a buffer ready.
+ *
+ * Each registration carries its own token in the epoll data, an event that was already collected for a removed fd
+ * is dropped even if the fd number was registered again in the meantime.
+ *
+ * EPOLLERR and EPOLLHUP are reported whether they were asked for or not and persist on a level-triggered fd, so
+ * the reactor disarms the fd before passing them to the handler. The handler stays registered, modify() arms the fd
+ * again once the owner fixed the condition, also from within the handler.
+ */
+class EventReactor {
+public:
+    using Handler = std::function<void(std::uint32_t events)>;
+
+private:
+    struct Registration {
+        std::uint64_t token;
+        std::uint32_t events;
+        bool armed;
+        /* shared so a handler may remove its own fd while it is running */
+        std::shared_ptr<Handler> handler;
+    };
+
+    int m_epoll_fd{-1};
+    bool m_stopped{false};
+    std::uint64_t m_next_token{1};
+    std::unordered_map<int, Registration> m_registrations;
+    /* fd of every live token */
+    std::unordered_map<std::uint64_t, int> m_tokens;
+    std::vector<std::function<void()> > m_posted;
+
+    void control(int operation, int fd, const Registration &registration);
+
+    void disarm(int fd, Registration &registration);
+
+public:
+    EventReactor();
+
+    EventReactor(const EventReactor &other) = delete;
+
+    EventReactor &operator=(const EventReactor &other) = delete;
+
+    void add(int fd, std::uint32_t events, Handler handler);
+
+    /**
+     * Replaces the events of the fd, arms it again if it was disarmed after an error.
+     */
+    void modify(int fd, std::uint32_t events);
+
+    [[nodiscard]] bool armed(int fd) const;
+
+    void remove(int fd);
+
+    /**
+     * Defers the callback to the end of the current (or next) run_once(), the wait does not block while callbacks
+     * are pending.
+     */
+    void post(std::function<void()> callback);
+
+    /**
+     * Waits at most timeout_ms (-1 waits forever) for events, dispatches them and runs the posted callbacks.
+     * @return number of dispatched file descriptors and posted callbacks
+     */
+    std::size_t run_once(int timeout_ms = -1);
+
+    /**
+     * Dispatches events until stop() is called from within a handler.
+     */
+    void run();
+
+    void stop();
+
+    ~EventReactor();
+};
+
+#endif //EVENT_REACTOR_HPP
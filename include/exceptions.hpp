@@ -11,4 +11,12 @@ class DeviceFileError : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
+class EventReactorError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+class NetworkError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
 #endif //EXCEPTIONS_HPP
@@ -0,0 +1,156 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef FAKE_DEVICE_BACKEND_HPP
+#define FAKE_DEVICE_BACKEND_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/time.h>
+
+#include "device_backend.hpp"
+
+/**
+ * Userspace model of the camera and the m2m encoder for benchmarks on machines without V4L2 hardware.
+ *
+ * Every opened video device is a set of buffer queues. A device with an output queue behaves like the encoder: each
+ * queued output buffer is paired with the next queued capture buffer and both complete encode_latency after the
+ * encoder became free, the capture buffer carries the copied timestamp and a fraction of the input size. A device
+ * with only a capture queue behaves like the camera: queued buffers are filled on a frame_interval grid with a
+ * monotonic timestamp, a buffer queued too late waits for the next frame.
+ *
+ * Device file descriptors are one end of a socket pair, the backend makes them readable while a completed capture
+ * buffer waits and writable while a completed output buffer waits, so epoll sees POLLIN and POLLOUT like on a real
+ * device. A helper thread updates them when buffers complete between two ioctls.
+ * The camera enumerates YUYV, the encoder H.264 on its capture queue. Dma heaps hand out memfds, cpu access syncs
+ * are no-ops. Only DMABUF memory is supported.
+ */
+class FakeDeviceBackend : public IDeviceBackend {
+public:
+    struct Latencies {
+        /* spent in every ioctl, models the syscall and driver overhead */
+        std::chrono::nanoseconds ioctl{0};
+        /* spent in every dma heap allocation */
+        std::chrono::nanoseconds allocation{0};
+        std::chrono::nanoseconds frame_interval{std::chrono::microseconds{33333}};
+        std::chrono::nanoseconds encode{std::chrono::milliseconds{5}};
+    };
+
+private:
+    struct Buffer {
+        enum class State {
+            Dequeued,
+            Queued,
+            /* completes at ready_ns */
+            Scheduled
+        };
+
+        State state{State::Dequeued};
+        std::uint32_t bytesused{0};
+        std::uint32_t field{0};
+        std::uint32_t flags{0};
+        timeval timestamp{};
+        std::uint64_t queued_ns{0};
+        std::uint64_t ready_ns{0};
+        std::uint32_t sequence{0};
+    };
+
+    struct Queue {
+        std::uint32_t width{0};
+        std::uint32_t height{0};
+        std::uint32_t sizeimage{0};
+        std::uint32_t pixelformat{0};
+        bool streaming{false};
+        std::vector<Buffer> buffers;
+        /* indices in the order they were queued and not yet scheduled */
+        std::deque<std::uint32_t> pending;
+        std::uint32_t sequence{0};
+    };
+
+    struct Device {
+        bool nonblocking;
+        std::map<std::uint32_t, Queue> queues;
+        std::uint64_t stream_start_ns{0};
+        std::uint64_t next_frame_ns{0};
+        std::uint64_t encoder_free_ns{0};
+        std::uint64_t frames_encoded{0};
+        /* the end of the socket pair the backend keeps, the device fd is the other one */
+        int peer{-1};
+        bool readable{false};
+        bool writable{true};
+        /* the next buffer to complete, 0 if none is scheduled */
+        std::uint64_t next_ready_ns{0};
+    };
+
+    Latencies m_latencies;
+    std::uint32_t m_keyframe_interval;
+    /* pixel formats the encoder accepts on its output queue, the first one is the fallback of VIDIOC_S_FMT */
+    std::vector<std::uint32_t> m_encoder_input_formats;
+    std::mutex m_mutex;
+    std::condition_variable m_buffer_scheduled;
+    std::map<int, Device> m_devices;
+    std::vector<int> m_heaps;
+    std::condition_variable m_readiness_changed;
+    /* when the readiness thread wakes up next, 0 while it waits for a change */
+    std::uint64_t m_readiness_deadline{0};
+    bool m_stopping{false};
+    std::thread m_readiness_thread;
+
+    static std::uint64_t now_ns();
+
+    static void spin_for(std::chrono::nanoseconds duration);
+
+    [[nodiscard]] static bool is_m2m(const Device &device);
+
+    void schedule(int fd, Device &device);
+
+    static void set_readiness(int fd, Device &device, bool readable, bool writable);
+
+    void arm_readiness(int fd, Device &device);
+
+    void signal_readiness();
+
+    int dequeue(std::unique_lock<std::mutex> &lock, int fd, void *arg);
+
+    int device_ioctl(std::unique_lock<std::mutex> &lock, int fd, Device &device, unsigned long request, void *arg);
+
+    int heap_ioctl(unsigned long request, void *arg) const;
+
+public:
+    FakeDeviceBackend();
+
+    /**
+     * @param keyframe_interval every keyframe_interval-th encoded frame is flagged as keyframe
+     */
+    explicit FakeDeviceBackend(Latencies latencies, std::uint32_t keyframe_interval = 30);
+
+    FakeDeviceBackend(const FakeDeviceBackend &other) = delete;
+
+    /**
+     * Replaces the formats enumerated on the encoder output queue, YUYV, NV12 and I420 by default. Models encoders
+     * that cannot take the camera format directly.
+     */
+    void set_encoder_input_formats(std::vector<std::uint32_t> formats);
+
+    FakeDeviceBackend &operator=(const FakeDeviceBackend &other) = delete;
+
+    /**
+     * Any path under /dev/dma_heap opens a heap, every other path a video device.
+     */
+    int open(const std::string &path, int flags) override;
+
+    int close(int fd) override;
+
+    int ioctl(int fd, unsigned long request, void *arg) override;
+
+    ~FakeDeviceBackend() override;
+};
+
+#endif //FAKE_DEVICE_BACKEND_HPP
@@ -0,0 +1,142 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef FAN_OUT_SINK_HPP
+#define FAN_OUT_SINK_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "encoded_sink.hpp"
+#include "latency_histogram.hpp"
+#include "shared_package.hpp"
+
+/**
+ * Delivery state of one fan-out consumer.
+ */
+struct ConsumerLag {
+    std::uint64_t delivered;
+    /* frames delivered but not yet dropped, each of them keeps an encoder buffer away from the driver */
+    std::uint64_t outstanding;
+    std::uint64_t max_outstanding;
+    /* from the delivery until the consumer dropped the frame */
+    LatencySummary hold_time;
+};
+
+/**
+ * Lock-free counters of one consumer, the consumer's frames update them from whatever thread drops them.
+ */
+class ConsumerCounters {
+    std::atomic<std::uint64_t> m_delivered{0};
+    std::atomic<std::uint64_t> m_released{0};
+    std::atomic<std::uint64_t> m_max_outstanding{0};
+    LatencyHistogram m_hold_time;
+
+public:
+    /**
+     * @return the frames outstanding including this one
+     */
+    std::uint64_t delivered();
+
+    void released(std::uint64_t hold_ns);
+
+    [[nodiscard]] std::uint64_t outstanding() const;
+
+    [[nodiscard]] ConsumerLag lag() const;
+};
+
+/**
+ * One consumer's reference to an encoded frame that is shared by all consumers of a FanOutSink. The encoder buffer
+ * is requeued once every consumer dropped its reference, the frame may be dropped on any thread.
+ */
+class SharedEncodedFrame {
+    SharedPackage<EncodedFrame> m_frame;
+    std::shared_ptr<ConsumerCounters> m_counters;
+    std::uint64_t m_delivered_ns{0};
+
+public:
+    SharedEncodedFrame(SharedPackage<EncodedFrame> frame, std::shared_ptr<ConsumerCounters> counters);
+
+    SharedEncodedFrame(const SharedEncodedFrame &other) = delete;
+
+    SharedEncodedFrame(SharedEncodedFrame &&other) noexcept = default;
+
+    SharedEncodedFrame &operator=(const SharedEncodedFrame &other) = delete;
+
+    SharedEncodedFrame &operator=(SharedEncodedFrame &&other) noexcept;
+
+    ~SharedEncodedFrame();
+
+    [[nodiscard]] std::span<const std::byte> data() const { return m_frame.data().data(); }
+
+    [[nodiscard]] timeval timestamp() const { return m_frame.data().timestamp(); }
+
+    [[nodiscard]] bool is_keyframe() const { return m_frame.data().is_keyframe(); }
+
+    [[nodiscard]] const BufferInfo &info() const { return m_frame.data().info(); }
+
+    [[nodiscard]] const DmaBuf &buffer() const { return m_frame.data().buffer(); }
+};
+
+/**
+ * Consumer of a FanOutSink, e.g. a recorder, a network sender and a pre-event buffer fed with the same bitstream.
+ */
+class ISharedEncodedSink {
+public:
+    virtual ~ISharedEncodedSink() = default;
+
+    /**
+     * Forwarded from IEncodedSink::prepare().
+     */
+    virtual void prepare([[maybe_unused]] const std::vector<const DmaBuf *> &buffers) {
+    }
+
+    virtual void consume(SharedEncodedFrame &&frame) = 0;
+};
+
+/**
+ * Hands every encoded frame to several consumers without copying the bitstream. All consumers reference the same
+ * encoder buffer, it goes back to the encoder when the last of them drops its frame.
+ *
+ * The outstanding frames of each consumer are counted, a consumer that holds lag_limit frames at once is reported
+ * as lagging and logged once when it reaches the limit, before it holds every encoder buffer and stalls the
+ * encoder. The streamer needs its encoder buffers in ReturnMode::Deferred for consumers on other threads, which
+ * V4L2Streamer does.
+ */
+class FanOutSink : public IEncodedSink {
+    struct Consumer {
+        std::shared_ptr<ISharedEncodedSink> sink;
+        std::shared_ptr<ConsumerCounters> counters;
+        bool lagging;
+    };
+
+    std::vector<Consumer> m_consumers;
+    std::uint64_t m_lag_limit;
+
+public:
+    explicit FanOutSink(std::uint64_t lag_limit = 4);
+
+    /**
+     * Add the consumers before the sink is set on the streamer, so they are prepared with the encoder buffers.
+     * @return the id of the consumer for lag()
+     */
+    std::size_t add_consumer(std::shared_ptr<ISharedEncodedSink> consumer);
+
+    void prepare(const std::vector<const DmaBuf *> &buffers) override;
+
+    void consume(EncodedFrame &&frame) override;
+
+    /**
+     * Can be read from any thread.
+     */
+    [[nodiscard]] ConsumerLag lag(std::size_t consumer) const;
+
+    [[nodiscard]] bool is_lagging(std::size_t consumer) const;
+
+    [[nodiscard]] std::size_t consumers() const;
+};
+
+#endif //FAN_OUT_SINK_HPP
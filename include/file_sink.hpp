@@ -0,0 +1,30 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef FILE_SINK_HPP
+#define FILE_SINK_HPP
+
+#include <string>
+
+#include "encoded_sink.hpp"
+
+/**
+ * Appends the encoded bitstream to a file with blocking writes.
+ */
+class FileSink : public IEncodedSink {
+    int m_fd{-1};
+
+public:
+    explicit FileSink(const std::string &path);
+
+    FileSink(const FileSink &other) = delete;
+
+    FileSink &operator=(const FileSink &other) = delete;
+
+    void consume(EncodedFrame &&frame) override;
+
+    ~FileSink() override;
+};
+
+#endif //FILE_SINK_HPP
@@ -0,0 +1,97 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef FMP4_MUXER_HPP
+#define FMP4_MUXER_HPP
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "encoded_sink.hpp"
+#include "nal_scanner.hpp"
+
+/**
+ * Writes the encoded stream as fragmented MP4 (ISO BMFF, CMAF style) that players can seek and play while it grows.
+ *
+ * The file starts with ftyp and moov, written at the first IDR once SPS and PPS are known. Every IDR starts a new
+ * segment with an styp box, every frame is a moof and mdat pair of one sample. A fragment per GOP would have to hold
+ * every encoder buffer of the GOP until the next IDR, more than the encoder has, so the segments are made of single
+ * sample fragments instead.
+ *
+ * The duration of a frame is the distance of its driver timestamp to the next one, so every frame is held back until
+ * its successor arrives. A timestamp that does not advance keeps the previous duration. Decode times in microseconds
+ * are the summed up durations, starting at zero with the first written frame. Frames before the first IDR are
+ * dropped.
+ *
+ * The moof of a single sample has a fixed layout and is prebuilt once, per frame only its fields are patched. The
+ * sample is written with one writev straight from the mapped encoder buffer: the Annex-B start codes are replaced by
+ * 4 byte lengths in their own iovecs, SPS, PPS and access unit delimiters are left out since they live in the avcC
+ * box. Muxing copies no payload byte.
+ */
+class Fmp4Muxer : public IEncodedSink {
+public:
+    /* moof with mfhd, traf, tfhd, tfdt and a trun of one sample, followed by the mdat header */
+    static constexpr std::size_t FRAGMENT_HEADER_SIZE{108};
+
+private:
+    int m_fd{-1};
+    std::uint32_t m_width;
+    std::uint32_t m_height;
+    NalScanner m_scanner;
+    bool m_initialized{false};
+    /* the frame waiting for its successor to know its duration, with its index */
+    std::optional<EncodedFrame> m_held;
+    NalUnits m_held_units;
+    std::uint64_t m_held_decode_time_us{0};
+    std::uint32_t m_last_duration_us{0};
+    std::uint32_t m_sequence_number{0};
+    std::array<std::byte, FRAGMENT_HEADER_SIZE> m_fragment_header{};
+    /* big endian NAL lengths of the fragment being written */
+    std::array<std::uint32_t, MAX_NAL_UNITS> m_lengths{};
+    std::uint64_t m_bytes_written{0};
+    std::uint64_t m_frames_written{0};
+    std::uint64_t m_frames_dropped{0};
+
+    void write_init_segment();
+
+    void write_fragment(const EncodedFrame &frame, const NalUnits &units, std::uint64_t decode_time_us,
+                        std::uint32_t duration_us);
+
+    void write_all(struct iovec *iov, int count);
+
+public:
+    /**
+     * @param width  coded width stored in the track header
+     * @param height coded height stored in the track header
+     */
+    Fmp4Muxer(const std::string &path, std::uint32_t width, std::uint32_t height);
+
+    Fmp4Muxer(const Fmp4Muxer &other) = delete;
+
+    Fmp4Muxer &operator=(const Fmp4Muxer &other) = delete;
+
+    void consume(EncodedFrame &&frame) override;
+
+    /**
+     * Writes the held back frame with the duration of its predecessor and hands its buffer back, at the end of the
+     * stream.
+     */
+    void flush();
+
+    [[nodiscard]] std::uint64_t bytes_written() const;
+
+    [[nodiscard]] std::uint64_t frames_written() const;
+
+    /**
+     * Frames dropped while waiting for the first IDR.
+     */
+    [[nodiscard]] std::uint64_t frames_dropped() const;
+
+    ~Fmp4Muxer() override;
+};
+
+#endif //FMP4_MUXER_HPP
@@ -0,0 +1,87 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef FORMAT_CONVERTER_HPP
+#define FORMAT_CONVERTER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <linux/videodev2.h>
+
+#include "dmabuf.hpp"
+#include "format_kernels.hpp"
+
+/**
+ * Converts YUYV camera frames into the NV12 or I420 frames many encoders expect.
+ *
+ * The frame is split into horizontal tiles of whole row pairs, one per thread. The calling thread converts the first
+ * tile while the workers convert the others, convert() returns once every tile is done. Tiles are disjoint in both
+ * frames, so the threads never share a cache line except at the tile borders.
+ *
+ * The target planes are packed without padding: the luma plane with a stride of width followed by either the
+ * interleaved chroma plane (NV12) or the U and V planes with a stride of width / 2 (I420).
+ */
+class FormatConverter {
+    std::uint32_t m_width;
+    std::uint32_t m_height;
+    std::uint32_t m_bytesperline;
+    std::uint32_t m_target_format;
+    const FormatKernels *m_kernels;
+    std::size_t m_tiles;
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    /* bumped for every frame, workers wait for a generation they have not converted yet */
+    std::uint64_t m_generation{0};
+    std::size_t m_tiles_left{0};
+    bool m_stop{false};
+    const std::uint8_t *m_source{nullptr};
+    std::uint8_t *m_target{nullptr};
+
+    void convert_tile(const std::uint8_t *source, std::uint8_t *target, std::size_t tile) const;
+
+    void work(std::size_t tile);
+
+public:
+    /**
+     * @param source        negotiated camera format, YUYV with even width and height
+     * @param target_format V4L2_PIX_FMT_NV12 or V4L2_PIX_FMT_YUV420
+     * @param threads       number of tiles including the calling thread, 0 uses one per core
+     * @param kernels       defaults to best_format_kernels()
+     */
+    FormatConverter(const v4l2_pix_format &source, std::uint32_t target_format, std::size_t threads = 0,
+                    const FormatKernels *kernels = nullptr);
+
+    FormatConverter(const FormatConverter &other) = delete;
+
+    FormatConverter &operator=(const FormatConverter &other) = delete;
+
+    [[nodiscard]] static bool can_convert(std::uint32_t source_format, std::uint32_t target_format);
+
+    /**
+     * Size of a converted frame, the bytesused of the encoder input buffer.
+     */
+    [[nodiscard]] std::size_t target_size() const;
+
+    [[nodiscard]] std::uint32_t target_format() const;
+
+    [[nodiscard]] std::size_t threads() const;
+
+    [[nodiscard]] const char *kernel_name() const;
+
+    /**
+     * Maps both buffers and converts the frame, the target needs at least target_size() bytes.
+     */
+    void convert(const DmaBuf &source, const DmaBuf &target);
+
+    void convert(const std::uint8_t *source, std::uint8_t *target);
+
+    ~FormatConverter();
+};
+
+#endif //FORMAT_CONVERTER_HPP
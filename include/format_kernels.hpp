@@ -0,0 +1,55 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef FORMAT_KERNELS_HPP
+#define FORMAT_KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <linux/videodev2.h>
+
+/**
+ * Row kernels of the FormatConverter. Each call converts a pair of YUYV rows into two luma rows and one row of 4:2:0
+ * chroma, the chroma of both rows is averaged with rounding up. Every implementation produces bit identical results,
+ * the SIMD ones only differ in speed.
+ */
+struct FormatKernels {
+    const char *name;
+
+    /**
+     * @param uv    interleaved chroma row of NV12, width bytes
+     * @param width pixels per row, even
+     */
+    void (*yuyv_to_nv12)(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                         std::uint8_t *y_bottom, std::uint8_t *uv, std::size_t width);
+
+    /**
+     * @param u     chroma row of the U plane of I420, width / 2 bytes
+     * @param v     chroma row of the V plane of I420, width / 2 bytes
+     * @param width pixels per row, even
+     */
+    void (*yuyv_to_i420)(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                         std::uint8_t *y_bottom, std::uint8_t *u, std::uint8_t *v, std::size_t width);
+};
+
+/**
+ * Stride of a YUYV frame, drivers that leave it out pack the rows with two bytes per pixel.
+ */
+std::uint32_t yuyv_bytesperline(const v4l2_pix_format &format);
+
+const FormatKernels &scalar_format_kernels();
+
+/**
+ * The fastest kernels the CPU supports: AVX2 or SSE4.1 on x86-64 if available at runtime, NEON on aarch64, scalar
+ * otherwise.
+ */
+const FormatKernels &best_format_kernels();
+
+/**
+ * Every implementation the CPU supports, scalar first, for tests and benchmarks.
+ */
+std::vector<const FormatKernels *> supported_format_kernels();
+
+#endif //FORMAT_KERNELS_HPP
@@ -0,0 +1,236 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef FRAME_SERVER_HPP
+#define FRAME_SERVER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+#include <linux/videodev2.h>
+
+#include "camera_frame_observer.hpp"
+#include "encoded_sink.hpp"
+#include "event_reactor.hpp"
+
+/* buffers a frame server can share, the held buffers of a subscriber are a 64 bit mask */
+constexpr std::size_t MAX_SHARED_BUFFERS{64};
+/* entries of each direction of a control ring, at least the frames a subscriber may hold */
+constexpr std::uint32_t FRAME_RING_SIZE{32};
+
+/**
+ * Control ring shared by the server and one subscriber in a memfd, two single producer single consumer rings of
+ * free-running indices.
+ */
+struct FrameRing {
+    /* server to subscriber, the index of each BufferInfo is the buffer index */
+    alignas(64) std::atomic<std::uint32_t> ready_head;
+    alignas(64) std::atomic<std::uint32_t> ready_tail;
+    BufferInfo ready[FRAME_RING_SIZE];
+    /* subscriber to server, buffer indices the subscriber is done with */
+    alignas(64) std::atomic<std::uint32_t> release_head;
+    alignas(64) std::atomic<std::uint32_t> release_tail;
+    std::uint32_t release[FRAME_RING_SIZE];
+};
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "The control ring needs address free atomics");
+
+/**
+ * First and only message on the socket. It carries the ring memfd, the ready and release eventfds and one fd per
+ * buffer, in that order.
+ */
+struct FrameServerHello {
+    std::uint32_t version;
+    std::uint32_t buffer_count;
+    /* the camera format, pixelformat V4L2_PIX_FMT_H264 and no size for the encoded stream */
+    v4l2_pix_format format;
+};
+
+constexpr std::uint32_t FRAME_SERVER_VERSION{1};
+
+/**
+ * Shares the camera frames or the encoded buffers of a V4L2Streamer with other processes without copying them.
+ *
+ * Subscribers connect to a Unix seqpacket socket and receive every buffer fd once with SCM_RIGHTS when they join,
+ * along with a shared memory control ring and two eventfds. From then on a frame is published by writing its
+ * BufferInfo into the ready ring and signalling the ready eventfd, the subscriber hands the buffer index back through
+ * the release ring and the release eventfd. The socket carries nothing after the hello, it only tells the server
+ * when a subscriber is gone.
+ *
+ * The server holds each published frame until every subscriber it went to released it, only then does the buffer
+ * go back to the driver. A subscriber that holds max_outstanding frames is skipped for the next frames, so a stuck
+ * subscriber costs at most max_outstanding buffers and never stalls the stream. The buffers of a disconnected
+ * subscriber are released at once.
+ *
+ * As sink of a streamer (set_sink) the encoded buffers are shared, as camera sink (set_camera_sink) the raw frames.
+ * New subscribers and releases are picked up whenever a frame is published, attach() also picks them up between
+ * frames. Not synchronized, use it from the streaming thread.
+ */
+class FrameServer : public IEncodedSink, public ICameraFrameSink {
+public:
+    struct Config {
+        /* frames a subscriber may hold at once, at most FRAME_RING_SIZE */
+        std::uint32_t max_outstanding;
+
+        Config() : max_outstanding{2} {
+        }
+    };
+
+private:
+    struct Subscriber {
+        int socket;
+        int ready_event;
+        FrameRing *ring;
+        /* bit per buffer index */
+        std::uint64_t held;
+        std::uint32_t outstanding;
+    };
+
+    /* a published frame, kept until every subscriber released it */
+    struct Slot {
+        std::optional<EncodedFrame> encoded;
+        std::optional<CameraFrameHold> camera;
+        std::uint32_t pending{0};
+    };
+
+    int m_listen_fd{-1};
+    std::string m_path;
+    Config m_config;
+    /* shared by all subscribers, the server drains every ring when it fires */
+    int m_release_event{-1};
+    v4l2_pix_format m_format{};
+    /* own duplicates, the streamer moves its buffers around */
+    std::vector<int> m_buffer_fds;
+    std::vector<Slot> m_slots;
+    std::vector<Subscriber> m_subscribers;
+    EventReactor *m_reactor{nullptr};
+    std::uint64_t m_frames_published{0};
+    std::uint64_t m_frames_skipped{0};
+
+    void share_buffers(const std::vector<const DmaBuf *> &buffers);
+
+    void accept_subscribers();
+
+    void add_subscriber(int socket);
+
+    void remove_subscriber(std::size_t position);
+
+    void release(Subscriber &subscriber, std::uint32_t buffer);
+
+    void drain_releases();
+
+    void drop_disconnected();
+
+    /**
+     * @return the number of subscribers the frame went to
+     */
+    std::uint32_t publish(const BufferInfo &info);
+
+public:
+    /**
+     * Listens on the socket path, an existing socket file at the path is replaced.
+     */
+    explicit FrameServer(const std::string &socket_path, Config config = {});
+
+    FrameServer(const FrameServer &other) = delete;
+
+    FrameServer &operator=(const FrameServer &other) = delete;
+
+    void prepare(const std::vector<const DmaBuf *> &buffers) override;
+
+    void prepare(const v4l2_pix_format &format, const std::vector<const DmaBuf *> &buffers) override;
+
+    void consume(EncodedFrame &&frame) override;
+
+    void consume(CameraFrameHold &&hold, const BufferInfo &info) override;
+
+    [[nodiscard]] int release_fd() const override;
+
+    /**
+     * Accepts new subscribers, takes back released buffers and drops disconnected subscribers.
+     */
+    void service() override;
+
+    /**
+     * Services on new connections and releases, so held buffers go back without waiting for the next frame.
+     */
+    void attach(EventReactor &reactor);
+
+    void detach();
+
+    [[nodiscard]] std::size_t subscribers() const;
+
+    /**
+     * Frames held for at least one subscriber.
+     */
+    [[nodiscard]] std::size_t frames_held() const;
+
+    [[nodiscard]] std::uint64_t frames_published() const;
+
+    /**
+     * Deliveries left out because the subscriber held max_outstanding frames, counted per subscriber.
+     */
+    [[nodiscard]] std::uint64_t frames_skipped() const;
+
+    ~FrameServer() override;
+};
+
+/**
+ * A frame of a FrameSubscriber, readable until it is released.
+ */
+struct SubscribedFrame {
+    BufferInfo info;
+    std::span<const std::byte> data;
+};
+
+/**
+ * The other end of a FrameServer, used by the processes that want the frames.
+ *
+ * Maps every shared buffer read-only once at connect. Frames are received in order and have to be released, the
+ * server skips this subscriber while it holds max_outstanding of them.
+ */
+class FrameSubscriber {
+    int m_socket{-1};
+    int m_ready_event{-1};
+    int m_release_event{-1};
+    FrameRing *m_ring{nullptr};
+    v4l2_pix_format m_format{};
+    std::vector<int> m_buffer_fds;
+    std::vector<std::span<const std::byte> > m_maps;
+
+    void close_all() noexcept;
+
+public:
+    explicit FrameSubscriber(const std::string &socket_path);
+
+    FrameSubscriber(const FrameSubscriber &other) = delete;
+
+    FrameSubscriber &operator=(const FrameSubscriber &other) = delete;
+
+    std::optional<SubscribedFrame> try_receive();
+
+    /**
+     * Waits up to timeout for the next frame.
+     */
+    std::optional<SubscribedFrame> receive(std::chrono::milliseconds timeout);
+
+    void release(const SubscribedFrame &frame);
+
+    [[nodiscard]] const v4l2_pix_format &format() const;
+
+    [[nodiscard]] std::size_t buffer_count() const;
+
+    /**
+     * Readable when frames are ready, for an event loop of the subscriber.
+     */
+    [[nodiscard]] int ready_fd() const;
+
+    ~FrameSubscriber();
+};
+
+#endif //FRAME_SERVER_HPP
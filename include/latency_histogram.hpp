@@ -0,0 +1,74 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+struct LatencySummary {
+    std::uint64_t count;
+    std::uint64_t min_ns;
+    std::uint64_t mean_ns;
+    std::uint64_t p50_ns;
+    std::uint64_t p99_ns;
+    std::uint64_t p999_ns;
+    std::uint64_t max_ns;
+};
+
+/**
+ * HDR style histogram of nanosecond latencies. Every power of two range is split into 2^SUB_BUCKET_BITS linear
+ * sub buckets, so a percentile is off by at most 1/64 of its value while the whole range up to 2^MAX_MAGNITUDE ns
+ * (about 18 minutes) fits into a fixed array. Larger values are clamped.
+ *
+ * Recording is lock-free and may happen on any thread, queries see a consistent enough view for monitoring.
+ */
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BUCKET_BITS{6};
+    static constexpr unsigned MAX_MAGNITUDE{40};
+
+private:
+    static constexpr std::size_t SUB_BUCKETS{std::size_t{1} << SUB_BUCKET_BITS};
+    static constexpr std::size_t BUCKET_COUNT{(MAX_MAGNITUDE - SUB_BUCKET_BITS + 1) * SUB_BUCKETS};
+
+    std::array<std::atomic<std::uint64_t>, BUCKET_COUNT> m_counts{};
+    std::atomic<std::uint64_t> m_count{0};
+    std::atomic<std::uint64_t> m_sum{0};
+    std::atomic<std::uint64_t> m_min{UINT64_MAX};
+    std::atomic<std::uint64_t> m_max{0};
+
+public:
+    static std::size_t bucket_index(std::uint64_t value);
+
+    /**
+     * The highest value that falls into the bucket, percentiles are reported conservatively with it.
+     */
+    static std::uint64_t bucket_highest_value(std::size_t index);
+
+    void record(std::uint64_t value_ns);
+
+    /**
+     * @param percentile in [0, 100]
+     * @return the latency below which the given percentage of the recorded values fall, 0 while empty
+     */
+    [[nodiscard]] std::uint64_t percentile(double percentile) const;
+
+    [[nodiscard]] std::uint64_t count() const;
+
+    [[nodiscard]] std::uint64_t min() const;
+
+    [[nodiscard]] std::uint64_t max() const;
+
+    [[nodiscard]] std::uint64_t mean() const;
+
+    [[nodiscard]] LatencySummary summary() const;
+
+    void reset();
+};
+
+#endif //LATENCY_HISTOGRAM_HPP
@@ -0,0 +1,112 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef LATENCY_TRACKER_HPP
+#define LATENCY_TRACKER_HPP
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "buffer_info.hpp"
+#include "latency_histogram.hpp"
+
+/**
+ * Consecutive stages of a frame on its way from the sensor to the sink. Each stage is measured from the end of the
+ * previous one, EndToEnd covers the whole way from the sensor timestamp to the sink release.
+ */
+enum class LatencyStage : std::uint8_t {
+    SensorToCameraDequeue,
+    CameraDequeueToEncoderQueue,
+    EncoderQueueToOutputDequeue,
+    OutputDequeueToCaptureDequeue,
+    CaptureDequeueToSinkRelease,
+    EndToEnd
+};
+
+constexpr std::size_t LATENCY_STAGE_COUNT{6};
+
+const char *latency_stage_name(LatencyStage stage);
+
+class LatencyTracker;
+
+/**
+ * Carried by an encoded frame, records the sink release stages once the frame is dropped.
+ */
+class SinkRelease {
+    std::weak_ptr<LatencyTracker> m_tracker;
+    /* 0 if the camera does not deliver monotonic timestamps */
+    std::uint64_t m_sensor_ns{0};
+    std::uint64_t m_capture_dequeue_ns{0};
+
+    void record() noexcept;
+
+public:
+    SinkRelease() = default;
+
+    SinkRelease(std::weak_ptr<LatencyTracker> tracker, std::uint64_t sensor_ns, std::uint64_t capture_dequeue_ns);
+
+    SinkRelease(const SinkRelease &other) = delete;
+
+    SinkRelease(SinkRelease &&other) noexcept;
+
+    SinkRelease &operator=(const SinkRelease &other) = delete;
+
+    SinkRelease &operator=(SinkRelease &&other) noexcept;
+
+    ~SinkRelease();
+};
+
+/**
+ * Follows every frame through the pipeline and keeps one histogram per stage.
+ *
+ * Frames are matched by their driver timestamp, which the encoder copies from the output to the capture buffer.
+ * The stage notifications have to come from the streaming thread, only the histograms may be read and the sink
+ * release recorded from other threads.
+ */
+class LatencyTracker : public std::enable_shared_from_this<LatencyTracker> {
+    struct FrameTimes {
+        std::uint64_t key;
+        std::uint64_t sensor_ns;
+        std::uint64_t camera_dequeue_ns;
+        std::uint64_t encoder_queue_ns;
+        std::uint64_t output_dequeue_ns;
+    };
+
+    /* frames the encoder drops never reach the capture queue, their records are evicted by age */
+    static constexpr std::size_t MAX_FRAMES_IN_FLIGHT{32};
+
+    std::array<LatencyHistogram, LATENCY_STAGE_COUNT> m_histograms;
+    std::vector<FrameTimes> m_frames;
+
+    FrameTimes *find_frame(const BufferInfo &info);
+
+    void record(LatencyStage stage, std::uint64_t begin_ns, std::uint64_t end_ns);
+
+    friend class SinkRelease;
+
+public:
+    /**
+     * CLOCK_MONOTONIC in nanoseconds, the clock V4L2 drivers use for their buffer timestamps.
+     */
+    static std::uint64_t now_ns();
+
+    void camera_dequeued(const BufferInfo &camera_info);
+
+    void encoder_queued(const BufferInfo &camera_info);
+
+    void output_dequeued(const BufferInfo &camera_info);
+
+    /**
+     * @return the stamp to hand to the sink together with the encoded frame
+     */
+    SinkRelease capture_dequeued(const BufferInfo &encoded_info);
+
+    [[nodiscard]] const LatencyHistogram &histogram(LatencyStage stage) const;
+
+    void reset();
+};
+
+#endif //LATENCY_TRACKER_HPP
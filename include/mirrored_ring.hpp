@@ -0,0 +1,54 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef MIRRORED_RING_HPP
+#define MIRRORED_RING_HPP
+
+#include <cstddef>
+#include <utility>
+
+/**
+ * Ring memory mapped twice back to back, so any range of up to size() bytes starting inside the ring is contiguous
+ * in memory even if it wraps. Writes and reads at position % size() never have to be split.
+ *
+ * Both halves map the same memfd pages. The size is rounded up to whole pages.
+ */
+class MirroredRing {
+    std::byte *m_data{nullptr};
+    std::size_t m_size{0};
+
+    void release() noexcept;
+
+public:
+    explicit MirroredRing(std::size_t size);
+
+    MirroredRing(const MirroredRing &other) = delete;
+
+    MirroredRing(MirroredRing &&other) noexcept
+        : m_data(std::exchange(other.m_data, nullptr)),
+          m_size(std::exchange(other.m_size, 0)) {
+    }
+
+    MirroredRing &operator=(const MirroredRing &other) = delete;
+
+    MirroredRing &operator=(MirroredRing &&other) noexcept {
+        if (this == &other)
+            return *this;
+        release();
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        return *this;
+    }
+
+    ~MirroredRing();
+
+    /**
+     * Start of the first mapping, valid for 2 * size() bytes.
+     */
+    [[nodiscard]] std::byte *data() const { return m_data; }
+
+    [[nodiscard]] std::size_t size() const { return m_size; }
+};
+
+#endif //MIRRORED_RING_HPP
@@ -0,0 +1,98 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef MOTION_DETECTOR_HPP
+#define MOTION_DETECTOR_HPP
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "camera_frame_observer.hpp"
+#include "motion_kernels.hpp"
+
+struct MotionResult {
+    /* share of luma samples that differ from the background */
+    double score;
+    std::uint32_t changed_blocks;
+    std::uint32_t blocks_x;
+    std::uint32_t blocks_y;
+    /* one byte per block in row order, 1 if the block changed */
+    std::span<const std::uint8_t> mask;
+};
+
+/**
+ * Detects motion in YUYV camera frames.
+ *
+ * The luma plane is subsampled by two in both directions, the first luma sample of every macro pixel in every
+ * second row. Each sample is compared against an approximate median background that moves one step towards the
+ * frame per frame, so slow lighting changes are absorbed while moving objects stand out. The sampled plane is split
+ * into blocks of MOTION_BLOCK_SIZE samples squared, a block changed if enough of its samples differ by more than
+ * the pixel threshold. Columns and rows beyond the last whole block are ignored.
+ *
+ * At 1080p a frame is 960 x 540 samples, the AVX2 and NEON kernels process it in a fraction of a millisecond. The
+ * first frame only initializes the background.
+ */
+class MotionDetector : public ICameraFrameObserver {
+public:
+    struct Config {
+        std::uint8_t pixel_threshold;
+        /* changed samples out of MOTION_BLOCK_SIZE squared that mark the block as changed */
+        std::uint16_t block_threshold;
+
+        Config() : pixel_threshold{25}, block_threshold{32} {
+        }
+    };
+
+private:
+    Config m_config;
+    const MotionKernels *m_kernels;
+    std::uint32_t m_bytesperline{0};
+    std::uint32_t m_blocks_x{0};
+    std::uint32_t m_blocks_y{0};
+    std::vector<std::uint8_t> m_luma;
+    std::vector<std::uint8_t> m_background;
+    std::vector<std::uint16_t> m_changed;
+    std::vector<std::uint8_t> m_mask;
+    bool m_initialized{false};
+    MotionResult m_result{};
+    std::function<void(const MotionResult &)> m_handler;
+
+    [[nodiscard]] std::size_t samples_x() const;
+
+public:
+    /**
+     * @param kernels defaults to best_motion_kernels()
+     */
+    explicit MotionDetector(Config config = {}, const MotionKernels *kernels = nullptr);
+
+    /**
+     * Sizes the detector for the frame format, allocates every buffer and resets the background.
+     */
+    void prepare(const v4l2_pix_format &format) override;
+
+    /**
+     * Runs process() on the mapped buffer and calls the motion handler if any block changed.
+     */
+    void observe(const DmaBuf &buffer, const BufferInfo &info) override;
+
+    /**
+     * @param yuyv frame in the prepared format
+     * @return valid until the next call
+     */
+    const MotionResult &process(const std::uint8_t *yuyv);
+
+    /**
+     * Called on the streaming thread for every observed frame with motion, e.g. to gate a recorder or to flush a
+     * PreEventBuffer.
+     */
+    void set_motion_handler(std::function<void(const MotionResult &)> handler);
+
+    [[nodiscard]] const MotionResult &last_result() const;
+
+    [[nodiscard]] const char *kernel_name() const;
+};
+
+#endif //MOTION_DETECTOR_HPP
@@ -0,0 +1,44 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef MOTION_KERNELS_HPP
+#define MOTION_KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Row kernels of the MotionDetector. Every implementation produces bit identical results, the SIMD ones only differ
+ * in speed.
+ */
+struct MotionKernels {
+    const char *name;
+
+    /**
+     * Takes the first luma sample of every YUYV macro pixel, i.e. every second luma sample of the row.
+     * @param samples number of macro pixels to read and luma samples to write
+     */
+    void (*extract_luma)(const std::uint8_t *yuyv, std::uint8_t *luma, std::size_t samples);
+
+    /**
+     * Compares a row of luma samples against the background, counts the samples differing by more than threshold
+     * into changed[sample / MOTION_BLOCK_SIZE] and moves every background sample one step towards the luma sample
+     * (approximate median background).
+     * @param samples multiple of MOTION_BLOCK_SIZE
+     */
+    void (*compare_row)(const std::uint8_t *luma, std::uint8_t *background, std::size_t samples,
+                        std::uint8_t threshold, std::uint16_t *changed);
+};
+
+/* samples per block side of the motion mask */
+constexpr std::size_t MOTION_BLOCK_SIZE{16};
+
+const MotionKernels &scalar_motion_kernels();
+
+/**
+ * The fastest kernels the CPU supports: AVX2 on x86-64 if available at runtime, NEON on aarch64, scalar otherwise.
+ */
+const MotionKernels &best_motion_kernels();
+
+#endif //MOTION_KERNELS_HPP
@@ -0,0 +1,142 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef NAL_SCANNER_HPP
+#define NAL_SCANNER_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+enum class NalUnitType : std::uint8_t {
+    Unspecified = 0,
+    Slice = 1,
+    SliceDataA = 2,
+    SliceDataB = 3,
+    SliceDataC = 4,
+    Idr = 5,
+    Sei = 6,
+    Sps = 7,
+    Pps = 8,
+    AccessUnitDelimiter = 9,
+    EndOfSequence = 10,
+    EndOfStream = 11,
+    Filler = 12
+};
+
+/**
+ * Position of a NAL unit inside an Annex-B buffer. The unit starts with its header byte, start code and trailing zero
+ * bytes are not part of it.
+ */
+struct NalUnit {
+    std::uint32_t offset;
+    std::uint32_t size;
+    NalUnitType type;
+    /* nal_ref_idc, 0 for units no other picture refers to */
+    std::uint8_t ref_idc;
+};
+
+/* enough for parameter sets, SEI and a sliced picture, further units of the buffer are not indexed */
+constexpr std::size_t MAX_NAL_UNITS{32};
+
+/**
+ * The NAL units of one encoder buffer in bitstream order, without any payload.
+ */
+struct NalUnits {
+    std::array<NalUnit, MAX_NAL_UNITS> units;
+    std::uint32_t count{0};
+    /* the buffer held more than MAX_NAL_UNITS units */
+    bool truncated{false};
+
+    [[nodiscard]] const NalUnit *begin() const { return units.data(); }
+
+    [[nodiscard]] const NalUnit *end() const { return units.data() + count; }
+
+    /**
+     * @return the first unit of the type or nullptr
+     */
+    [[nodiscard]] const NalUnit *find(NalUnitType type) const;
+
+    [[nodiscard]] bool has_idr() const { return find(NalUnitType::Idr) != nullptr; }
+};
+
+/**
+ * Start code search, every implementation finds the same positions.
+ */
+struct StartCodeSearch {
+    const char *name;
+
+    /**
+     * @return the first byte of the first 00 00 01 sequence in [begin, end) or end
+     */
+    const std::byte *(*find)(const std::byte *begin, const std::byte *end);
+};
+
+/**
+ * memchr for the 01 byte followed by a look back, libc vectorizes memchr on every target.
+ */
+const StartCodeSearch &memchr_start_code_search();
+
+/**
+ * Skips blocks without a zero byte and compares three shifted loads per vector in the others: AVX2 on x86-64 if
+ * available at runtime, NEON on aarch64, the memchr search otherwise.
+ */
+const StartCodeSearch &best_start_code_search();
+
+/**
+ * Indexes the NAL units of an Annex-B buffer. Both 3 and 4 byte start codes are accepted, bytes before the first
+ * start code are ignored.
+ * @param search defaults to best_start_code_search()
+ */
+NalUnits index_nal_units(std::span<const std::byte> bitstream, const StartCodeSearch *search = nullptr);
+
+/**
+ * Indexes encoded buffers and keeps the latest SPS and PPS, so a consumer that joins the stream between two IDR
+ * pictures can be started with parameter_sets() in front of the next IDR.
+ *
+ * The index is kept in the scanner and points into the scanned buffer, it is valid until the next scan. Only the
+ * parameter sets are copied, they are a few bytes once per IDR. Not synchronized, scan and read on one thread.
+ */
+class NalScanner {
+    const StartCodeSearch *m_search;
+    NalUnits m_units;
+    std::vector<std::byte> m_sps;
+    std::vector<std::byte> m_pps;
+    std::uint64_t m_parameter_set_updates{0};
+
+    static bool update(std::vector<std::byte> &cached, std::span<const std::byte> unit);
+
+public:
+    /**
+     * @param search defaults to best_start_code_search()
+     */
+    explicit NalScanner(const StartCodeSearch *search = nullptr);
+
+    const NalUnits &scan(std::span<const std::byte> bitstream);
+
+    [[nodiscard]] const NalUnits &units() const;
+
+    /**
+     * @return the latest SPS without start code, empty before the first one
+     */
+    [[nodiscard]] std::span<const std::byte> sps() const;
+
+    [[nodiscard]] std::span<const std::byte> pps() const;
+
+    /**
+     * @return SPS and PPS each behind a 4 byte start code, ready to be sent in front of an IDR
+     */
+    [[nodiscard]] std::vector<std::byte> parameter_sets() const;
+
+    /**
+     * Number of scans that brought an SPS or PPS different from the cached one.
+     */
+    [[nodiscard]] std::uint64_t parameter_set_updates() const;
+
+    [[nodiscard]] const char *search_name() const;
+};
+
+#endif //NAL_SCANNER_HPP
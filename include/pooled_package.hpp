@@ -0,0 +1,169 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef POOLED_PACKAGE_HPP
+#define POOLED_PACKAGE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "condition.hpp"
+
+/**
+ * Index of a pool slot together with the generation the slot had when the package was handed out.
+ */
+struct SlotHandle {
+    std::uint32_t index{0};
+    std::uint32_t generation{0};
+};
+
+/**
+ * Generation counter for every slot of a pool. The counter is odd while the slot is handed out and even while the
+ * pool holds it, so a package that comes back twice or belongs to an earlier hand-out does not match. The checks are
+ * PRECONDITIONs and vanish in release builds, only the counters remain.
+ */
+class SlotGenerations {
+    std::vector<std::uint32_t> m_generations;
+
+public:
+    explicit SlotGenerations(std::size_t slots) : m_generations(slots, 0) {
+    }
+
+    SlotGenerations(const SlotGenerations &other) = delete;
+
+    SlotGenerations &operator=(const SlotGenerations &other) = delete;
+
+    ~SlotGenerations() {
+        PRECONDITION(handed_out() == 0, "Pool destroyed while packages are still handed out");
+    }
+
+    SlotHandle hand_out(std::uint32_t index) {
+        PRECONDITION(index < m_generations.size(), "Slot index out of range");
+        PRECONDITION(!is_handed_out(index), "Slot handed out twice");
+        return {index, ++m_generations[index]};
+    }
+
+    void take_back(SlotHandle slot) {
+        PRECONDITION(slot.index < m_generations.size(), "Slot index out of range");
+        PRECONDITION(m_generations[slot.index] == slot.generation, "Stale package returned to its pool");
+        ++m_generations[slot.index];
+    }
+
+    [[nodiscard]] bool is_handed_out(std::uint32_t index) const {
+        return m_generations[index] & 1u;
+    }
+
+    [[nodiscard]] std::size_t handed_out() const {
+        return std::ranges::count_if(m_generations, [](std::uint32_t generation) { return generation & 1u; });
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return m_generations.size();
+    }
+
+    /**
+     * Gives up the slots still handed out, for a pool whose packages keep what they return to alive on their own.
+     */
+    void abandon() {
+        m_generations.clear();
+    }
+};
+
+/**
+ * Owns a value that belongs to a slot of Pool and gives it back when dropped, the lighter sibling of RequeingPackage.
+ *
+ * The package holds a plain pointer to its pool instead of a weak_ptr and returns through the non-virtual
+ * Pool::enqueue(PooledPackage &&), so handing a package on costs no atomic operation and no indirect call. In turn the
+ * pool has to outlive its packages and has to keep the values, not the packages: enqueue takes the value back with
+ * release(). Debug builds check both, release builds trust the pool.
+ *
+ * Packages handed to other threads can rarely promise to die before their pool. With a PoolRef of
+ * std::shared_ptr<Pool> the package keeps its pool alive instead, creating and dropping it then costs an atomic
+ * operation, moving it still does not.
+ */
+template<class T, class Pool, class PoolRef = Pool *>
+class PooledPackage {
+    T m_value;
+    PoolRef m_pool{};
+    SlotHandle m_slot{};
+
+    PooledPackage(T &&value, PoolRef pool, SlotHandle slot) : m_value{std::forward<T>(value)},
+                                                              m_pool{std::move(pool)}, m_slot{slot} {
+    }
+
+    void reset() {
+        if (m_pool != nullptr) {
+            /* release() empties the package inside enqueue, a shared pool has to stay alive until it returns */
+            const PoolRef pool = m_pool;
+            pool->enqueue(std::move(*this));
+            PRECONDITION(m_pool == nullptr, "Pool did not release the returned package");
+        }
+    }
+
+public:
+    /**
+     * @param slot the handle the pool handed out for the value, see SlotGenerations
+     */
+    template<typename... Args>
+    static PooledPackage create(Pool &pool, SlotHandle slot, Args &&... args) {
+        return PooledPackage{T{std::forward<Args>(args)...}, &pool, slot};
+    }
+
+    /**
+     * For a PoolRef that keeps the pool alive.
+     */
+    template<typename... Args>
+    static PooledPackage create(PoolRef pool, SlotHandle slot, Args &&... args) {
+        return PooledPackage{T{std::forward<Args>(args)...}, std::move(pool), slot};
+    }
+
+    PooledPackage(const PooledPackage &other) = delete;
+
+    PooledPackage(PooledPackage &&other) noexcept
+        : m_value(std::move(other.m_value)),
+          m_pool(std::exchange(other.m_pool, nullptr)),
+          m_slot(other.m_slot) {
+    }
+
+    PooledPackage &operator=(const PooledPackage &other) = delete;
+
+    /**
+     * Returns the value held so far to its pool before taking over the other one.
+     */
+    PooledPackage &operator=(PooledPackage &&other) noexcept {
+        if (this == &other)
+            return *this;
+        reset();
+        m_value = std::move(other.m_value);
+        m_pool = std::exchange(other.m_pool, nullptr);
+        m_slot = other.m_slot;
+        return *this;
+    }
+
+    ~PooledPackage() {
+        reset();
+    }
+
+    [[nodiscard]] bool is_empty() const { return m_pool == nullptr; }
+
+    [[nodiscard]] std::uint32_t index() const { return m_slot.index; }
+
+    [[nodiscard]] SlotHandle slot() const { return m_slot; }
+
+    const T &data() const { return m_value; }
+
+    /**
+     * Hands the value back without requeueing, for Pool::enqueue. Leaves the package empty.
+     */
+    T release() {
+        PRECONDITION(m_pool != nullptr, "Released an empty package");
+        m_pool = nullptr;
+        return std::move(m_value);
+    }
+};
+
+#endif //POOLED_PACKAGE_HPP
@@ -0,0 +1,102 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef PRE_EVENT_BUFFER_HPP
+#define PRE_EVENT_BUFFER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <sys/time.h>
+
+#include "encoded_sink.hpp"
+#include "fan_out_sink.hpp"
+#include "mirrored_ring.hpp"
+
+/**
+ * Keeps the most recent encoded bitstream in memory, so the footage before a trigger can be saved.
+ *
+ * Frames are copied into a MirroredRing bounded by bytes, the oldest frames are overwritten once it is full. The
+ * ring always starts at a keyframe: when an overwrite cuts into a GOP, the rest of that GOP is dropped too, and
+ * frames before the first keyframe are not stored at all. Frame records and the keyframe index are fixed size rings
+ * as well, so appending never allocates.
+ *
+ * Used as an IEncodedSink of the streamer or as a consumer of a FanOutSink. The buffer is not synchronized, consume,
+ * append and flush have to run on one thread.
+ */
+class PreEventBuffer : public IEncodedSink, public ISharedEncodedSink {
+    struct FrameRecord {
+        /* byte position in the stream of all appended frames, the ring offset is position % ring size */
+        std::uint64_t position;
+        std::uint64_t timestamp_ns;
+        std::uint32_t size;
+        bool keyframe;
+    };
+
+    MirroredRing m_ring;
+    /* frame numbers [m_first_frame, m_next_frame) are stored, record n lives at n % size */
+    std::vector<FrameRecord> m_frames;
+    std::uint64_t m_first_frame{0};
+    std::uint64_t m_next_frame{0};
+    /* frame numbers of the stored keyframes, same layout */
+    std::vector<std::uint64_t> m_keyframes;
+    std::uint64_t m_first_keyframe{0};
+    std::uint64_t m_next_keyframe{0};
+    std::uint64_t m_head{0};
+    std::uint64_t m_dropped_frames{0};
+
+    [[nodiscard]] const FrameRecord &frame(std::uint64_t number) const;
+
+    void evict_oldest();
+
+public:
+    /**
+     * @param capacity   bytes of bitstream kept, rounded up to whole pages
+     * @param max_frames frames kept at most, independent of their size
+     */
+    explicit PreEventBuffer(std::size_t capacity, std::size_t max_frames = 4096);
+
+    void consume(EncodedFrame &&frame) override;
+
+    void consume(SharedEncodedFrame &&frame) override;
+
+    /**
+     * Copies one encoded frame into the ring. A frame larger than the whole ring clears it.
+     */
+    void append(std::span<const std::byte> data, timeval timestamp, bool keyframe);
+
+    /**
+     * The stored bitstream covering at least the last duration, starting at the newest keyframe that is not younger
+     * than the newest frame minus duration, or at the oldest keyframe if the ring does not reach back that far. The
+     * span stays valid until the next append.
+     */
+    [[nodiscard]] std::span<const std::byte> window(std::chrono::nanoseconds duration) const;
+
+    /**
+     * Writes window(duration) to fd, with a single write unless the kernel takes it partially.
+     * @return the number of bytes written
+     */
+    std::size_t flush(int fd, std::chrono::nanoseconds duration) const;
+
+    void clear();
+
+    [[nodiscard]] std::size_t capacity() const;
+
+    [[nodiscard]] std::size_t buffered_bytes() const;
+
+    [[nodiscard]] std::size_t buffered_frames() const;
+
+    /**
+     * Time between the oldest and the newest stored frame.
+     */
+    [[nodiscard]] std::chrono::nanoseconds buffered_duration() const;
+
+    /**
+     * Frames not stored because they preceded the first keyframe or exceeded the capacity.
+     */
+    [[nodiscard]] std::uint64_t dropped_frames() const;
+};
+
+#endif //PRE_EVENT_BUFFER_HPP
@@ -0,0 +1,141 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef PREVIEW_SCALER_HPP
+#define PREVIEW_SCALER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "camera_frame_observer.hpp"
+#include "pooled_package.hpp"
+#include "return_queue.hpp"
+
+/**
+ * Downscaled YUYV copy of a camera frame.
+ */
+struct PreviewFrame {
+    std::vector<std::uint8_t> pixels;
+    std::uint32_t width{0};
+    std::uint32_t height{0};
+    timeval timestamp{};
+};
+
+/**
+ * Produces a low resolution YUYV preview of the camera frames for live views and thumbnails, without touching the
+ * encoded stream.
+ *
+ * Every output sample is the rounded mean of a factor x factor box of input samples: luma over the box of pixels,
+ * chroma over the factor macro pixels of the box. The rows of a box are summed with SIMD widening adds, the columns
+ * are reduced once per output row. Columns and rows beyond the last whole box are ignored.
+ *
+ * Previews are written into a small fixed set of buffers and handed to the handler as PooledPackages. A package may
+ * be kept and dropped on any thread, it returns through a ReturnQueue and is reused on the streaming thread. The
+ * packages share the queue, so a preview may also outlive the scaler. While the handler holds every buffer frames are
+ * skipped instead of waiting, so a slow consumer never stalls the encode.
+ */
+class PreviewScaler : public ICameraFrameObserver {
+public:
+    struct Config {
+        /* 2, 4 or 8 */
+        std::uint32_t factor;
+        /* only every n-th camera frame is scaled, e.g. the frame rate for one thumbnail per second */
+        std::uint32_t frame_divider;
+        std::uint32_t buffers;
+
+        Config() : factor{4}, frame_divider{1}, buffers{3} {
+        }
+    };
+
+private:
+    struct Returns;
+
+public:
+    using Package = PooledPackage<PreviewFrame, Returns, std::shared_ptr<Returns> >;
+
+private:
+    struct Returned {
+        SlotHandle slot;
+        PreviewFrame frame;
+    };
+
+    /**
+     * Where dropped previews go, on any thread.
+     */
+    struct Returns {
+        ReturnQueue<Returned> queue;
+
+        explicit Returns(std::size_t capacity) : queue(capacity) {
+        }
+
+        void enqueue(Package &&package) {
+            const auto slot = package.slot();
+            queue.enqueue(Returned{slot, package.release()});
+        }
+    };
+
+    Config m_config;
+    std::uint32_t m_shift;
+    std::uint32_t m_bytesperline{0};
+    std::uint32_t m_width{0};
+    std::uint32_t m_height{0};
+    /* vertical sums of factor rows, one per byte of the input row */
+    std::vector<std::uint16_t> m_sums;
+    /* free preview buffers, indexed by slot, empty while handed out */
+    std::vector<PreviewFrame> m_frames;
+    SlotGenerations m_slots;
+    std::shared_ptr<Returns> m_returns;
+    std::uint64_t m_frames_seen{0};
+    std::uint64_t m_frames_skipped{0};
+    std::function<void(Package &&)> m_handler;
+
+    void take_back_returned();
+
+    [[nodiscard]] std::optional<std::uint32_t> find_free_slot() const;
+
+public:
+    explicit PreviewScaler(Config config = {});
+
+    PreviewScaler(const PreviewScaler &other) = delete;
+
+    PreviewScaler &operator=(const PreviewScaler &other) = delete;
+
+    /**
+     * Sizes the preview buffers for the frame format.
+     */
+    void prepare(const v4l2_pix_format &format) override;
+
+    /**
+     * Scales the mapped buffer into a free preview buffer and hands it to the handler. Skips the frame if it is not
+     * due or every preview buffer is held.
+     */
+    void observe(const DmaBuf &buffer, const BufferInfo &info) override;
+
+    /**
+     * Scales a frame in the prepared format into preview, which is resized to the preview size.
+     */
+    void scale(const std::uint8_t *yuyv, PreviewFrame &preview);
+
+    /**
+     * Called on the streaming thread for every preview.
+     */
+    void set_preview_handler(std::function<void(Package &&)> handler);
+
+    [[nodiscard]] std::uint32_t preview_width() const;
+
+    [[nodiscard]] std::uint32_t preview_height() const;
+
+    /**
+     * Due frames that were skipped because the handler held every preview buffer.
+     */
+    [[nodiscard]] std::uint64_t frames_skipped() const;
+
+    [[nodiscard]] const char *kernel_name() const;
+
+    ~PreviewScaler() override;
+};
+
+#endif //PREVIEW_SCALER_HPP
@@ -0,0 +1,61 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef QUEUE_MONITOR_HPP
+#define QUEUE_MONITOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "buffer_info.hpp"
+
+struct QueueStatistics {
+    /* buffers dequeued */
+    std::uint64_t buffers;
+    /* frames the driver skipped, taken from the gaps in the sequence numbers */
+    std::uint64_t dropped;
+    /* buffers flagged with V4L2_BUF_FLAG_ERROR, their content is unreliable */
+    std::uint64_t errors;
+    /* buffers dequeued more than the late threshold after their timestamp */
+    std::uint64_t late;
+};
+
+/**
+ * Counts what the driver reports on the buffers of one queue, so frame drops under load show up as numbers.
+ *
+ * A buffer is late when it is dequeued more than late_after after its timestamp, which is only judged for monotonic
+ * and copied timestamps. Copied timestamps are assumed to come from a monotonic camera, a copied wall clock time
+ * lies far in the future of CLOCK_MONOTONIC and is never counted.
+ *
+ * Recording has to happen on one thread, the statistics may be read from any thread.
+ */
+class QueueMonitor {
+    std::uint64_t m_late_after_ns;
+    /* sequence + 1 of the previous buffer, 0 before the first one */
+    std::uint64_t m_next_sequence{0};
+    std::atomic<std::uint64_t> m_buffers{0};
+    std::atomic<std::uint64_t> m_dropped{0};
+    std::atomic<std::uint64_t> m_errors{0};
+    std::atomic<std::uint64_t> m_late{0};
+
+public:
+    explicit QueueMonitor(std::chrono::nanoseconds late_after);
+
+    /**
+     * @param dequeue_ns CLOCK_MONOTONIC when the buffer was dequeued, see LatencyTracker::now_ns()
+     */
+    void record(const BufferInfo &info, std::uint64_t dequeue_ns);
+
+    /**
+     * The driver restarts the sequence numbers with every STREAMON.
+     */
+    void restart_sequence();
+
+    [[nodiscard]] QueueStatistics statistics() const;
+
+    void reset();
+};
+
+#endif //QUEUE_MONITOR_HPP
@@ -4,6 +4,8 @@
 
 #ifndef REQUEINGPACKAGE_HPP
 #define REQUEINGPACKAGE_HPP
+#include <cstdint>
+#include <memory>
 #include <optional>
 #include <utility>
 
@@ -14,6 +16,8 @@ template<class T>
 class RequeingPackage {
     T m_value;
     std::weak_ptr<IIndexedQueue<RequeingPackage> > m_queue;
+    /* slot of the package in its queue, lets the queue take it back without searching */
+    std::uint32_t m_index = 0;
     bool m_is_empty = true;
 
     explicit RequeingPackage(T &&value) : m_value{std::forward<T>(value)}, m_queue{}, m_is_empty(false) {
@@ -24,7 +28,8 @@ public:
 
     RequeingPackage(RequeingPackage &&other) noexcept
         : m_value(std::move(other.m_value)),
-          m_queue(std::move(other.m_queue)) {
+          m_queue(std::move(other.m_queue)),
+          m_index(other.m_index) {
         m_is_empty = other.m_is_empty;
         other.m_is_empty = true;
     }
@@ -36,6 +41,7 @@ public:
             return *this;
         m_value = std::move(other.m_value);
         m_queue = std::move(other.m_queue);
+        m_index = other.m_index;
         m_is_empty = other.m_is_empty;
         other.m_is_empty = true;
         return *this;
@@ -43,6 +49,8 @@ public:
 
     auto is_empty() const -> bool { return m_is_empty; }
 
+    auto index() const -> std::uint32_t { return m_index; }
+
 private:
     class PackageBuilder {
         RequeingPackage m_underConstruction;
@@ -56,6 +64,11 @@ private:
             return *this;
         }
 
+        PackageBuilder &with_index(std::uint32_t index) {
+            m_underConstruction.m_index = index;
+            return *this;
+        }
+
         RequeingPackage &&build() {
             PRECONDITION(!m_underConstruction.m_queue.expired(), "Queue is null");
             return std::move(m_underConstruction);
@@ -0,0 +1,232 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef RETURN_QUEUE_HPP
+#define RETURN_QUEUE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <poll.h>
+#include <unistd.h>
+#include <utility>
+#include <plog/Log.h>
+#include <sys/eventfd.h>
+
+#include "exceptions.hpp"
+#include "indexed_queue.hpp"
+
+/**
+ * Bounded lock-free multi producer, single consumer queue, used to hand packages back from consumer threads to the
+ * thread that owns their resource.
+ *
+ * Any thread may enqueue, for a RequeingPackage that is whichever thread drops it. Only one thread, the owner, may
+ * dequeue or drain. Every cell carries a sequence number (Vyukov's bounded queue): producers claim a cell with a CAS
+ * on the tail and publish it by advancing the cell's sequence, the consumer reads cells in order without any atomic
+ * read-modify-write. Sized to cover every package that can be in flight a producer never waits, on a full queue
+ * producers sleep on the cell until the consumer frees it.
+ *
+ * The owner can block until something is returned, in dequeue() or by polling event_fd() between prepare_wait() and
+ * finish_wait(), e.g. together with a device fd. Producers only signal the eventfd while the owner announced a wait,
+ * so returning a value costs no system call otherwise.
+ */
+template<class T>
+class ReturnQueue : public IIndexedQueue<T> {
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        std::optional<T> value;
+    };
+
+    /* a cache line on the targets we build for */
+    static constexpr std::size_t CACHE_LINE{64};
+
+    std::size_t m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+    int m_event_fd;
+    /* producers and the consumer write different cache lines */
+    alignas(CACHE_LINE) std::atomic<std::size_t> m_tail{0};
+    std::atomic<std::uint32_t> m_producers_waiting{0};
+    alignas(CACHE_LINE) std::size_t m_head{0};
+    std::atomic<bool> m_owner_waiting{false};
+
+    void wake_owner() {
+        /* pairs with the fence in prepare_wait(), either the owner sees the value or the producer sees the wait */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (m_owner_waiting.load(std::memory_order_relaxed)) {
+            const std::uint64_t one = 1;
+            /* a full counter already wakes the owner */
+            [[maybe_unused]] const auto written = write(m_event_fd, &one, sizeof(one));
+        }
+    }
+
+    void wait_for_cell(Cell &cell, std::size_t sequence) {
+        m_producers_waiting.fetch_add(1, std::memory_order_relaxed);
+        /* pairs with the fence in try_dequeue(), either the owner sees the waiter or the waiter sees the free cell */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cell.sequence.wait(sequence, std::memory_order_acquire);
+        m_producers_waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+public:
+    /**
+     * @param capacity rounded up to a power of two, at least two as a single cell could not tell full from empty
+     */
+    explicit ReturnQueue(std::size_t capacity)
+        : m_mask(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1),
+          m_cells(std::make_unique<Cell[]>(m_mask + 1)),
+          m_event_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+        if (m_event_fd == -1) {
+            PLOGE << "Failed to create return queue eventfd: " << std::strerror(errno);
+            throw EventReactorError{"Failed to create return queue eventfd"};
+        }
+
+        for (std::size_t i = 0; i <= m_mask; i++) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ReturnQueue(const ReturnQueue &other) = delete;
+
+    ReturnQueue &operator=(const ReturnQueue &other) = delete;
+
+    ~ReturnQueue() override {
+        close(m_event_fd);
+    }
+
+    /**
+     * Safe to call from any thread.
+     */
+    void enqueue(T &&value) override {
+        auto tail = m_tail.load(std::memory_order_relaxed);
+
+        while (true) {
+            auto &cell = m_cells[tail & m_mask];
+            const auto sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence - tail);
+
+            if (difference == 0) {
+                if (m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+                    cell.value.emplace(std::move(value));
+                    cell.sequence.store(tail + 1, std::memory_order_release);
+                    wake_owner();
+                    return;
+                }
+            } else if (difference < 0) {
+                wait_for_cell(cell, sequence);
+                tail = m_tail.load(std::memory_order_relaxed);
+            } else {
+                tail = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Owner thread only.
+     * @return the oldest returned value or std::nullopt if nothing was returned
+     */
+    std::optional<T> try_dequeue() {
+        auto &cell = m_cells[m_head & m_mask];
+
+        if (cell.sequence.load(std::memory_order_acquire) != m_head + 1) {
+            return std::nullopt;
+        }
+
+        std::optional<T> value{std::move(cell.value)};
+        cell.value.reset();
+        cell.sequence.store(m_head + m_mask + 1, std::memory_order_release);
+        m_head++;
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (m_producers_waiting.load(std::memory_order_relaxed) != 0) {
+            cell.sequence.notify_all();
+        }
+
+        return value;
+    }
+
+    /**
+     * Owner thread only, blocks until a value is returned.
+     */
+    T dequeue() override {
+        while (true) {
+            if (auto value = try_dequeue()) {
+                return std::move(*value);
+            }
+            wait();
+        }
+    }
+
+    /**
+     * Owner thread only, blocks until a value was returned since the last try_dequeue() or drain().
+     */
+    void wait() {
+        if (prepare_wait()) {
+            pollfd event{m_event_fd, POLLIN, 0};
+
+            while (poll(&event, 1, -1) == -1 && errno == EINTR) {
+            }
+        }
+
+        finish_wait();
+    }
+
+    /**
+     * Owner thread only, makes producers signal event_fd() from now on.
+     * @return false if a value is already waiting, the owner must not block then
+     */
+    bool prepare_wait() {
+        m_owner_waiting.store(true, std::memory_order_relaxed);
+        /* pairs with the fence in wake_owner() */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        return m_cells[m_head & m_mask].sequence.load(std::memory_order_acquire) != m_head + 1;
+    }
+
+    /**
+     * Owner thread only, ends a wait started with prepare_wait() and clears event_fd().
+     */
+    void finish_wait() {
+        m_owner_waiting.store(false, std::memory_order_relaxed);
+
+        std::uint64_t count;
+        [[maybe_unused]] const auto read_bytes = read(m_event_fd, &count, sizeof(count));
+    }
+
+    /**
+     * Readable while a value waits for the owner, once prepare_wait() returned true.
+     */
+    [[nodiscard]] int event_fd() const {
+        return m_event_fd;
+    }
+
+    /**
+     * Owner thread only, passes every value returned so far to consume.
+     * @return the number of values drained
+     */
+    template<class Consumer>
+    std::size_t drain(Consumer &&consume) {
+        std::size_t drained = 0;
+
+        while (auto value = try_dequeue()) {
+            consume(std::move(*value));
+            drained++;
+        }
+
+        return drained;
+    }
+
+    [[nodiscard]] std::size_t capacity() const {
+        return m_mask + 1;
+    }
+};
+
+#endif //RETURN_QUEUE_HPP
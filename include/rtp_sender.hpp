@@ -0,0 +1,131 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef RTP_SENDER_HPP
+#define RTP_SENDER_HPP
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "encoded_sink.hpp"
+#include "nal_scanner.hpp"
+
+/**
+ * Streams the encoded bitstream as RTP over UDP, packetized after RFC 6184 in non-interleaved mode.
+ *
+ * A NAL unit that fits into max_payload goes into a single NAL unit packet, larger ones are split into FU-A
+ * fragments of at most max_payload bytes. Access unit delimiters are left out, SPS and PPS are repeated from the cache
+ * of the scanner in front of an IDR that comes without them, so a receiver can join at every IDR. All packets of a
+ * frame carry the same 90 kHz timestamp derived from the driver timestamp, the last one has the marker bit set.
+ *
+ * The packets are never assembled in memory: every packet is two iovecs, its prebuilt header and the payload straight
+ * from the mapped encoder buffer, and the whole frame is handed to the kernel with one sendmmsg. With UDP generic
+ * segmentation offload the FU-A fragments of a NAL unit are sent as one message the kernel or the NIC cuts into
+ * packets, which saves most of the per packet cost of the stack.
+ *
+ * A frame that cannot be sent, e.g. while the receiver is not listening yet, is dropped with a warning.
+ */
+class RtpSender : public IEncodedSink {
+public:
+    struct Config {
+        std::uint8_t payload_type;
+        /* RTP payload bytes per packet, 1400 keeps IP, UDP and RTP headers below an MTU of 1500 */
+        std::uint32_t max_payload;
+        /* use UDP_SEGMENT if the kernel supports it */
+        bool gso;
+        /* 0 picks a random SSRC */
+        std::uint32_t ssrc;
+
+        Config() : payload_type{96}, max_payload{1400}, gso{true}, ssrc{0} {
+        }
+    };
+
+    static constexpr std::size_t RTP_HEADER_SIZE{12};
+    /* FU indicator and FU header */
+    static constexpr std::size_t FU_A_HEADER_SIZE{2};
+
+private:
+    using PacketHeader = std::array<std::byte, RTP_HEADER_SIZE + FU_A_HEADER_SIZE>;
+
+    /* ancillary data with the UDP_SEGMENT size of a message */
+    union SegmentControl {
+        cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(std::uint16_t))];
+    };
+
+    int m_fd{-1};
+    Config m_config;
+    bool m_gso{false};
+    NalScanner m_scanner;
+    std::uint16_t m_sequence_number;
+    std::uint32_t m_timestamp_offset;
+    /* NAL units of the frame being sent, parameter sets may point into the scanner cache */
+    std::vector<std::span<const std::byte> > m_units;
+    /* grown to the largest frame and reused, the messages point into the other vectors */
+    std::vector<PacketHeader> m_headers;
+    std::vector<iovec> m_iov;
+    std::vector<mmsghdr> m_messages;
+    std::vector<SegmentControl> m_controls;
+    std::uint64_t m_frames_sent{0};
+    std::uint64_t m_frames_dropped{0};
+    std::uint64_t m_packets_sent{0};
+    std::uint64_t m_bytes_sent{0};
+    std::uint64_t m_send_calls{0};
+
+    [[nodiscard]] std::size_t count_packets() const;
+
+    /**
+     * Builds headers, iovecs and messages of every packet of m_units.
+     * @return the number of messages
+     */
+    std::size_t build_messages(std::uint32_t timestamp);
+
+    bool send_messages(std::size_t count);
+
+    void write_header(PacketHeader &header, bool marker, std::uint32_t timestamp);
+
+public:
+    /**
+     * @param address IPv4 address of the receiver, unicast or multicast
+     */
+    RtpSender(const std::string &address, std::uint16_t port, Config config = {});
+
+    RtpSender(const RtpSender &other) = delete;
+
+    RtpSender &operator=(const RtpSender &other) = delete;
+
+    void consume(EncodedFrame &&frame) override;
+
+    [[nodiscard]] bool uses_gso() const;
+
+    [[nodiscard]] std::uint32_t ssrc() const;
+
+    [[nodiscard]] std::uint64_t frames_sent() const;
+
+    [[nodiscard]] std::uint64_t frames_dropped() const;
+
+    /**
+     * Packets on the wire, a segmented message counts once per segment.
+     */
+    [[nodiscard]] std::uint64_t packets_sent() const;
+
+    /**
+     * UDP payload bytes, RTP headers included.
+     */
+    [[nodiscard]] std::uint64_t bytes_sent() const;
+
+    /**
+     * Number of sendmmsg calls, one per frame unless the kernel took a frame only partly.
+     */
+    [[nodiscard]] std::uint64_t send_calls() const;
+
+    ~RtpSender() override;
+};
+
+#endif //RTP_SENDER_HPP
@@ -0,0 +1,158 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef SEGMENTED_RECORDER_HPP
+#define SEGMENTED_RECORDER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "encoded_sink.hpp"
+
+/**
+ * Records the encoded bitstream continuously into a directory of fixed duration segment files.
+ *
+ * Every segment starts with a keyframe, a new one is opened at the first keyframe after segment_duration. The file is
+ * preallocated with fallocate to segment_size, so the filesystem hands out one contiguous extent instead of growing
+ * the file block by block, and written with O_DIRECT from an aligned staging buffer in staging_size chunks. Flash
+ * then sees large sequential writes and the page cache is not filled with footage nobody reads again. When a segment
+ * is closed its unused preallocation is given back, and the oldest segments are deleted until all segments fit into
+ * total_budget.
+ *
+ * consume() only hands the frame to a dedicated I/O thread, which copies it into the staging buffer and drops it,
+ * so the encoder buffer goes back as soon as it is copied and a slow write never blocks the streaming thread. When
+ * max_queued frames are waiting the frame is dropped instead, the recording then resumes at the next keyframe.
+ *
+ * Segments are named <prefix>-<number>.h264 with a zero padded number. Segments of an earlier recording with the
+ * same prefix count towards the budget and the numbering continues after them.
+ */
+class SegmentedRecorder : public IEncodedSink {
+public:
+    struct Config {
+        std::string prefix;
+        std::chrono::nanoseconds segment_duration;
+        /* preallocated per segment, a larger segment keeps growing */
+        std::uint64_t segment_size;
+        /* all segments of the prefix together, at least the newest segment is always kept */
+        std::uint64_t total_budget;
+        /* bytes per direct write, a multiple of DIRECT_IO_ALIGNMENT */
+        std::size_t staging_size;
+        /* frames waiting for the I/O thread, has to stay below the number of encoder capture buffers */
+        std::size_t max_queued;
+
+        Config() : prefix{"segment"},
+                   segment_duration{std::chrono::seconds{60}},
+                   segment_size{64 << 20},
+                   total_budget{std::uint64_t{1} << 30},
+                   staging_size{1 << 20},
+                   max_queued{4} {
+        }
+    };
+
+    /* alignment of buffer address, file offset and length for O_DIRECT on the block devices we record to */
+    static constexpr std::size_t DIRECT_IO_ALIGNMENT{4096};
+
+private:
+    struct Segment {
+        std::string path;
+        std::uint64_t size;
+    };
+
+    std::string m_directory;
+    Config m_config;
+
+    /* handed from consume() to the I/O thread */
+    std::mutex m_mutex;
+    std::condition_variable m_queued;
+    std::condition_variable m_idle;
+    std::deque<EncodedFrame> m_queue;
+    bool m_writing{false};
+    bool m_stopping{false};
+    /* only touched by consume(), set after a drop until the next keyframe */
+    bool m_resyncing{false};
+
+    /* only touched by the I/O thread */
+    std::unique_ptr<std::byte, decltype(&std::free)> m_staging{nullptr, &std::free};
+    std::size_t m_staged{0};
+    int m_fd{-1};
+    std::string m_segment_path;
+    /* bytes of the open segment already on disk, always aligned */
+    std::uint64_t m_file_offset{0};
+    std::optional<std::chrono::nanoseconds> m_segment_start;
+    std::uint64_t m_next_number{0};
+    /* closed segments, oldest first */
+    std::deque<Segment> m_segments;
+    std::uint64_t m_segments_size{0};
+
+    std::atomic<std::uint64_t> m_frames_written{0};
+    std::atomic<std::uint64_t> m_frames_dropped{0};
+    std::atomic<std::uint64_t> m_segments_written{0};
+
+    std::thread m_thread;
+
+    void scan_existing_segments();
+
+    void run();
+
+    void write(const EncodedFrame &frame);
+
+    /**
+     * Writes the first length bytes of the staging buffer at the file offset, length is aligned.
+     */
+    [[nodiscard]] bool write_staging(std::size_t length);
+
+    void open_segment();
+
+    void close_segment();
+
+    /**
+     * Deletes the oldest segments until they fit into the budget along with reserved bytes.
+     */
+    void prune(std::uint64_t reserved);
+
+    [[nodiscard]] std::string segment_path(std::uint64_t number) const;
+
+public:
+    /**
+     * Starts the I/O thread, the directory has to exist.
+     */
+    explicit SegmentedRecorder(const std::string &directory, Config config = {});
+
+    SegmentedRecorder(const SegmentedRecorder &other) = delete;
+
+    SegmentedRecorder &operator=(const SegmentedRecorder &other) = delete;
+
+    void consume(EncodedFrame &&frame) override;
+
+    /**
+     * Waits until every queued frame is in the staging buffer. The open segment is only written completely when it
+     * is closed, by rotation or by the destructor.
+     */
+    void flush();
+
+    [[nodiscard]] std::uint64_t frames_written() const;
+
+    [[nodiscard]] std::uint64_t frames_dropped() const;
+
+    /**
+     * Segments closed so far, not counting the open one.
+     */
+    [[nodiscard]] std::uint64_t segments_written() const;
+
+    /**
+     * Closes the open segment after writing every queued frame.
+     */
+    ~SegmentedRecorder() override;
+};
+
+#endif //SEGMENTED_RECORDER_HPP
@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef SHARED_PACKAGE_HPP
+#define SHARED_PACKAGE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+#include "condition.hpp"
+
+/**
+ * Shared, read-only ownership of a value by several consumers, the fan-out counterpart of RequeingPackage.
+ *
+ * Copies are references to the same value and cost one atomic increment. The value is destroyed together with the
+ * last reference, on whichever thread drops it, so a T that requeues its buffer on destruction goes back to the
+ * driver only once every consumer is done. Such a T has to be safe to destroy on any thread, e.g. a VideoFrame of a
+ * V4L2VideoBuffer in ReturnMode::Deferred.
+ */
+template<class T>
+class SharedPackage {
+    struct Block {
+        T value;
+        std::atomic<std::uint32_t> references{1};
+    };
+
+    Block *m_block{nullptr};
+
+    explicit SharedPackage(Block *block) : m_block(block) {
+    }
+
+    void release() noexcept {
+        /* the decrement that drops the last reference has to see every consumer's reads of the value */
+        if (m_block != nullptr && m_block->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete m_block;
+        }
+        m_block = nullptr;
+    }
+
+public:
+    SharedPackage() = default;
+
+    template<typename... Args>
+    static SharedPackage create(Args &&... args) {
+        return SharedPackage{new Block{T{std::forward<Args>(args)...}}};
+    }
+
+    SharedPackage(const SharedPackage &other) noexcept : m_block(other.m_block) {
+        if (m_block != nullptr) {
+            m_block->references.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    SharedPackage(SharedPackage &&other) noexcept : m_block(std::exchange(other.m_block, nullptr)) {
+    }
+
+    SharedPackage &operator=(const SharedPackage &other) noexcept {
+        if (this == &other)
+            return *this;
+        SharedPackage copy{other};
+        std::swap(m_block, copy.m_block);
+        return *this;
+    }
+
+    SharedPackage &operator=(SharedPackage &&other) noexcept {
+        if (this == &other)
+            return *this;
+        release();
+        m_block = std::exchange(other.m_block, nullptr);
+        return *this;
+    }
+
+    ~SharedPackage() {
+        release();
+    }
+
+    [[nodiscard]] bool is_empty() const { return m_block == nullptr; }
+
+    /**
+     * Number of references to the value, only a snapshot while other threads hold references.
+     */
+    [[nodiscard]] std::uint32_t use_count() const {
+        return m_block != nullptr ? m_block->references.load(std::memory_order_relaxed) : 0;
+    }
+
+    const T &data() const {
+        PRECONDITION(m_block != nullptr, "Access to an empty shared package");
+        return m_block->value;
+    }
+};
+
+#endif //SHARED_PACKAGE_HPP
@@ -0,0 +1,171 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <plog/Log.h>
+
+/**
+ * Lazily started coroutine returning a T.
+ *
+ * A Task only runs once it is awaited, the awaiting coroutine is resumed by symmetric transfer as soon as the task
+ * finishes. Top level tasks are started with co_spawn().
+ */
+template<class T>
+class Task {
+public:
+    struct promise_type {
+        std::optional<T> m_value;
+        std::exception_ptr m_exception;
+        std::coroutine_handle<> m_continuation{std::noop_coroutine()};
+
+        Task get_return_object() {
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                return handle.promise().m_continuation;
+            }
+
+            void await_resume() noexcept {
+            }
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        template<class U>
+        void return_value(U &&value) {
+            m_value.emplace(std::forward<U>(value));
+        }
+
+        void unhandled_exception() {
+            m_exception = std::current_exception();
+        }
+    };
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {
+    }
+
+public:
+    Task(const Task &other) = delete;
+
+    Task(Task &&other) noexcept : m_handle(std::exchange(other.m_handle, {})) {
+    }
+
+    Task &operator=(const Task &other) = delete;
+
+    Task &operator=(Task &&other) noexcept {
+        if (this == &other)
+            return *this;
+        if (m_handle)
+            m_handle.destroy();
+        m_handle = std::exchange(other.m_handle, {});
+        return *this;
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+        m_handle.promise().m_continuation = continuation;
+        return m_handle;
+    }
+
+    T await_resume() {
+        if (m_handle.promise().m_exception) {
+            std::rethrow_exception(m_handle.promise().m_exception);
+        }
+        return std::move(*m_handle.promise().m_value);
+    }
+
+    ~Task() {
+        if (m_handle)
+            m_handle.destroy();
+    }
+};
+
+template<>
+struct Task<void>::promise_type {
+    std::exception_ptr m_exception;
+    std::coroutine_handle<> m_continuation{std::noop_coroutine()};
+
+    Task get_return_object() {
+        return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+            return handle.promise().m_continuation;
+        }
+
+        void await_resume() noexcept {
+        }
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void return_void() {
+    }
+
+    void unhandled_exception() {
+        m_exception = std::current_exception();
+    }
+};
+
+template<>
+inline void Task<void>::await_resume() {
+    if (m_handle.promise().m_exception) {
+        std::rethrow_exception(m_handle.promise().m_exception);
+    }
+}
+
+/**
+ * Fire and forget coroutine used to start top level tasks, it frees itself once the task is done.
+ */
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() {
+        }
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+/**
+ * Starts the task on the calling thread. It runs until its first suspension, afterwards it is resumed by whoever
+ * completes the awaited operation (usually an EventReactor).
+ */
+inline DetachedTask co_spawn(Task<void> task) {
+    try {
+        co_await std::move(task);
+    } catch (const std::exception &e) {
+        PLOGE << "Spawned task failed: " << e.what();
+    }
+}
+
+#endif //TASK_HPP
@@ -0,0 +1,158 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string>
+
+/**
+ * Compile time trace level:
+ *  0 compiles every trace point out,
+ *  1 traces buffer queue operations (QBUF, DQBUF, STREAMON, ...),
+ *  2 additionally traces non-blocking dequeues that found no buffer.
+ */
+#ifndef SPICAM_TRACE_LEVEL
+#define SPICAM_TRACE_LEVEL 1
+#endif
+
+enum class TraceOp : std::uint8_t {
+    Qbuf,
+    Dqbuf,
+    Reqbufs,
+    Streamon,
+    Streamoff,
+    Dqevent
+};
+
+enum class TraceResult : std::uint8_t {
+    Ok,
+    /* non-blocking call without a ready buffer */
+    Empty,
+    Error
+};
+
+/**
+ * Fixed size binary trace record, written as is into the trace file.
+ */
+struct TraceEvent {
+    /* CLOCK_MONOTONIC at the start of the operation */
+    std::uint64_t timestamp_ns;
+    /* saturates at about 4.29 s, e.g. for a blocking DQBUF on a stalled camera */
+    std::uint32_t duration_ns;
+    std::uint32_t bytesused;
+    std::uint32_t index;
+    std::uint32_t buffer_type;
+    std::int32_t fd;
+    TraceOp op;
+    TraceResult result;
+    std::uint16_t reserved;
+};
+
+static_assert(sizeof(TraceEvent) == 32, "TraceEvent is part of the trace file format");
+
+struct TraceFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t event_size;
+    std::uint32_t ring_count;
+    std::uint32_t reserved;
+};
+
+struct TraceRingHeader {
+    std::uint32_t thread_id;
+    std::uint32_t event_count;
+};
+
+constexpr char TRACE_FILE_MAGIC[8] = {'S', 'P', 'C', 'T', 'R', 'A', 'C', 'E'};
+constexpr std::uint32_t TRACE_FILE_VERSION{1};
+
+/**
+ * Appends the event to the trace ring of the calling thread. The ring is lock-free and overwrites the oldest events.
+ */
+void trace_record(const TraceEvent &event);
+
+/**
+ * Writes the rings of the running threads and of the last threads that exited into a binary trace file, see
+ * tools/tracedecode.cpp. Events recorded concurrently to the dump may be missing or torn, dump once the pipeline
+ * stopped for an exact trace.
+ */
+void trace_dump(const std::string &path);
+
+const char *trace_op_name(TraceOp op);
+
+template<bool Enabled>
+class BasicTraceScope;
+
+/**
+ * Measures the operation from construction to destruction and records it.
+ */
+template<>
+class BasicTraceScope<true> {
+    TraceEvent m_event;
+    std::chrono::steady_clock::time_point m_start;
+
+public:
+    BasicTraceScope(TraceOp op, int fd, std::uint32_t buffer_type, std::uint32_t index = 0,
+                    std::uint32_t bytesused = 0)
+        : m_event{0, 0, bytesused, index, buffer_type, fd, op, TraceResult::Ok, 0},
+          m_start(std::chrono::steady_clock::now()) {
+    }
+
+    BasicTraceScope(const BasicTraceScope &other) = delete;
+
+    BasicTraceScope &operator=(const BasicTraceScope &other) = delete;
+
+    void set_buffer(std::uint32_t index, std::uint32_t bytesused) {
+        m_event.index = index;
+        m_event.bytesused = bytesused;
+    }
+
+    void set_result(TraceResult result) {
+        m_event.result = result;
+    }
+
+    ~BasicTraceScope() {
+        if (SPICAM_TRACE_LEVEL < 2 && m_event.result == TraceResult::Empty) {
+            return;
+        }
+
+        const auto end = std::chrono::steady_clock::now();
+        m_event.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            m_start.time_since_epoch()).count();
+        const auto duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_start).count();
+        m_event.duration_ns = static_cast<std::uint32_t>(
+            std::min<std::int64_t>(duration_ns, std::numeric_limits<std::uint32_t>::max()));
+
+        trace_record(m_event);
+    }
+};
+
+/**
+ * Disabled trace point, every call compiles to nothing.
+ */
+template<>
+class BasicTraceScope<false> {
+public:
+    BasicTraceScope(TraceOp, int, std::uint32_t, std::uint32_t = 0, std::uint32_t = 0) {
+    }
+
+    BasicTraceScope(const BasicTraceScope &other) = delete;
+
+    BasicTraceScope &operator=(const BasicTraceScope &other) = delete;
+
+    void set_buffer(std::uint32_t, std::uint32_t) {
+    }
+
+    void set_result(TraceResult) {
+    }
+};
+
+using TraceScope = BasicTraceScope<(SPICAM_TRACE_LEVEL >= 1)>;
+
+#endif //TRACE_HPP
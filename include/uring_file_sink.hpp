@@ -0,0 +1,110 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef URING_FILE_SINK_HPP
+#define URING_FILE_SINK_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+
+#include "encoded_sink.hpp"
+#include "event_reactor.hpp"
+
+/**
+ * Writes the encoded bitstream to a file without blocking the capture thread.
+ *
+ * Every frame is submitted as an asynchronous write on an io_uring, the frame is kept until its completion arrives
+ * and only then dropped, which requeues the buffer to the encoder. The encoder capture mappings are registered as
+ * fixed buffers when the kernel allows it. At most queue_depth frames are in flight, it has to stay below the number
+ * of encoder capture buffers. A failed write throws DeviceFileError from the call that reaps its completion, the file
+ * has a hole where the frame should be.
+ *
+ * On kernels without io_uring the frames are collected up to queue_depth and written with a single pwritev.
+ */
+class UringFileSink : public IEncodedSink {
+    struct Ring {
+        int fd{-1};
+        void *sq_ring{nullptr};
+        std::size_t sq_ring_size{0};
+        void *cq_ring{nullptr};
+        std::size_t cq_ring_size{0};
+        void *sqes{nullptr};
+        std::size_t sqes_size{0};
+        unsigned *sq_head{nullptr};
+        unsigned *sq_tail{nullptr};
+        unsigned *sq_mask{nullptr};
+        unsigned *sq_array{nullptr};
+        unsigned *cq_head{nullptr};
+        unsigned *cq_tail{nullptr};
+        unsigned *cq_mask{nullptr};
+        void *cqes{nullptr};
+    };
+
+    struct InFlightWrite {
+        EncodedFrame frame;
+        std::uint64_t offset;
+        /* bytes of the frame already written, a short write is resubmitted for the remainder */
+        std::size_t written;
+    };
+
+    int m_fd{-1};
+    std::uint32_t m_queue_depth;
+    std::uint64_t m_offset{0};
+    std::optional<Ring> m_ring;
+    /* mapping of every registered fixed buffer, the position is the fixed buffer index */
+    std::vector<iovec> m_fixed_buffers;
+    std::vector<std::optional<InFlightWrite> > m_in_flight;
+    /* frames collected for the pwritev fallback */
+    std::vector<EncodedFrame> m_pending;
+    EventReactor *m_reactor{nullptr};
+
+    void setup_ring();
+
+    void destroy_ring() noexcept;
+
+    void submit(std::uint32_t slot);
+
+    std::size_t reap_completions();
+
+    void wait_completion();
+
+    void write_pending();
+
+    [[nodiscard]] std::optional<std::uint32_t> find_free_slot() const;
+
+    [[nodiscard]] std::optional<std::uint16_t> find_fixed_buffer(const void *map) const;
+
+public:
+    UringFileSink(const std::string &path, std::uint32_t queue_depth);
+
+    UringFileSink(const UringFileSink &other) = delete;
+
+    UringFileSink &operator=(const UringFileSink &other) = delete;
+
+    void prepare(const std::vector<const DmaBuf *> &buffers) override;
+
+    void consume(EncodedFrame &&frame) override;
+
+    /**
+     * Reaps completions whenever the ring signals POLLIN, so buffers go back to the encoder without waiting for the
+     * next frame. Without io_uring this is a no-op.
+     */
+    void attach(EventReactor &reactor);
+
+    void detach();
+
+    /**
+     * Waits until every submitted frame is written and requeued.
+     */
+    void flush();
+
+    [[nodiscard]] bool uses_io_uring() const;
+
+    ~UringFileSink() override;
+};
+
+#endif //URING_FILE_SINK_HPP
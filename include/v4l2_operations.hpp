@@ -4,14 +4,21 @@
 
 #ifndef V4L2_OPERATIONS_HPP
 #define V4L2_OPERATIONS_HPP
+#include <optional>
+#include <vector>
 #include <linux/videodev2.h>
 
 #include "buffer_info.hpp"
 #include "dmabuf.hpp"
 
+constexpr auto ENCODER_DEVICE_PATH = "/dev/video11";
+
 v4l2_format set_camera_format(int fd);
 
-v4l2_format set_encoding_format_output(int fd);
+/**
+ * @param pixelformat format of the raw frames queued to the encoder, e.g. the camera format
+ */
+v4l2_format set_encoding_format_output(int fd, std::uint32_t pixelformat);
 
 
 v4l2_format set_encoding_format_capture(int fd);
@@ -25,6 +32,9 @@ void queue_dma_buffer(int fd, const DmaBuf &dma_buf, std::uint32_t buffer_type,
 
 void queue_dma_buffer(int fd, const std::vector<DmaBuf> &dma_bufs, std::uint32_t buffer_type);
 
+/**
+ * Queries and logs the buffer flags. Issues VIDIOC_QUERYBUF, keep it off the streaming path.
+ */
 void log_buffer_status(int fd, std::uint32_t buffer_type, std::uint32_t index);
 
 void queue_dma_buffer_mplane(int fd, const DmaBuf &dma_buf, std::uint32_t buffer_tye, std::uint32_t index);
@@ -36,10 +46,35 @@ void queue_dma_buffer_mplane(int fd, const std::vector<DmaBuf> &dma_bufs, std::u
 
 BufferInfo dequeue_buffer(int fd, std::uint32_t buffer_type, std::uint32_t memory_type);
 
-std::uint32_t dequeue_buffer_mplane(int fd, std::uint32_t buffer_type, std::uint32_t memory_type);
+/**
+ * Dequeues a buffer from a device opened with O_NONBLOCK.
+ * @return the dequeued buffer or std::nullopt if the driver has no buffer ready (EAGAIN)
+ */
+std::optional<BufferInfo> try_dequeue_buffer(int fd, std::uint32_t buffer_type, std::uint32_t memory_type);
+
+/**
+ * Dequeues a single planar buffer of a multi-planar queue, bytesused is taken from the plane.
+ */
+BufferInfo dequeue_buffer_mplane(int fd, std::uint32_t buffer_type, std::uint32_t memory_type);
+
+std::optional<BufferInfo> try_dequeue_buffer_mplane(int fd, std::uint32_t buffer_type, std::uint32_t memory_type);
+
+void subscribe_event(int fd, std::uint32_t event_type);
+
+/**
+ * Dequeues a pending event, signalled by POLLPRI on the device.
+ * @return the event or std::nullopt if no event is pending
+ */
+std::optional<v4l2_event> try_dequeue_event(int fd);
 
 void log_enum_fmt(int fd, std::uint32_t buffer_type);
 
+/**
+ * @return the pixel formats the queue supports in the driver's order of preference, empty if the driver cannot
+ *         enumerate them
+ */
+std::vector<std::uint32_t> enum_formats(int fd, std::uint32_t buffer_type);
+
 void stream_on(int fd, std::uint32_t buffer_type);
 
 void stream_on_capture(int fd);
@@ -50,6 +85,8 @@ void stream_on_output_mplane(int fd);
 
 void stream_on_capture_mplane(int fd);
 
+void stream_off(int fd, std::uint32_t buffer_type);
+
 void stream_off_capture(int fd);
 
 void stream_off_output(int fd);
@@ -4,11 +4,40 @@
 
 #ifndef V4L2_STREAMER_HPP
 #define V4L2_STREAMER_HPP
+#include <array>
+#include <deque>
+#include <memory>
+#include <optional>
 #include <string>
 
+#include "buffer_info.hpp"
+#include "camera_frame_observer.hpp"
 #include "device_file_handle.hpp"
 #include "dmabuf.hpp"
+#include "dmabuf_pool.hpp"
+#include "encoded_sink.hpp"
+#include "event_reactor.hpp"
+#include "format_converter.hpp"
+#include "latency_tracker.hpp"
+#include "queue_monitor.hpp"
+#include "return_queue.hpp"
+#include "v4l2_video_buffer.hpp"
 
+/**
+ * The buffer queues of a streamer, each one is watched by a QueueMonitor.
+ */
+enum class StreamQueue : std::uint8_t {
+    /* raw frames from the camera, late means a frame waited more than a frame interval for the streamer */
+    CameraCapture,
+    /* raw frames the encoder has read, late means the encoder took longer than the pipeline depth allows */
+    EncoderOutput,
+    /* encoded frames, late as for EncoderOutput */
+    EncoderCapture
+};
+
+constexpr std::size_t STREAM_QUEUE_COUNT{3};
+
+const char *stream_queue_name(StreamQueue queue);
 
 class V4L2Streamer {
 public:
@@ -18,22 +47,173 @@ public:
         Done
     };
 
+    enum class IoMode {
+        /* every DQBUF sleeps in the driver, frames are pulled with next_frame() */
+        Blocking,
+        /* devices are opened with O_NONBLOCK and driven by an EventReactor, see attach() */
+        NonBlocking
+    };
+
 private:
     Status status{Status::Initialized};
     std::size_t m_width;
     std::size_t m_height;
+    std::size_t m_pipeline_depth;
+    IoMode m_io_mode;
+    std::shared_ptr<DmaBufPool> m_pool;
     DeviceFileHandle m_camera;
-    DeviceFileHandle m_encoder;
+    std::shared_ptr<DeviceFileHandle> m_encoder;
     std::vector<DmaBuf> m_camera_capture_buffers;
-    std::vector<DmaBuf> m_encoder_capture_buffers;
+    v4l2_pix_format m_camera_format{};
+    std::vector<std::shared_ptr<ICameraFrameObserver> > m_camera_observers;
+    std::shared_ptr<ICameraFrameSink> m_camera_sink;
+    /* one hold per camera buffer, parked here while the camera sink does not have it */
+    std::vector<std::optional<CameraFrameHold> > m_camera_holds;
+    std::shared_ptr<ReturnQueue<CameraFrameHold> > m_camera_returns;
+    /* camera buffers the encoder still reads, indexed by the camera buffer index */
+    std::vector<bool> m_camera_encoding;
+    /* only set when the encoder does not take the camera format, converts into m_encoder_input_buffers */
+    std::unique_ptr<FormatConverter> m_converter;
+    /* converted frames, indexed by the encoder output buffer index */
+    std::vector<DmaBuf> m_encoder_input_buffers;
+    std::shared_ptr<V4L2VideoBuffer> m_encoder_capture_buffers;
+    std::shared_ptr<IEncodedSink> m_sink;
+    /* camera frame currently held by each encoder output buffer, indexed by the output buffer index */
+    std::vector<std::optional<BufferInfo> > m_encoder_output_slots;
+    std::size_t m_frames_in_flight{0};
+    std::size_t m_frames_encoded{0};
+    /* camera frames dequeued while every encoder output buffer was busy */
+    std::deque<BufferInfo> m_pending_camera_frames;
+    EventReactor *m_reactor{nullptr};
+    std::shared_ptr<LatencyTracker> m_latency{std::make_shared<LatencyTracker>()};
+    std::array<QueueMonitor, STREAM_QUEUE_COUNT> m_queue_monitors;
+
+    void record_dequeue(StreamQueue queue, const BufferInfo &info);
+
+    [[nodiscard]] std::optional<std::uint32_t> find_free_output_slot() const;
+
+    void hand_off_to_encoder(const BufferInfo &image_buffer_info);
+
+    void release_output_slot(std::uint32_t output_index);
+
+    /**
+     * Requeues the camera buffer once neither the encoder nor the camera sink uses it.
+     */
+    void requeue_camera_buffer(std::uint32_t camera_index);
+
+    void take_back_camera_holds();
+
+    [[nodiscard]] bool camera_buffer_queued() const;
+
+    /**
+     * Sleeps until the camera sink or another thread drops a hold, then takes the dropped holds back.
+     */
+    void wait_for_camera_holds();
+
+    void on_camera_returns();
+
+    void deliver_encoded_frame(VideoFrame &&encoded_frame);
+
+    void hand_off_pending_frames();
+
+    void feed_encoder();
+
+    void reclaim_encoder_output();
+
+    void drain_encoder();
+
+    /**
+     * Arms the device again if the reactor disarmed it after an error, called whenever a buffer was queued to it.
+     */
+    void rearm(DeviceFileHandle &device, std::uint32_t events);
+
+    void on_camera_ready(std::uint32_t events);
+
+    void on_encoder_ready(std::uint32_t events);
 
 public:
-    V4L2Streamer(const std::string &camera_device_path, std::size_t width, std::size_t height);
+    /**
+     * @param pipeline_depth number of camera frames kept inside the encoder at once. A depth of 1 reproduces the
+     *                       fully serialized behaviour, larger depths let the encoder work on the next frames while
+     *                       the previous ones are drained.
+     * @param io_mode        whether the devices are driven by blocking calls or by an EventReactor
+     * @param pool           pool the camera and encoder buffers are taken from and returned to when the streamer is
+     *                       destroyed, without a pool they are freshly allocated
+     *
+     * The encoder is fed the camera frames directly if it accepts the camera format. Otherwise the first format it
+     * enumerates that a FormatConverter can produce is negotiated and every frame is converted into a buffer of
+     * its own before it is queued.
+     */
+    V4L2Streamer(const std::string &camera_device_path, std::size_t width, std::size_t height,
+                 std::size_t pipeline_depth = 1, IoMode io_mode = IoMode::Blocking,
+                 std::shared_ptr<DmaBufPool> pool = nullptr);
 
     void start_streaming();
 
+    /**
+     * Hands the next camera frame to the encoder and, once the pipeline is primed, drains the oldest frame in flight.
+     * The first pipeline_depth - 1 calls only fill the pipeline.
+     */
     void next_frame();
 
+    /**
+     * Drains every frame still in flight in the encoder.
+     */
+    void flush();
+
+    /**
+     * Registers the camera and encoder file descriptors with the reactor. Camera frames are handed to the encoder
+     * as soon as the camera signals POLLIN and an encoder output buffer is free (POLLOUT), encoded buffers are
+     * drained on POLLIN of the encoder. Several streamers can share one reactor.
+     */
+    void attach(EventReactor &reactor);
+
+    void detach();
+
+    /**
+     * Every encoded buffer is handed to the sink, it is requeued to the encoder once the sink drops it. Set the sink
+     * before start_streaming() so it is prepared with all encoder buffers.
+     */
+    void set_sink(std::shared_ptr<IEncodedSink> sink);
+
+    /**
+     * Every camera frame is shown to the observer once it was queued to the encoder, see ICameraFrameObserver. The
+     * observer is prepared with the camera format right away.
+     */
+    void add_camera_observer(std::shared_ptr<ICameraFrameObserver> observer);
+
+    /**
+     * Every camera frame is handed to the sink after the observers, the camera buffer goes back to the driver only
+     * once the encoder is done and the sink dropped the hold. The sink is prepared with the camera format and
+     * buffers right away.
+     */
+    void set_camera_sink(std::shared_ptr<ICameraFrameSink> sink);
+
+    /**
+     * @return the pixel format queued to the encoder, differs from the camera format if frames are converted
+     */
+    [[nodiscard]] std::uint32_t encoder_input_format() const;
+
+    [[nodiscard]] std::size_t frames_in_flight() const;
+
+    [[nodiscard]] std::size_t frames_encoded() const;
+
+    /**
+     * Latency of one pipeline stage over every frame since construction or the last reset_latency(). The histogram
+     * can be read from any thread while streaming.
+     */
+    [[nodiscard]] const LatencyHistogram &latency(LatencyStage stage) const;
+
+    void reset_latency();
+
+    /**
+     * Dropped, error flagged and late buffers of one queue since construction or the last reset_queue_statistics(),
+     * readable from any thread while streaming.
+     */
+    [[nodiscard]] QueueStatistics queue_statistics(StreamQueue queue) const;
+
+    void reset_queue_statistics();
+
     ~V4L2Streamer();
 };
 
@@ -7,31 +7,118 @@
 
 #include <cstdint>
 #include <memory>
+#include <optional>
 
 #include "device_file_handle.hpp"
 #include "dmabuf.hpp"
+#include "dmabuf_pool.hpp"
 #include "indexed_queue.hpp"
 #include "requeing_package.hpp"
+#include "return_queue.hpp"
+#include "video_frame.hpp"
 
-class V4L2VideoBuffer : public IIndexedQueue<RequeingPackage<DmaBuf> > {
+/**
+ * Slot table of the driver buffers, addressed by the V4L2 buffer index. Every slot is free (owned by the table but
+ * not queued), queued to the driver or owned by the user of a dequeued package. The states are kept in two bitmaps,
+ * a package carries its index and goes straight back to its slot.
+ *
+ * With ReturnMode::Immediate a dropped package is queued to the driver right away, so it has to be dropped on the
+ * thread that dequeues. With ReturnMode::Deferred packages may be dropped on any thread: they are pushed to a
+ * lock-free ReturnQueue and the dequeuing thread queues them to the driver in one batch, see requeue_returned().
+ */
+class V4L2VideoBuffer : public IIndexedQueue<RequeingPackage<DmaBuf> >,
+                        public std::enable_shared_from_this<V4L2VideoBuffer> {
+public:
+    enum class SlotState {
+        Free,
+        Queued,
+        User
+    };
+
+    enum class ReturnMode {
+        /* dropped packages are queued to the driver by the dropping thread */
+        Immediate,
+        /* dropped packages wait in the return queue until the dequeuing thread requeues them */
+        Deferred
+    };
+
+    /* VIDEO_MAX_FRAME of the V4L2 API */
+    static constexpr std::uint32_t MAX_BUFFERS{32};
+
+private:
     std::weak_ptr<DeviceFileHandle> m_device;
     std::uint32_t m_buffer_type;
     std::uint32_t m_memory_type;
     std::uint32_t m_buffer_size;
     std::uint32_t m_buffer_sizes;
+    std::shared_ptr<DmaBufPool> m_pool;
     std::vector<RequeingPackage<DmaBuf> > m_buffers;
+    /* bit i set: buffer i is queued to the driver */
+    std::uint32_t m_queued{0};
+    /* bit i set: buffer i is handed out to the user */
+    std::uint32_t m_user{0};
+    /* declared after the buffers so it expires first, packages still held by the user are then dropped */
+    std::shared_ptr<ReturnQueue<RequeingPackage<DmaBuf> > > m_returns;
+
+    void set_slot_state(std::uint32_t index, SlotState state);
+
+    VideoFrame take_frame(const BufferInfo &info);
 
     void fill_buffer();
 
     void request_buffer() const;
 
-public:
+    void queue_buffer(int fd, std::uint32_t index);
+
+    void take_back(RequeingPackage<DmaBuf> &&package);
+
     V4L2VideoBuffer(std::weak_ptr<DeviceFileHandle> device, std::uint32_t buffer_type, std::uint32_t memory_type,
-                    std::uint32_t buffer_sizes);
+                    std::uint32_t buffer_sizes, std::shared_ptr<DmaBufPool> pool, ReturnMode return_mode);
+
+public:
+    /**
+     * Requests the driver buffers and, for capture queues, allocates and queues the dma buffers. Packages handed out
+     * by dequeue() requeue themselves to the driver once they are dropped.
+     * @param pool the dma buffers are taken from the pool if given and return to it with the video buffer, otherwise
+     *             they are freshly allocated
+     * @param return_mode whether dropped packages are requeued by the dropping thread or by the dequeuing thread
+     */
+    static std::shared_ptr<V4L2VideoBuffer> create(std::weak_ptr<DeviceFileHandle> device, std::uint32_t buffer_type,
+                                                   std::uint32_t memory_type, std::uint32_t buffer_sizes,
+                                                   std::shared_ptr<DmaBufPool> pool = nullptr,
+                                                   ReturnMode return_mode = ReturnMode::Immediate);
 
     RequeingPackage<DmaBuf> dequeue() override;
 
-    void enqueue(RequeingPackage<DmaBuf> package);
+    /**
+     * Requeues the returned packages first. In ReturnMode::Deferred it waits for a package to be returned if the
+     * user holds every buffer, so the driver is never asked to dequeue from an empty queue.
+     */
+    VideoFrame dequeue_frame();
+
+    /**
+     * Dequeues a frame from a device opened with O_NONBLOCK.
+     * @return the frame or std::nullopt if the driver has no buffer ready
+     */
+    std::optional<VideoFrame> try_dequeue_frame();
+
+    void enqueue(RequeingPackage<DmaBuf> &&package) override;
+
+    /**
+     * Queues every package returned since the last call to the driver, dequeue_frame() and try_dequeue_frame() call
+     * it on their own. Only the dequeuing thread may call it, a no-op in ReturnMode::Immediate.
+     * @return the number of requeued buffers
+     */
+    std::size_t requeue_returned();
+
+    /**
+     * The buffers currently owned by the queue, i.e. not handed out by dequeue().
+     */
+    [[nodiscard]] std::vector<const DmaBuf *> buffers() const;
+
+    [[nodiscard]] SlotState slot_state(std::uint32_t index) const;
+
+    [[nodiscard]] std::uint32_t queued_buffers() const;
 };
 
 #endif //V4L2_BUFFER_HPP
@@ -0,0 +1,21 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef VIDEO_FRAME_HPP
+#define VIDEO_FRAME_HPP
+
+#include "buffer_info.hpp"
+#include "dmabuf.hpp"
+#include "requeing_package.hpp"
+
+/**
+ * A dequeued buffer together with the metadata the driver reported for it. Dropping the frame requeues the buffer
+ * to the queue it was dequeued from.
+ */
+struct VideoFrame {
+    RequeingPackage<DmaBuf> buffer;
+    BufferInfo info;
+};
+
+#endif //VIDEO_FRAME_HPP
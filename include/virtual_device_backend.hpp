@@ -0,0 +1,47 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef VIRTUAL_DEVICE_BACKEND_HPP
+#define VIRTUAL_DEVICE_BACKEND_HPP
+
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "device_backend.hpp"
+
+/**
+ * Runs the pipeline on the kernel's virtual drivers: vivid as the camera and vicodec as the m2m encoder, buffers come
+ * from the system dma heap. Load the drivers with `modprobe vivid` and `modprobe vicodec multiplanar=1`.
+ *
+ * Opening the encoder path opens the vicodec encoder, every other video device path opens the vivid capture node
+ * and every dma heap path the system heap. vicodec only encodes FWHT, so the H.264 capture format is requested as
+ * FWHT and a missing frame interval control is ignored. Everything else goes unchanged to the kernel.
+ */
+class VirtualDeviceBackend : public IDeviceBackend {
+    std::string m_camera_path;
+    std::string m_encoder_path;
+    std::mutex m_mutex;
+    std::set<int> m_encoder_fds;
+
+    void discover_devices();
+
+public:
+    /**
+     * Finds the vivid and vicodec nodes with VIDIOC_QUERYCAP, throws DeviceFileError if one of them is missing.
+     */
+    VirtualDeviceBackend();
+
+    int open(const std::string &path, int flags) override;
+
+    int close(int fd) override;
+
+    int ioctl(int fd, unsigned long request, void *arg) override;
+
+    [[nodiscard]] const std::string &camera_path() const;
+
+    [[nodiscard]] const std::string &encoder_path() const;
+};
+
+#endif //VIRTUAL_DEVICE_BACKEND_HPP
@@ -0,0 +1,195 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "async_v4l2.hpp"
+
+#include <algorithm>
+#include <sys/epoll.h>
+
+#include "condition.hpp"
+#include "exceptions.hpp"
+#include "v4l2_operations.hpp"
+
+AsyncDevice::AsyncDevice(EventReactor &reactor, std::shared_ptr<DeviceFileHandle> device)
+    : m_device(std::move(device)), m_reactor(reactor) {
+    m_device->do_file_operation([this](int fd) {
+        m_reactor.add(fd, EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLET, [this](std::uint32_t events) {
+            on_ready(events);
+        });
+    });
+}
+
+void AsyncDevice::resume_waiters(Waiters &waiters) {
+    if (waiters.empty()) {
+        return;
+    }
+
+    /* a resumed waiter may destroy others or suspend again, only those still waiting from before are resumed */
+    const auto last = waiters.rbegin()->first;
+
+    while (!waiters.empty() && waiters.begin()->first <= last) {
+        const auto waiter = waiters.begin()->second;
+        waiters.erase(waiters.begin());
+        waiter.resume();
+    }
+}
+
+void AsyncDevice::on_ready(std::uint32_t events) {
+    if (events & (EPOLLIN | EPOLLPRI | EPOLLERR)) {
+        resume_waiters(m_readable_waiters);
+    }
+
+    if (events & (EPOLLOUT | EPOLLERR)) {
+        resume_waiters(m_writable_waiters);
+    }
+}
+
+void AsyncDevice::wake(std::uint32_t events) {
+    m_reactor.post([this, events] { on_ready(events); });
+}
+
+AsyncDevice::~AsyncDevice() {
+    PRECONDITION(m_readable_waiters.empty() && m_writable_waiters.empty(), "Tasks still wait for the device");
+
+    m_device->do_file_operation([this](int fd) {
+        m_reactor.remove(fd);
+    });
+}
+
+AsyncCamera::AsyncCamera(EventReactor &reactor, const std::string &camera_device_path)
+    : m_device(std::make_shared<DeviceFileHandle>(camera_device_path, O_RDWR | O_NONBLOCK)),
+      m_async_device(reactor, m_device) {
+    auto cam_fmt = m_device->do_file_operation(set_camera_format);
+
+    m_buffers = V4L2VideoBuffer::create(m_device, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_DMABUF,
+                                        cam_fmt.fmt.pix.sizeimage);
+
+    m_device->do_file_operation(stream_on_capture);
+
+    PLOGD << "Async camera capture stream turned on";
+}
+
+Task<VideoFrame> AsyncCamera::next() {
+    while (true) {
+        if (auto frame = m_buffers->try_dequeue_frame()) {
+            co_return std::move(*frame);
+        }
+
+        co_await m_async_device.readable();
+    }
+}
+
+AsyncCamera::~AsyncCamera() {
+    m_device->do_file_operation(stream_off_capture);
+}
+
+AsyncEncoder::AsyncEncoder(EventReactor &reactor, std::size_t pipeline_depth)
+    : m_device(std::make_shared<DeviceFileHandle>(ENCODER_DEVICE_PATH, O_RDWR | O_NONBLOCK)),
+      m_async_device(reactor, m_device),
+      m_output_slots(pipeline_depth) {
+    PRECONDITION(pipeline_depth >= 1, "Pipeline depth must be at least 1");
+
+    auto enc_fmt_capture = m_device->do_file_operation(set_encoding_format_capture);
+    m_device->do_file_operation([](int fd) {
+        return set_encoding_format_output(fd, V4L2_PIX_FMT_YUYV);
+    });
+    m_device->do_file_operation(set_encoding_frame_interval);
+
+    m_device->do_file_operation([pipeline_depth](int fd) {
+        request_buffers(fd, pipeline_depth, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_DMABUF);
+    });
+
+    m_capture_buffers = V4L2VideoBuffer::create(m_device, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_DMABUF,
+                                                enc_fmt_capture.fmt.pix.sizeimage);
+
+    m_device->do_file_operation(stream_on_output_mplane);
+    m_device->do_file_operation(stream_on_capture_mplane);
+
+    PLOGD << "Async encoder streams turned on";
+}
+
+std::optional<std::uint32_t> AsyncEncoder::find_free_output_slot() const {
+    auto free_slot = std::ranges::find_if(m_output_slots, [](const auto &slot) {
+        return !slot.has_value();
+    });
+
+    if (free_slot == m_output_slots.end()) {
+        return std::nullopt;
+    }
+
+    return static_cast<std::uint32_t>(std::distance(m_output_slots.begin(), free_slot));
+}
+
+bool AsyncEncoder::reclaim_output_buffers() {
+    bool reclaimed = false;
+
+    while (auto output_info = m_device->do_file_operation([](int fd) {
+        return try_dequeue_buffer_mplane(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_DMABUF);
+    })) {
+        /* dropping the camera frame requeues it to the camera */
+        m_output_slots.at(output_info->index).reset();
+        reclaimed = true;
+    }
+
+    /* the POLLOUT edge is consumed here, encode calls waiting for a free slot would never see it */
+    if (reclaimed) {
+        m_async_device.wake(EPOLLOUT);
+    }
+
+    return reclaimed;
+}
+
+void AsyncEncoder::collect_encoded_frames() {
+    reclaim_output_buffers();
+
+    bool collected = false;
+
+    while (auto encoded = m_capture_buffers->try_dequeue_frame()) {
+        m_encoded.emplace(m_next_encoded_ticket++, std::move(*encoded));
+        collected = true;
+    }
+
+    /* the readiness edge is consumed here, other encode calls may be waiting for these frames */
+    if (collected) {
+        m_async_device.wake(EPOLLIN);
+    }
+}
+
+Task<VideoFrame> AsyncEncoder::encode(VideoFrame frame) {
+    reclaim_output_buffers();
+
+    auto output_index = find_free_output_slot();
+
+    while (!output_index) {
+        co_await m_async_device.writable();
+        reclaim_output_buffers();
+        output_index = find_free_output_slot();
+    }
+
+    m_device->do_file_operation([&frame, output_index](int fd) {
+        queue_dma_buffer_mplane(fd, frame.buffer.data(), V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, frame.info,
+                                *output_index);
+    });
+
+    m_output_slots[*output_index] = std::move(frame);
+
+    const auto ticket = m_next_ticket++;
+
+    while (true) {
+        collect_encoded_frames();
+
+        if (auto encoded = m_encoded.find(ticket); encoded != m_encoded.end()) {
+            auto result = std::move(encoded->second);
+            m_encoded.erase(encoded);
+            co_return std::move(result);
+        }
+
+        co_await m_async_device.readable();
+    }
+}
+
+AsyncEncoder::~AsyncEncoder() {
+    m_device->do_file_operation(stream_off_capture_mplane);
+    m_device->do_file_operation(stream_off_output_mplane);
+}
@@ -0,0 +1,38 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "device_backend.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+static std::shared_ptr<IDeviceBackend> &installed_backend() {
+    static std::shared_ptr<IDeviceBackend> backend = std::make_shared<KernelDeviceBackend>();
+    return backend;
+}
+
+int KernelDeviceBackend::open(const std::string &path, int flags) {
+    return ::open(path.c_str(), flags, 0);
+}
+
+int KernelDeviceBackend::close(int fd) {
+    return ::close(fd);
+}
+
+int KernelDeviceBackend::ioctl(int fd, unsigned long request, void *arg) {
+    return ::ioctl(fd, request, arg);
+}
+
+IDeviceBackend &device_backend() {
+    return *installed_backend();
+}
+
+std::shared_ptr<IDeviceBackend> shared_device_backend() {
+    return installed_backend();
+}
+
+void set_device_backend(std::shared_ptr<IDeviceBackend> backend) {
+    installed_backend() = backend ? std::move(backend) : std::make_shared<KernelDeviceBackend>();
+}
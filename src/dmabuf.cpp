@@ -25,8 +25,13 @@ SOFTWARE.
 #include "dmabuf.hpp"
 
 #include "dmabuf_operations.hpp"
+#include <cerrno>
+#include <cstring>
+#include <linux/dma-buf.h>
 #include <sys/mman.h>
+#include "condition.hpp"
 #include "device_file_handle.hpp"
+#include "dmabuf_pool.hpp"
 #include "exceptions.hpp"
 
 DmaBuf::DmaBuf(int heap_fd, size_t size, const std::string &name) {
@@ -37,12 +42,6 @@ DmaBuf::DmaBuf(int heap_fd, size_t size, const std::string &name) {
         throw DeviceFileError{"Failed to alloc dmabuf"};
     }
 
-    m_map = mmap(0, size, PROT_WRITE | PROT_READ,
-                 MAP_SHARED, m_fd, 0);
-
-    if (m_map == MAP_FAILED) {
-        throw DeviceFileError{"Failed to map dmabuf"};
-    }
     m_size = size;
 }
 
@@ -51,15 +50,95 @@ int DmaBuf::get_fd() const {
 }
 
 void *DmaBuf::get_map() const {
+    if (m_map == nullptr) {
+        auto map = mmap(0, m_size, PROT_WRITE | PROT_READ,
+                        MAP_SHARED, m_fd, 0);
+
+        if (map == MAP_FAILED) {
+            PLOGE << "Failed to map dmabuf " << m_fd << ": " << std::strerror(errno);
+            throw DeviceFileError{"Failed to map dmabuf"};
+        }
+
+        m_map = map;
+    }
+
     return m_map;
 }
 
+bool DmaBuf::is_mapped() const {
+    return m_map != nullptr;
+}
+
 std::size_t DmaBuf::get_size() const {
     return m_size;
 }
 
+void DmaBuf::release() noexcept {
+    if (m_fd == -1) {
+        return;
+    }
+
+    if (const auto pool = m_pool.lock()) {
+        pool->recycle(std::move(*this));
+        return;
+    }
+
+    if (m_map != nullptr) {
+        munmap(m_map, m_size);
+        m_map = nullptr;
+    }
+    if (m_fd != -1) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
 DmaBuf::~DmaBuf() {
-    munmap(m_map, m_size);
+    release();
+}
+
+static std::uint64_t sync_direction(DmaBufAccess::Mode mode) {
+    switch (mode) {
+        case DmaBufAccess::Mode::Read:
+            return DMA_BUF_SYNC_READ;
+        case DmaBufAccess::Mode::Write:
+            return DMA_BUF_SYNC_WRITE;
+        case DmaBufAccess::Mode::ReadWrite:
+        default:
+            return DMA_BUF_SYNC_RW;
+    }
+}
+
+DmaBufAccess::DmaBufAccess(const DmaBuf &buffer, Mode mode)
+    : m_fd(buffer.get_fd()),
+      m_map(static_cast<std::byte *>(buffer.get_map())),
+      m_size(buffer.get_size()),
+      m_mode(mode) {
+    if (dmabuf_sync_start(m_fd, sync_direction(m_mode)) == -1) {
+        PLOGE << "Failed to start cpu access on dmabuf " << m_fd << ": " << std::strerror(errno);
+        throw DeviceFileError{"Failed to start cpu access on dmabuf"};
+    }
+}
+
+std::span<std::byte> DmaBufAccess::writable_data() const {
+    PRECONDITION(m_mode != Mode::Read, "Buffer is only accessed for reading");
+    return {m_map, m_size};
+}
+
+void DmaBufAccess::end_access() noexcept {
+    if (m_fd == -1) {
+        return;
+    }
+
+    if (dmabuf_sync_stop(m_fd, sync_direction(m_mode)) == -1) {
+        PLOGE << "Failed to end cpu access on dmabuf " << m_fd << ": " << std::strerror(errno);
+    }
+
+    m_fd = -1;
+}
+
+DmaBufAccess::~DmaBufAccess() {
+    end_access();
 }
 
 
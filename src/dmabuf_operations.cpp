@@ -35,7 +35,8 @@
 #include <sys/mman.h>
 #include <linux/dma-heap.h>
 #include <fcntl.h>
-#include <sys/ioctl.h>
+
+#include "device_backend.hpp"
 
 std::uint32_t dmabuf_heap_alloc(int heap_fd, const char *name, size_t size) {
     dma_heap_allocation_data alloc = {0};
@@ -43,32 +44,32 @@ std::uint32_t dmabuf_heap_alloc(int heap_fd, const char *name, size_t size) {
     alloc.len = size;
     alloc.fd_flags = O_CLOEXEC | O_RDWR;
 
-    if (ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &alloc) < 0)
+    if (device_backend().ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &alloc) < 0)
         return -1;
 
     if (name)
-        ioctl(alloc.fd, DMA_BUF_SET_NAME, name);
+        device_backend().ioctl(alloc.fd, DMA_BUF_SET_NAME, const_cast<char *>(name));
 
     return alloc.fd;
 }
 
-static int dmabuf_sync(int buf_fd, bool start) {
+static int dmabuf_sync(int buf_fd, bool start, std::uint64_t direction) {
     dma_buf_sync sync = {0};
 
-    sync.flags = (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END) | DMA_BUF_SYNC_RW;
+    sync.flags = (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END) | direction;
 
     do {
-        if (ioctl(buf_fd, DMA_BUF_IOCTL_SYNC, &sync) == 0)
+        if (device_backend().ioctl(buf_fd, DMA_BUF_IOCTL_SYNC, &sync) == 0)
             return 0;
     } while ((errno == EINTR) || (errno == EAGAIN));
 
     return -1;
 }
 
-int dmabuf_sync_start(int buf_fd) {
-    return dmabuf_sync(buf_fd, true);
+int dmabuf_sync_start(int buf_fd, std::uint64_t direction) {
+    return dmabuf_sync(buf_fd, true, direction);
 }
 
-int dmabuf_sync_stop(int buf_fd) {
-    return dmabuf_sync(buf_fd, false);
+int dmabuf_sync_stop(int buf_fd, std::uint64_t direction) {
+    return dmabuf_sync(buf_fd, false, direction);
 }
@@ -0,0 +1,135 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "dmabuf_pool.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <string>
+#include <unistd.h>
+
+DmaBufPool::DmaBufPool(Heap heap) : m_heap(heap_path(heap)) {
+    PLOGD << "Opened dma heap " << heap_path(heap);
+}
+
+std::shared_ptr<DmaBufPool> DmaBufPool::create(Heap heap) {
+    return std::shared_ptr<DmaBufPool>{new DmaBufPool{heap}};
+}
+
+const char *DmaBufPool::heap_path(Heap heap) {
+    switch (heap) {
+        case Heap::System:
+            return "/dev/dma_heap/system";
+        case Heap::Cma:
+        default:
+            return "/dev/dma_heap/linux,cma";
+    }
+}
+
+std::size_t DmaBufPool::size_class(std::size_t size) {
+    static const auto PAGE_SIZE = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    constexpr std::size_t SMALL_LIMIT{64 * 1024};
+
+    const auto pages = (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+
+    if (pages <= SMALL_LIMIT) {
+        return std::max(pages, PAGE_SIZE);
+    }
+
+    /* four classes per power of two: 2^k * {1, 1.25, 1.5, 1.75} */
+    const auto step = std::bit_floor(pages) / 4;
+
+    return (pages + step - 1) / step * step;
+}
+
+DmaBuf DmaBufPool::allocate(std::size_t size_class) {
+    PLOG_DEBUG << "Allocating pooled dma buffer with size: " << size_class;
+
+    auto buffer = m_heap.do_file_operation([this, size_class](int fd) {
+        return DmaBuf{fd, size_class, "spycampool_" + std::to_string(m_allocated)};
+    });
+
+    buffer.m_pool = weak_from_this();
+    m_allocated++;
+
+    return buffer;
+}
+
+void DmaBufPool::recycle(DmaBuf &&buffer) noexcept {
+    std::lock_guard lock{m_mutex};
+
+    const auto size = buffer.get_size();
+    m_free[size].push_back(std::move(buffer));
+}
+
+DmaBuf DmaBufPool::acquire(std::size_t size) {
+    const auto buffer_class = size_class(size);
+
+    std::lock_guard lock{m_mutex};
+
+    if (auto free = m_free.find(buffer_class); free != m_free.end() && !free->second.empty()) {
+        auto buffer = std::move(free->second.back());
+        free->second.pop_back();
+        return buffer;
+    }
+
+    return allocate(buffer_class);
+}
+
+std::vector<DmaBuf> DmaBufPool::acquire(std::uint32_t num_bufs, std::size_t size) {
+    std::vector<DmaBuf> buffers;
+    buffers.reserve(num_bufs);
+
+    for (std::uint32_t i = 0; i < num_bufs; i++) {
+        buffers.push_back(acquire(size));
+    }
+
+    return buffers;
+}
+
+void DmaBufPool::reserve(std::uint32_t num_bufs, std::size_t size) {
+    const auto buffer_class = size_class(size);
+
+    std::vector<DmaBuf> allocated;
+
+    {
+        std::lock_guard lock{m_mutex};
+
+        const auto available = m_free[buffer_class].size();
+
+        for (auto i = available; i < num_bufs; i++) {
+            allocated.push_back(allocate(buffer_class));
+        }
+    }
+
+    /* destroying them outside the lock returns them to the free list */
+    allocated.clear();
+}
+
+void DmaBufPool::trim() {
+    std::map<std::size_t, std::vector<DmaBuf> > free;
+
+    {
+        std::lock_guard lock{m_mutex};
+        free.swap(m_free);
+    }
+
+    /* detached from the pool, so destroying them really frees them */
+    for (auto &[size, buffers]: free) {
+        for (auto &buffer: buffers) {
+            buffer.m_pool.reset();
+        }
+    }
+}
+
+std::size_t DmaBufPool::free_buffers() const {
+    std::lock_guard lock{m_mutex};
+
+    std::size_t count = 0;
+    for (const auto &[size, buffers]: m_free) {
+        count += buffers.size();
+    }
+
+    return count;
+}
@@ -0,0 +1,160 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "event_reactor.hpp"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <plog/Log.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "exceptions.hpp"
+
+EventReactor::EventReactor() : m_epoll_fd(epoll_create1(EPOLL_CLOEXEC)) {
+    if (m_epoll_fd == -1) {
+        PLOGE << "Failed to create epoll instance: " << std::strerror(errno);
+        throw EventReactorError{"Failed to create epoll instance"};
+    }
+}
+
+void EventReactor::control(int operation, int fd, const Registration &registration) {
+    epoll_event event = {};
+    event.events = registration.events;
+    event.data.u64 = registration.token;
+
+    if (epoll_ctl(m_epoll_fd, operation, fd, &event) == -1) {
+        PLOGE << "Failed to update fd " << fd << " in epoll set: " << std::strerror(errno);
+        throw EventReactorError{"Failed to update file descriptor in epoll set"};
+    }
+}
+
+void EventReactor::add(int fd, std::uint32_t events, Handler handler) {
+    const Registration registration{m_next_token++, events, true, std::make_shared<Handler>(std::move(handler))};
+
+    control(EPOLL_CTL_ADD, fd, registration);
+
+    /* closing an fd removes it from the epoll set, the number may come back without a remove() */
+    if (const auto stale = m_registrations.find(fd); stale != m_registrations.end()) {
+        m_tokens.erase(stale->second.token);
+    }
+
+    m_tokens.emplace(registration.token, fd);
+    m_registrations.insert_or_assign(fd, registration);
+}
+
+void EventReactor::modify(int fd, std::uint32_t events) {
+    auto &registration = m_registrations.at(fd);
+
+    /* a fresh token, events collected before the change are stale */
+    m_tokens.erase(registration.token);
+    registration.token = m_next_token++;
+    registration.events = events;
+    m_tokens.emplace(registration.token, fd);
+
+    control(registration.armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, registration);
+    registration.armed = true;
+}
+
+bool EventReactor::armed(int fd) const {
+    const auto entry = m_registrations.find(fd);
+    return entry != m_registrations.end() && entry->second.armed;
+}
+
+void EventReactor::disarm(int fd, Registration &registration) {
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+        PLOGW << "Failed to disarm fd " << fd << ": " << std::strerror(errno);
+    }
+
+    m_tokens.erase(registration.token);
+    registration.armed = false;
+}
+
+void EventReactor::remove(int fd) {
+    const auto entry = m_registrations.find(fd);
+
+    if (entry == m_registrations.end()) {
+        return;
+    }
+
+    if (entry->second.armed && epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+        PLOGW << "Failed to remove fd " << fd << " from epoll set: " << std::strerror(errno);
+    }
+
+    m_tokens.erase(entry->second.token);
+    m_registrations.erase(entry);
+}
+
+void EventReactor::post(std::function<void()> callback) {
+    m_posted.push_back(std::move(callback));
+}
+
+std::size_t EventReactor::run_once(int timeout_ms) {
+    constexpr std::size_t MAX_EVENTS{16};
+    std::array<epoll_event, MAX_EVENTS> events{};
+
+    const int ready = epoll_wait(m_epoll_fd, events.data(), MAX_EVENTS, m_posted.empty() ? timeout_ms : 0);
+
+    if (ready == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        PLOGE << "Failed to wait for events: " << std::strerror(errno);
+        throw EventReactorError{"Failed to wait for events"};
+    }
+
+    std::size_t dispatched = 0;
+
+    for (int i = 0; i < ready; i++) {
+        const auto token = events[i].data.u64;
+
+        /* a previous handler of this round may have removed or modified the fd */
+        const auto entry = m_tokens.find(token);
+        if (entry == m_tokens.end()) {
+            continue;
+        }
+
+        const int fd = entry->second;
+        auto &registration = m_registrations.at(fd);
+        const auto handler = registration.handler;
+
+        /* left as it is the fd reports the same condition on every wait, an edge-triggered one only once. Disarmed
+         * before the handler runs, so a handler that fixes the condition can arm it again right away */
+        if ((events[i].events & (EPOLLERR | EPOLLHUP)) != 0 && (registration.events & EPOLLET) == 0) {
+            PLOGD << "Disarming fd " << fd << " on events " << events[i].events;
+            disarm(fd, registration);
+        }
+
+        (*handler)(events[i].events);
+        dispatched++;
+    }
+
+    /* callbacks posted while running these are deferred to the next round */
+    auto posted = std::move(m_posted);
+    m_posted.clear();
+
+    for (auto &callback: posted) {
+        callback();
+        dispatched++;
+    }
+
+    return dispatched;
+}
+
+void EventReactor::run() {
+    m_stopped = false;
+
+    while (!m_stopped) {
+        run_once();
+    }
+}
+
+void EventReactor::stop() {
+    m_stopped = true;
+}
+
+EventReactor::~EventReactor() {
+    close(m_epoll_fd);
+}
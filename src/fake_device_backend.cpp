@@ -0,0 +1,608 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "fake_device_backend.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <linux/videodev2.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+static bool is_mplane_type(std::uint32_t type) {
+    return type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE || type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+}
+
+static bool is_capture_type(std::uint32_t type) {
+    return type == V4L2_BUF_TYPE_VIDEO_CAPTURE || type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+}
+
+static std::uint32_t image_size(std::uint32_t width, std::uint32_t height, std::uint32_t pixelformat) {
+    switch (pixelformat) {
+        case V4L2_PIX_FMT_YUYV:
+            return width * height * 2;
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_YUV420:
+            return width * height * 3 / 2;
+        default:
+            /* compressed formats, enough for any encoded frame of the fake encoder */
+            return width * height;
+    }
+}
+
+static timeval to_timeval(std::uint64_t ns) {
+    return {static_cast<time_t>(ns / 1000000000), static_cast<suseconds_t>(ns % 1000000000 / 1000)};
+}
+
+static int fail(int error) {
+    errno = error;
+    return -1;
+}
+
+static void drain_socket(int fd) {
+    char buffer[4096];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+static void fill_socket(int fd) {
+    static const char buffer[4096] = {};
+    while (write(fd, buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+FakeDeviceBackend::FakeDeviceBackend() : FakeDeviceBackend(Latencies{}) {
+}
+
+FakeDeviceBackend::FakeDeviceBackend(Latencies latencies, std::uint32_t keyframe_interval)
+    : m_latencies(latencies), m_keyframe_interval(std::max<std::uint32_t>(keyframe_interval, 1)),
+      m_encoder_input_formats{V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUV420},
+      m_readiness_thread([this] { signal_readiness(); }) {
+}
+
+FakeDeviceBackend::~FakeDeviceBackend() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+
+    m_readiness_changed.notify_all();
+    m_readiness_thread.join();
+}
+
+void FakeDeviceBackend::set_encoder_input_formats(std::vector<std::uint32_t> formats) {
+    std::lock_guard lock{m_mutex};
+    m_encoder_input_formats = std::move(formats);
+}
+
+std::uint64_t FakeDeviceBackend::now_ns() {
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<std::uint64_t>(now.tv_sec) * 1000000000 + static_cast<std::uint64_t>(now.tv_nsec);
+}
+
+void FakeDeviceBackend::spin_for(std::chrono::nanoseconds duration) {
+    if (duration.count() <= 0) {
+        return;
+    }
+
+    /* sleeping is far too coarse for the few microseconds of a real ioctl */
+    const auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+bool FakeDeviceBackend::is_m2m(const Device &device) {
+    return device.queues.contains(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) ||
+           device.queues.contains(V4L2_BUF_TYPE_VIDEO_OUTPUT);
+}
+
+int FakeDeviceBackend::open(const std::string &path, int flags) {
+    if (path.starts_with("/dev/dma_heap/")) {
+        const int fd = eventfd(0, EFD_CLOEXEC);
+
+        if (fd != -1) {
+            std::lock_guard lock{m_mutex};
+            m_heaps.push_back(fd);
+        }
+
+        return fd;
+    }
+
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, fds) == -1) {
+        return -1;
+    }
+
+    /* the kernel raises it to its minimum, a few writes are enough to take POLLOUT away */
+    const int send_buffer = 1;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer));
+
+    std::lock_guard lock{m_mutex};
+
+    auto &device = m_devices.emplace(fds[0], Device{(flags & O_NONBLOCK) != 0, {}}).first->second;
+    device.peer = fds[1];
+    set_readiness(fds[0], device, false, false);
+
+    return fds[0];
+}
+
+int FakeDeviceBackend::close(int fd) {
+    {
+        std::lock_guard lock{m_mutex};
+
+        if (const auto device = m_devices.find(fd); device != m_devices.end()) {
+            ::close(device->second.peer);
+            m_devices.erase(device);
+        }
+        std::erase(m_heaps, fd);
+    }
+
+    /* a blocked DQBUF on the device fails with EBADF */
+    m_buffer_scheduled.notify_all();
+
+    return ::close(fd);
+}
+
+int FakeDeviceBackend::ioctl(int fd, unsigned long request, void *arg) {
+    spin_for(m_latencies.ioctl);
+
+    std::unique_lock lock{m_mutex};
+
+    if (std::ranges::find(m_heaps, fd) != m_heaps.end()) {
+        lock.unlock();
+        return heap_ioctl(request, arg);
+    }
+
+    if (const auto device = m_devices.find(fd); device != m_devices.end()) {
+        return device_ioctl(lock, fd, device->second, request, arg);
+    }
+
+    /* the memfds handed out as dma buffers */
+    if (request == DMA_BUF_IOCTL_SYNC || request == DMA_BUF_SET_NAME) {
+        return 0;
+    }
+
+    return fail(ENOTTY);
+}
+
+int FakeDeviceBackend::heap_ioctl(unsigned long request, void *arg) const {
+    if (request != DMA_HEAP_IOCTL_ALLOC) {
+        return fail(ENOTTY);
+    }
+
+    spin_for(m_latencies.allocation);
+
+    auto *alloc = static_cast<dma_heap_allocation_data *>(arg);
+
+    const int fd = memfd_create("spicam-fake-dmabuf", MFD_CLOEXEC);
+
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (ftruncate(fd, static_cast<off_t>(alloc->len)) == -1) {
+        const int error = errno;
+        ::close(fd);
+        return fail(error);
+    }
+
+    alloc->fd = static_cast<std::uint32_t>(fd);
+
+    return 0;
+}
+
+void FakeDeviceBackend::schedule(int fd, Device &device) {
+    const auto now = now_ns();
+
+    if (is_m2m(device)) {
+        auto output = device.queues.find(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+        if (output == device.queues.end()) {
+            output = device.queues.find(V4L2_BUF_TYPE_VIDEO_OUTPUT);
+        }
+
+        auto capture = device.queues.find(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+        if (capture == device.queues.end()) {
+            capture = device.queues.find(V4L2_BUF_TYPE_VIDEO_CAPTURE);
+        }
+
+        if (capture == device.queues.end() || !output->second.streaming || !capture->second.streaming) {
+            return;
+        }
+
+        auto &input_queue = output->second;
+        auto &encoded_queue = capture->second;
+
+        /* a pair becomes available with the qbuf or streamon that completes it, that is now */
+        while (!input_queue.pending.empty() && !encoded_queue.pending.empty()) {
+            auto &input = input_queue.buffers[input_queue.pending.front()];
+            auto &encoded = encoded_queue.buffers[encoded_queue.pending.front()];
+
+            const auto ready = std::max(now, device.encoder_free_ns) +
+                               static_cast<std::uint64_t>(m_latencies.encode.count());
+            device.encoder_free_ns = ready;
+
+            const bool keyframe = device.frames_encoded++ % m_keyframe_interval == 0;
+
+            input.state = Buffer::State::Scheduled;
+            input.ready_ns = ready;
+            input.flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+            input.sequence = input_queue.sequence++;
+
+            encoded.state = Buffer::State::Scheduled;
+            encoded.ready_ns = ready;
+            encoded.timestamp = input.timestamp;
+            encoded.field = input.field;
+            encoded.bytesused = std::clamp<std::uint32_t>(input.bytesused / (keyframe ? 4 : 20), 1,
+                                                          std::max<std::uint32_t>(encoded_queue.sizeimage, 1));
+            encoded.flags = V4L2_BUF_FLAG_TIMESTAMP_COPY |
+                            (keyframe ? V4L2_BUF_FLAG_KEYFRAME : V4L2_BUF_FLAG_PFRAME);
+            encoded.sequence = encoded_queue.sequence++;
+
+            input_queue.pending.pop_front();
+            encoded_queue.pending.pop_front();
+        }
+    } else {
+        for (auto &[type, queue]: device.queues) {
+            if (!is_capture_type(type) || !queue.streaming) {
+                continue;
+            }
+
+            const auto interval = static_cast<std::uint64_t>(m_latencies.frame_interval.count());
+
+            while (!queue.pending.empty()) {
+                auto &buffer = queue.buffers[queue.pending.front()];
+
+                /* frames that found no queued buffer are dropped like on a real sensor */
+                if (device.next_frame_ns < now && interval > 0) {
+                    const auto missed = (now - device.next_frame_ns + interval - 1) / interval;
+                    device.next_frame_ns += missed * interval;
+                    queue.sequence += static_cast<std::uint32_t>(missed);
+                }
+
+                buffer.state = Buffer::State::Scheduled;
+                buffer.ready_ns = std::max(device.next_frame_ns, now);
+                buffer.timestamp = to_timeval(buffer.ready_ns);
+                buffer.bytesused = queue.sizeimage;
+                buffer.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+                buffer.sequence = queue.sequence++;
+
+                device.next_frame_ns = buffer.ready_ns + interval;
+                queue.pending.pop_front();
+            }
+        }
+    }
+
+    arm_readiness(fd, device);
+    m_buffer_scheduled.notify_all();
+}
+
+void FakeDeviceBackend::set_readiness(int fd, Device &device, bool readable, bool writable) {
+    if (readable != device.readable) {
+        if (readable) {
+            const char byte = 0;
+            [[maybe_unused]] const auto written = write(device.peer, &byte, sizeof(byte));
+        } else {
+            drain_socket(fd);
+        }
+        device.readable = readable;
+    }
+
+    if (writable != device.writable) {
+        if (writable) {
+            drain_socket(device.peer);
+        } else {
+            fill_socket(fd);
+        }
+        device.writable = writable;
+    }
+}
+
+void FakeDeviceBackend::arm_readiness(int fd, Device &device) {
+    const auto now = now_ns();
+
+    bool readable = false;
+    bool writable = false;
+    std::uint64_t next_ready = 0;
+
+    for (const auto &[type, queue]: device.queues) {
+        for (const auto &buffer: queue.buffers) {
+            if (buffer.state != Buffer::State::Scheduled) {
+                continue;
+            }
+
+            if (buffer.ready_ns > now) {
+                next_ready = next_ready == 0 ? buffer.ready_ns : std::min(next_ready, buffer.ready_ns);
+            } else if (is_capture_type(type)) {
+                readable = true;
+            } else {
+                writable = true;
+            }
+        }
+    }
+
+    set_readiness(fd, device, readable, writable);
+    device.next_ready_ns = next_ready;
+
+    /* only an earlier completion needs the readiness thread before its deadline */
+    if (next_ready != 0 && (m_readiness_deadline == 0 || next_ready < m_readiness_deadline)) {
+        m_readiness_changed.notify_one();
+    }
+}
+
+void FakeDeviceBackend::signal_readiness() {
+    std::unique_lock lock{m_mutex};
+
+    while (!m_stopping) {
+        const auto now = now_ns();
+        std::uint64_t next_ready = 0;
+
+        for (auto &[fd, device]: m_devices) {
+            if (device.next_ready_ns != 0 && device.next_ready_ns <= now) {
+                arm_readiness(fd, device);
+            }
+            if (device.next_ready_ns != 0) {
+                next_ready = next_ready == 0 ? device.next_ready_ns : std::min(next_ready, device.next_ready_ns);
+            }
+        }
+
+        m_readiness_deadline = next_ready;
+
+        if (next_ready == 0) {
+            m_readiness_changed.wait(lock);
+        } else {
+            m_readiness_changed.wait_until(lock, std::chrono::steady_clock::time_point{
+                                               std::chrono::nanoseconds{next_ready}
+                                           });
+        }
+    }
+}
+
+int FakeDeviceBackend::dequeue(std::unique_lock<std::mutex> &lock, int fd, void *arg) {
+    auto *buf = static_cast<v4l2_buffer *>(arg);
+
+    while (true) {
+        const auto device_entry = m_devices.find(fd);
+
+        if (device_entry == m_devices.end()) {
+            return fail(EBADF);
+        }
+
+        auto &device = device_entry->second;
+        const auto queue_entry = device.queues.find(buf->type);
+
+        if (queue_entry == device.queues.end() || !queue_entry->second.streaming) {
+            return fail(EINVAL);
+        }
+
+        auto &queue = queue_entry->second;
+
+        auto next = queue.buffers.end();
+        for (auto buffer = queue.buffers.begin(); buffer != queue.buffers.end(); ++buffer) {
+            if (buffer->state == Buffer::State::Scheduled && (next == queue.buffers.end() ||
+                                                              buffer->ready_ns < next->ready_ns)) {
+                next = buffer;
+            }
+        }
+
+        if (next != queue.buffers.end() && next->ready_ns <= now_ns()) {
+            next->state = Buffer::State::Dequeued;
+
+            buf->index = static_cast<std::uint32_t>(std::distance(queue.buffers.begin(), next));
+            buf->bytesused = next->bytesused;
+            buf->flags = next->flags;
+            buf->field = next->field;
+            buf->timestamp = next->timestamp;
+            buf->sequence = next->sequence;
+
+            if (is_mplane_type(buf->type) && buf->m.planes != nullptr && buf->length >= 1) {
+                buf->m.planes[0].bytesused = next->bytesused;
+                buf->m.planes[0].length = queue.sizeimage;
+            } else if (!is_mplane_type(buf->type)) {
+                buf->length = queue.sizeimage;
+            }
+
+            arm_readiness(fd, device);
+
+            return 0;
+        }
+
+        if (device.nonblocking) {
+            return fail(EAGAIN);
+        }
+
+        if (next != queue.buffers.end()) {
+            m_buffer_scheduled.wait_until(lock, std::chrono::steady_clock::time_point{
+                                              std::chrono::nanoseconds{next->ready_ns}
+                                          });
+        } else {
+            /* nothing queued yet, another thread has to qbuf, stream off or close first, the loop checks again */
+            m_buffer_scheduled.wait(lock);
+        }
+    }
+}
+
+int FakeDeviceBackend::device_ioctl(std::unique_lock<std::mutex> &lock, int fd, Device &device,
+                                    unsigned long request, void *arg) {
+    switch (request) {
+        case VIDIOC_QUERYCAP: {
+            auto *cap = static_cast<v4l2_capability *>(arg);
+            *cap = {};
+            std::strncpy(reinterpret_cast<char *>(cap->driver), "spicam-fake", sizeof(cap->driver) - 1);
+            std::strncpy(reinterpret_cast<char *>(cap->card), "Fake camera and encoder", sizeof(cap->card) - 1);
+            cap->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_M2M_MPLANE | V4L2_CAP_STREAMING;
+            cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+            return 0;
+        }
+        case VIDIOC_S_FMT:
+        case VIDIOC_G_FMT: {
+            auto *fmt = static_cast<v4l2_format *>(arg);
+            auto &queue = device.queues[fmt->type];
+
+            if (request == VIDIOC_S_FMT) {
+                queue.width = fmt->fmt.pix.width;
+                queue.height = fmt->fmt.pix.height;
+                queue.pixelformat = fmt->fmt.pix.pixelformat;
+
+                /* like a driver the encoder replaces a format it cannot take by its preferred one */
+                if (fmt->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE && !m_encoder_input_formats.empty() &&
+                    std::ranges::find(m_encoder_input_formats, queue.pixelformat) == m_encoder_input_formats.end()) {
+                    queue.pixelformat = m_encoder_input_formats.front();
+                }
+
+                queue.sizeimage = image_size(queue.width, queue.height, queue.pixelformat);
+            }
+
+            if (is_mplane_type(fmt->type)) {
+                fmt->fmt.pix_mp.width = queue.width;
+                fmt->fmt.pix_mp.height = queue.height;
+                fmt->fmt.pix_mp.pixelformat = queue.pixelformat;
+                fmt->fmt.pix_mp.num_planes = 1;
+                fmt->fmt.pix_mp.plane_fmt[0].sizeimage = queue.sizeimage;
+            } else {
+                fmt->fmt.pix.width = queue.width;
+                fmt->fmt.pix.height = queue.height;
+                fmt->fmt.pix.pixelformat = queue.pixelformat;
+                fmt->fmt.pix.sizeimage = queue.sizeimage;
+            }
+            return 0;
+        }
+        case VIDIOC_S_PARM:
+        case VIDIOC_G_PARM:
+        case VIDIOC_SUBSCRIBE_EVENT:
+            return 0;
+        case VIDIOC_DQEVENT:
+            return fail(ENOENT);
+        case VIDIOC_ENUM_FMT: {
+            auto *desc = static_cast<v4l2_fmtdesc *>(arg);
+            std::vector<std::uint32_t> formats;
+
+            if (desc->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+                formats = m_encoder_input_formats;
+            } else if (desc->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+                formats = {V4L2_PIX_FMT_H264};
+            } else if (desc->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+                formats = {V4L2_PIX_FMT_YUYV};
+            }
+
+            if (desc->index >= formats.size()) {
+                return fail(EINVAL);
+            }
+
+            desc->pixelformat = formats[desc->index];
+            desc->flags = 0;
+            return 0;
+        }
+        case VIDIOC_REQBUFS: {
+            auto *req = static_cast<v4l2_requestbuffers *>(arg);
+
+            if (req->memory != V4L2_MEMORY_DMABUF) {
+                return fail(EINVAL);
+            }
+
+            auto &queue = device.queues[req->type];
+
+            if (queue.streaming) {
+                return fail(EBUSY);
+            }
+
+            queue.buffers.assign(req->count, {});
+            queue.pending.clear();
+            req->capabilities = V4L2_BUF_CAP_SUPPORTS_DMABUF;
+            return 0;
+        }
+        case VIDIOC_QUERYBUF: {
+            auto *buf = static_cast<v4l2_buffer *>(arg);
+            const auto queue = device.queues.find(buf->type);
+
+            if (queue == device.queues.end() || buf->index >= queue->second.buffers.size()) {
+                return fail(EINVAL);
+            }
+
+            const auto &buffer = queue->second.buffers[buf->index];
+
+            buf->flags = 0;
+            if (buffer.state != Buffer::State::Dequeued) {
+                buf->flags |= V4L2_BUF_FLAG_QUEUED;
+            }
+            if (buffer.state == Buffer::State::Scheduled && buffer.ready_ns <= now_ns()) {
+                buf->flags |= V4L2_BUF_FLAG_DONE;
+            }
+            return 0;
+        }
+        case VIDIOC_QBUF: {
+            auto *buf = static_cast<v4l2_buffer *>(arg);
+            const auto queue_entry = device.queues.find(buf->type);
+
+            if (queue_entry == device.queues.end() || buf->index >= queue_entry->second.buffers.size() ||
+                buf->memory != V4L2_MEMORY_DMABUF) {
+                return fail(EINVAL);
+            }
+
+            auto &queue = queue_entry->second;
+            auto &buffer = queue.buffers[buf->index];
+
+            if (buffer.state != Buffer::State::Dequeued) {
+                return fail(EINVAL);
+            }
+
+            std::uint32_t bytesused = buf->bytesused;
+            if (is_mplane_type(buf->type) && buf->m.planes != nullptr && buf->m.planes[0].bytesused != 0) {
+                bytesused = buf->m.planes[0].bytesused;
+            }
+
+            buffer.state = Buffer::State::Queued;
+            buffer.queued_ns = now_ns();
+            buffer.bytesused = bytesused != 0 ? bytesused : queue.sizeimage;
+            buffer.timestamp = buf->timestamp;
+            buffer.field = buf->field;
+
+            queue.pending.push_back(buf->index);
+
+            schedule(fd, device);
+            return 0;
+        }
+        case VIDIOC_DQBUF:
+            return dequeue(lock, fd, arg);
+        case VIDIOC_STREAMON: {
+            const auto type = *static_cast<std::uint32_t *>(arg);
+            auto &queue = device.queues[type];
+
+            queue.streaming = true;
+
+            if (is_capture_type(type) && !is_m2m(device)) {
+                device.stream_start_ns = now_ns();
+                device.next_frame_ns = device.stream_start_ns + m_latencies.frame_interval.count();
+            }
+
+            schedule(fd, device);
+            return 0;
+        }
+        case VIDIOC_STREAMOFF: {
+            const auto type = *static_cast<std::uint32_t *>(arg);
+            auto &queue = device.queues[type];
+
+            /* like the kernel, every buffer returns to userspace */
+            queue.streaming = false;
+            queue.pending.clear();
+            for (auto &buffer: queue.buffers) {
+                buffer.state = Buffer::State::Dequeued;
+            }
+
+            arm_readiness(fd, device);
+            m_buffer_scheduled.notify_all();
+            return 0;
+        }
+        default:
+            return fail(ENOTTY);
+    }
+}
@@ -0,0 +1,112 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "fan_out_sink.hpp"
+
+#include <plog/Log.h>
+
+#include "condition.hpp"
+#include "latency_tracker.hpp"
+
+std::uint64_t ConsumerCounters::delivered() {
+    const auto delivered = m_delivered.fetch_add(1, std::memory_order_relaxed) + 1;
+    const auto outstanding = delivered - m_released.load(std::memory_order_acquire);
+
+    /* only the streaming thread delivers, a plain compare is enough */
+    if (outstanding > m_max_outstanding.load(std::memory_order_relaxed)) {
+        m_max_outstanding.store(outstanding, std::memory_order_relaxed);
+    }
+
+    return outstanding;
+}
+
+void ConsumerCounters::released(std::uint64_t hold_ns) {
+    m_hold_time.record(hold_ns);
+    m_released.fetch_add(1, std::memory_order_release);
+}
+
+std::uint64_t ConsumerCounters::outstanding() const {
+    /* released first, every counted release was delivered before so the difference cannot wrap */
+    const auto released = m_released.load(std::memory_order_acquire);
+    return m_delivered.load(std::memory_order_relaxed) - released;
+}
+
+ConsumerLag ConsumerCounters::lag() const {
+    return {
+        m_delivered.load(std::memory_order_relaxed),
+        outstanding(),
+        m_max_outstanding.load(std::memory_order_relaxed),
+        m_hold_time.summary()
+    };
+}
+
+SharedEncodedFrame::SharedEncodedFrame(SharedPackage<EncodedFrame> frame, std::shared_ptr<ConsumerCounters> counters)
+    : m_frame(std::move(frame)),
+      m_counters(std::move(counters)),
+      m_delivered_ns(LatencyTracker::now_ns()) {
+}
+
+SharedEncodedFrame &SharedEncodedFrame::operator=(SharedEncodedFrame &&other) noexcept {
+    if (this == &other)
+        return *this;
+    if (m_counters) {
+        m_counters->released(LatencyTracker::now_ns() - m_delivered_ns);
+    }
+    m_frame = std::move(other.m_frame);
+    m_counters = std::move(other.m_counters);
+    m_delivered_ns = other.m_delivered_ns;
+    return *this;
+}
+
+SharedEncodedFrame::~SharedEncodedFrame() {
+    if (m_counters) {
+        m_counters->released(LatencyTracker::now_ns() - m_delivered_ns);
+    }
+}
+
+FanOutSink::FanOutSink(std::uint64_t lag_limit) : m_lag_limit(lag_limit) {
+}
+
+std::size_t FanOutSink::add_consumer(std::shared_ptr<ISharedEncodedSink> consumer) {
+    PRECONDITION(consumer != nullptr, "Consumer is null");
+
+    m_consumers.push_back({std::move(consumer), std::make_shared<ConsumerCounters>(), false});
+    return m_consumers.size() - 1;
+}
+
+void FanOutSink::prepare(const std::vector<const DmaBuf *> &buffers) {
+    for (const auto &consumer: m_consumers) {
+        consumer.sink->prepare(buffers);
+    }
+}
+
+void FanOutSink::consume(EncodedFrame &&frame) {
+    const auto shared = SharedPackage<EncodedFrame>::create(std::move(frame));
+
+    for (std::size_t i = 0; i < m_consumers.size(); i++) {
+        auto &consumer = m_consumers[i];
+
+        const auto outstanding = consumer.counters->delivered();
+        const bool lagging = outstanding >= m_lag_limit;
+
+        if (lagging && !consumer.lagging) {
+            PLOGW << "Consumer " << i << " holds " << outstanding << " encoded frames and falls behind the encoder";
+        }
+        consumer.lagging = lagging;
+
+        consumer.sink->consume(SharedEncodedFrame{shared, consumer.counters});
+    }
+}
+
+ConsumerLag FanOutSink::lag(std::size_t consumer) const {
+    return m_consumers.at(consumer).counters->lag();
+}
+
+bool FanOutSink::is_lagging(std::size_t consumer) const {
+    return m_consumers.at(consumer).counters->outstanding() >= m_lag_limit;
+}
+
+std::size_t FanOutSink::consumers() const {
+    return m_consumers.size();
+}
@@ -0,0 +1,42 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "file_sink.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <plog/Log.h>
+
+#include "exceptions.hpp"
+
+FileSink::FileSink(const std::string &path) : m_fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) {
+    if (m_fd == -1) {
+        PLOGE << "Failed to open output file " << path << ": " << std::strerror(errno);
+        throw DeviceFileError{"Failed to open output file at path " + path};
+    }
+}
+
+void FileSink::consume(EncodedFrame &&frame) {
+    auto data = frame.data();
+
+    while (!data.empty()) {
+        const auto written = write(m_fd, data.data(), data.size());
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            PLOGE << "Failed to write encoded frame: " << std::strerror(errno);
+            throw DeviceFileError{"Failed to write encoded frame"};
+        }
+
+        data = data.subspan(written);
+    }
+}
+
+FileSink::~FileSink() {
+    close(m_fd);
+}
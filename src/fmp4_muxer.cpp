@@ -0,0 +1,465 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "fmp4_muxer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <plog/Log.h>
+#include <sys/uio.h>
+
+#include "condition.hpp"
+#include "exceptions.hpp"
+
+/* media time in microseconds, the resolution of the driver timestamps */
+static constexpr std::uint32_t TIMESCALE{1000000};
+static constexpr std::uint32_t TRACK_ID{1};
+
+/* field offsets inside the prebuilt fragment header */
+static constexpr std::size_t SEQUENCE_NUMBER_OFFSET{20};
+static constexpr std::size_t DECODE_TIME_OFFSET{60};
+static constexpr std::size_t SAMPLE_DURATION_OFFSET{88};
+static constexpr std::size_t SAMPLE_SIZE_OFFSET{92};
+static constexpr std::size_t SAMPLE_FLAGS_OFFSET{96};
+static constexpr std::size_t MDAT_SIZE_OFFSET{100};
+
+/* sample_depends_on 2 for sync samples, sample_depends_on 1 and sample_is_non_sync_sample for the others */
+static constexpr std::uint32_t SYNC_SAMPLE_FLAGS{0x02000000};
+static constexpr std::uint32_t NON_SYNC_SAMPLE_FLAGS{0x01010000};
+
+static constexpr std::uint32_t UNITY_MATRIX[] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+
+static void put_u8(std::vector<std::byte> &out, std::uint8_t value) {
+    out.push_back(static_cast<std::byte>(value));
+}
+
+static void put_u16(std::vector<std::byte> &out, std::uint16_t value) {
+    put_u8(out, value >> 8);
+    put_u8(out, value & 0xff);
+}
+
+static void put_u32(std::vector<std::byte> &out, std::uint32_t value) {
+    put_u16(out, value >> 16);
+    put_u16(out, value & 0xffff);
+}
+
+static void put_u64(std::vector<std::byte> &out, std::uint64_t value) {
+    put_u32(out, value >> 32);
+    put_u32(out, value & 0xffffffff);
+}
+
+static void put_fourcc(std::vector<std::byte> &out, const char *fourcc) {
+    for (int i = 0; i < 4; i++) {
+        put_u8(out, fourcc[i]);
+    }
+}
+
+static void put_bytes(std::vector<std::byte> &out, std::span<const std::byte> bytes) {
+    out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+static void put_zeros(std::vector<std::byte> &out, std::size_t count) {
+    out.insert(out.end(), count, std::byte{0});
+}
+
+static void store_u32(std::byte *at, std::uint32_t value) {
+    value = htobe32(value);
+    std::memcpy(at, &value, sizeof(value));
+}
+
+static void store_u64(std::byte *at, std::uint64_t value) {
+    value = htobe64(value);
+    std::memcpy(at, &value, sizeof(value));
+}
+
+/**
+ * Appends the header of a box whose size is patched by end_box().
+ * @return offset of the box
+ */
+static std::size_t begin_box(std::vector<std::byte> &out, const char *type) {
+    const auto start = out.size();
+    put_u32(out, 0);
+    put_fourcc(out, type);
+    return start;
+}
+
+static std::size_t begin_full_box(std::vector<std::byte> &out, const char *type, std::uint8_t version,
+                                  std::uint32_t flags) {
+    const auto start = begin_box(out, type);
+    put_u32(out, static_cast<std::uint32_t>(version) << 24 | flags);
+    return start;
+}
+
+static void end_box(std::vector<std::byte> &out, std::size_t start) {
+    store_u32(out.data() + start, static_cast<std::uint32_t>(out.size() - start));
+}
+
+static std::uint64_t timestamp_us(const timeval &timestamp) {
+    return static_cast<std::uint64_t>(timestamp.tv_sec) * 1000000 + static_cast<std::uint64_t>(timestamp.tv_usec);
+}
+
+/* marks the start of a media segment, written in front of every IDR */
+static const std::vector<std::byte> &segment_type_box() {
+    static const auto styp = [] {
+        std::vector<std::byte> out;
+        const auto box = begin_box(out, "styp");
+        put_fourcc(out, "msdh");
+        put_u32(out, 0);
+        put_fourcc(out, "msdh");
+        put_fourcc(out, "msix");
+        end_box(out, box);
+        return out;
+    }();
+    return styp;
+}
+
+static bool is_parameter_set_or_delimiter(NalUnitType type) {
+    return type == NalUnitType::Sps || type == NalUnitType::Pps || type == NalUnitType::AccessUnitDelimiter;
+}
+
+Fmp4Muxer::Fmp4Muxer(const std::string &path, std::uint32_t width, std::uint32_t height)
+    : m_fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+      m_width(width),
+      m_height(height) {
+    if (m_fd == -1) {
+        PLOGE << "Failed to open output file " << path << ": " << std::strerror(errno);
+        throw DeviceFileError{"Failed to open output file at path " + path};
+    }
+
+    std::vector<std::byte> header;
+
+    const auto moof = begin_box(header, "moof");
+    const auto mfhd = begin_full_box(header, "mfhd", 0, 0);
+    put_u32(header, 0);
+    end_box(header, mfhd);
+
+    const auto traf = begin_box(header, "traf");
+    /* default-base-is-moof, the data offset of the trun counts from the moof */
+    const auto tfhd = begin_full_box(header, "tfhd", 0, 0x020000);
+    put_u32(header, TRACK_ID);
+    end_box(header, tfhd);
+
+    const auto tfdt = begin_full_box(header, "tfdt", 1, 0);
+    put_u64(header, 0);
+    end_box(header, tfdt);
+
+    /* data offset, sample duration, size and flags present */
+    const auto trun = begin_full_box(header, "trun", 0, 0x000701);
+    put_u32(header, 1);
+    put_u32(header, FRAGMENT_HEADER_SIZE);
+    put_u32(header, 0);
+    put_u32(header, 0);
+    put_u32(header, 0);
+    end_box(header, trun);
+    end_box(header, traf);
+    end_box(header, moof);
+
+    begin_box(header, "mdat");
+
+    PRECONDITION(header.size() == FRAGMENT_HEADER_SIZE, "Fragment header layout changed");
+    std::memcpy(m_fragment_header.data(), header.data(), FRAGMENT_HEADER_SIZE);
+}
+
+void Fmp4Muxer::write_all(iovec *iov, int count) {
+    while (count > 0) {
+        auto written = writev(m_fd, iov, count);
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            PLOGE << "Failed to write fragment: " << std::strerror(errno);
+            throw DeviceFileError{"Failed to write fragment"};
+        }
+
+        m_bytes_written += written;
+
+        /* a short write continues with the first iovec that was not written completely */
+        while (count > 0 && static_cast<std::size_t>(written) >= iov->iov_len) {
+            written -= static_cast<ssize_t>(iov->iov_len);
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<std::byte *>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+void Fmp4Muxer::write_init_segment() {
+    const auto sps = m_scanner.sps();
+    const auto pps = m_scanner.pps();
+
+    std::vector<std::byte> out;
+
+    const auto ftyp = begin_box(out, "ftyp");
+    put_fourcc(out, "isom");
+    put_u32(out, 0x200);
+    put_fourcc(out, "isom");
+    put_fourcc(out, "iso6");
+    put_fourcc(out, "avc1");
+    put_fourcc(out, "mp41");
+    end_box(out, ftyp);
+
+    const auto moov = begin_box(out, "moov");
+
+    const auto mvhd = begin_full_box(out, "mvhd", 0, 0);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_u32(out, TIMESCALE);
+    put_u32(out, 0);
+    put_u32(out, 0x00010000);
+    put_u16(out, 0x0100);
+    put_zeros(out, 10);
+    for (const auto value: UNITY_MATRIX) {
+        put_u32(out, value);
+    }
+    put_zeros(out, 24);
+    put_u32(out, TRACK_ID + 1);
+    end_box(out, mvhd);
+
+    const auto trak = begin_box(out, "trak");
+
+    /* track enabled and in movie */
+    const auto tkhd = begin_full_box(out, "tkhd", 0, 0x000003);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_u32(out, TRACK_ID);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_zeros(out, 16);
+    for (const auto value: UNITY_MATRIX) {
+        put_u32(out, value);
+    }
+    put_u32(out, m_width << 16);
+    put_u32(out, m_height << 16);
+    end_box(out, tkhd);
+
+    const auto mdia = begin_box(out, "mdia");
+
+    const auto mdhd = begin_full_box(out, "mdhd", 0, 0);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_u32(out, TIMESCALE);
+    put_u32(out, 0);
+    /* packed ISO-639-2 "und" */
+    put_u16(out, 0x55c4);
+    put_u16(out, 0);
+    end_box(out, mdhd);
+
+    const auto hdlr = begin_full_box(out, "hdlr", 0, 0);
+    put_u32(out, 0);
+    put_fourcc(out, "vide");
+    put_zeros(out, 12);
+    for (const auto character: std::string_view{"VideoHandler"}) {
+        put_u8(out, character);
+    }
+    put_u8(out, 0);
+    end_box(out, hdlr);
+
+    const auto minf = begin_box(out, "minf");
+
+    const auto vmhd = begin_full_box(out, "vmhd", 0, 1);
+    put_zeros(out, 8);
+    end_box(out, vmhd);
+
+    const auto dinf = begin_box(out, "dinf");
+    const auto dref = begin_full_box(out, "dref", 0, 0);
+    put_u32(out, 1);
+    /* self contained, the media data is in this file */
+    end_box(out, begin_full_box(out, "url ", 0, 1));
+    end_box(out, dref);
+    end_box(out, dinf);
+
+    const auto stbl = begin_box(out, "stbl");
+
+    const auto stsd = begin_full_box(out, "stsd", 0, 0);
+    put_u32(out, 1);
+
+    const auto avc1 = begin_box(out, "avc1");
+    put_zeros(out, 6);
+    put_u16(out, 1);
+    put_zeros(out, 16);
+    put_u16(out, static_cast<std::uint16_t>(m_width));
+    put_u16(out, static_cast<std::uint16_t>(m_height));
+    /* 72 dpi */
+    put_u32(out, 0x00480000);
+    put_u32(out, 0x00480000);
+    put_u32(out, 0);
+    put_u16(out, 1);
+    put_zeros(out, 32);
+    put_u16(out, 0x0018);
+    put_u16(out, 0xffff);
+
+    const auto avcc = begin_box(out, "avcC");
+    put_u8(out, 1);
+    /* profile_idc, constraint flags and level_idc follow the SPS header byte */
+    put_u8(out, std::to_integer<std::uint8_t>(sps[1]));
+    put_u8(out, std::to_integer<std::uint8_t>(sps[2]));
+    put_u8(out, std::to_integer<std::uint8_t>(sps[3]));
+    /* 4 byte NAL lengths, one SPS, one PPS */
+    put_u8(out, 0xff);
+    put_u8(out, 0xe1);
+    put_u16(out, static_cast<std::uint16_t>(sps.size()));
+    put_bytes(out, sps);
+    put_u8(out, 1);
+    put_u16(out, static_cast<std::uint16_t>(pps.size()));
+    put_bytes(out, pps);
+    end_box(out, avcc);
+
+    end_box(out, avc1);
+    end_box(out, stsd);
+
+    /* the sample tables are empty, every sample is described by its fragment */
+    for (const auto *table: {"stts", "stsc", "stco"}) {
+        const auto box = begin_full_box(out, table, 0, 0);
+        put_u32(out, 0);
+        end_box(out, box);
+    }
+
+    const auto stsz = begin_full_box(out, "stsz", 0, 0);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    end_box(out, stsz);
+
+    end_box(out, stbl);
+    end_box(out, minf);
+    end_box(out, mdia);
+    end_box(out, trak);
+
+    const auto mvex = begin_box(out, "mvex");
+    const auto trex = begin_full_box(out, "trex", 0, 0);
+    put_u32(out, TRACK_ID);
+    put_u32(out, 1);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    end_box(out, trex);
+    end_box(out, mvex);
+
+    end_box(out, moov);
+
+    iovec iov{out.data(), out.size()};
+    write_all(&iov, 1);
+}
+
+void Fmp4Muxer::write_fragment(const EncodedFrame &frame, const NalUnits &units, std::uint64_t decode_time_us,
+                               std::uint32_t duration_us) {
+    const auto data = frame.data();
+    const bool sync = units.has_idr();
+
+    /* segment type, fragment header and a length and payload pair per unit */
+    std::array<iovec, 2 + 2 * MAX_NAL_UNITS> iov{};
+    int count = 0;
+
+    if (sync) {
+        const auto &styp = segment_type_box();
+        iov[count++] = {const_cast<std::byte *>(styp.data()), styp.size()};
+    }
+
+    iov[count++] = {m_fragment_header.data(), m_fragment_header.size()};
+
+    std::uint32_t sample_size = 0;
+    std::size_t lengths = 0;
+
+    for (const auto &unit: units) {
+        if (is_parameter_set_or_delimiter(unit.type)) {
+            continue;
+        }
+
+        m_lengths[lengths] = htobe32(unit.size);
+        iov[count++] = {&m_lengths[lengths], sizeof(std::uint32_t)};
+        /* straight from the mapped encoder buffer */
+        iov[count++] = {const_cast<std::byte *>(data.data() + unit.offset), unit.size};
+
+        sample_size += sizeof(std::uint32_t) + unit.size;
+        lengths++;
+    }
+
+    store_u32(m_fragment_header.data() + SEQUENCE_NUMBER_OFFSET, ++m_sequence_number);
+    store_u64(m_fragment_header.data() + DECODE_TIME_OFFSET, decode_time_us);
+    store_u32(m_fragment_header.data() + SAMPLE_DURATION_OFFSET, duration_us);
+    store_u32(m_fragment_header.data() + SAMPLE_SIZE_OFFSET, sample_size);
+    store_u32(m_fragment_header.data() + SAMPLE_FLAGS_OFFSET, sync ? SYNC_SAMPLE_FLAGS : NON_SYNC_SAMPLE_FLAGS);
+    store_u32(m_fragment_header.data() + MDAT_SIZE_OFFSET, 8 + sample_size);
+
+    write_all(iov.data(), count);
+
+    m_frames_written++;
+}
+
+void Fmp4Muxer::consume(EncodedFrame &&frame) {
+    const auto units = m_scanner.scan(frame.data());
+
+    if (!m_initialized) {
+        /* players need the parameter sets before the first sample */
+        if (!units.has_idr() || m_scanner.sps().size() < 4 || m_scanner.pps().empty()) {
+            m_frames_dropped++;
+            return;
+        }
+
+        write_init_segment();
+        m_initialized = true;
+    }
+
+    if (units.truncated) {
+        PLOGW << "Encoded frame has more than " << MAX_NAL_UNITS << " NAL units, the rest is not muxed";
+    }
+
+    if (m_held) {
+        const auto current_us = timestamp_us(frame.timestamp());
+        const auto held_us = timestamp_us(m_held->timestamp());
+
+        /* a timestamp going backwards, e.g. after a driver restart, would wrap the unsigned distance */
+        if (current_us > held_us) {
+            m_last_duration_us = static_cast<std::uint32_t>(
+                std::min<std::uint64_t>(current_us - held_us, std::numeric_limits<std::uint32_t>::max()));
+        }
+
+        write_fragment(*m_held, m_held_units, m_held_decode_time_us, m_last_duration_us);
+        m_held_decode_time_us += m_last_duration_us;
+        m_held.reset();
+    }
+
+    m_held.emplace(std::move(frame));
+    m_held_units = units;
+}
+
+void Fmp4Muxer::flush() {
+    if (!m_held) {
+        return;
+    }
+
+    write_fragment(*m_held, m_held_units, m_held_decode_time_us, m_last_duration_us);
+    m_held_decode_time_us += m_last_duration_us;
+    m_held.reset();
+}
+
+std::uint64_t Fmp4Muxer::bytes_written() const {
+    return m_bytes_written;
+}
+
+std::uint64_t Fmp4Muxer::frames_written() const {
+    return m_frames_written;
+}
+
+std::uint64_t Fmp4Muxer::frames_dropped() const {
+    return m_frames_dropped;
+}
+
+Fmp4Muxer::~Fmp4Muxer() {
+    try {
+        flush();
+    } catch (const DeviceFileError &e) {
+        PLOGE << "Failed to write the last fragment: " << e.what();
+    }
+
+    close(m_fd);
+}
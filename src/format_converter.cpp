@@ -0,0 +1,158 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "format_converter.hpp"
+
+#include <algorithm>
+
+#include "condition.hpp"
+
+static std::size_t tile_count(std::size_t threads, std::uint32_t height) {
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    /* every tile needs at least one row pair */
+    return std::clamp<std::size_t>(threads, 1, std::max<std::uint32_t>(height / 2, 1));
+}
+
+FormatConverter::FormatConverter(const v4l2_pix_format &source, std::uint32_t target_format, std::size_t threads,
+                                 const FormatKernels *kernels)
+    : m_width(source.width),
+      m_height(source.height),
+      m_bytesperline(yuyv_bytesperline(source)),
+      m_target_format(target_format),
+      m_kernels(kernels != nullptr ? kernels : &best_format_kernels()),
+      m_tiles(tile_count(threads, source.height)) {
+    PRECONDITION(can_convert(source.pixelformat, target_format), "Conversion between the formats is not supported");
+    PRECONDITION(m_width % 2 == 0 && m_height % 2 == 0, "4:2:0 needs an even width and height");
+
+    for (std::size_t tile = 1; tile < m_tiles; tile++) {
+        m_workers.emplace_back([this, tile] { work(tile); });
+    }
+}
+
+bool FormatConverter::can_convert(std::uint32_t source_format, std::uint32_t target_format) {
+    return source_format == V4L2_PIX_FMT_YUYV &&
+           (target_format == V4L2_PIX_FMT_NV12 || target_format == V4L2_PIX_FMT_YUV420);
+}
+
+std::size_t FormatConverter::target_size() const {
+    return std::size_t{m_width} * m_height * 3 / 2;
+}
+
+std::uint32_t FormatConverter::target_format() const {
+    return m_target_format;
+}
+
+std::size_t FormatConverter::threads() const {
+    return m_tiles;
+}
+
+const char *FormatConverter::kernel_name() const {
+    return m_kernels->name;
+}
+
+void FormatConverter::convert_tile(const std::uint8_t *source, std::uint8_t *target, std::size_t tile) const {
+    const std::size_t pairs = m_height / 2;
+    const std::size_t begin = pairs * tile / m_tiles;
+    const std::size_t end = pairs * (tile + 1) / m_tiles;
+
+    const std::size_t luma_size = std::size_t{m_width} * m_height;
+    const std::size_t chroma_stride = m_width / 2;
+    const std::size_t chroma_plane_size = chroma_stride * (m_height / 2);
+
+    for (std::size_t pair = begin; pair < end; pair++) {
+        const auto *yuyv_top = source + 2 * pair * m_bytesperline;
+        const auto *yuyv_bottom = yuyv_top + m_bytesperline;
+        auto *y_top = target + 2 * pair * m_width;
+        auto *y_bottom = y_top + m_width;
+
+        if (m_target_format == V4L2_PIX_FMT_NV12) {
+            auto *uv = target + luma_size + pair * m_width;
+            m_kernels->yuyv_to_nv12(yuyv_top, yuyv_bottom, y_top, y_bottom, uv, m_width);
+        } else {
+            auto *u = target + luma_size + pair * chroma_stride;
+            auto *v = target + luma_size + chroma_plane_size + pair * chroma_stride;
+            m_kernels->yuyv_to_i420(yuyv_top, yuyv_bottom, y_top, y_bottom, u, v, m_width);
+        }
+    }
+}
+
+void FormatConverter::work(std::size_t tile) {
+    std::uint64_t converted = 0;
+
+    while (true) {
+        const std::uint8_t *source;
+        std::uint8_t *target;
+
+        {
+            std::unique_lock lock{m_mutex};
+
+            m_start.wait(lock, [this, converted] { return m_stop || m_generation != converted; });
+
+            if (m_stop) {
+                return;
+            }
+
+            converted = m_generation;
+            source = m_source;
+            target = m_target;
+        }
+
+        convert_tile(source, target, tile);
+
+        std::lock_guard lock{m_mutex};
+
+        if (--m_tiles_left == 0) {
+            m_done.notify_one();
+        }
+    }
+}
+
+void FormatConverter::convert(const DmaBuf &source, const DmaBuf &target) {
+    PRECONDITION(source.get_size() >= std::size_t{m_bytesperline} * m_height, "Source buffer is too small");
+    PRECONDITION(target.get_size() >= target_size(), "Target buffer is too small");
+
+    const DmaBufAccess source_access{source, DmaBufAccess::Mode::Read};
+    const DmaBufAccess target_access{target, DmaBufAccess::Mode::Write};
+
+    convert(reinterpret_cast<const std::uint8_t *>(source_access.data().data()),
+            reinterpret_cast<std::uint8_t *>(target_access.writable_data().data()));
+}
+
+void FormatConverter::convert(const std::uint8_t *source, std::uint8_t *target) {
+    if (m_workers.empty()) {
+        convert_tile(source, target, 0);
+        return;
+    }
+
+    {
+        std::lock_guard lock{m_mutex};
+        m_source = source;
+        m_target = target;
+        m_tiles_left = m_workers.size();
+        m_generation++;
+    }
+
+    m_start.notify_all();
+
+    convert_tile(source, target, 0);
+
+    std::unique_lock lock{m_mutex};
+
+    m_done.wait(lock, [this] { return m_tiles_left == 0; });
+}
+
+FormatConverter::~FormatConverter() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_stop = true;
+    }
+
+    m_start.notify_all();
+
+    for (auto &worker: m_workers) {
+        worker.join();
+    }
+}
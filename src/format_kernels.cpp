@@ -0,0 +1,272 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "format_kernels.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+std::uint32_t yuyv_bytesperline(const v4l2_pix_format &format) {
+    return format.bytesperline != 0 ? format.bytesperline : format.width * 2;
+}
+
+static std::uint8_t average(std::uint8_t a, std::uint8_t b) {
+    return static_cast<std::uint8_t>((a + b + 1) >> 1);
+}
+
+/* converts the pixels [begin, width), begin is even */
+static void yuyv_to_nv12_pixels(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                                std::uint8_t *y_bottom, std::uint8_t *uv, std::size_t begin, std::size_t width) {
+    for (std::size_t x = begin; x < width; x += 2) {
+        const auto *top = yuyv_top + 2 * x;
+        const auto *bottom = yuyv_bottom + 2 * x;
+
+        y_top[x] = top[0];
+        y_top[x + 1] = top[2];
+        y_bottom[x] = bottom[0];
+        y_bottom[x + 1] = bottom[2];
+        uv[x] = average(top[1], bottom[1]);
+        uv[x + 1] = average(top[3], bottom[3]);
+    }
+}
+
+static void yuyv_to_i420_pixels(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                                std::uint8_t *y_bottom, std::uint8_t *u, std::uint8_t *v, std::size_t begin,
+                                std::size_t width) {
+    for (std::size_t x = begin; x < width; x += 2) {
+        const auto *top = yuyv_top + 2 * x;
+        const auto *bottom = yuyv_bottom + 2 * x;
+
+        y_top[x] = top[0];
+        y_top[x + 1] = top[2];
+        y_bottom[x] = bottom[0];
+        y_bottom[x + 1] = bottom[2];
+        u[x / 2] = average(top[1], bottom[1]);
+        v[x / 2] = average(top[3], bottom[3]);
+    }
+}
+
+static void yuyv_to_nv12_scalar(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                                std::uint8_t *y_bottom, std::uint8_t *uv, std::size_t width) {
+    yuyv_to_nv12_pixels(yuyv_top, yuyv_bottom, y_top, y_bottom, uv, 0, width);
+}
+
+static void yuyv_to_i420_scalar(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                                std::uint8_t *y_bottom, std::uint8_t *u, std::uint8_t *v, std::size_t width) {
+    yuyv_to_i420_pixels(yuyv_top, yuyv_bottom, y_top, y_bottom, u, v, 0, width);
+}
+
+#if defined(__x86_64__)
+
+/*
+ * Splits 16 pixels of a YUYV row into 16 luma bytes and 8 interleaved chroma pairs. The luma samples are the low
+ * bytes of every 16 bit lane, the chroma samples the high bytes.
+ */
+__attribute__((target("sse4.1")))
+static void split_yuyv_sse4(const std::uint8_t *yuyv, __m128i &luma, __m128i &chroma) {
+    const __m128i low_byte = _mm_set1_epi16(0xff);
+
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(yuyv));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(yuyv + 16));
+
+    luma = _mm_packus_epi16(_mm_and_si128(a, low_byte), _mm_and_si128(b, low_byte));
+    chroma = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+__attribute__((target("sse4.1")))
+static __m128i convert_pixels_sse4(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                                   std::uint8_t *y_bottom) {
+    __m128i luma_top, chroma_top, luma_bottom, chroma_bottom;
+
+    split_yuyv_sse4(yuyv_top, luma_top, chroma_top);
+    split_yuyv_sse4(yuyv_bottom, luma_bottom, chroma_bottom);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y_top), luma_top);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y_bottom), luma_bottom);
+
+    /* pavgb rounds up like the scalar average */
+    return _mm_avg_epu8(chroma_top, chroma_bottom);
+}
+
+__attribute__((target("sse4.1")))
+static void yuyv_to_nv12_sse4(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                              std::uint8_t *y_bottom, std::uint8_t *uv, std::size_t width) {
+    std::size_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        const __m128i chroma = convert_pixels_sse4(yuyv_top + 2 * x, yuyv_bottom + 2 * x, y_top + x, y_bottom + x);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(uv + x), chroma);
+    }
+
+    yuyv_to_nv12_pixels(yuyv_top, yuyv_bottom, y_top, y_bottom, uv, x, width);
+}
+
+__attribute__((target("sse4.1")))
+static void yuyv_to_i420_sse4(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                              std::uint8_t *y_bottom, std::uint8_t *u, std::uint8_t *v, std::size_t width) {
+    const __m128i low_byte = _mm_set1_epi16(0xff);
+
+    std::size_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        const __m128i chroma = convert_pixels_sse4(yuyv_top + 2 * x, yuyv_bottom + 2 * x, y_top + x, y_bottom + x);
+        /* 8 U samples followed by 8 V samples */
+        const __m128i planar = _mm_packus_epi16(_mm_and_si128(chroma, low_byte), _mm_srli_epi16(chroma, 8));
+
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(u + x / 2), planar);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(v + x / 2), _mm_srli_si128(planar, 8));
+    }
+
+    yuyv_to_i420_pixels(yuyv_top, yuyv_bottom, y_top, y_bottom, u, v, x, width);
+}
+
+/* 32 pixels of a YUYV row, the packs interleave the 128 bit lanes and are put back in order with a permute */
+__attribute__((target("avx2")))
+static void split_yuyv_avx2(const std::uint8_t *yuyv, __m256i &luma, __m256i &chroma) {
+    const __m256i low_byte = _mm256_set1_epi16(0xff);
+
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(yuyv));
+    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(yuyv + 32));
+
+    luma = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(a, low_byte), _mm256_and_si256(b, low_byte)),
+                                    0xd8);
+    chroma = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+}
+
+__attribute__((target("avx2")))
+static __m256i convert_pixels_avx2(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                                   std::uint8_t *y_bottom) {
+    __m256i luma_top, chroma_top, luma_bottom, chroma_bottom;
+
+    split_yuyv_avx2(yuyv_top, luma_top, chroma_top);
+    split_yuyv_avx2(yuyv_bottom, luma_bottom, chroma_bottom);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(y_top), luma_top);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(y_bottom), luma_bottom);
+
+    /* the average is per byte, so the chroma lanes are put in order once afterwards */
+    return _mm256_permute4x64_epi64(_mm256_avg_epu8(chroma_top, chroma_bottom), 0xd8);
+}
+
+__attribute__((target("avx2")))
+static void yuyv_to_nv12_avx2(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                              std::uint8_t *y_bottom, std::uint8_t *uv, std::size_t width) {
+    std::size_t x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+        const __m256i chroma = convert_pixels_avx2(yuyv_top + 2 * x, yuyv_bottom + 2 * x, y_top + x, y_bottom + x);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(uv + x), chroma);
+    }
+
+    yuyv_to_nv12_pixels(yuyv_top, yuyv_bottom, y_top, y_bottom, uv, x, width);
+}
+
+__attribute__((target("avx2")))
+static void yuyv_to_i420_avx2(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                              std::uint8_t *y_bottom, std::uint8_t *u, std::uint8_t *v, std::size_t width) {
+    const __m256i low_byte = _mm256_set1_epi16(0xff);
+
+    std::size_t x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+        const __m256i chroma = convert_pixels_avx2(yuyv_top + 2 * x, yuyv_bottom + 2 * x, y_top + x, y_bottom + x);
+        /* 16 U samples in the low lane, 16 V samples in the high lane */
+        const __m256i planar = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(_mm256_and_si256(chroma, low_byte), _mm256_srli_epi16(chroma, 8)), 0xd8);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(u + x / 2), _mm256_castsi256_si128(planar));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(v + x / 2), _mm256_extracti128_si256(planar, 1));
+    }
+
+    yuyv_to_i420_pixels(yuyv_top, yuyv_bottom, y_top, y_bottom, u, v, x, width);
+}
+
+#elif defined(__aarch64__)
+
+/* 16 pixels of both rows, returns 8 averaged chroma pairs */
+static uint8x16_t convert_pixels_neon(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom,
+                                      std::uint8_t *y_top, std::uint8_t *y_bottom) {
+    /* de-interleaves luma and chroma bytes */
+    const uint8x16x2_t top = vld2q_u8(yuyv_top);
+    const uint8x16x2_t bottom = vld2q_u8(yuyv_bottom);
+
+    vst1q_u8(y_top, top.val[0]);
+    vst1q_u8(y_bottom, bottom.val[0]);
+
+    return vrhaddq_u8(top.val[1], bottom.val[1]);
+}
+
+static void yuyv_to_nv12_neon(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                              std::uint8_t *y_bottom, std::uint8_t *uv, std::size_t width) {
+    std::size_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        vst1q_u8(uv + x, convert_pixels_neon(yuyv_top + 2 * x, yuyv_bottom + 2 * x, y_top + x, y_bottom + x));
+    }
+
+    yuyv_to_nv12_pixels(yuyv_top, yuyv_bottom, y_top, y_bottom, uv, x, width);
+}
+
+static void yuyv_to_i420_neon(const std::uint8_t *yuyv_top, const std::uint8_t *yuyv_bottom, std::uint8_t *y_top,
+                              std::uint8_t *y_bottom, std::uint8_t *u, std::uint8_t *v, std::size_t width) {
+    std::size_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16_t chroma = convert_pixels_neon(yuyv_top + 2 * x, yuyv_bottom + 2 * x, y_top + x, y_bottom + x);
+        const uint8x8x2_t planar = vuzp_u8(vget_low_u8(chroma), vget_high_u8(chroma));
+
+        vst1_u8(u + x / 2, planar.val[0]);
+        vst1_u8(v + x / 2, planar.val[1]);
+    }
+
+    yuyv_to_i420_pixels(yuyv_top, yuyv_bottom, y_top, y_bottom, u, v, x, width);
+}
+
+#endif
+
+const FormatKernels &scalar_format_kernels() {
+    static constexpr FormatKernels kernels{"scalar", yuyv_to_nv12_scalar, yuyv_to_i420_scalar};
+    return kernels;
+}
+
+#if defined(__x86_64__)
+static constexpr FormatKernels SSE4_KERNELS{"sse4.1", yuyv_to_nv12_sse4, yuyv_to_i420_sse4};
+static constexpr FormatKernels AVX2_KERNELS{"avx2", yuyv_to_nv12_avx2, yuyv_to_i420_avx2};
+#elif defined(__aarch64__)
+static constexpr FormatKernels NEON_KERNELS{"neon", yuyv_to_nv12_neon, yuyv_to_i420_neon};
+#endif
+
+const FormatKernels &best_format_kernels() {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        return AVX2_KERNELS;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SSE4_KERNELS;
+    }
+#elif defined(__aarch64__)
+    return NEON_KERNELS;
+#endif
+    return scalar_format_kernels();
+}
+
+std::vector<const FormatKernels *> supported_format_kernels() {
+    std::vector<const FormatKernels *> kernels{&scalar_format_kernels()};
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.1")) {
+        kernels.push_back(&SSE4_KERNELS);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back(&AVX2_KERNELS);
+    }
+#elif defined(__aarch64__)
+    kernels.push_back(&NEON_KERNELS);
+#endif
+
+    return kernels;
+}
@@ -0,0 +1,571 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "frame_server.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <poll.h>
+#include <unistd.h>
+#include <plog/Log.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "condition.hpp"
+#include "dmabuf_operations.hpp"
+#include "exceptions.hpp"
+
+/* ring memfd, ready and release eventfd */
+static constexpr std::size_t CONTROL_FDS{3};
+
+union FdControl {
+    cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int) * (CONTROL_FDS + MAX_SHARED_BUFFERS))];
+};
+
+static sockaddr_un socket_address(const std::string &path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw NetworkError{"Socket path too long: " + path};
+    }
+
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+static void signal_event(int event_fd) {
+    const std::uint64_t one = 1;
+    /* a full counter already wakes the reader */
+    [[maybe_unused]] const auto written = write(event_fd, &one, sizeof(one));
+}
+
+static void clear_event(int event_fd) {
+    std::uint64_t count;
+    [[maybe_unused]] const auto read_bytes = read(event_fd, &count, sizeof(count));
+}
+
+FrameServer::FrameServer(const std::string &socket_path, Config config)
+    : m_listen_fd(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)),
+      m_path(socket_path),
+      m_config(config) {
+    PRECONDITION(config.max_outstanding >= 1 && config.max_outstanding <= FRAME_RING_SIZE,
+                 "Outstanding frames must be in [1, FRAME_RING_SIZE]");
+
+    if (m_listen_fd == -1) {
+        PLOGE << "Failed to create frame server socket: " << std::strerror(errno);
+        throw NetworkError{"Failed to create frame server socket"};
+    }
+
+    const auto address = socket_address(socket_path);
+    unlink(socket_path.c_str());
+
+    if (bind(m_listen_fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == -1 ||
+        listen(m_listen_fd, 8) == -1) {
+        PLOGE << "Failed to listen on " << socket_path << ": " << std::strerror(errno);
+        close(m_listen_fd);
+        throw NetworkError{"Failed to listen on " + socket_path};
+    }
+
+    m_release_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (m_release_event == -1) {
+        PLOGE << "Failed to create release eventfd: " << std::strerror(errno);
+        close(m_listen_fd);
+        unlink(socket_path.c_str());
+        throw NetworkError{"Failed to create release eventfd"};
+    }
+}
+
+void FrameServer::share_buffers(const std::vector<const DmaBuf *> &buffers) {
+    PRECONDITION(buffers.size() <= MAX_SHARED_BUFFERS, "Too many buffers to share");
+    PRECONDITION(m_buffer_fds.empty(), "Frame server is already prepared");
+
+    for (const auto *buffer: buffers) {
+        const int fd = fcntl(buffer->get_fd(), F_DUPFD_CLOEXEC, 0);
+
+        if (fd == -1) {
+            PLOGE << "Failed to duplicate buffer fd: " << std::strerror(errno);
+            throw DeviceFileError{"Failed to duplicate buffer fd"};
+        }
+        m_buffer_fds.push_back(fd);
+    }
+
+    m_slots.resize(buffers.size());
+}
+
+void FrameServer::prepare(const std::vector<const DmaBuf *> &buffers) {
+    m_format = {};
+    m_format.pixelformat = V4L2_PIX_FMT_H264;
+
+    share_buffers(buffers);
+}
+
+void FrameServer::prepare(const v4l2_pix_format &format, const std::vector<const DmaBuf *> &buffers) {
+    m_format = format;
+
+    share_buffers(buffers);
+}
+
+void FrameServer::add_subscriber(int socket) {
+    const int ring_fd = memfd_create("frame_ring", MFD_CLOEXEC);
+    void *map = MAP_FAILED;
+
+    if (ring_fd != -1 && ftruncate(ring_fd, sizeof(FrameRing)) == 0) {
+        map = mmap(nullptr, sizeof(FrameRing), PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+    }
+
+    const int ready_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (map == MAP_FAILED || ready_event == -1) {
+        PLOGW << "Failed to set up a control ring, rejecting subscriber: " << std::strerror(errno);
+        if (map != MAP_FAILED) {
+            munmap(map, sizeof(FrameRing));
+        }
+        if (ring_fd != -1) {
+            close(ring_fd);
+        }
+        if (ready_event != -1) {
+            close(ready_event);
+        }
+        close(socket);
+        return;
+    }
+
+    auto *ring = new(map) FrameRing{};
+
+    FrameServerHello hello = {};
+    hello.version = FRAME_SERVER_VERSION;
+    hello.buffer_count = static_cast<std::uint32_t>(m_buffer_fds.size());
+    hello.format = m_format;
+
+    iovec iov{&hello, sizeof(hello)};
+    FdControl control = {};
+    msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * (CONTROL_FDS + m_buffer_fds.size()));
+
+    auto *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * (CONTROL_FDS + m_buffer_fds.size()));
+
+    /* the buffer fds go out once, every frame after this is only an index in the ring */
+    auto *fds = reinterpret_cast<int *>(CMSG_DATA(cmsg));
+    fds[0] = ring_fd;
+    fds[1] = ready_event;
+    fds[2] = m_release_event;
+    std::memcpy(fds + CONTROL_FDS, m_buffer_fds.data(), m_buffer_fds.size() * sizeof(int));
+
+    const auto sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+
+    /* the mapping keeps the ring alive */
+    close(ring_fd);
+
+    if (sent != static_cast<ssize_t>(sizeof(hello))) {
+        PLOGW << "Failed to send the buffers to a subscriber: " << std::strerror(errno);
+        munmap(ring, sizeof(FrameRing));
+        close(ready_event);
+        close(socket);
+        return;
+    }
+
+    m_subscribers.push_back({socket, ready_event, ring, 0, 0});
+
+    PLOGI << "Frame subscriber connected, " << m_subscribers.size() << " subscribers";
+}
+
+void FrameServer::accept_subscribers() {
+    /* a subscriber that connects before the buffers are known waits in the backlog */
+    if (m_buffer_fds.empty()) {
+        return;
+    }
+
+    while (true) {
+        const int socket = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+
+        if (socket == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                PLOGW << "Failed to accept frame subscriber: " << std::strerror(errno);
+            }
+            if (errno != EINTR) {
+                return;
+            }
+            continue;
+        }
+
+        add_subscriber(socket);
+    }
+}
+
+void FrameServer::release(Subscriber &subscriber, std::uint32_t buffer) {
+    const auto bit = std::uint64_t{1} << (buffer % MAX_SHARED_BUFFERS);
+
+    if (buffer >= m_slots.size() || (subscriber.held & bit) == 0) {
+        PLOGW << "Subscriber released buffer " << buffer << " it does not hold";
+        return;
+    }
+
+    subscriber.held &= ~bit;
+    subscriber.outstanding--;
+
+    auto &slot = m_slots[buffer];
+
+    /* the last release hands the buffer back to the driver */
+    if (--slot.pending == 0) {
+        slot.encoded.reset();
+        slot.camera.reset();
+    }
+}
+
+void FrameServer::remove_subscriber(std::size_t position) {
+    auto &subscriber = m_subscribers[position];
+
+    while (subscriber.held != 0) {
+        release(subscriber, static_cast<std::uint32_t>(std::countr_zero(subscriber.held)));
+    }
+
+    munmap(subscriber.ring, sizeof(FrameRing));
+    close(subscriber.ready_event);
+    close(subscriber.socket);
+
+    m_subscribers.erase(m_subscribers.begin() + static_cast<std::ptrdiff_t>(position));
+
+    PLOGI << "Frame subscriber disconnected, " << m_subscribers.size() << " subscribers";
+}
+
+void FrameServer::drain_releases() {
+    clear_event(m_release_event);
+
+    for (std::size_t i = 0; i < m_subscribers.size();) {
+        auto &subscriber = m_subscribers[i];
+        auto *ring = subscriber.ring;
+
+        auto head = ring->release_head.load(std::memory_order_relaxed);
+        const auto tail = ring->release_tail.load(std::memory_order_acquire);
+
+        /* the ring is writable by the subscriber, never trust it */
+        if (tail - head > FRAME_RING_SIZE) {
+            PLOGW << "Subscriber corrupted its control ring";
+            remove_subscriber(i);
+            continue;
+        }
+
+        for (; head != tail; head++) {
+            release(subscriber, ring->release[head % FRAME_RING_SIZE]);
+        }
+
+        ring->release_head.store(head, std::memory_order_release);
+        i++;
+    }
+}
+
+void FrameServer::drop_disconnected() {
+    for (std::size_t i = 0; i < m_subscribers.size();) {
+        char byte;
+        const auto received = recv(m_subscribers[i].socket, &byte, 1, MSG_DONTWAIT | MSG_PEEK);
+
+        /* subscribers never send, end of file or an error means the process is gone */
+        if (received == 0 || (received == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            remove_subscriber(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+void FrameServer::service() {
+    accept_subscribers();
+    drain_releases();
+    drop_disconnected();
+}
+
+std::uint32_t FrameServer::publish(const BufferInfo &info) {
+    service();
+
+    PRECONDITION(info.index < m_slots.size(), "Frame of a buffer that was not shared");
+
+    auto &slot = m_slots[info.index];
+
+    PRECONDITION(slot.pending == 0, "Buffer published again before every subscriber released it");
+
+    const auto bit = std::uint64_t{1} << info.index;
+
+    for (auto &subscriber: m_subscribers) {
+        if (subscriber.outstanding >= m_config.max_outstanding) {
+            m_frames_skipped++;
+            continue;
+        }
+
+        auto *ring = subscriber.ring;
+        const auto tail = ring->ready_tail.load(std::memory_order_relaxed);
+        ring->ready[tail % FRAME_RING_SIZE] = info;
+        ring->ready_tail.store(tail + 1, std::memory_order_release);
+
+        subscriber.held |= bit;
+        subscriber.outstanding++;
+        slot.pending++;
+
+        signal_event(subscriber.ready_event);
+    }
+
+    if (slot.pending > 0) {
+        m_frames_published++;
+    }
+
+    return slot.pending;
+}
+
+void FrameServer::consume(EncodedFrame &&frame) {
+    const auto index = frame.info().index;
+
+    if (publish(frame.info()) > 0) {
+        m_slots[index].encoded.emplace(std::move(frame));
+    }
+}
+
+void FrameServer::consume(CameraFrameHold &&hold, const BufferInfo &info) {
+    PRECONDITION(hold.data() == info.index, "Hold of another camera buffer");
+
+    if (publish(info) > 0) {
+        m_slots[info.index].camera.emplace(std::move(hold));
+    }
+}
+
+int FrameServer::release_fd() const {
+    return m_release_event;
+}
+
+void FrameServer::attach(EventReactor &reactor) {
+    PRECONDITION(m_reactor == nullptr, "Frame server is already attached to a reactor");
+
+    reactor.add(m_listen_fd, EPOLLIN, [this](std::uint32_t) { service(); });
+    reactor.add(m_release_event, EPOLLIN, [this](std::uint32_t) { service(); });
+
+    m_reactor = &reactor;
+}
+
+void FrameServer::detach() {
+    if (m_reactor == nullptr) {
+        return;
+    }
+
+    m_reactor->remove(m_listen_fd);
+    m_reactor->remove(m_release_event);
+
+    m_reactor = nullptr;
+}
+
+std::size_t FrameServer::subscribers() const {
+    return m_subscribers.size();
+}
+
+std::size_t FrameServer::frames_held() const {
+    return static_cast<std::size_t>(std::ranges::count_if(m_slots, [](const Slot &slot) {
+        return slot.pending > 0;
+    }));
+}
+
+std::uint64_t FrameServer::frames_published() const {
+    return m_frames_published;
+}
+
+std::uint64_t FrameServer::frames_skipped() const {
+    return m_frames_skipped;
+}
+
+FrameServer::~FrameServer() {
+    detach();
+
+    while (!m_subscribers.empty()) {
+        remove_subscriber(m_subscribers.size() - 1);
+    }
+
+    for (const int fd: m_buffer_fds) {
+        close(fd);
+    }
+
+    close(m_release_event);
+    close(m_listen_fd);
+    unlink(m_path.c_str());
+}
+
+FrameSubscriber::FrameSubscriber(const std::string &socket_path)
+    : m_socket(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) {
+    if (m_socket == -1) {
+        PLOGE << "Failed to create subscriber socket: " << std::strerror(errno);
+        throw NetworkError{"Failed to create subscriber socket"};
+    }
+
+    const auto address = socket_address(socket_path);
+
+    if (connect(m_socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == -1) {
+        PLOGE << "Failed to connect to frame server " << socket_path << ": " << std::strerror(errno);
+        close_all();
+        throw NetworkError{"Failed to connect to frame server at " + socket_path};
+    }
+
+    FrameServerHello hello = {};
+    iovec iov{&hello, sizeof(hello)};
+    FdControl control = {};
+    msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    /* the server sends the hello once it services the connection */
+    ssize_t received;
+    do {
+        received = recvmsg(m_socket, &message, MSG_CMSG_CLOEXEC);
+    } while (received == -1 && errno == EINTR);
+
+    std::vector<int> fds;
+    for (auto *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            const auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const auto *data = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+            fds.insert(fds.end(), data, data + count);
+        }
+    }
+
+    const bool valid = received == static_cast<ssize_t>(sizeof(hello)) && (message.msg_flags & MSG_CTRUNC) == 0 &&
+                       hello.version == FRAME_SERVER_VERSION && fds.size() == CONTROL_FDS + hello.buffer_count;
+
+    if (!valid) {
+        for (const int fd: fds) {
+            close(fd);
+        }
+        close_all();
+        throw NetworkError{"Invalid hello from frame server at " + socket_path};
+    }
+
+    m_format = hello.format;
+    m_ready_event = fds[1];
+    m_release_event = fds[2];
+    m_buffer_fds.assign(fds.begin() + CONTROL_FDS, fds.end());
+
+    auto *ring = mmap(nullptr, sizeof(FrameRing), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+
+    if (ring == MAP_FAILED) {
+        PLOGE << "Failed to map the control ring: " << std::strerror(errno);
+        close_all();
+        throw NetworkError{"Failed to map the control ring"};
+    }
+    m_ring = static_cast<FrameRing *>(ring);
+
+    for (const int fd: m_buffer_fds) {
+        /* dma-bufs report their size on seeking to the end */
+        const auto size = lseek(fd, 0, SEEK_END);
+        auto *map = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+        if (map == MAP_FAILED) {
+            PLOGE << "Failed to map a shared buffer: " << std::strerror(errno);
+            close_all();
+            throw DeviceFileError{"Failed to map a shared buffer"};
+        }
+        m_maps.emplace_back(static_cast<const std::byte *>(map), static_cast<std::size_t>(size));
+    }
+}
+
+void FrameSubscriber::close_all() noexcept {
+    for (const auto &map: m_maps) {
+        munmap(const_cast<std::byte *>(map.data()), map.size());
+    }
+    m_maps.clear();
+
+    for (const int fd: m_buffer_fds) {
+        close(fd);
+    }
+    m_buffer_fds.clear();
+
+    if (m_ring != nullptr) {
+        munmap(m_ring, sizeof(FrameRing));
+        m_ring = nullptr;
+    }
+
+    for (int *fd: {&m_ready_event, &m_release_event, &m_socket}) {
+        if (*fd != -1) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+std::optional<SubscribedFrame> FrameSubscriber::try_receive() {
+    const auto head = m_ring->ready_head.load(std::memory_order_relaxed);
+
+    if (head == m_ring->ready_tail.load(std::memory_order_acquire)) {
+        return std::nullopt;
+    }
+
+    const auto info = m_ring->ready[head % FRAME_RING_SIZE];
+    m_ring->ready_head.store(head + 1, std::memory_order_release);
+
+    PRECONDITION(info.index < m_maps.size(), "Frame server published an unknown buffer");
+
+    dmabuf_sync_start(m_buffer_fds[info.index], DMA_BUF_SYNC_READ);
+
+    const auto &map = m_maps[info.index];
+    return SubscribedFrame{info, map.first(std::min<std::size_t>(info.bytesused, map.size()))};
+}
+
+std::optional<SubscribedFrame> FrameSubscriber::receive(std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    while (true) {
+        if (auto frame = try_receive()) {
+            return frame;
+        }
+
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+
+        if (remaining.count() < 0) {
+            return std::nullopt;
+        }
+
+        pollfd descriptor{m_ready_event, POLLIN, 0};
+        if (poll(&descriptor, 1, static_cast<int>(remaining.count())) == 1) {
+            clear_event(m_ready_event);
+        }
+    }
+}
+
+void FrameSubscriber::release(const SubscribedFrame &frame) {
+    dmabuf_sync_stop(m_buffer_fds[frame.info.index], DMA_BUF_SYNC_READ);
+
+    const auto tail = m_ring->release_tail.load(std::memory_order_relaxed);
+    m_ring->release[tail % FRAME_RING_SIZE] = frame.info.index;
+    m_ring->release_tail.store(tail + 1, std::memory_order_release);
+
+    signal_event(m_release_event);
+}
+
+const v4l2_pix_format &FrameSubscriber::format() const {
+    return m_format;
+}
+
+std::size_t FrameSubscriber::buffer_count() const {
+    return m_buffer_fds.size();
+}
+
+int FrameSubscriber::ready_fd() const {
+    return m_ready_event;
+}
+
+FrameSubscriber::~FrameSubscriber() {
+    close_all();
+}
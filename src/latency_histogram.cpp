@@ -0,0 +1,109 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "latency_histogram.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "condition.hpp"
+
+std::size_t LatencyHistogram::bucket_index(std::uint64_t value) {
+    value = std::min(value, (std::uint64_t{1} << MAX_MAGNITUDE) - 1);
+
+    if (value < SUB_BUCKETS) {
+        return value;
+    }
+
+    const unsigned magnitude = std::bit_width(value) - 1;
+    const unsigned shift = magnitude - SUB_BUCKET_BITS;
+    const auto sub_bucket = static_cast<std::size_t>(value >> shift) - SUB_BUCKETS;
+
+    return (shift + 1) * SUB_BUCKETS + sub_bucket;
+}
+
+std::uint64_t LatencyHistogram::bucket_highest_value(std::size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+
+    const auto shift = static_cast<unsigned>(index / SUB_BUCKETS - 1);
+    const auto sub_bucket = index % SUB_BUCKETS;
+
+    return ((SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(std::uint64_t value_ns) {
+    m_counts[bucket_index(value_ns)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value_ns, std::memory_order_relaxed);
+
+    auto current_min = m_min.load(std::memory_order_relaxed);
+    while (value_ns < current_min && !m_min.compare_exchange_weak(current_min, value_ns,
+                                                                  std::memory_order_relaxed)) {
+    }
+
+    auto current_max = m_max.load(std::memory_order_relaxed);
+    while (value_ns > current_max && !m_max.compare_exchange_weak(current_max, value_ns,
+                                                                  std::memory_order_relaxed)) {
+    }
+}
+
+std::uint64_t LatencyHistogram::percentile(double percentile) const {
+    PRECONDITION(percentile >= 0.0 && percentile <= 100.0, "Percentile must be in [0, 100]");
+
+    const auto total = count();
+
+    if (total == 0) {
+        return 0;
+    }
+
+    const auto target = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(
+                                                     std::ceil(percentile / 100.0 * static_cast<double>(total))));
+
+    std::uint64_t seen = 0;
+
+    for (std::size_t i = 0; i < BUCKET_COUNT; i++) {
+        seen += m_counts[i].load(std::memory_order_relaxed);
+
+        if (seen >= target) {
+            return std::min(bucket_highest_value(i), max());
+        }
+    }
+
+    return max();
+}
+
+std::uint64_t LatencyHistogram::count() const {
+    return m_count.load(std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::min() const {
+    return count() == 0 ? 0 : m_min.load(std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::max() const {
+    return m_max.load(std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::mean() const {
+    const auto total = count();
+    return total == 0 ? 0 : m_sum.load(std::memory_order_relaxed) / total;
+}
+
+LatencySummary LatencyHistogram::summary() const {
+    return {count(), min(), mean(), percentile(50.0), percentile(99.0), percentile(99.9), max()};
+}
+
+void LatencyHistogram::reset() {
+    for (auto &bucket: m_counts) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_min.store(UINT64_MAX, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
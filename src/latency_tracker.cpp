@@ -0,0 +1,168 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "latency_tracker.hpp"
+
+#include <algorithm>
+#include <ctime>
+#include <utility>
+
+static std::uint64_t timestamp_key(const BufferInfo &info) {
+    return static_cast<std::uint64_t>(info.timestamp.tv_sec) * 1000000000 +
+           static_cast<std::uint64_t>(info.timestamp.tv_usec) * 1000;
+}
+
+const char *latency_stage_name(LatencyStage stage) {
+    switch (stage) {
+        case LatencyStage::SensorToCameraDequeue:
+            return "sensor -> camera dqbuf";
+        case LatencyStage::CameraDequeueToEncoderQueue:
+            return "camera dqbuf -> encoder qbuf";
+        case LatencyStage::EncoderQueueToOutputDequeue:
+            return "encoder qbuf -> output dqbuf";
+        case LatencyStage::OutputDequeueToCaptureDequeue:
+            return "output dqbuf -> capture dqbuf";
+        case LatencyStage::CaptureDequeueToSinkRelease:
+            return "capture dqbuf -> sink release";
+        case LatencyStage::EndToEnd:
+            return "sensor -> sink release";
+        default:
+            return "unknown";
+    }
+}
+
+SinkRelease::SinkRelease(std::weak_ptr<LatencyTracker> tracker, std::uint64_t sensor_ns,
+                         std::uint64_t capture_dequeue_ns) : m_tracker(std::move(tracker)),
+                                                             m_sensor_ns(sensor_ns),
+                                                             m_capture_dequeue_ns(capture_dequeue_ns) {
+}
+
+SinkRelease::SinkRelease(SinkRelease &&other) noexcept : m_tracker(std::move(other.m_tracker)),
+                                                         m_sensor_ns(other.m_sensor_ns),
+                                                         m_capture_dequeue_ns(other.m_capture_dequeue_ns) {
+    other.m_tracker.reset();
+}
+
+SinkRelease &SinkRelease::operator=(SinkRelease &&other) noexcept {
+    if (this == &other) {
+        return *this;
+    }
+
+    record();
+
+    m_tracker = std::move(other.m_tracker);
+    m_sensor_ns = other.m_sensor_ns;
+    m_capture_dequeue_ns = other.m_capture_dequeue_ns;
+    other.m_tracker.reset();
+
+    return *this;
+}
+
+void SinkRelease::record() noexcept {
+    const auto tracker = m_tracker.lock();
+
+    if (!tracker) {
+        return;
+    }
+
+    const auto release_ns = LatencyTracker::now_ns();
+
+    tracker->record(LatencyStage::CaptureDequeueToSinkRelease, m_capture_dequeue_ns, release_ns);
+
+    if (m_sensor_ns != 0) {
+        tracker->record(LatencyStage::EndToEnd, m_sensor_ns, release_ns);
+    }
+
+    m_tracker.reset();
+}
+
+SinkRelease::~SinkRelease() {
+    record();
+}
+
+std::uint64_t LatencyTracker::now_ns() {
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<std::uint64_t>(now.tv_sec) * 1000000000 + static_cast<std::uint64_t>(now.tv_nsec);
+}
+
+LatencyTracker::FrameTimes *LatencyTracker::find_frame(const BufferInfo &info) {
+    const auto key = timestamp_key(info);
+
+    auto frame = std::ranges::find(m_frames, key, &FrameTimes::key);
+
+    return frame == m_frames.end() ? nullptr : &*frame;
+}
+
+void LatencyTracker::record(LatencyStage stage, std::uint64_t begin_ns, std::uint64_t end_ns) {
+    /* the stages are taken on different queues, a stage that ended before it began counts as 0 */
+    m_histograms[static_cast<std::size_t>(stage)].record(end_ns > begin_ns ? end_ns - begin_ns : 0);
+}
+
+void LatencyTracker::camera_dequeued(const BufferInfo &camera_info) {
+    const auto dequeue_ns = now_ns();
+    const auto sensor_ns = camera_info.has_monotonic_timestamp() ? timestamp_key(camera_info) : 0;
+
+    if (sensor_ns != 0) {
+        record(LatencyStage::SensorToCameraDequeue, sensor_ns, dequeue_ns);
+    }
+
+    if (m_frames.size() == MAX_FRAMES_IN_FLIGHT) {
+        m_frames.erase(m_frames.begin());
+    }
+
+    m_frames.push_back({timestamp_key(camera_info), sensor_ns, dequeue_ns, 0, 0});
+}
+
+void LatencyTracker::encoder_queued(const BufferInfo &camera_info) {
+    auto *frame = find_frame(camera_info);
+
+    if (frame == nullptr) {
+        return;
+    }
+
+    frame->encoder_queue_ns = now_ns();
+    record(LatencyStage::CameraDequeueToEncoderQueue, frame->camera_dequeue_ns, frame->encoder_queue_ns);
+}
+
+void LatencyTracker::output_dequeued(const BufferInfo &camera_info) {
+    auto *frame = find_frame(camera_info);
+
+    if (frame == nullptr || frame->encoder_queue_ns == 0) {
+        return;
+    }
+
+    frame->output_dequeue_ns = now_ns();
+    record(LatencyStage::EncoderQueueToOutputDequeue, frame->encoder_queue_ns, frame->output_dequeue_ns);
+}
+
+SinkRelease LatencyTracker::capture_dequeued(const BufferInfo &encoded_info) {
+    const auto dequeue_ns = now_ns();
+    const auto *frame = find_frame(encoded_info);
+
+    if (frame == nullptr) {
+        return {weak_from_this(), 0, dequeue_ns};
+    }
+
+    /* the capture buffer can be dequeued before the output buffer, that frame has no output stage */
+    if (frame->output_dequeue_ns != 0) {
+        record(LatencyStage::OutputDequeueToCaptureDequeue, frame->output_dequeue_ns, dequeue_ns);
+    }
+
+    const auto sensor_ns = frame->sensor_ns;
+
+    m_frames.erase(m_frames.begin() + (frame - m_frames.data()));
+
+    return {weak_from_this(), sensor_ns, dequeue_ns};
+}
+
+const LatencyHistogram &LatencyTracker::histogram(LatencyStage stage) const {
+    return m_histograms[static_cast<std::size_t>(stage)];
+}
+
+void LatencyTracker::reset() {
+    for (auto &histogram: m_histograms) {
+        histogram.reset();
+    }
+}
@@ -0,0 +1,68 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "mirrored_ring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <plog/Log.h>
+#include <sys/mman.h>
+
+#include "exceptions.hpp"
+
+MirroredRing::MirroredRing(std::size_t size) {
+    const auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    m_size = (std::max<std::size_t>(size, 1) + page_size - 1) / page_size * page_size;
+
+    const int fd = memfd_create("mirrored_ring", MFD_CLOEXEC);
+
+    if (fd == -1) {
+        PLOGE << "Failed to create ring memory: " << std::strerror(errno);
+        throw DeviceFileError{"Failed to create ring memory"};
+    }
+
+    if (ftruncate(fd, static_cast<off_t>(m_size)) == -1) {
+        PLOGE << "Failed to size ring memory to " << m_size << " bytes: " << std::strerror(errno);
+        close(fd);
+        throw DeviceFileError{"Failed to size ring memory"};
+    }
+
+    /* reserve the address range for both halves first, then map the memfd into each of them */
+    auto *reserved = mmap(nullptr, 2 * m_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (reserved == MAP_FAILED) {
+        PLOGE << "Failed to reserve ring address space: " << std::strerror(errno);
+        close(fd);
+        throw DeviceFileError{"Failed to reserve ring address space"};
+    }
+
+    auto *base = static_cast<std::byte *>(reserved);
+
+    for (auto *half: {base, base + m_size}) {
+        if (mmap(half, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            PLOGE << "Failed to map ring memory: " << std::strerror(errno);
+            munmap(reserved, 2 * m_size);
+            close(fd);
+            throw DeviceFileError{"Failed to map ring memory"};
+        }
+    }
+
+    /* the mappings keep the pages alive */
+    close(fd);
+
+    m_data = base;
+}
+
+void MirroredRing::release() noexcept {
+    if (m_data != nullptr) {
+        munmap(m_data, 2 * m_size);
+        m_data = nullptr;
+    }
+}
+
+MirroredRing::~MirroredRing() {
+    release();
+}
@@ -0,0 +1,101 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "motion_detector.hpp"
+
+#include <algorithm>
+
+#include "condition.hpp"
+#include "format_kernels.hpp"
+
+/* only every second row is sampled */
+static constexpr std::uint32_t ROW_STEP{2};
+
+MotionDetector::MotionDetector(Config config, const MotionKernels *kernels)
+    : m_config(config),
+      m_kernels(kernels != nullptr ? kernels : &best_motion_kernels()) {
+}
+
+std::size_t MotionDetector::samples_x() const {
+    return std::size_t{m_blocks_x} * MOTION_BLOCK_SIZE;
+}
+
+void MotionDetector::prepare(const v4l2_pix_format &format) {
+    PRECONDITION(format.pixelformat == V4L2_PIX_FMT_YUYV, "Motion detection needs YUYV frames");
+
+    m_bytesperline = yuyv_bytesperline(format);
+    m_blocks_x = static_cast<std::uint32_t>(format.width / 2 / MOTION_BLOCK_SIZE);
+    m_blocks_y = static_cast<std::uint32_t>(format.height / ROW_STEP / MOTION_BLOCK_SIZE);
+
+    m_luma.assign(samples_x(), 0);
+    m_background.assign(samples_x() * m_blocks_y * MOTION_BLOCK_SIZE, 0);
+    m_changed.assign(m_blocks_x, 0);
+    m_mask.assign(std::size_t{m_blocks_x} * m_blocks_y, 0);
+    m_initialized = false;
+    m_result = {0.0, 0, m_blocks_x, m_blocks_y, m_mask};
+}
+
+void MotionDetector::observe(const DmaBuf &buffer, const BufferInfo &) {
+    PRECONDITION(m_bytesperline != 0, "Detector was not prepared");
+
+    const DmaBufAccess access{buffer, DmaBufAccess::Mode::Read};
+    const auto &result = process(reinterpret_cast<const std::uint8_t *>(access.data().data()));
+
+    if (result.changed_blocks > 0 && m_handler) {
+        m_handler(result);
+    }
+}
+
+const MotionResult &MotionDetector::process(const std::uint8_t *yuyv) {
+    const auto samples = samples_x();
+    std::uint64_t changed_samples = 0;
+    std::uint32_t changed_blocks = 0;
+
+    for (std::uint32_t block_y = 0; block_y < m_blocks_y; block_y++) {
+        std::ranges::fill(m_changed, 0);
+
+        for (std::uint32_t row = 0; row < MOTION_BLOCK_SIZE; row++) {
+            const auto sample_row = block_y * MOTION_BLOCK_SIZE + row;
+            const auto *line = yuyv + std::size_t{sample_row} * ROW_STEP * m_bytesperline;
+            auto *background = m_background.data() + sample_row * samples;
+
+            if (!m_initialized) {
+                m_kernels->extract_luma(line, background, samples);
+                continue;
+            }
+
+            m_kernels->extract_luma(line, m_luma.data(), samples);
+            m_kernels->compare_row(m_luma.data(), background, samples, m_config.pixel_threshold, m_changed.data());
+        }
+
+        for (std::uint32_t block_x = 0; block_x < m_blocks_x; block_x++) {
+            const bool changed = m_changed[block_x] >= m_config.block_threshold;
+
+            m_mask[block_y * m_blocks_x + block_x] = changed;
+            changed_blocks += changed;
+            changed_samples += m_changed[block_x];
+        }
+    }
+
+    m_initialized = true;
+
+    const auto total_samples = samples * m_blocks_y * MOTION_BLOCK_SIZE;
+
+    m_result.score = total_samples > 0 ? static_cast<double>(changed_samples) / static_cast<double>(total_samples) : 0;
+    m_result.changed_blocks = changed_blocks;
+
+    return m_result;
+}
+
+void MotionDetector::set_motion_handler(std::function<void(const MotionResult &)> handler) {
+    m_handler = std::move(handler);
+}
+
+const MotionResult &MotionDetector::last_result() const {
+    return m_result;
+}
+
+const char *MotionDetector::kernel_name() const {
+    return m_kernels->name;
+}
@@ -0,0 +1,155 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "motion_kernels.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static void extract_luma_scalar(const std::uint8_t *yuyv, std::uint8_t *luma, std::size_t samples) {
+    for (std::size_t i = 0; i < samples; i++) {
+        luma[i] = yuyv[4 * i];
+    }
+}
+
+static void compare_samples_scalar(const std::uint8_t *luma, std::uint8_t *background, std::size_t begin,
+                                   std::size_t end, std::uint8_t threshold, std::uint16_t *changed) {
+    for (std::size_t i = begin; i < end; i++) {
+        const std::uint8_t sample = luma[i];
+        const std::uint8_t model = background[i];
+        const std::uint8_t difference = sample > model ? sample - model : model - sample;
+
+        changed[i / MOTION_BLOCK_SIZE] += difference > threshold;
+        background[i] = model + (sample > model) - (sample < model);
+    }
+}
+
+static void compare_row_scalar(const std::uint8_t *luma, std::uint8_t *background, std::size_t samples,
+                               std::uint8_t threshold, std::uint16_t *changed) {
+    compare_samples_scalar(luma, background, 0, samples, threshold, changed);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static void extract_luma_avx2(const std::uint8_t *yuyv, std::uint8_t *luma, std::size_t samples) {
+    /* the low byte of every 32 bit lane is the first luma sample of a macro pixel */
+    const __m256i low_byte = _mm256_set1_epi32(0xff);
+    /* undoes the lane interleaving of the two packs */
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    std::size_t i = 0;
+
+    for (; i + 32 <= samples; i += 32) {
+        const auto *source = reinterpret_cast<const __m256i *>(yuyv + 4 * i);
+
+        const __m256i a = _mm256_and_si256(_mm256_loadu_si256(source), low_byte);
+        const __m256i b = _mm256_and_si256(_mm256_loadu_si256(source + 1), low_byte);
+        const __m256i c = _mm256_and_si256(_mm256_loadu_si256(source + 2), low_byte);
+        const __m256i d = _mm256_and_si256(_mm256_loadu_si256(source + 3), low_byte);
+
+        const __m256i packed = _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_packus_epi32(c, d));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(luma + i), _mm256_permutevar8x32_epi32(packed, order));
+    }
+
+    extract_luma_scalar(yuyv + 4 * i, luma + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void compare_row_avx2(const std::uint8_t *luma, std::uint8_t *background, std::size_t samples,
+                             std::uint8_t threshold, std::uint16_t *changed) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i limit = _mm256_set1_epi8(static_cast<char>(threshold));
+
+    std::size_t i = 0;
+
+    /* two blocks per iteration */
+    for (; i + 32 <= samples; i += 32) {
+        const __m256i sample = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(luma + i));
+        const __m256i model = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(background + i));
+
+        const __m256i above = _mm256_subs_epu8(sample, model);
+        const __m256i below = _mm256_subs_epu8(model, sample);
+        const __m256i difference = _mm256_or_si256(above, below);
+
+        /* 1 where the difference exceeds the threshold */
+        const __m256i unchanged = _mm256_cmpeq_epi8(_mm256_subs_epu8(difference, limit), zero);
+        const __m256i counts = _mm256_sad_epu8(_mm256_andnot_si256(unchanged, one), zero);
+
+        changed[i / MOTION_BLOCK_SIZE] += _mm256_extract_epi64(counts, 0) + _mm256_extract_epi64(counts, 1);
+        changed[i / MOTION_BLOCK_SIZE + 1] += _mm256_extract_epi64(counts, 2) + _mm256_extract_epi64(counts, 3);
+
+        const __m256i up = _mm256_min_epu8(above, one);
+        const __m256i down = _mm256_min_epu8(below, one);
+        const __m256i updated = _mm256_sub_epi8(_mm256_add_epi8(model, up), down);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(background + i), updated);
+    }
+
+    compare_samples_scalar(luma, background, i, samples, threshold, changed);
+}
+
+#elif defined(__aarch64__)
+
+static void extract_luma_neon(const std::uint8_t *yuyv, std::uint8_t *luma, std::size_t samples) {
+    std::size_t i = 0;
+
+    for (; i + 16 <= samples; i += 16) {
+        /* de-interleaves the bytes of 16 macro pixels, the first vector holds the first luma samples */
+        const uint8x16x4_t macro_pixels = vld4q_u8(yuyv + 4 * i);
+        vst1q_u8(luma + i, macro_pixels.val[0]);
+    }
+
+    extract_luma_scalar(yuyv + 4 * i, luma + i, samples - i);
+}
+
+static void compare_row_neon(const std::uint8_t *luma, std::uint8_t *background, std::size_t samples,
+                             std::uint8_t threshold, std::uint16_t *changed) {
+    const uint8x16_t one = vdupq_n_u8(1);
+    const uint8x16_t limit = vdupq_n_u8(threshold);
+
+    std::size_t i = 0;
+
+    /* one block per iteration */
+    for (; i + 16 <= samples; i += 16) {
+        const uint8x16_t sample = vld1q_u8(luma + i);
+        const uint8x16_t model = vld1q_u8(background + i);
+
+        const uint8x16_t over = vshrq_n_u8(vcgtq_u8(vabdq_u8(sample, model), limit), 7);
+        changed[i / MOTION_BLOCK_SIZE] += vaddvq_u8(over);
+
+        const uint8x16_t up = vminq_u8(vqsubq_u8(sample, model), one);
+        const uint8x16_t down = vminq_u8(vqsubq_u8(model, sample), one);
+
+        vst1q_u8(background + i, vsubq_u8(vaddq_u8(model, up), down));
+    }
+
+    compare_samples_scalar(luma, background, i, samples, threshold, changed);
+}
+
+#endif
+
+const MotionKernels &scalar_motion_kernels() {
+    static constexpr MotionKernels kernels{"scalar", extract_luma_scalar, compare_row_scalar};
+    return kernels;
+}
+
+const MotionKernels &best_motion_kernels() {
+#if defined(__x86_64__)
+    static constexpr MotionKernels avx2{"avx2", extract_luma_avx2, compare_row_avx2};
+
+    if (__builtin_cpu_supports("avx2")) {
+        return avx2;
+    }
+#elif defined(__aarch64__)
+    static constexpr MotionKernels neon{"neon", extract_luma_neon, compare_row_neon};
+    return neon;
+#endif
+    return scalar_motion_kernels();
+}
@@ -0,0 +1,252 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "nal_scanner.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static constexpr std::byte START_CODE[] = {std::byte{0}, std::byte{0}, std::byte{0}, std::byte{1}};
+
+static const std::byte *find_start_code_memchr(const std::byte *begin, const std::byte *end) {
+    const auto *candidate = begin;
+
+    while (end - candidate >= 3) {
+        const auto *one = static_cast<const std::byte *>(std::memchr(candidate + 2, 1, end - candidate - 2));
+
+        if (one == nullptr) {
+            return end;
+        }
+        if (one[-1] == std::byte{0} && one[-2] == std::byte{0}) {
+            return one - 2;
+        }
+
+        /* the next start code ends after this 01 at the earliest */
+        candidate = one - 1;
+    }
+
+    return end;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static std::uint32_t start_code_mask_avx2(const std::byte *position) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+
+    const __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(position));
+    const __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(position + 1));
+    const __m256i third = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(position + 2));
+
+    const __m256i match = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(first, zero),
+                                                            _mm256_cmpeq_epi8(second, zero)),
+                                           _mm256_cmpeq_epi8(third, one));
+
+    return static_cast<std::uint32_t>(_mm256_movemask_epi8(match));
+}
+
+__attribute__((target("avx2")))
+static const std::byte *find_start_code_avx2(const std::byte *begin, const std::byte *end) {
+    const __m256i zero = _mm256_setzero_si256();
+
+    const auto *position = begin;
+
+    /* the shifted loads read two bytes past the 64 positions tested */
+    for (; end - position >= 66; position += 64) {
+        const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(position));
+        const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(position + 32));
+
+        /* a start code begins with a zero byte, emulation prevention keeps zeros rare in slice data */
+        const __m256i zeros = _mm256_cmpeq_epi8(_mm256_min_epu8(low, high), zero);
+
+        if (_mm256_testz_si256(zeros, zeros)) {
+            continue;
+        }
+
+        if (const auto mask = start_code_mask_avx2(position); mask != 0) {
+            return position + std::countr_zero(mask);
+        }
+        if (const auto mask = start_code_mask_avx2(position + 32); mask != 0) {
+            return position + 32 + std::countr_zero(mask);
+        }
+    }
+
+    return find_start_code_memchr(position, end);
+}
+
+#elif defined(__aarch64__)
+
+/* one nibble per tested position */
+static std::uint64_t start_code_mask_neon(const std::byte *position) {
+    const auto *bytes = reinterpret_cast<const std::uint8_t *>(position);
+
+    const uint8x16_t match = vandq_u8(vandq_u8(vceqzq_u8(vld1q_u8(bytes)), vceqzq_u8(vld1q_u8(bytes + 1))),
+                                      vceqq_u8(vld1q_u8(bytes + 2), vdupq_n_u8(1)));
+
+    /* narrows every byte of the comparison to a nibble of a 64 bit mask */
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+}
+
+static const std::byte *find_start_code_neon(const std::byte *begin, const std::byte *end) {
+    const auto *position = begin;
+
+    /* the shifted loads read two bytes past the 32 positions tested */
+    for (; end - position >= 34; position += 32) {
+        const auto *bytes = reinterpret_cast<const std::uint8_t *>(position);
+
+        /* a start code begins with a zero byte, emulation prevention keeps zeros rare in slice data */
+        if (vminvq_u8(vminq_u8(vld1q_u8(bytes), vld1q_u8(bytes + 16))) != 0) {
+            continue;
+        }
+
+        if (const auto mask = start_code_mask_neon(position); mask != 0) {
+            return position + std::countr_zero(mask) / 4;
+        }
+        if (const auto mask = start_code_mask_neon(position + 16); mask != 0) {
+            return position + 16 + std::countr_zero(mask) / 4;
+        }
+    }
+
+    return find_start_code_memchr(position, end);
+}
+
+#endif
+
+const StartCodeSearch &memchr_start_code_search() {
+    static constexpr StartCodeSearch search{"memchr", find_start_code_memchr};
+    return search;
+}
+
+const StartCodeSearch &best_start_code_search() {
+#if defined(__x86_64__)
+    static constexpr StartCodeSearch avx2{"avx2", find_start_code_avx2};
+
+    if (__builtin_cpu_supports("avx2")) {
+        return avx2;
+    }
+#elif defined(__aarch64__)
+    static constexpr StartCodeSearch neon{"neon", find_start_code_neon};
+    return neon;
+#endif
+    return memchr_start_code_search();
+}
+
+const NalUnit *NalUnits::find(NalUnitType type) const {
+    const auto unit = std::find_if(begin(), end(), [type](const NalUnit &candidate) {
+        return candidate.type == type;
+    });
+    return unit != end() ? unit : nullptr;
+}
+
+NalUnits index_nal_units(std::span<const std::byte> bitstream, const StartCodeSearch *search) {
+    const auto find = (search != nullptr ? search : &best_start_code_search())->find;
+    const auto *data = bitstream.data();
+    const auto *end = data + bitstream.size();
+
+    NalUnits units;
+
+    for (const auto *start = find(data, end); start != end;) {
+        const auto *payload = start + 3;
+        const auto *next = find(payload, end);
+
+        /* the leading zero of a 4 byte start code and trailing_zero_8bits do not belong to the unit */
+        const auto *unit_end = next;
+        while (unit_end > payload && unit_end[-1] == std::byte{0}) {
+            unit_end--;
+        }
+
+        if (unit_end > payload) {
+            if (units.count == MAX_NAL_UNITS) {
+                units.truncated = true;
+                break;
+            }
+
+            const auto header = std::to_integer<std::uint8_t>(payload[0]);
+
+            units.units[units.count++] = {
+                static_cast<std::uint32_t>(payload - data),
+                static_cast<std::uint32_t>(unit_end - payload),
+                static_cast<NalUnitType>(header & 0x1f),
+                static_cast<std::uint8_t>(header >> 5 & 0x3)
+            };
+        }
+
+        start = next;
+    }
+
+    return units;
+}
+
+NalScanner::NalScanner(const StartCodeSearch *search)
+    : m_search(search != nullptr ? search : &best_start_code_search()) {
+}
+
+bool NalScanner::update(std::vector<std::byte> &cached, std::span<const std::byte> unit) {
+    if (std::ranges::equal(cached, unit)) {
+        return false;
+    }
+
+    cached.assign(unit.begin(), unit.end());
+    return true;
+}
+
+const NalUnits &NalScanner::scan(std::span<const std::byte> bitstream) {
+    m_units = index_nal_units(bitstream, m_search);
+
+    bool updated = false;
+
+    for (const auto &unit: m_units) {
+        if (unit.type == NalUnitType::Sps) {
+            updated |= update(m_sps, bitstream.subspan(unit.offset, unit.size));
+        } else if (unit.type == NalUnitType::Pps) {
+            updated |= update(m_pps, bitstream.subspan(unit.offset, unit.size));
+        }
+    }
+
+    m_parameter_set_updates += updated;
+
+    return m_units;
+}
+
+const NalUnits &NalScanner::units() const {
+    return m_units;
+}
+
+std::span<const std::byte> NalScanner::sps() const {
+    return m_sps;
+}
+
+std::span<const std::byte> NalScanner::pps() const {
+    return m_pps;
+}
+
+std::vector<std::byte> NalScanner::parameter_sets() const {
+    std::vector<std::byte> parameter_sets;
+    parameter_sets.reserve(2 * sizeof(START_CODE) + m_sps.size() + m_pps.size());
+
+    for (const auto &unit: {std::span<const std::byte>{m_sps}, std::span<const std::byte>{m_pps}}) {
+        if (!unit.empty()) {
+            parameter_sets.insert(parameter_sets.end(), std::begin(START_CODE), std::end(START_CODE));
+            parameter_sets.insert(parameter_sets.end(), unit.begin(), unit.end());
+        }
+    }
+
+    return parameter_sets;
+}
+
+std::uint64_t NalScanner::parameter_set_updates() const {
+    return m_parameter_set_updates;
+}
+
+const char *NalScanner::search_name() const {
+    return m_search->name;
+}
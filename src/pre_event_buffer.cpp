@@ -0,0 +1,166 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "pre_event_buffer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <plog/Log.h>
+
+#include "condition.hpp"
+#include "exceptions.hpp"
+
+static std::uint64_t to_ns(const timeval &time) {
+    return static_cast<std::uint64_t>(time.tv_sec) * 1000000000u + static_cast<std::uint64_t>(time.tv_usec) * 1000u;
+}
+
+PreEventBuffer::PreEventBuffer(std::size_t capacity, std::size_t max_frames)
+    : m_ring(capacity),
+      m_frames(max_frames),
+      m_keyframes(max_frames) {
+    PRECONDITION(max_frames > 0, "The buffer has to hold at least one frame");
+}
+
+const PreEventBuffer::FrameRecord &PreEventBuffer::frame(std::uint64_t number) const {
+    return m_frames[number % m_frames.size()];
+}
+
+void PreEventBuffer::evict_oldest() {
+    PRECONDITION(m_first_frame < m_next_frame, "Evicted from an empty buffer");
+
+    if (m_first_keyframe < m_next_keyframe && m_keyframes[m_first_keyframe % m_keyframes.size()] == m_first_frame) {
+        m_first_keyframe++;
+    }
+
+    m_first_frame++;
+}
+
+void PreEventBuffer::consume(EncodedFrame &&frame) {
+    append(frame.data(), frame.timestamp(), frame.is_keyframe());
+}
+
+void PreEventBuffer::consume(SharedEncodedFrame &&frame) {
+    append(frame.data(), frame.timestamp(), frame.is_keyframe());
+}
+
+void PreEventBuffer::append(std::span<const std::byte> data, timeval timestamp, bool keyframe) {
+    if (data.size() > m_ring.size()) {
+        PLOGW << "Encoded frame of " << data.size() << " bytes exceeds the pre-event buffer of " << m_ring.size()
+              << " bytes";
+        clear();
+        m_dropped_frames++;
+        return;
+    }
+
+    while (m_first_frame < m_next_frame &&
+           (m_next_frame - m_first_frame == m_frames.size() ||
+            m_head + data.size() - frame(m_first_frame).position > m_ring.size())) {
+        evict_oldest();
+    }
+
+    /* the remainder of an overwritten GOP cannot be decoded */
+    while (m_first_frame < m_next_frame && !frame(m_first_frame).keyframe) {
+        evict_oldest();
+    }
+
+    if (m_first_frame == m_next_frame && !keyframe) {
+        m_dropped_frames++;
+        return;
+    }
+
+    /* the mirror behind the ring takes the part of the frame that wraps */
+    std::memcpy(m_ring.data() + m_head % m_ring.size(), data.data(), data.size());
+
+    m_frames[m_next_frame % m_frames.size()] = {
+        m_head, to_ns(timestamp), static_cast<std::uint32_t>(data.size()), keyframe
+    };
+
+    if (keyframe) {
+        m_keyframes[m_next_keyframe % m_keyframes.size()] = m_next_frame;
+        m_next_keyframe++;
+    }
+
+    m_next_frame++;
+    m_head += data.size();
+}
+
+std::span<const std::byte> PreEventBuffer::window(std::chrono::nanoseconds duration) const {
+    if (m_first_frame == m_next_frame) {
+        return {};
+    }
+
+    const auto newest_ns = frame(m_next_frame - 1).timestamp_ns;
+    const auto duration_ns = static_cast<std::uint64_t>(std::max(duration.count(), std::int64_t{0}));
+    const auto cutoff_ns = newest_ns > duration_ns ? newest_ns - duration_ns : 0;
+
+    /* the ring starts at a keyframe, it is the fallback if no keyframe is old enough */
+    auto start = m_first_frame;
+
+    for (auto keyframe = m_next_keyframe; keyframe-- > m_first_keyframe;) {
+        const auto number = m_keyframes[keyframe % m_keyframes.size()];
+
+        if (frame(number).timestamp_ns <= cutoff_ns) {
+            start = number;
+            break;
+        }
+    }
+
+    const auto position = frame(start).position;
+
+    return {m_ring.data() + position % m_ring.size(), static_cast<std::size_t>(m_head - position)};
+}
+
+std::size_t PreEventBuffer::flush(int fd, std::chrono::nanoseconds duration) const {
+    auto data = window(duration);
+    const auto size = data.size();
+
+    while (!data.empty()) {
+        const auto written = write(fd, data.data(), data.size());
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            PLOGE << "Failed to write the pre-event buffer: " << std::strerror(errno);
+            throw DeviceFileError{"Failed to write the pre-event buffer"};
+        }
+
+        data = data.subspan(written);
+    }
+
+    return size;
+}
+
+void PreEventBuffer::clear() {
+    m_first_frame = m_next_frame;
+    m_first_keyframe = m_next_keyframe;
+}
+
+std::size_t PreEventBuffer::capacity() const {
+    return m_ring.size();
+}
+
+std::size_t PreEventBuffer::buffered_bytes() const {
+    if (m_first_frame == m_next_frame) {
+        return 0;
+    }
+    return static_cast<std::size_t>(m_head - frame(m_first_frame).position);
+}
+
+std::size_t PreEventBuffer::buffered_frames() const {
+    return static_cast<std::size_t>(m_next_frame - m_first_frame);
+}
+
+std::chrono::nanoseconds PreEventBuffer::buffered_duration() const {
+    if (m_first_frame == m_next_frame) {
+        return std::chrono::nanoseconds{0};
+    }
+    return std::chrono::nanoseconds{frame(m_next_frame - 1).timestamp_ns - frame(m_first_frame).timestamp_ns};
+}
+
+std::uint64_t PreEventBuffer::dropped_frames() const {
+    return m_dropped_frames;
+}
@@ -0,0 +1,227 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "preview_scaler.hpp"
+
+#include <algorithm>
+#include <bit>
+
+#include "condition.hpp"
+#include "format_kernels.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* adds one row of bytes to the vertical sums */
+struct AccumulateKernel {
+    const char *name;
+    void (*accumulate_row)(const std::uint8_t *row, std::uint16_t *sums, std::size_t bytes);
+};
+
+static void accumulate_bytes_scalar(const std::uint8_t *row, std::uint16_t *sums, std::size_t begin,
+                                    std::size_t end) {
+    for (std::size_t i = begin; i < end; i++) {
+        sums[i] += row[i];
+    }
+}
+
+static void accumulate_row_scalar(const std::uint8_t *row, std::uint16_t *sums, std::size_t bytes) {
+    accumulate_bytes_scalar(row, sums, 0, bytes);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static void accumulate_row_avx2(const std::uint8_t *row, std::uint16_t *sums, std::size_t bytes) {
+    std::size_t i = 0;
+
+    for (; i + 32 <= bytes; i += 32) {
+        const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + i));
+        auto *low = reinterpret_cast<__m256i *>(sums + i);
+        auto *high = reinterpret_cast<__m256i *>(sums + i + 16);
+
+        const __m256i low_bytes = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(pixels));
+        const __m256i high_bytes = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(pixels, 1));
+
+        _mm256_storeu_si256(low, _mm256_add_epi16(_mm256_loadu_si256(low), low_bytes));
+        _mm256_storeu_si256(high, _mm256_add_epi16(_mm256_loadu_si256(high), high_bytes));
+    }
+
+    accumulate_bytes_scalar(row, sums, i, bytes);
+}
+
+#elif defined(__aarch64__)
+
+static void accumulate_row_neon(const std::uint8_t *row, std::uint16_t *sums, std::size_t bytes) {
+    std::size_t i = 0;
+
+    for (; i + 16 <= bytes; i += 16) {
+        const uint8x16_t pixels = vld1q_u8(row + i);
+
+        vst1q_u16(sums + i, vaddw_u8(vld1q_u16(sums + i), vget_low_u8(pixels)));
+        vst1q_u16(sums + i + 8, vaddw_u8(vld1q_u16(sums + i + 8), vget_high_u8(pixels)));
+    }
+
+    accumulate_bytes_scalar(row, sums, i, bytes);
+}
+
+#endif
+
+static const AccumulateKernel &best_accumulate_kernel() {
+    static constexpr AccumulateKernel scalar{"scalar", accumulate_row_scalar};
+#if defined(__x86_64__)
+    static constexpr AccumulateKernel avx2{"avx2", accumulate_row_avx2};
+
+    if (__builtin_cpu_supports("avx2")) {
+        return avx2;
+    }
+#elif defined(__aarch64__)
+    static constexpr AccumulateKernel neon{"neon", accumulate_row_neon};
+    return neon;
+#endif
+    return scalar;
+}
+
+PreviewScaler::PreviewScaler(Config config)
+    : m_config(config),
+      /* a box holds factor squared samples, the mean is a shift */
+      m_shift(2 * static_cast<std::uint32_t>(std::countr_zero(config.factor))),
+      m_frames(config.buffers),
+      m_slots(config.buffers),
+      m_returns(std::make_shared<Returns>(config.buffers)) {
+    PRECONDITION(config.factor == 2 || config.factor == 4 || config.factor == 8, "Preview factor must be 2, 4 or 8");
+    PRECONDITION(config.frame_divider >= 1, "Frame divider must be at least 1");
+    PRECONDITION(config.buffers >= 1, "Preview needs at least one buffer");
+}
+
+void PreviewScaler::prepare(const v4l2_pix_format &format) {
+    PRECONDITION(format.pixelformat == V4L2_PIX_FMT_YUYV, "Preview needs YUYV frames");
+    PRECONDITION(m_slots.handed_out() == 0, "Preview prepared while previews are handed out");
+
+    m_bytesperline = yuyv_bytesperline(format);
+    /* whole macro pixels only, an output macro pixel covers factor input macro pixels */
+    m_width = format.width / (2 * m_config.factor) * 2;
+    m_height = format.height / m_config.factor;
+
+    m_sums.assign(std::size_t{m_width} * m_config.factor * 2, 0);
+
+    for (auto &frame: m_frames) {
+        frame.pixels.assign(std::size_t{m_width} * m_height * 2, 0);
+        frame.width = m_width;
+        frame.height = m_height;
+    }
+}
+
+void PreviewScaler::take_back_returned() {
+    m_returns->queue.drain([this](Returned &&returned) {
+        m_slots.take_back(returned.slot);
+        m_frames[returned.slot.index] = std::move(returned.frame);
+    });
+}
+
+std::optional<std::uint32_t> PreviewScaler::find_free_slot() const {
+    for (std::uint32_t index = 0; index < m_slots.size(); index++) {
+        if (!m_slots.is_handed_out(index)) {
+            return index;
+        }
+    }
+    return std::nullopt;
+}
+
+void PreviewScaler::observe(const DmaBuf &buffer, const BufferInfo &info) {
+    PRECONDITION(m_bytesperline != 0, "Preview was not prepared");
+
+    take_back_returned();
+
+    if (m_frames_seen++ % m_config.frame_divider != 0 || !m_handler) {
+        return;
+    }
+
+    const auto slot = find_free_slot();
+
+    if (!slot) {
+        m_frames_skipped++;
+        return;
+    }
+
+    auto &preview = m_frames[*slot];
+
+    {
+        /* the camera buffer is only mapped for the scale */
+        const DmaBufAccess access{buffer, DmaBufAccess::Mode::Read};
+        scale(reinterpret_cast<const std::uint8_t *>(access.data().data()), preview);
+    }
+
+    preview.timestamp = info.timestamp;
+
+    m_handler(Package::create(m_returns, m_slots.hand_out(*slot), std::move(preview)));
+}
+
+void PreviewScaler::scale(const std::uint8_t *yuyv, PreviewFrame &preview) {
+    const auto factor = m_config.factor;
+    const auto accumulate_row = best_accumulate_kernel().accumulate_row;
+    const std::uint32_t round = 1u << (m_shift - 1);
+
+    preview.pixels.resize(std::size_t{m_width} * m_height * 2);
+    preview.width = m_width;
+    preview.height = m_height;
+
+    for (std::uint32_t y = 0; y < m_height; y++) {
+        std::ranges::fill(m_sums, 0);
+
+        for (std::uint32_t row = 0; row < factor; row++) {
+            accumulate_row(yuyv + std::size_t{y * factor + row} * m_bytesperline, m_sums.data(), m_sums.size());
+        }
+
+        auto *output = preview.pixels.data() + std::size_t{y} * m_width * 2;
+
+        /* an output macro pixel covers factor input macro pixels, each output luma sample half of them */
+        for (std::uint32_t macro_pixel = 0; macro_pixel < m_width / 2; macro_pixel++) {
+            const auto *sums = m_sums.data() + std::size_t{macro_pixel} * factor * 4;
+            std::uint32_t luma[2] = {0, 0};
+            std::uint32_t u = 0;
+            std::uint32_t v = 0;
+
+            for (std::uint32_t input = 0; input < factor; input++) {
+                luma[input * 2 / factor] += sums[4 * input] + sums[4 * input + 2];
+                u += sums[4 * input + 1];
+                v += sums[4 * input + 3];
+            }
+
+            output[4 * macro_pixel] = static_cast<std::uint8_t>((luma[0] + round) >> m_shift);
+            output[4 * macro_pixel + 1] = static_cast<std::uint8_t>((u + round) >> m_shift);
+            output[4 * macro_pixel + 2] = static_cast<std::uint8_t>((luma[1] + round) >> m_shift);
+            output[4 * macro_pixel + 3] = static_cast<std::uint8_t>((v + round) >> m_shift);
+        }
+    }
+}
+
+void PreviewScaler::set_preview_handler(std::function<void(Package &&)> handler) {
+    m_handler = std::move(handler);
+}
+
+std::uint32_t PreviewScaler::preview_width() const {
+    return m_width;
+}
+
+std::uint32_t PreviewScaler::preview_height() const {
+    return m_height;
+}
+
+std::uint64_t PreviewScaler::frames_skipped() const {
+    return m_frames_skipped;
+}
+
+const char *PreviewScaler::kernel_name() const {
+    return best_accumulate_kernel().name;
+}
+
+PreviewScaler::~PreviewScaler() {
+    take_back_returned();
+    /* previews still held go to the returns they share and are freed with them */
+    m_slots.abandon();
+}
@@ -0,0 +1,67 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "queue_monitor.hpp"
+
+#include <linux/videodev2.h>
+
+/* a sequence number that went back this far was restarted by the driver rather than wrapped */
+static constexpr std::uint32_t MAX_SEQUENCE_GAP{1u << 31};
+
+static void increment(std::atomic<std::uint64_t> &counter, std::uint64_t amount = 1) {
+    /* reset() may clear the counter from another thread, a separate load and store could bring the old count back */
+    counter.fetch_add(amount, std::memory_order_relaxed);
+}
+
+QueueMonitor::QueueMonitor(std::chrono::nanoseconds late_after)
+    : m_late_after_ns(static_cast<std::uint64_t>(late_after.count())) {
+}
+
+void QueueMonitor::record(const BufferInfo &info, std::uint64_t dequeue_ns) {
+    increment(m_buffers);
+
+    if (m_next_sequence != 0) {
+        const auto gap = info.sequence - static_cast<std::uint32_t>(m_next_sequence);
+
+        if (gap != 0 && gap < MAX_SEQUENCE_GAP) {
+            increment(m_dropped, gap);
+        }
+    }
+    m_next_sequence = std::uint64_t{info.sequence} + 1;
+
+    if (info.flags & V4L2_BUF_FLAG_ERROR) {
+        increment(m_errors);
+    }
+
+    const auto timestamp_type = info.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK;
+
+    if (timestamp_type == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC || timestamp_type == V4L2_BUF_FLAG_TIMESTAMP_COPY) {
+        const auto timestamp_ns = static_cast<std::uint64_t>(info.timestamp.tv_sec) * 1000000000 +
+                                  static_cast<std::uint64_t>(info.timestamp.tv_usec) * 1000;
+
+        if (timestamp_ns != 0 && timestamp_ns <= dequeue_ns && dequeue_ns - timestamp_ns > m_late_after_ns) {
+            increment(m_late);
+        }
+    }
+}
+
+void QueueMonitor::restart_sequence() {
+    m_next_sequence = 0;
+}
+
+QueueStatistics QueueMonitor::statistics() const {
+    return {
+        m_buffers.load(std::memory_order_relaxed),
+        m_dropped.load(std::memory_order_relaxed),
+        m_errors.load(std::memory_order_relaxed),
+        m_late.load(std::memory_order_relaxed)
+    };
+}
+
+void QueueMonitor::reset() {
+    m_buffers.store(0, std::memory_order_relaxed);
+    m_dropped.store(0, std::memory_order_relaxed);
+    m_errors.store(0, std::memory_order_relaxed);
+    m_late.store(0, std::memory_order_relaxed);
+}
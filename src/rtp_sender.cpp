@@ -0,0 +1,304 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "rtp_sender.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <plog/Log.h>
+
+#include "condition.hpp"
+#include "exceptions.hpp"
+
+static constexpr std::uint8_t FU_A_TYPE{28};
+
+/* UDP_MAX_SEGMENTS of the kernel */
+static constexpr std::size_t MAX_SEGMENTS{64};
+/* a segmented message is still one UDP datagram for the stack */
+static constexpr std::size_t MAX_SEGMENTED_BYTES{65000};
+
+static void store_u16(std::byte *at, std::uint16_t value) {
+    at[0] = static_cast<std::byte>(value >> 8);
+    at[1] = static_cast<std::byte>(value & 0xff);
+}
+
+static void store_u32(std::byte *at, std::uint32_t value) {
+    store_u16(at, value >> 16);
+    store_u16(at + 2, value & 0xffff);
+}
+
+/* the 90 kHz clock of RFC 6184 */
+static std::uint32_t rtp_timestamp(const timeval &timestamp) {
+    return static_cast<std::uint32_t>(static_cast<std::uint64_t>(timestamp.tv_sec) * 90000 +
+                                      static_cast<std::uint64_t>(timestamp.tv_usec) * 9 / 100);
+}
+
+static bool supports_gso(int fd) {
+#if defined(UDP_SEGMENT)
+    int segment_size = 0;
+    socklen_t length = sizeof(segment_size);
+    return getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment_size, &length) == 0;
+#else
+    return false;
+#endif
+}
+
+RtpSender::RtpSender(const std::string &address, std::uint16_t port, Config config)
+    : m_fd(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)),
+      m_config(config) {
+    PRECONDITION(config.max_payload > FU_A_HEADER_SIZE, "Payload size must leave room for FU-A fragments");
+
+    if (m_fd == -1) {
+        PLOGE << "Failed to create UDP socket: " << std::strerror(errno);
+        throw NetworkError{"Failed to create UDP socket"};
+    }
+
+    sockaddr_in destination = {};
+    destination.sin_family = AF_INET;
+    destination.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, address.c_str(), &destination.sin_addr) != 1) {
+        close(m_fd);
+        throw NetworkError{"Invalid IPv4 address " + address};
+    }
+
+    /* a connected socket needs no address per message and reports ICMP errors of the receiver */
+    if (connect(m_fd, reinterpret_cast<const sockaddr *>(&destination), sizeof(destination)) == -1) {
+        PLOGE << "Failed to connect UDP socket to " << address << ":" << port << ": " << std::strerror(errno);
+        close(m_fd);
+        throw NetworkError{"Failed to connect UDP socket to " + address};
+    }
+
+    std::random_device random;
+
+    if (m_config.ssrc == 0) {
+        m_config.ssrc = random();
+    }
+    /* random initial values as RFC 3550 recommends */
+    m_sequence_number = static_cast<std::uint16_t>(random());
+    m_timestamp_offset = random();
+
+    m_gso = m_config.gso && supports_gso(m_fd);
+
+    if (m_config.gso && !m_gso) {
+        PLOGW << "UDP segmentation offload not available, sending every packet as its own message";
+    }
+}
+
+void RtpSender::write_header(PacketHeader &header, bool marker, std::uint32_t timestamp) {
+    /* version 2, no padding, extension or CSRCs */
+    header[0] = std::byte{0x80};
+    header[1] = static_cast<std::byte>((marker ? 0x80 : 0x00) | (m_config.payload_type & 0x7f));
+    store_u16(header.data() + 2, m_sequence_number++);
+    store_u32(header.data() + 4, timestamp);
+    store_u32(header.data() + 8, m_config.ssrc);
+}
+
+std::size_t RtpSender::count_packets() const {
+    const std::size_t fragment_size = m_config.max_payload - FU_A_HEADER_SIZE;
+
+    std::size_t packets = 0;
+
+    for (const auto &unit: m_units) {
+        /* the NAL header byte is carried in the FU indicator and FU header */
+        packets += unit.size() <= m_config.max_payload ? 1 : (unit.size() - 1 + fragment_size - 1) / fragment_size;
+    }
+
+    return packets;
+}
+
+std::size_t RtpSender::build_messages(std::uint32_t timestamp) {
+    const std::size_t packets = count_packets();
+
+    /* sized before any pointer into them is taken */
+    if (m_headers.size() < packets) {
+        m_headers.resize(packets);
+        m_iov.resize(2 * packets);
+        m_messages.resize(packets);
+        m_controls.resize(packets);
+    }
+
+    const std::size_t fragment_size = m_config.max_payload - FU_A_HEADER_SIZE;
+    const std::size_t segment_size = RTP_HEADER_SIZE + FU_A_HEADER_SIZE + fragment_size;
+    const std::size_t segments_per_message =
+        m_gso ? std::clamp<std::size_t>(MAX_SEGMENTED_BYTES / segment_size, 1, MAX_SEGMENTS) : 1;
+
+    std::size_t packet = 0;
+    std::size_t message_count = 0;
+
+    auto add_message = [this, &message_count](std::size_t first_packet, std::size_t packet_count) {
+        auto &message = m_messages[message_count++];
+        message = {};
+        message.msg_hdr.msg_iov = &m_iov[2 * first_packet];
+        message.msg_hdr.msg_iovlen = 2 * packet_count;
+        return &message;
+    };
+
+    for (std::size_t i = 0; i < m_units.size(); i++) {
+        const auto unit = m_units[i];
+        const bool last_unit = i + 1 == m_units.size();
+
+        if (unit.size() <= m_config.max_payload) {
+            auto &header = m_headers[packet];
+            write_header(header, last_unit, timestamp);
+
+            m_iov[2 * packet] = {header.data(), RTP_HEADER_SIZE};
+            m_iov[2 * packet + 1] = {const_cast<std::byte *>(unit.data()), unit.size()};
+            add_message(packet, 1);
+            packet++;
+            continue;
+        }
+
+        const auto nal_header = std::to_integer<std::uint8_t>(unit[0]);
+        const auto payload = unit.subspan(1);
+        const std::size_t first_packet = packet;
+
+        for (std::size_t offset = 0; offset < payload.size(); offset += fragment_size) {
+            const auto fragment = payload.subspan(offset, std::min(fragment_size, payload.size() - offset));
+            const bool start = offset == 0;
+            const bool end = offset + fragment.size() == payload.size();
+
+            auto &header = m_headers[packet];
+            write_header(header, last_unit && end, timestamp);
+            header[RTP_HEADER_SIZE] = static_cast<std::byte>((nal_header & 0xe0) | FU_A_TYPE);
+            header[RTP_HEADER_SIZE + 1] = static_cast<std::byte>((start ? 0x80 : 0x00) | (end ? 0x40 : 0x00) |
+                                                                 (nal_header & 0x1f));
+
+            m_iov[2 * packet] = {header.data(), RTP_HEADER_SIZE + FU_A_HEADER_SIZE};
+            m_iov[2 * packet + 1] = {const_cast<std::byte *>(fragment.data()), fragment.size()};
+            packet++;
+        }
+
+        /* every fragment but the last has the full size, exactly what segmentation offload cuts */
+        for (std::size_t first = first_packet; first < packet; first += segments_per_message) {
+            const std::size_t count = std::min(segments_per_message, packet - first);
+            auto *message = add_message(first, count);
+
+#if defined(UDP_SEGMENT)
+            if (count > 1) {
+                auto &control = m_controls[first];
+                message->msg_hdr.msg_control = control.buffer;
+                message->msg_hdr.msg_controllen = sizeof(control.buffer);
+
+                auto *cmsg = CMSG_FIRSTHDR(&message->msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+
+                const auto size = static_cast<std::uint16_t>(segment_size);
+                std::memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+            }
+#else
+            (void) message;
+#endif
+        }
+    }
+
+    return message_count;
+}
+
+bool RtpSender::send_messages(std::size_t count) {
+    std::size_t sent = 0;
+
+    while (sent < count) {
+        const auto result = sendmmsg(m_fd, m_messages.data() + sent, count - sent, 0);
+        m_send_calls++;
+
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EIO && m_gso) {
+                /* the route has no device that can checksum segmented messages */
+                PLOGW << "UDP segmentation offload failed, disabling it";
+                m_gso = false;
+            } else {
+                PLOGW << "Failed to send RTP packets, dropping frame: " << std::strerror(errno);
+            }
+            return false;
+        }
+
+        for (int i = 0; i < result; i++) {
+            m_bytes_sent += m_messages[sent + i].msg_len;
+        }
+        sent += result;
+    }
+
+    return true;
+}
+
+void RtpSender::consume(EncodedFrame &&frame) {
+    const auto bitstream = frame.data();
+    const auto &units = m_scanner.scan(bitstream);
+
+    m_units.clear();
+
+    if (units.has_idr()) {
+        /* a receiver joining now needs the parameter sets even if the encoder sent them only once */
+        if (units.find(NalUnitType::Sps) == nullptr && !m_scanner.sps().empty()) {
+            m_units.push_back(m_scanner.sps());
+        }
+        if (units.find(NalUnitType::Pps) == nullptr && !m_scanner.pps().empty()) {
+            m_units.push_back(m_scanner.pps());
+        }
+    }
+
+    for (const auto &unit: units) {
+        if (unit.type != NalUnitType::AccessUnitDelimiter) {
+            m_units.push_back(bitstream.subspan(unit.offset, unit.size));
+        }
+    }
+
+    if (m_units.empty()) {
+        return;
+    }
+
+    const auto messages = build_messages(rtp_timestamp(frame.timestamp()) + m_timestamp_offset);
+
+    if (send_messages(messages)) {
+        m_frames_sent++;
+        m_packets_sent += count_packets();
+    } else {
+        m_frames_dropped++;
+    }
+}
+
+bool RtpSender::uses_gso() const {
+    return m_gso;
+}
+
+std::uint32_t RtpSender::ssrc() const {
+    return m_config.ssrc;
+}
+
+std::uint64_t RtpSender::frames_sent() const {
+    return m_frames_sent;
+}
+
+std::uint64_t RtpSender::frames_dropped() const {
+    return m_frames_dropped;
+}
+
+std::uint64_t RtpSender::packets_sent() const {
+    return m_packets_sent;
+}
+
+std::uint64_t RtpSender::bytes_sent() const {
+    return m_bytes_sent;
+}
+
+std::uint64_t RtpSender::send_calls() const {
+    return m_send_calls;
+}
+
+RtpSender::~RtpSender() {
+    close(m_fd);
+}
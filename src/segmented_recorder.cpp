@@ -0,0 +1,325 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "segmented_recorder.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <limits>
+#include <new>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+#include <plog/Log.h>
+
+#include "condition.hpp"
+#include "exceptions.hpp"
+
+static constexpr std::size_t SEGMENT_NUMBER_DIGITS{6};
+static constexpr std::string_view SEGMENT_EXTENSION{".h264"};
+
+static std::chrono::nanoseconds to_nanoseconds(const timeval &timestamp) {
+    return std::chrono::seconds{timestamp.tv_sec} + std::chrono::microseconds{timestamp.tv_usec};
+}
+
+SegmentedRecorder::SegmentedRecorder(const std::string &directory, Config config)
+    : m_directory(directory),
+      m_config(std::move(config)) {
+    PRECONDITION(m_config.staging_size > 0 && m_config.staging_size % DIRECT_IO_ALIGNMENT == 0,
+                 "Staging size must be a multiple of the direct I/O alignment");
+    PRECONDITION(m_config.max_queued >= 1, "At least one frame has to be queued");
+
+    if (!std::filesystem::is_directory(directory)) {
+        throw DeviceFileError{"Recording directory does not exist: " + directory};
+    }
+
+    scan_existing_segments();
+
+    m_staging.reset(static_cast<std::byte *>(std::aligned_alloc(DIRECT_IO_ALIGNMENT, m_config.staging_size)));
+
+    if (!m_staging) {
+        throw std::bad_alloc{};
+    }
+
+    m_thread = std::thread{&SegmentedRecorder::run, this};
+}
+
+std::string SegmentedRecorder::segment_path(std::uint64_t number) const {
+    auto digits = std::to_string(number);
+
+    if (digits.size() < SEGMENT_NUMBER_DIGITS) {
+        digits.insert(0, SEGMENT_NUMBER_DIGITS - digits.size(), '0');
+    }
+
+    return m_directory + "/" + m_config.prefix + "-" + digits + std::string{SEGMENT_EXTENSION};
+}
+
+void SegmentedRecorder::scan_existing_segments() {
+    struct Existing {
+        std::uint64_t number;
+        std::string path;
+        std::uint64_t size;
+    };
+
+    std::vector<Existing> existing;
+    const auto stem_prefix = m_config.prefix + "-";
+
+    for (const auto &entry: std::filesystem::directory_iterator{m_directory}) {
+        const auto name = entry.path().filename().string();
+
+        if (!entry.is_regular_file() || !name.starts_with(stem_prefix) || !name.ends_with(SEGMENT_EXTENSION)) {
+            continue;
+        }
+
+        const auto digits =
+            name.substr(stem_prefix.size(), name.size() - stem_prefix.size() - SEGMENT_EXTENSION.size());
+
+        /* longer numbers may not fit, the recorder never writes them */
+        if (digits.empty() || digits.size() > std::numeric_limits<std::uint64_t>::digits10 ||
+            !std::ranges::all_of(digits, [](char c) { return c >= '0' && c <= '9'; })) {
+            continue;
+        }
+
+        existing.push_back({std::stoull(digits), entry.path().string(), entry.file_size()});
+    }
+
+    std::ranges::sort(existing, {}, &Existing::number);
+
+    for (auto &segment: existing) {
+        m_segments_size += segment.size;
+        m_segments.push_back({std::move(segment.path), segment.size});
+        m_next_number = segment.number + 1;
+    }
+
+    if (!existing.empty()) {
+        PLOGI << "Continuing after " << existing.size() << " existing segments of " << m_segments_size << " bytes";
+    }
+}
+
+void SegmentedRecorder::prune(std::uint64_t reserved) {
+    while (!m_segments.empty() && m_segments_size + reserved > m_config.total_budget) {
+        const auto &oldest = m_segments.front();
+
+        if (unlink(oldest.path.c_str()) == -1 && errno != ENOENT) {
+            PLOGW << "Failed to delete segment " << oldest.path << ": " << std::strerror(errno);
+        }
+
+        m_segments_size -= oldest.size;
+        m_segments.pop_front();
+    }
+}
+
+void SegmentedRecorder::open_segment() {
+    m_segment_path = segment_path(m_next_number++);
+
+    /* the preallocation of the new segment counts against the budget right away */
+    prune(m_config.segment_size);
+
+    m_fd = open(m_segment_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+
+    if (m_fd == -1 && errno == EINVAL) {
+        /* tmpfs and some FUSE filesystems have no direct I/O, the aligned writes work through the page cache too */
+        PLOGW << "Direct I/O not supported for " << m_segment_path << ", writing through the page cache";
+        m_fd = open(m_segment_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+
+    if (m_fd == -1) {
+        PLOGE << "Failed to open segment " << m_segment_path << ": " << std::strerror(errno);
+        return;
+    }
+
+    /* the size stays at what was written, a segment cut short by a power loss is still readable */
+    if (fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(m_config.segment_size)) == -1) {
+        PLOGW << "Failed to preallocate segment " << m_segment_path << ": " << std::strerror(errno);
+    }
+
+    m_file_offset = 0;
+    m_staged = 0;
+
+    PLOGD << "Recording segment " << m_segment_path;
+}
+
+bool SegmentedRecorder::write_staging(std::size_t length) {
+    std::size_t written = 0;
+
+    while (written < length) {
+        const auto result = pwrite(m_fd, m_staging.get() + written, length - written,
+                                   static_cast<off_t>(m_file_offset + written));
+
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            PLOGE << "Failed to write segment " << m_segment_path << ": " << std::strerror(errno);
+            return false;
+        }
+
+        written += result;
+    }
+
+    m_file_offset += length;
+    m_staged = 0;
+
+    return true;
+}
+
+void SegmentedRecorder::close_segment() {
+    if (m_fd == -1) {
+        return;
+    }
+
+    /* direct writes cover whole blocks, the padding of the last one is cut off again below */
+    const auto tail = m_staged;
+    const auto padded = (tail + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    std::memset(m_staging.get() + tail, 0, padded - tail);
+
+    auto size = m_file_offset;
+
+    if (padded > 0 && write_staging(padded)) {
+        size = m_file_offset - (padded - tail);
+    }
+
+    /* also releases the preallocated blocks beyond the end */
+    if (ftruncate(m_fd, static_cast<off_t>(size)) == -1) {
+        PLOGW << "Failed to trim segment " << m_segment_path << ": " << std::strerror(errno);
+    }
+
+    close(m_fd);
+    m_fd = -1;
+    m_staged = 0;
+    m_segment_start.reset();
+
+    m_segments.push_back({m_segment_path, size});
+    m_segments_size += size;
+    m_segments_written++;
+
+    prune(0);
+}
+
+void SegmentedRecorder::write(const EncodedFrame &frame) {
+    const auto timestamp = to_nanoseconds(frame.timestamp());
+
+    if (frame.is_keyframe() && (!m_segment_start || timestamp - *m_segment_start >= m_config.segment_duration)) {
+        close_segment();
+        open_segment();
+
+        if (m_fd != -1) {
+            m_segment_start = timestamp;
+        }
+    }
+
+    /* before the first keyframe or after a failed segment, a segment only starts with a keyframe */
+    if (m_fd == -1) {
+        m_frames_dropped++;
+        return;
+    }
+
+    auto data = frame.data();
+
+    while (!data.empty()) {
+        const auto chunk = std::min(data.size(), m_config.staging_size - m_staged);
+        std::memcpy(m_staging.get() + m_staged, data.data(), chunk);
+        m_staged += chunk;
+        data = data.subspan(chunk);
+
+        if (m_staged == m_config.staging_size && !write_staging(m_staged)) {
+            /* keep what is on disk and start over at the next keyframe */
+            m_staged = 0;
+            close_segment();
+            m_frames_dropped++;
+            return;
+        }
+    }
+
+    m_frames_written++;
+}
+
+void SegmentedRecorder::run() {
+    std::unique_lock lock{m_mutex};
+
+    while (true) {
+        m_queued.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+
+        if (m_queue.empty()) {
+            break;
+        }
+
+        {
+            EncodedFrame frame{std::move(m_queue.front())};
+            m_queue.pop_front();
+            m_writing = true;
+
+            lock.unlock();
+            write(frame);
+            /* dropping the frame here hands the buffer back to the encoder */
+        }
+
+        lock.lock();
+        m_writing = false;
+
+        if (m_queue.empty()) {
+            m_idle.notify_all();
+        }
+    }
+
+    lock.unlock();
+    close_segment();
+}
+
+void SegmentedRecorder::consume(EncodedFrame &&frame) {
+    if (m_resyncing) {
+        if (!frame.is_keyframe()) {
+            m_frames_dropped++;
+            return;
+        }
+        m_resyncing = false;
+    }
+
+    {
+        std::lock_guard lock{m_mutex};
+
+        if (m_queue.size() < m_config.max_queued) {
+            m_queue.push_back(std::move(frame));
+            m_queued.notify_one();
+            return;
+        }
+    }
+
+    /* the following frames reference this one, skip them up to the next keyframe */
+    PLOGW << "Recorder falls behind, dropping frames up to the next keyframe";
+    m_frames_dropped++;
+    m_resyncing = true;
+}
+
+void SegmentedRecorder::flush() {
+    std::unique_lock lock{m_mutex};
+
+    m_idle.wait(lock, [this] { return m_queue.empty() && !m_writing; });
+}
+
+std::uint64_t SegmentedRecorder::frames_written() const {
+    return m_frames_written;
+}
+
+std::uint64_t SegmentedRecorder::frames_dropped() const {
+    return m_frames_dropped;
+}
+
+std::uint64_t SegmentedRecorder::segments_written() const {
+    return m_segments_written;
+}
+
+SegmentedRecorder::~SegmentedRecorder() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_queued.notify_one();
+
+    m_thread.join();
+}
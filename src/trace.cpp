@@ -0,0 +1,167 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "trace.hpp"
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <plog/Log.h>
+#include <unistd.h>
+
+#include "exceptions.hpp"
+
+/**
+ * Single producer ring, only the owning thread writes. The head is published with release semantics so a dump
+ * running on another thread sees complete events up to the head.
+ */
+class TraceRing {
+public:
+    static constexpr std::size_t CAPACITY{4096};
+
+private:
+    std::array<TraceEvent, CAPACITY> m_events{};
+    std::atomic<std::uint64_t> m_head{0};
+    std::uint32_t m_thread_id;
+
+public:
+    explicit TraceRing(std::uint32_t thread_id) : m_thread_id(thread_id) {
+    }
+
+    void push(const TraceEvent &event) {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        m_events[head % CAPACITY] = event;
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    std::vector<TraceEvent> snapshot() const {
+        const auto head = m_head.load(std::memory_order_acquire);
+        const auto count = std::min<std::uint64_t>(head, CAPACITY);
+
+        std::vector<TraceEvent> events;
+        events.reserve(count);
+
+        for (auto i = head - count; i < head; i++) {
+            events.push_back(m_events[i % CAPACITY]);
+        }
+
+        return events;
+    }
+
+    [[nodiscard]] std::uint32_t thread_id() const { return m_thread_id; }
+};
+
+/* rings of exited threads kept for the dump, a thread per connection would otherwise grow the registry forever */
+static constexpr std::size_t RETIRED_RING_LIMIT{8};
+
+class TraceRegistry {
+    std::mutex m_mutex;
+    std::vector<std::shared_ptr<TraceRing> > m_rings;
+    /* rings of exited threads, oldest first */
+    std::deque<std::shared_ptr<TraceRing> > m_retired;
+
+public:
+    static TraceRegistry &instance() {
+        static TraceRegistry registry;
+        return registry;
+    }
+
+    std::shared_ptr<TraceRing> register_thread() {
+        std::lock_guard lock{m_mutex};
+        return m_rings.emplace_back(std::make_shared<TraceRing>(static_cast<std::uint32_t>(gettid())));
+    }
+
+    void retire(const std::shared_ptr<TraceRing> &ring) {
+        std::lock_guard lock{m_mutex};
+        std::erase(m_rings, ring);
+        m_retired.push_back(ring);
+
+        if (m_retired.size() > RETIRED_RING_LIMIT) {
+            /* a dump still holding the ring keeps it alive until it is written */
+            m_retired.pop_front();
+        }
+    }
+
+    std::vector<std::shared_ptr<TraceRing> > rings() {
+        std::lock_guard lock{m_mutex};
+        std::vector<std::shared_ptr<TraceRing> > rings{m_retired.begin(), m_retired.end()};
+        rings.insert(rings.end(), m_rings.begin(), m_rings.end());
+        return rings;
+    }
+};
+
+/**
+ * Owns the ring of one thread and retires it when the thread exits.
+ */
+class TraceRingOwner {
+    std::shared_ptr<TraceRing> m_ring{TraceRegistry::instance().register_thread()};
+
+public:
+    ~TraceRingOwner() {
+        TraceRegistry::instance().retire(m_ring);
+    }
+
+    TraceRing &ring() { return *m_ring; }
+};
+
+void trace_record(const TraceEvent &event) {
+    thread_local TraceRingOwner owner;
+    owner.ring().push(event);
+}
+
+void trace_dump(const std::string &path) {
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+
+    if (!file) {
+        PLOGE << "Failed to open trace file " << path << ": " << std::strerror(errno);
+        throw DeviceFileError{"Failed to open trace file at path " + path};
+    }
+
+    const auto rings = TraceRegistry::instance().rings();
+
+    TraceFileHeader header = {};
+    std::memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_FILE_VERSION;
+    header.event_size = sizeof(TraceEvent);
+    header.ring_count = static_cast<std::uint32_t>(rings.size());
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    for (const auto &ring: rings) {
+        const auto events = ring->snapshot();
+
+        const TraceRingHeader ring_header{ring->thread_id(), static_cast<std::uint32_t>(events.size())};
+
+        file.write(reinterpret_cast<const char *>(&ring_header), sizeof(ring_header));
+        file.write(reinterpret_cast<const char *>(events.data()),
+                   static_cast<std::streamsize>(events.size() * sizeof(TraceEvent)));
+    }
+
+    PLOGI << "Trace of " << rings.size() << " threads written to " << path;
+}
+
+const char *trace_op_name(TraceOp op) {
+    switch (op) {
+        case TraceOp::Qbuf:
+            return "QBUF";
+        case TraceOp::Dqbuf:
+            return "DQBUF";
+        case TraceOp::Reqbufs:
+            return "REQBUFS";
+        case TraceOp::Streamon:
+            return "STREAMON";
+        case TraceOp::Streamoff:
+            return "STREAMOFF";
+        case TraceOp::Dqevent:
+            return "DQEVENT";
+        default:
+            return "UNKNOWN";
+    }
+}
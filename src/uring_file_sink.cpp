@@ -0,0 +1,391 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "uring_file_sink.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <plog/Log.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "condition.hpp"
+#include "exceptions.hpp"
+
+static int io_uring_setup(unsigned entries, io_uring_params *params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int io_uring_register(int ring_fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+template<class T>
+static T *ring_pointer(void *ring, std::uint32_t offset) {
+    return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+
+UringFileSink::UringFileSink(const std::string &path, std::uint32_t queue_depth)
+    : m_fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+      m_queue_depth(queue_depth),
+      m_in_flight(queue_depth) {
+    PRECONDITION(queue_depth >= 1, "Queue depth must be at least 1");
+
+    if (m_fd == -1) {
+        PLOGE << "Failed to open output file " << path << ": " << std::strerror(errno);
+        throw DeviceFileError{"Failed to open output file at path " + path};
+    }
+
+    m_pending.reserve(queue_depth);
+
+    setup_ring();
+}
+
+void UringFileSink::setup_ring() {
+    io_uring_params params = {};
+
+    Ring ring;
+    ring.fd = io_uring_setup(m_queue_depth, &params);
+
+    if (ring.fd == -1) {
+        /* ENOSYS on old kernels, EPERM when io_uring is disabled by the administrator */
+        PLOGW << "io_uring not available, falling back to pwritev: " << std::strerror(errno);
+        return;
+    }
+
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.sq_ring_size = std::max(ring.sq_ring_size, ring.cq_ring_size);
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+
+    ring.sq_ring = mmap(nullptr, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                        IORING_OFF_SQ_RING);
+
+    if (ring.sq_ring == MAP_FAILED) {
+        close(ring.fd);
+        throw DeviceFileError{"Failed to map io_uring submission ring"};
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.cq_ring = ring.sq_ring;
+    } else {
+        ring.cq_ring = mmap(nullptr, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                            IORING_OFF_CQ_RING);
+
+        if (ring.cq_ring == MAP_FAILED) {
+            munmap(ring.sq_ring, ring.sq_ring_size);
+            close(ring.fd);
+            throw DeviceFileError{"Failed to map io_uring completion ring"};
+        }
+    }
+
+    ring.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring.sqes = mmap(nullptr, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                     IORING_OFF_SQES);
+
+    if (ring.sqes == MAP_FAILED) {
+        if (ring.cq_ring != ring.sq_ring) {
+            munmap(ring.cq_ring, ring.cq_ring_size);
+        }
+        munmap(ring.sq_ring, ring.sq_ring_size);
+        close(ring.fd);
+        throw DeviceFileError{"Failed to map io_uring submission entries"};
+    }
+
+    ring.sq_head = ring_pointer<unsigned>(ring.sq_ring, params.sq_off.head);
+    ring.sq_tail = ring_pointer<unsigned>(ring.sq_ring, params.sq_off.tail);
+    ring.sq_mask = ring_pointer<unsigned>(ring.sq_ring, params.sq_off.ring_mask);
+    ring.sq_array = ring_pointer<unsigned>(ring.sq_ring, params.sq_off.array);
+    ring.cq_head = ring_pointer<unsigned>(ring.cq_ring, params.cq_off.head);
+    ring.cq_tail = ring_pointer<unsigned>(ring.cq_ring, params.cq_off.tail);
+    ring.cq_mask = ring_pointer<unsigned>(ring.cq_ring, params.cq_off.ring_mask);
+    ring.cqes = ring_pointer<void>(ring.cq_ring, params.cq_off.cqes);
+
+    m_ring = ring;
+
+    PLOGD << "io_uring set up with " << params.sq_entries << " entries";
+}
+
+void UringFileSink::destroy_ring() noexcept {
+    if (!m_ring) {
+        return;
+    }
+
+    munmap(m_ring->sqes, m_ring->sqes_size);
+    if (m_ring->cq_ring != m_ring->sq_ring) {
+        munmap(m_ring->cq_ring, m_ring->cq_ring_size);
+    }
+    munmap(m_ring->sq_ring, m_ring->sq_ring_size);
+    close(m_ring->fd);
+
+    m_ring.reset();
+}
+
+void UringFileSink::prepare(const std::vector<const DmaBuf *> &buffers) {
+    /* with every encoder buffer waiting for a write the encoder could never hand out the frame that completes it */
+    if (m_queue_depth >= buffers.size()) {
+        PLOGE << "Queue depth " << m_queue_depth << " needs more than " << buffers.size() << " encoder buffers";
+        throw DeviceFileError{"Queue depth must stay below the number of encoder buffers"};
+    }
+
+    if (!m_ring) {
+        return;
+    }
+
+    std::vector<iovec> mappings;
+    mappings.reserve(buffers.size());
+
+    for (const auto *buffer: buffers) {
+        mappings.push_back({buffer->get_map(), buffer->get_size()});
+    }
+
+    /* dma-buf mappings are often PFN mappings that cannot be pinned, plain writes work on them regardless */
+    if (io_uring_register(m_ring->fd, IORING_REGISTER_BUFFERS, mappings.data(), mappings.size()) == -1) {
+        PLOGW << "Failed to register encoder buffers as fixed buffers: " << std::strerror(errno);
+        return;
+    }
+
+    m_fixed_buffers = std::move(mappings);
+
+    PLOGD << "Registered " << m_fixed_buffers.size() << " fixed buffers";
+}
+
+std::optional<std::uint16_t> UringFileSink::find_fixed_buffer(const void *map) const {
+    for (std::uint16_t i = 0; i < m_fixed_buffers.size(); i++) {
+        if (m_fixed_buffers[i].iov_base == map) {
+            return i;
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::optional<std::uint32_t> UringFileSink::find_free_slot() const {
+    auto free_slot = std::ranges::find_if(m_in_flight, [](const auto &slot) {
+        return !slot.has_value();
+    });
+
+    if (free_slot == m_in_flight.end()) {
+        return std::nullopt;
+    }
+
+    return static_cast<std::uint32_t>(std::distance(m_in_flight.begin(), free_slot));
+}
+
+void UringFileSink::submit(std::uint32_t slot) {
+    const auto &write = *m_in_flight[slot];
+    const auto data = write.frame.data().subspan(write.written);
+
+    const auto tail = *m_ring->sq_tail;
+    const auto index = tail & *m_ring->sq_mask;
+    auto *sqe = static_cast<io_uring_sqe *>(m_ring->sqes) + index;
+
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = m_fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(data.data());
+    sqe->len = static_cast<std::uint32_t>(data.size());
+    sqe->off = write.offset + write.written;
+    sqe->user_data = slot;
+
+    if (auto fixed_buffer = find_fixed_buffer(write.frame.buffer().get_map())) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = *fixed_buffer;
+    } else {
+        sqe->opcode = IORING_OP_WRITE;
+    }
+
+    m_ring->sq_array[index] = index;
+    std::atomic_ref{*m_ring->sq_tail}.store(tail + 1, std::memory_order_release);
+
+    while (io_uring_enter(m_ring->fd, 1, 0, 0) == -1) {
+        if (errno != EINTR) {
+            PLOGE << "Failed to submit write: " << std::strerror(errno);
+            throw DeviceFileError{"Failed to submit write"};
+        }
+    }
+}
+
+std::size_t UringFileSink::reap_completions() {
+    auto head = *m_ring->cq_head;
+    const auto tail = std::atomic_ref{*m_ring->cq_tail}.load(std::memory_order_acquire);
+
+    std::size_t reaped = 0;
+    bool failed = false;
+
+    for (; head != tail; head++) {
+        const auto &cqe = static_cast<io_uring_cqe *>(m_ring->cqes)[head & *m_ring->cq_mask];
+        const auto slot = static_cast<std::uint32_t>(cqe.user_data);
+        auto &write = m_in_flight.at(slot);
+
+        if (cqe.res < 0) {
+            PLOGE << "Failed to write encoded frame: " << std::strerror(-cqe.res);
+            write.reset();
+            failed = true;
+        } else if (cqe.res == 0) {
+            /* resubmitting a write that made no progress would never end */
+            PLOGE << "Failed to write encoded frame: no bytes written";
+            write.reset();
+            failed = true;
+        } else {
+            write->written += cqe.res;
+
+            if (write->written < write->frame.data().size()) {
+                submit(slot);
+                continue;
+            }
+
+            /* the frame is dropped here, which requeues the buffer to the encoder */
+            write.reset();
+        }
+
+        reaped++;
+    }
+
+    std::atomic_ref{*m_ring->cq_head}.store(head, std::memory_order_release);
+
+    /* only after every completion is consumed, the frames behind the failed one are still in the file */
+    if (failed) {
+        throw DeviceFileError{"Failed to write encoded frame"};
+    }
+
+    return reaped;
+}
+
+void UringFileSink::wait_completion() {
+    while (io_uring_enter(m_ring->fd, 0, 1, IORING_ENTER_GETEVENTS) == -1) {
+        if (errno != EINTR) {
+            PLOGE << "Failed to wait for write completion: " << std::strerror(errno);
+            throw DeviceFileError{"Failed to wait for write completion"};
+        }
+    }
+
+    reap_completions();
+}
+
+void UringFileSink::write_pending() {
+    std::vector<iovec> iovecs;
+    iovecs.reserve(m_pending.size());
+
+    for (const auto &frame: m_pending) {
+        const auto data = frame.data();
+        iovecs.push_back({const_cast<std::byte *>(data.data()), data.size()});
+    }
+
+    auto remaining = std::span{iovecs};
+
+    while (!remaining.empty()) {
+        const auto written = pwritev(m_fd, remaining.data(), static_cast<int>(remaining.size()),
+                                     static_cast<off_t>(m_offset));
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            PLOGE << "Failed to write encoded frames: " << std::strerror(errno);
+            throw DeviceFileError{"Failed to write encoded frames"};
+        }
+
+        m_offset += written;
+
+        /* skip the fully written iovecs and advance into a partially written one */
+        auto advance = static_cast<std::size_t>(written);
+        while (!remaining.empty() && advance >= remaining.front().iov_len) {
+            advance -= remaining.front().iov_len;
+            remaining = remaining.subspan(1);
+        }
+        if (!remaining.empty()) {
+            remaining.front().iov_base = static_cast<char *>(remaining.front().iov_base) + advance;
+            remaining.front().iov_len -= advance;
+        }
+    }
+
+    m_pending.clear();
+}
+
+void UringFileSink::consume(EncodedFrame &&frame) {
+    const auto size = frame.data().size();
+
+    if (!m_ring) {
+        m_pending.push_back(std::move(frame));
+        if (m_pending.size() == m_queue_depth) {
+            write_pending();
+        }
+        return;
+    }
+
+    reap_completions();
+
+    auto slot = find_free_slot();
+
+    while (!slot) {
+        wait_completion();
+        slot = find_free_slot();
+    }
+
+    m_in_flight[*slot] = InFlightWrite{std::move(frame), m_offset, 0};
+    m_offset += size;
+
+    submit(*slot);
+}
+
+void UringFileSink::attach(EventReactor &reactor) {
+    PRECONDITION(m_reactor == nullptr, "Sink is already attached to a reactor");
+
+    if (!m_ring) {
+        return;
+    }
+
+    reactor.add(m_ring->fd, EPOLLIN, [this](std::uint32_t) { reap_completions(); });
+    m_reactor = &reactor;
+}
+
+void UringFileSink::detach() {
+    if (m_reactor == nullptr) {
+        return;
+    }
+
+    m_reactor->remove(m_ring->fd);
+    m_reactor = nullptr;
+}
+
+void UringFileSink::flush() {
+    if (!m_ring) {
+        write_pending();
+        return;
+    }
+
+    while (std::ranges::any_of(m_in_flight, [](const auto &slot) { return slot.has_value(); })) {
+        wait_completion();
+    }
+}
+
+bool UringFileSink::uses_io_uring() const {
+    return m_ring.has_value();
+}
+
+UringFileSink::~UringFileSink() {
+    detach();
+
+    try {
+        flush();
+    } catch (const DeviceFileError &e) {
+        PLOGE << "Failed to flush encoded frames: " << e.what();
+    }
+
+    destroy_ring();
+    close(m_fd);
+}
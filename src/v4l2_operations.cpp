@@ -6,9 +6,10 @@
 
 #include <iostream>
 #include <plog/Log.h>
-#include <sys/ioctl.h>
 
+#include "device_backend.hpp"
 #include "exceptions.hpp"
+#include "trace.hpp"
 
 v4l2_format set_camera_format(int fd) {
     v4l2_format cam_fmt = {};
@@ -18,7 +19,7 @@ v4l2_format set_camera_format(int fd) {
     cam_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
     cam_fmt.fmt.pix.field = V4L2_FIELD_ANY;
 
-    if (ioctl(fd, VIDIOC_S_FMT, &cam_fmt) == -1) {
+    if (device_backend().ioctl(fd, VIDIOC_S_FMT, &cam_fmt) == -1) {
         throw DeviceFileError{"Failed to set device format"};
     }
 
@@ -31,15 +32,15 @@ v4l2_format set_camera_format(int fd) {
     return cam_fmt;
 }
 
-v4l2_format set_encoding_format_output(int fd) {
+v4l2_format set_encoding_format_output(int fd, std::uint32_t pixelformat) {
     v4l2_format enc_fmt = {};
     enc_fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
     enc_fmt.fmt.pix.width = 640;
     enc_fmt.fmt.pix.height = 480;
-    enc_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV; // Input format: YUYV
+    enc_fmt.fmt.pix.pixelformat = pixelformat; // Input format of the encoder
     enc_fmt.fmt.pix.field = V4L2_FIELD_ANY;
 
-    if (ioctl(fd, VIDIOC_S_FMT, &enc_fmt) == -1) {
+    if (device_backend().ioctl(fd, VIDIOC_S_FMT, &enc_fmt) == -1) {
         PLOGE << "Failed to set device output format" << std::strerror(errno);
         throw DeviceFileError{"Failed to set device output format"};
     }
@@ -55,7 +56,7 @@ v4l2_format set_encoding_format_capture(int fd) {
     enc_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_H264; // Output format: H.264
     enc_fmt.fmt.pix.field = V4L2_FIELD_ANY;
 
-    if (ioctl(fd, VIDIOC_S_FMT, &enc_fmt) == -1) {
+    if (device_backend().ioctl(fd, VIDIOC_S_FMT, &enc_fmt) == -1) {
         PLOGE << "Failed to set device capture format" << std::strerror(errno);
         throw DeviceFileError{"Failed to set device capture format"};
     }
@@ -72,7 +73,7 @@ void set_encoding_frame_interval(int fd) {
     stream_parm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
     stream_parm.parm.output.timeperframe = {1, 30};
 
-    if (ioctl(fd, VIDIOC_S_PARM, &stream_parm) == -1) {
+    if (device_backend().ioctl(fd, VIDIOC_S_PARM, &stream_parm) == -1) {
         PLOGE << "Failed to set device output param" << std::strerror(errno);
         throw DeviceFileError{"Failed to set device output param"};
     }
@@ -82,12 +83,14 @@ void set_encoding_frame_interval(int fd) {
 }
 
 void request_buffers(int fd, std::uint32_t number_buffers, std::uint32_t buffer_tye, std::uint32_t memory_type) {
+    TraceScope trace{TraceOp::Reqbufs, fd, buffer_tye, number_buffers};
+
     v4l2_requestbuffers cam_req = {};
     cam_req.count = number_buffers;
     cam_req.type = buffer_tye;
     cam_req.memory = memory_type;
 
-    if (ioctl(fd, VIDIOC_REQBUFS, &cam_req) == -1) {
+    if (device_backend().ioctl(fd, VIDIOC_REQBUFS, &cam_req) == -1) {
         PLOGE << "Failed to request buffers" << std::strerror(errno);
         throw DeviceFileError{"Failed to request buffers"};
     }
@@ -108,7 +111,10 @@ void queue_dma_buffer(int fd, const DmaBuf &dma_buf, std::uint32_t buffer_type,
     buf.type = buffer_type;
     buf.m.fd = dma_buf.get_fd();
 
-    if (ioctl(fd, VIDIOC_QBUF, &buf)) {
+    TraceScope trace{TraceOp::Qbuf, fd, buffer_type, index};
+
+    if (device_backend().ioctl(fd, VIDIOC_QBUF, &buf)) {
+        trace.set_result(TraceResult::Error);
         PLOGE << "Failed to queue dma buffer" << std::strerror(errno);
         throw DeviceFileError{"Failed to queue dma buffer"};
     }
@@ -116,7 +122,6 @@ void queue_dma_buffer(int fd, const DmaBuf &dma_buf, std::uint32_t buffer_type,
 
 void queue_dma_buffer(int fd, const std::vector<DmaBuf> &dma_bufs, std::uint32_t buffer_type) {
     for (int i = 0; i < dma_bufs.size(); i++) {
-        PLOGD << "Queue dma buffer " << i;
         queue_dma_buffer(fd, dma_bufs[i], buffer_type, i);
     }
 }
@@ -130,7 +135,7 @@ void log_buffer_status(int fd, std::uint32_t buffer_type, std::uint32_t index) {
     buf.m.planes = &planes;
     buf.length = 1;
 
-    if (ioctl(fd, VIDIOC_QUERYBUF, &buf)) {
+    if (device_backend().ioctl(fd, VIDIOC_QUERYBUF, &buf)) {
         PLOGE << "Failed to query buffer: " << std::strerror(errno);
         throw DeviceFileError{"Failed to query buffer"};
     }
@@ -150,10 +155,6 @@ void log_buffer_status(int fd, std::uint32_t buffer_type, std::uint32_t index) {
 }
 
 void queue_dma_buffer_mplane(int fd, const DmaBuf &dma_buf, std::uint32_t buffer_tye, std::uint32_t index) {
-    PLOGD << "Queue dma buffer mplane " << index;
-
-    log_buffer_status(fd, buffer_tye, index);
-
     v4l2_plane planes = {};
     v4l2_buffer enc_buf = {};
 
@@ -165,19 +166,17 @@ void queue_dma_buffer_mplane(int fd, const DmaBuf &dma_buf, std::uint32_t buffer
     enc_buf.m.planes[0].m.fd =
             dma_buf.get_fd(); // Pass the DMABUF file descriptor
 
-    if (ioctl(fd, VIDIOC_QBUF, &enc_buf)) {
+    TraceScope trace{TraceOp::Qbuf, fd, buffer_tye, index};
+
+    if (device_backend().ioctl(fd, VIDIOC_QBUF, &enc_buf)) {
+        trace.set_result(TraceResult::Error);
         PLOGE << "Failed to queue dma buffer: " << std::strerror(errno);
         throw DeviceFileError{"Failed to queue dma buffer"};
     }
-    log_buffer_status(fd, buffer_tye, index);
 }
 
 void queue_dma_buffer_mplane(int fd, const DmaBuf &dma_buf, std::uint32_t buffer_tye, const BufferInfo &info,
                              std::uint32_t index) {
-    PLOGD << "Queue dma buffer mplane " << index;
-
-    log_buffer_status(fd, buffer_tye, index);
-
     v4l2_plane planes = {};
     v4l2_buffer enc_buf = {};
 
@@ -193,27 +192,34 @@ void queue_dma_buffer_mplane(int fd, const DmaBuf &dma_buf, std::uint32_t buffer
             dma_buf.get_fd(); // Pass the DMABUF file descriptor
     enc_buf.m.planes[0].length = dma_buf.get_size();
 
-    if (ioctl(fd, VIDIOC_QBUF, &enc_buf)) {
+    TraceScope trace{TraceOp::Qbuf, fd, buffer_tye, index, info.bytesused};
+
+    if (device_backend().ioctl(fd, VIDIOC_QBUF, &enc_buf)) {
+        trace.set_result(TraceResult::Error);
         PLOGE << "Failed to queue dma buffer: " << std::strerror(errno);
         throw DeviceFileError{"Failed to queue dma buffer"};
     }
-
-    log_buffer_status(fd, buffer_tye, index);
 }
 
 void queue_dma_buffer_mplane(int fd, const std::vector<DmaBuf> &dma_bufs, std::uint32_t buffer_tye) {
-    PLOGD << "Queue dma buffers mplane";
     for (int i = 0; i < dma_bufs.size(); i++) {
         queue_dma_buffer_mplane(fd, dma_bufs[i], buffer_tye, i);
     }
 }
 
-BufferInfo dequeue_buffer(int fd, std::uint32_t buffer_type, std::uint32_t memory_type) {
+std::optional<BufferInfo> try_dequeue_buffer(int fd, std::uint32_t buffer_type, std::uint32_t memory_type) {
     v4l2_buffer buf = {};
     buf.type = buffer_type;
     buf.memory = memory_type;
 
-    if (ioctl(fd, VIDIOC_DQBUF, &buf)) {
+    TraceScope trace{TraceOp::Dqbuf, fd, buffer_type};
+
+    if (device_backend().ioctl(fd, VIDIOC_DQBUF, &buf)) {
+        if (errno == EAGAIN) {
+            trace.set_result(TraceResult::Empty);
+            return std::nullopt;
+        }
+        trace.set_result(TraceResult::Error);
         PLOGE << "Failed to dequeue buffer: " << std::strerror(errno);
         throw DeviceFileError{"Failed to dequeue buffer"};
     }
@@ -226,13 +232,24 @@ BufferInfo dequeue_buffer(int fd, std::uint32_t buffer_type, std::uint32_t memor
         PLOGE << "Buffered got an error while dequeueing";
     }
 
-    PLOGD << "Dequeued buffer bytesused: " << buf.bytesused;
-    PLOGD << "Dequeued buffer field: " << buf.field;
+    trace.set_buffer(buf.index, buf.bytesused);
 
-    return {buf.index, buf.timestamp, buf.bytesused, buf.field};
+    return BufferInfo{buf.index, buf.timestamp, buf.bytesused, buf.field, buf.flags, buf.sequence};
 }
 
-std::uint32_t dequeue_buffer_mplane(int fd, std::uint32_t buffer_type, std::uint32_t memory_type) {
+BufferInfo dequeue_buffer(int fd, std::uint32_t buffer_type, std::uint32_t memory_type) {
+    auto info = try_dequeue_buffer(fd, buffer_type, memory_type);
+
+    if (!info) {
+        PLOGE << "Failed to dequeue buffer: no buffer ready on non-blocking device";
+        throw DeviceFileError{"Failed to dequeue buffer"};
+    }
+
+    return *info;
+}
+
+std::optional<BufferInfo> try_dequeue_buffer_mplane(int fd, std::uint32_t buffer_type,
+                                                    std::uint32_t memory_type) {
     v4l2_plane planes = {};
     v4l2_buffer buf = {};
     buf.type = buffer_type;
@@ -240,15 +257,18 @@ std::uint32_t dequeue_buffer_mplane(int fd, std::uint32_t buffer_type, std::uint
     buf.m.planes = &planes;
     buf.length = 1;
 
-    PLOGD << "Dequeue buffer mplane";
+    TraceScope trace{TraceOp::Dqbuf, fd, buffer_type};
 
-    if (ioctl(fd, VIDIOC_DQBUF, &buf) == -1) {
+    if (device_backend().ioctl(fd, VIDIOC_DQBUF, &buf) == -1) {
+        if (errno == EAGAIN) {
+            trace.set_result(TraceResult::Empty);
+            return std::nullopt;
+        }
+        trace.set_result(TraceResult::Error);
         PLOGE << "Failed to dequeue buffer: " << std::strerror(errno);
         throw DeviceFileError{"Failed to dequeue buffer"};
     }
 
-    log_buffer_status(fd, buffer_type, buf.index);
-
     if (buf.flags & V4L2_BUF_FLAG_LAST) {
         PLOGW << "Last buffer reached";
     }
@@ -257,12 +277,50 @@ std::uint32_t dequeue_buffer_mplane(int fd, std::uint32_t buffer_type, std::uint
         PLOGE << "Buffered got an error while dequeueing";
     }
 
-    PLOGD << "Dequeued file descriptor: " << buf.m.planes[0].m.fd;
-    PLOGD << "Dequeued buffer index: " << buf.index;
-    PLOGD << "Dequeued buffer bytesused: " << buf.m.planes[0].bytesused;
-    PLOGD << "Dequeued buffer field: " << buf.field;
+    trace.set_buffer(buf.index, buf.m.planes[0].bytesused);
+
+    return BufferInfo{buf.index, buf.timestamp, buf.m.planes[0].bytesused, buf.field, buf.flags, buf.sequence};
+}
+
+BufferInfo dequeue_buffer_mplane(int fd, std::uint32_t buffer_type, std::uint32_t memory_type) {
+    auto info = try_dequeue_buffer_mplane(fd, buffer_type, memory_type);
 
-    return buf.index;
+    if (!info) {
+        PLOGE << "Failed to dequeue buffer: no buffer ready on non-blocking device";
+        throw DeviceFileError{"Failed to dequeue buffer"};
+    }
+
+    return *info;
+}
+
+void subscribe_event(int fd, std::uint32_t event_type) {
+    v4l2_event_subscription sub = {};
+    sub.type = event_type;
+
+    if (device_backend().ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub)) {
+        PLOGE << "Failed to subscribe event " << event_type << ": " << std::strerror(errno);
+        throw DeviceFileError{"Failed to subscribe event"};
+    }
+}
+
+std::optional<v4l2_event> try_dequeue_event(int fd) {
+    v4l2_event event = {};
+
+    TraceScope trace{TraceOp::Dqevent, fd, 0};
+
+    if (device_backend().ioctl(fd, VIDIOC_DQEVENT, &event)) {
+        if (errno == ENOENT) {
+            trace.set_result(TraceResult::Empty);
+            return std::nullopt;
+        }
+        trace.set_result(TraceResult::Error);
+        PLOGE << "Failed to dequeue event: " << std::strerror(errno);
+        throw DeviceFileError{"Failed to dequeue event"};
+    }
+
+    trace.set_buffer(event.type, event.pending);
+
+    return event;
 }
 
 void log_enum_fmt(int fd, std::uint32_t buffer_type) {
@@ -275,7 +333,7 @@ void log_enum_fmt(int fd, std::uint32_t buffer_type) {
 
     do {
         fmt.index = index;
-        if (ioctl(fd, VIDIOC_ENUM_FMT, &fmt) == -1) {
+        if (device_backend().ioctl(fd, VIDIOC_ENUM_FMT, &fmt) == -1) {
             if (errno != EINVAL) {
                 PLOGE << "Failed to enumerate format";
                 throw DeviceFileError{"Failed to enumerate format"};
@@ -291,8 +349,28 @@ void log_enum_fmt(int fd, std::uint32_t buffer_type) {
     } while (!end_reached);
 }
 
+std::vector<std::uint32_t> enum_formats(int fd, std::uint32_t buffer_type) {
+    std::vector<std::uint32_t> formats;
+    v4l2_fmtdesc fmt = {};
+    fmt.type = buffer_type;
+
+    for (fmt.index = 0; device_backend().ioctl(fd, VIDIOC_ENUM_FMT, &fmt) == 0; fmt.index++) {
+        formats.push_back(fmt.pixelformat);
+    }
+
+    /* EINVAL marks the end of the list, drivers without VIDIOC_ENUM_FMT fail the first index with ENOTTY */
+    if (errno != EINVAL && errno != ENOTTY) {
+        PLOGE << "Failed to enumerate formats: " << std::strerror(errno);
+        throw DeviceFileError{"Failed to enumerate formats"};
+    }
+
+    return formats;
+}
+
 void stream_on(int fd, std::uint32_t buffer_type) {
-    if (ioctl(fd, VIDIOC_STREAMON, &buffer_type)) {
+    TraceScope trace{TraceOp::Streamon, fd, buffer_type};
+
+    if (device_backend().ioctl(fd, VIDIOC_STREAMON, &buffer_type)) {
         throw DeviceFileError{"Failed to stream on buffer"};
     }
 }
@@ -313,18 +391,26 @@ void stream_on_capture_mplane(int fd) {
     stream_on(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
 }
 
+void stream_off(int fd, std::uint32_t buffer_type) {
+    TraceScope trace{TraceOp::Streamoff, fd, buffer_type};
+
+    if (device_backend().ioctl(fd, VIDIOC_STREAMOFF, &buffer_type)) {
+        throw DeviceFileError{"Failed to stream off buffer"};
+    }
+}
+
 void stream_off_capture(int fd) {
-    stream_on(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+    stream_off(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE);
 }
 
 void stream_off_output(int fd) {
-    stream_on(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+    stream_off(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT);
 }
 
 void stream_off_output_mplane(int fd) {
-    stream_on(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+    stream_off(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
 }
 
 void stream_off_capture_mplane(int fd) {
-    stream_on(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+    stream_off(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
 }
@@ -4,26 +4,83 @@
 
 #include "v4l2_streamer.hpp"
 
-#include <plog/Init.h>
-#include <plog/Appenders/ConsoleAppender.h>
-#include <plog/Formatters/TxtFormatter.h>
-
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+#include <plog/Log.h>
+#include <sys/epoll.h>
+
+#include "condition.hpp"
+#include "exceptions.hpp"
 #include "v4l2_operations.hpp"
 
-constexpr auto ENCODER_DEVICE_PATH = "/dev/video11";
+/* the frame interval the encoder is configured for, see set_encoding_frame_interval */
+static constexpr std::chrono::nanoseconds FRAME_INTERVAL{std::chrono::nanoseconds{std::chrono::seconds{1}} / 30};
+
+static constexpr std::uint32_t CAMERA_EVENTS{EPOLLIN};
+static constexpr std::uint32_t ENCODER_EVENTS{EPOLLIN | EPOLLOUT | EPOLLPRI};
+
+static int device_open_flags(V4L2Streamer::IoMode io_mode) {
+    if (io_mode == V4L2Streamer::IoMode::NonBlocking) {
+        return O_RDWR | O_NONBLOCK;
+    }
+    return O_RDWR;
+}
+
+const char *stream_queue_name(StreamQueue queue) {
+    switch (queue) {
+        case StreamQueue::CameraCapture:
+            return "camera capture";
+        case StreamQueue::EncoderOutput:
+            return "encoder output";
+        case StreamQueue::EncoderCapture:
+            return "encoder capture";
+        default:
+            return "unknown";
+    }
+}
+
+/* the camera frames go to the encoder as they are whenever it takes them */
+static std::uint32_t negotiate_encoder_input(std::uint32_t camera_format,
+                                             const std::vector<std::uint32_t> &encoder_formats) {
+    if (encoder_formats.empty() || std::ranges::find(encoder_formats, camera_format) != encoder_formats.end()) {
+        return camera_format;
+    }
+
+    const auto convertible = std::ranges::find_if(encoder_formats, [camera_format](std::uint32_t format) {
+        return FormatConverter::can_convert(camera_format, format);
+    });
+
+    return convertible != encoder_formats.end() ? *convertible : camera_format;
+}
 
 V4L2Streamer::V4L2Streamer(const std::string &camera_device_path, std::size_t width,
-                           std::size_t height) : m_width(width),
-                                                 m_height(height), m_camera(camera_device_path),
-                                                 m_encoder(ENCODER_DEVICE_PATH) {
+                           std::size_t height, std::size_t pipeline_depth, IoMode io_mode,
+                           std::shared_ptr<DmaBufPool> pool) : m_width(width),
+                                                 m_height(height), m_pipeline_depth(pipeline_depth),
+                                                 m_io_mode(io_mode),
+                                                 m_pool(std::move(pool)),
+                                                 m_camera(camera_device_path, device_open_flags(io_mode)),
+                                                 m_encoder(std::make_shared<DeviceFileHandle>(ENCODER_DEVICE_PATH,
+                                                     device_open_flags(io_mode))),
+                                                 m_queue_monitors{
+                                                     QueueMonitor{FRAME_INTERVAL},
+                                                     /* every frame in the pipeline may delay the next by one */
+                                                     QueueMonitor{FRAME_INTERVAL * static_cast<long>(pipeline_depth + 1)},
+                                                     QueueMonitor{FRAME_INTERVAL * static_cast<long>(pipeline_depth + 1)}
+                                                 } {
     constexpr std::uint8_t NUM_BUFS{8};
 
-    static plog::ConsoleAppender<plog::TxtFormatter> consoleAppender;
-    plog::init(plog::debug, &consoleAppender);
+    /* the camera needs at least one queued buffer while the encoder holds pipeline_depth frames */
+    PRECONDITION(pipeline_depth >= 1 && pipeline_depth < NUM_BUFS, "Pipeline depth must be in [1, NUM_BUFS)");
 
     PLOG_INFO << "Camera device opened";
 
     auto cam_fmt = m_camera.do_file_operation(set_camera_format);
+    m_camera_format = cam_fmt.fmt.pix;
 
     PLOG_INFO << "Set camera format";
 
@@ -33,10 +90,19 @@ V4L2Streamer::V4L2Streamer(const std::string &camera_device_path, std::size_t wi
 
     PLOG_INFO << "Buffers requested";
 
-    m_camera_capture_buffers = allocate_dma_bufs(NUM_BUFS, cam_fmt.fmt.pix.sizeimage);
+    m_camera_capture_buffers = m_pool
+                                   ? m_pool->acquire(NUM_BUFS, cam_fmt.fmt.pix.sizeimage)
+                                   : allocate_dma_bufs(NUM_BUFS, cam_fmt.fmt.pix.sizeimage);
 
     PLOG_INFO << "DMA buffers allocated";
 
+    m_camera_returns = std::make_shared<ReturnQueue<CameraFrameHold> >(NUM_BUFS);
+    m_camera_encoding.resize(NUM_BUFS);
+
+    for (std::uint32_t i = 0; i < NUM_BUFS; i++) {
+        m_camera_holds.emplace_back(CameraFrameHold::create(i).with_queue(m_camera_returns).with_index(i));
+    }
+
     /* enqueue dmabufs into v4l2 device */
     m_camera.do_file_operation([this](int fd) {
         queue_dma_buffer(fd, m_camera_capture_buffers, V4L2_BUF_TYPE_VIDEO_CAPTURE);
@@ -44,40 +110,67 @@ V4L2Streamer::V4L2Streamer(const std::string &camera_device_path, std::size_t wi
 
     PLOG_INFO << "DMA buffers queued";
 
-    auto enc_fmt_capture = m_encoder.do_file_operation(set_encoding_format_capture);
-    auto enc_fmt_output = m_encoder.do_file_operation(set_encoding_format_output);
+    auto enc_fmt_capture = m_encoder->do_file_operation(set_encoding_format_capture);
+
+    const auto encoder_formats = m_encoder->do_file_operation([](int fd) {
+        return enum_formats(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+    });
+
+    auto enc_fmt_output = m_encoder->do_file_operation(
+        [input_format = negotiate_encoder_input(m_camera_format.pixelformat, encoder_formats)](int fd) {
+            return set_encoding_format_output(fd, input_format);
+        });
 
     PLOG_INFO << "Encoding device format set";
     PLOGD << "Encoding format sizeimage: " << enc_fmt_capture.fmt.pix.sizeimage;
     PLOGD << "Encoding format sizeimage: " << enc_fmt_output.fmt.pix.sizeimage;
 
-    m_encoder.do_file_operation(set_encoding_frame_interval);
+    m_encoder->do_file_operation(set_encoding_frame_interval);
 
     PLOG_INFO << "Encoding device param set";
 
 
-    m_encoder.do_file_operation([](int fd) {
-        request_buffers(fd, 1, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_DMABUF);
+    m_encoder->do_file_operation([this](int fd) {
+        request_buffers(fd, m_pipeline_depth, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_DMABUF);
     });
 
+    m_encoder_output_slots.resize(m_pipeline_depth);
 
-    PLOG_INFO << "Encoding device output Plane buffers requested";
+    if (const auto input_format = enc_fmt_output.fmt.pix_mp.pixelformat; input_format != m_camera_format.pixelformat) {
+        if (!FormatConverter::can_convert(m_camera_format.pixelformat, input_format)) {
+            PLOGE << "Encoding device does not accept the camera format";
+            throw DeviceFileError{"Encoding device does not accept the camera format"};
+        }
 
-    m_encoder.do_file_operation([](int fd) {
-        request_buffers(fd, 8, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_DMABUF);
-    });
+        m_converter = std::make_unique<FormatConverter>(m_camera_format, input_format);
+        m_encoder_input_buffers = m_pool
+                                      ? m_pool->acquire(m_pipeline_depth, m_converter->target_size())
+                                      : allocate_dma_bufs(m_pipeline_depth, m_converter->target_size());
 
+        PLOG_INFO << "Camera frames are converted for the encoder on " << m_converter->threads() << " threads ("
+                  << m_converter->kernel_name() << ")";
+    }
 
-    PLOG_INFO << "Encoding device capture Plane buffers requested";
 
-    m_encoder_capture_buffers = allocate_dma_bufs(8, enc_fmt_capture.fmt.pix.sizeimage);
+    PLOG_INFO << "Encoding device output Plane buffers requested";
 
-    m_encoder.do_file_operation([this](int fd) {
-        queue_dma_buffer_mplane(fd, m_encoder_capture_buffers, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
-    });
+    m_encoder_capture_buffers = V4L2VideoBuffer::create(m_encoder, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
+                                                        V4L2_MEMORY_DMABUF, enc_fmt_capture.fmt.pix.sizeimage,
+                                                        m_pool, V4L2VideoBuffer::ReturnMode::Deferred);
 
 
     PLOG_INFO << "Encoding device capture buffer queried";
+
+    if (m_io_mode == IoMode::NonBlocking) {
+        /* end of stream is signalled as POLLPRI, the encoder may not support it */
+        try {
+            m_encoder->do_file_operation([](int fd) {
+                subscribe_event(fd, V4L2_EVENT_EOS);
+            });
+        } catch (const DeviceFileError &) {
+            PLOGW << "Encoding device does not support end of stream events";
+        }
+    }
 }
 
 void V4L2Streamer::start_streaming() {
@@ -85,58 +178,400 @@ void V4L2Streamer::start_streaming() {
 
     PLOGD << "Camera capture stream turned on";
 
-    m_encoder.do_file_operation(stream_on_output_mplane);
+    m_encoder->do_file_operation(stream_on_output_mplane);
 
     PLOGD << "Encoding output Stream turned on";
 
-    m_encoder.do_file_operation(stream_on_capture_mplane);
+    m_encoder->do_file_operation(stream_on_capture_mplane);
 
     PLOGD << "Encoding capture stream turned on";
 
+    for (auto &monitor: m_queue_monitors) {
+        monitor.restart_sequence();
+    }
+
     status = Status::Streaming;
 }
 
-void V4L2Streamer::next_frame() {
-    auto image_buffer_info = m_camera.do_file_operation([](int fd) {
-        return dequeue_buffer(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_DMABUF);
+std::optional<std::uint32_t> V4L2Streamer::find_free_output_slot() const {
+    auto free_slot = std::ranges::find_if(m_encoder_output_slots, [](const auto &slot) {
+        return !slot.has_value();
     });
 
-    PLOG_INFO << "Got an Image buffer index: " << image_buffer_info.index;
+    if (free_slot == m_encoder_output_slots.end()) {
+        return std::nullopt;
+    }
+
+    return static_cast<std::uint32_t>(std::distance(m_encoder_output_slots.begin(), free_slot));
+}
+
+void V4L2Streamer::hand_off_to_encoder(const BufferInfo &image_buffer_info) {
+    const auto output_index = find_free_output_slot();
+
+    PRECONDITION(output_index.has_value(), "No free encoder output buffer");
+
+    if (m_converter) {
+        auto &input_buffer = m_encoder_input_buffers[*output_index];
+        auto input_info = image_buffer_info;
+        input_info.bytesused = static_cast<std::uint32_t>(m_converter->target_size());
+
+        m_converter->convert(m_camera_capture_buffers[image_buffer_info.index], input_buffer);
+
+        m_encoder->do_file_operation([&input_buffer, &input_info, output_index](int fd) {
+            queue_dma_buffer_mplane(fd, input_buffer, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, input_info, *output_index);
+        });
+    } else {
+        m_encoder->do_file_operation([this, &image_buffer_info, output_index](int fd) {
+            queue_dma_buffer_mplane(fd, m_camera_capture_buffers[image_buffer_info.index],
+                                    V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+                                    image_buffer_info, *output_index);
+        });
+    }
+
+    rearm(*m_encoder, ENCODER_EVENTS);
+
+    m_latency->encoder_queued(image_buffer_info);
 
-    m_encoder.do_file_operation([this, image_buffer_info](int fd) {
-        queue_dma_buffer_mplane(fd, m_camera_capture_buffers[image_buffer_info.index],
-                                V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
-                                image_buffer_info, 0);
+    m_encoder_output_slots[*output_index] = image_buffer_info;
+    m_camera_encoding[image_buffer_info.index] = true;
+    m_frames_in_flight++;
+
+    /* the encoder is already working on the frame, observers only read it alongside */
+    for (const auto &observer: m_camera_observers) {
+        observer->observe(m_camera_capture_buffers[image_buffer_info.index], image_buffer_info);
+    }
+
+    if (m_camera_sink) {
+        auto &hold = m_camera_holds[image_buffer_info.index];
+
+        PRECONDITION(hold.has_value(), "Camera sink still holds a buffer the camera returned");
+
+        auto taken = std::move(*hold);
+        hold.reset();
+        m_camera_sink->consume(std::move(taken), image_buffer_info);
+    }
+}
+
+void V4L2Streamer::release_output_slot(std::uint32_t output_index) {
+    auto &slot = m_encoder_output_slots.at(output_index);
+
+    PRECONDITION(slot.has_value(), "Encoder returned an output buffer that was never queued");
+
+    m_latency->output_dequeued(*slot);
+
+    const auto camera_index = slot->index;
+    slot.reset();
+
+    m_camera_encoding[camera_index] = false;
+    requeue_camera_buffer(camera_index);
+}
+
+void V4L2Streamer::requeue_camera_buffer(std::uint32_t camera_index) {
+    if (m_camera_encoding[camera_index] || !m_camera_holds[camera_index].has_value()) {
+        return;
+    }
+
+    m_camera.do_file_operation([this, camera_index](int fd) {
+        queue_dma_buffer(fd, m_camera_capture_buffers[camera_index], V4L2_BUF_TYPE_VIDEO_CAPTURE, camera_index);
+    });
+
+    rearm(m_camera, CAMERA_EVENTS);
+}
+
+void V4L2Streamer::rearm(DeviceFileHandle &device, std::uint32_t events) {
+    if (m_reactor == nullptr) {
+        return;
+    }
+
+    device.do_file_operation([this, events](int fd) {
+        if (!m_reactor->armed(fd)) {
+            m_reactor->modify(fd, events);
+        }
+    });
+}
+
+void V4L2Streamer::take_back_camera_holds() {
+    m_camera_returns->drain([this](CameraFrameHold &&hold) {
+        const auto camera_index = hold.index();
+        m_camera_holds[camera_index].emplace(std::move(hold));
+        requeue_camera_buffer(camera_index);
     });
+}
+
+bool V4L2Streamer::camera_buffer_queued() const {
+    for (std::size_t i = 0; i < m_camera_holds.size(); i++) {
+        if (!m_camera_encoding[i] && m_camera_holds[i].has_value()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void V4L2Streamer::wait_for_camera_holds() {
+    const int release_fd = m_camera_sink ? m_camera_sink->release_fd() : -1;
+    /* a subscriber that died holding frames only shows up in service(), look again after a frame interval */
+    const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(FRAME_INTERVAL).count() + 1;
+
+    if (m_camera_returns->prepare_wait()) {
+        /* poll skips a negative fd */
+        std::array<pollfd, 2> events{{{m_camera_returns->event_fd(), POLLIN, 0}, {release_fd, POLLIN, 0}}};
+
+        if (poll(events.data(), events.size(), static_cast<int>(timeout)) == -1 && errno != EINTR) {
+            PLOGE << "Failed to wait for camera holds: " << std::strerror(errno);
+            m_camera_returns->finish_wait();
+            throw DeviceFileError{"Failed to wait for camera holds"};
+        }
+    }
+
+    m_camera_returns->finish_wait();
+
+    if (m_camera_sink) {
+        m_camera_sink->service();
+    }
+
+    take_back_camera_holds();
+}
+
+void V4L2Streamer::on_camera_returns() {
+    /* the return queue signals its eventfd only while the owner waits, so the reactor keeps a wait open */
+    do {
+        m_camera_returns->finish_wait();
+        take_back_camera_holds();
+    } while (!m_camera_returns->prepare_wait());
+}
+
+void V4L2Streamer::record_dequeue(StreamQueue queue, const BufferInfo &info) {
+    m_queue_monitors[static_cast<std::size_t>(queue)].record(info, LatencyTracker::now_ns());
+}
+
+void V4L2Streamer::deliver_encoded_frame(VideoFrame &&encoded_frame) {
+    record_dequeue(StreamQueue::EncoderCapture, encoded_frame.info);
+
+    auto release = m_latency->capture_dequeued(encoded_frame.info);
 
-    PLOG_INFO << "Queued image dmabuf to encoding device output plane";
+    /* without a sink the frame is dropped here and the buffer goes back to the encoder with the next dequeue */
+    if (m_sink) {
+        m_sink->consume(EncodedFrame{std::move(encoded_frame), std::move(release)});
+    }
+
+    m_frames_in_flight--;
+    m_frames_encoded++;
+}
 
-    m_encoder.do_file_operation([](int fd) {
-        dequeue_buffer_mplane(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_DMABUF);
+void V4L2Streamer::feed_encoder() {
+    take_back_camera_holds();
+
+    /* the camera sink holds every buffer the encoder does not, a blocking dequeue would never return */
+    while (!camera_buffer_queued()) {
+        wait_for_camera_holds();
+    }
+
+    auto image_buffer_info = m_camera.do_file_operation([](int fd) {
+        return dequeue_buffer(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_DMABUF);
     });
 
-    auto encoded_capture_buf_index = m_encoder.do_file_operation([](int fd) {
-        return dequeue_buffer_mplane(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_DMABUF);
+    record_dequeue(StreamQueue::CameraCapture, image_buffer_info);
+    m_latency->camera_dequeued(image_buffer_info);
+
+    hand_off_to_encoder(image_buffer_info);
+}
+
+void V4L2Streamer::reclaim_encoder_output() {
+    auto output_info = m_encoder->do_file_operation([](int fd) {
+        return dequeue_buffer_mplane(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_DMABUF);
     });
 
-    PLOGD << "Capture buffer index: " << encoded_capture_buf_index;
+    record_dequeue(StreamQueue::EncoderOutput, output_info);
+    release_output_slot(output_info.index);
+}
+
+void V4L2Streamer::drain_encoder() {
+    deliver_encoded_frame(m_encoder_capture_buffers->dequeue_frame());
+}
+
+void V4L2Streamer::on_camera_ready(std::uint32_t events) {
+    /* V4L2 reports an error while no buffer is queued, the reactor disarms the camera until one is queued again */
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        PLOGW << "Camera device signalled an error condition";
+    }
+
+    take_back_camera_holds();
+
+    while (auto image_buffer_info = m_camera.do_file_operation([](int fd) {
+        return try_dequeue_buffer(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_DMABUF);
+    })) {
+        record_dequeue(StreamQueue::CameraCapture, *image_buffer_info);
+        m_latency->camera_dequeued(*image_buffer_info);
+        m_pending_camera_frames.push_back(*image_buffer_info);
+    }
 
-    m_encoder.do_file_operation([this, encoded_capture_buf_index](int fd) {
-        queue_dma_buffer_mplane(fd, m_encoder_capture_buffers[encoded_capture_buf_index],
-                                V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
-                                encoded_capture_buf_index);
+    /* while the sinks hold every encoded buffer the encoder stays silent, the camera keeps the requeue going */
+    if (m_encoder_capture_buffers->requeue_returned() > 0) {
+        rearm(*m_encoder, ENCODER_EVENTS);
+    }
+
+    hand_off_pending_frames();
+}
+
+void V4L2Streamer::on_encoder_ready(std::uint32_t events) {
+    if (events & EPOLLPRI) {
+        while (auto event = m_encoder->do_file_operation(try_dequeue_event)) {
+            if (event->type == V4L2_EVENT_EOS) {
+                PLOGI << "Encoding device reached end of stream";
+                status = Status::Done;
+            }
+        }
+    }
+
+    if (events & EPOLLOUT) {
+        while (auto output_info = m_encoder->do_file_operation([](int fd) {
+            return try_dequeue_buffer_mplane(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_DMABUF);
+        })) {
+            record_dequeue(StreamQueue::EncoderOutput, *output_info);
+            release_output_slot(output_info->index);
+        }
+
+        hand_off_pending_frames();
+    }
+
+    if (events & EPOLLIN) {
+        while (auto encoded_frame = m_encoder_capture_buffers->try_dequeue_frame()) {
+            deliver_encoded_frame(std::move(*encoded_frame));
+        }
+    }
+
+    /* V4L2 reports an error while a queue has no buffers, the reactor disarms the encoder until one is queued */
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        PLOGW << "Encoding device signalled an error condition";
+    }
+}
+
+void V4L2Streamer::hand_off_pending_frames() {
+    while (!m_pending_camera_frames.empty() && find_free_output_slot()) {
+        hand_off_to_encoder(m_pending_camera_frames.front());
+        m_pending_camera_frames.pop_front();
+    }
+}
+
+void V4L2Streamer::next_frame() {
+    PRECONDITION(status == Status::Streaming, "Streamer is not streaming");
+    PRECONDITION(m_io_mode == IoMode::Blocking, "next_frame requires blocking devices, use attach instead");
+
+    feed_encoder();
+
+    if (m_frames_in_flight < m_pipeline_depth) {
+        return;
+    }
+
+    reclaim_encoder_output();
+    drain_encoder();
+}
+
+void V4L2Streamer::flush() {
+    PRECONDITION(m_io_mode == IoMode::Blocking, "flush requires blocking devices");
+
+    while (m_frames_in_flight > 0) {
+        reclaim_encoder_output();
+        drain_encoder();
+    }
+}
+
+void V4L2Streamer::attach(EventReactor &reactor) {
+    PRECONDITION(m_io_mode == IoMode::NonBlocking, "Only non-blocking devices can be attached to a reactor");
+    PRECONDITION(m_reactor == nullptr, "Streamer is already attached to a reactor");
+
+    m_camera.do_file_operation([this, &reactor](int fd) {
+        reactor.add(fd, CAMERA_EVENTS, [this](std::uint32_t events) { on_camera_ready(events); });
     });
 
-    m_camera.do_file_operation([this, image_buffer_info](int fd) {
-        queue_dma_buffer(fd, m_camera_capture_buffers[image_buffer_info.index], V4L2_BUF_TYPE_VIDEO_CAPTURE,
-                         image_buffer_info.index);
+    m_encoder->do_file_operation([this, &reactor](int fd) {
+        reactor.add(fd, ENCODER_EVENTS, [this](std::uint32_t events) { on_encoder_ready(events); });
     });
+
+    /* holds dropped while no camera buffer is queued would otherwise wait for a frame that never comes */
+    reactor.add(m_camera_returns->event_fd(), EPOLLIN, [this](std::uint32_t) { on_camera_returns(); });
+    on_camera_returns();
+
+    m_reactor = &reactor;
+}
+
+void V4L2Streamer::detach() {
+    if (m_reactor == nullptr) {
+        return;
+    }
+
+    m_camera.do_file_operation([this](int fd) { m_reactor->remove(fd); });
+    m_encoder->do_file_operation([this](int fd) { m_reactor->remove(fd); });
+    m_reactor->remove(m_camera_returns->event_fd());
+    m_camera_returns->finish_wait();
+
+    m_reactor = nullptr;
+}
+
+void V4L2Streamer::set_sink(std::shared_ptr<IEncodedSink> sink) {
+    m_sink = std::move(sink);
+
+    if (m_sink) {
+        m_sink->prepare(m_encoder_capture_buffers->buffers());
+    }
+}
+
+void V4L2Streamer::add_camera_observer(std::shared_ptr<ICameraFrameObserver> observer) {
+    PRECONDITION(observer != nullptr, "Observer is null");
+
+    observer->prepare(m_camera_format);
+    m_camera_observers.push_back(std::move(observer));
+}
+
+void V4L2Streamer::set_camera_sink(std::shared_ptr<ICameraFrameSink> sink) {
+    m_camera_sink = std::move(sink);
+
+    if (m_camera_sink) {
+        std::vector<const DmaBuf *> buffers;
+        for (const auto &buffer: m_camera_capture_buffers) {
+            buffers.push_back(&buffer);
+        }
+        m_camera_sink->prepare(m_camera_format, buffers);
+    }
+}
+
+std::uint32_t V4L2Streamer::encoder_input_format() const {
+    return m_converter ? m_converter->target_format() : m_camera_format.pixelformat;
+}
+
+std::size_t V4L2Streamer::frames_in_flight() const {
+    return m_frames_in_flight;
+}
+
+std::size_t V4L2Streamer::frames_encoded() const {
+    return m_frames_encoded;
+}
+
+const LatencyHistogram &V4L2Streamer::latency(LatencyStage stage) const {
+    return m_latency->histogram(stage);
+}
+
+void V4L2Streamer::reset_latency() {
+    m_latency->reset();
+}
+
+QueueStatistics V4L2Streamer::queue_statistics(StreamQueue queue) const {
+    return m_queue_monitors[static_cast<std::size_t>(queue)].statistics();
+}
+
+void V4L2Streamer::reset_queue_statistics() {
+    for (auto &monitor: m_queue_monitors) {
+        monitor.reset();
+    }
 }
 
 V4L2Streamer::~V4L2Streamer() {
+    detach();
+
     if (status == Status::Streaming || status == Status::Done) {
-        m_encoder.do_file_operation(stream_off_capture_mplane);
-        m_encoder.do_file_operation(stream_off_output_mplane);
+        m_encoder->do_file_operation(stream_off_capture_mplane);
+        m_encoder->do_file_operation(stream_off_output_mplane);
         m_camera.do_file_operation(stream_off_capture);
     }
 
@@ -4,10 +4,11 @@
 
 #include "v4l2_video_buffer.hpp"
 
-#include <complex>
+#include <bit>
 #include <utility>
 #include <linux/videodev2.h>
 #include "condition.hpp"
+#include "exceptions.hpp"
 #include "v4l2_operations.hpp"
 
 bool is_mplane(std::uint32_t buffer_type) {
@@ -25,53 +26,199 @@ std::uint32_t get_default_buffer_size(std::uint32_t buffer_type) {
     return 8;
 }
 
-void V4L2VideoBuffer::fill_buffer() {
-    PRECONDITION(!m_device.expired(), "Device handle is already expired");
-    auto dmabufs = allocate_dma_bufs(m_buffer_size, m_buffer_sizes);
+V4L2VideoBuffer::SlotState V4L2VideoBuffer::slot_state(std::uint32_t index) const {
+    const std::uint32_t bit = 1u << index;
 
-    for (auto &buffer: dmabufs) {
-        m_buffers.push_back(std::move(RequeingPackage<DmaBuf>::create(std::move(buffer))));
+    if (m_queued & bit) {
+        return SlotState::Queued;
+    }
+    if (m_user & bit) {
+        return SlotState::User;
     }
+    return SlotState::Free;
+}
 
-    const auto device_instance = m_device.lock();
+void V4L2VideoBuffer::set_slot_state(std::uint32_t index, SlotState state) {
+    const std::uint32_t bit = 1u << index;
+
+    m_queued &= ~bit;
+    m_user &= ~bit;
+
+    if (state == SlotState::Queued) {
+        m_queued |= bit;
+    } else if (state == SlotState::User) {
+        m_user |= bit;
+    }
+}
+
+std::uint32_t V4L2VideoBuffer::queued_buffers() const {
+    return static_cast<std::uint32_t>(std::popcount(m_queued));
+}
 
+void V4L2VideoBuffer::queue_buffer(int fd, std::uint32_t index) {
     if (is_mplane(m_buffer_type)) {
-        device_instance->do_file_operation([this](int fd) {
-            for (int i = 0; i < m_buffers.size(); i++) {
-                queue_dma_buffer_mplane(fd, m_buffers[i].data(), m_memory_type, i);
-            }
-        });
+        queue_dma_buffer_mplane(fd, m_buffers[index].data(), m_buffer_type, index);
     } else {
-        device_instance->do_file_operation([this](int fd) {
-            for (int i = 0; i < m_buffers.size(); i++) {
-                queue_dma_buffer(fd, m_buffers[i].data(), m_memory_type, i);
-            }
-        });
+        queue_dma_buffer(fd, m_buffers[index].data(), m_buffer_type, index);
     }
+
+    set_slot_state(index, SlotState::Queued);
+}
+
+VideoFrame V4L2VideoBuffer::take_frame(const BufferInfo &info) {
+    PRECONDITION(info.index < m_buffers.size(), "Driver returned an unknown buffer index");
+    PRECONDITION(slot_state(info.index) == SlotState::Queued, "Driver returned a buffer that was not queued");
+
+    set_slot_state(info.index, SlotState::User);
+
+    return {std::move(m_buffers[info.index]), info};
+}
+
+void V4L2VideoBuffer::fill_buffer() {
+    PRECONDITION(!m_device.expired(), "Device handle is already expired");
+    PRECONDITION(m_buffer_size <= MAX_BUFFERS, "More buffers than the slot table can hold");
+
+    auto dmabufs = m_pool
+                       ? m_pool->acquire(m_buffer_size, m_buffer_sizes)
+                       : allocate_dma_bufs(m_buffer_size, m_buffer_sizes);
+
+    std::weak_ptr<IIndexedQueue<RequeingPackage<DmaBuf> > > queue = weak_from_this();
+    if (m_returns) {
+        queue = m_returns;
+    }
+
+    for (std::uint32_t i = 0; i < dmabufs.size(); i++) {
+        m_buffers.push_back(RequeingPackage<DmaBuf>::create(std::move(dmabufs[i]))
+            .with_queue(queue)
+            .with_index(i));
+    }
+
+    const auto device_instance = m_device.lock();
+
+    device_instance->do_file_operation([this](int fd) {
+        for (std::uint32_t i = 0; i < m_buffers.size(); i++) {
+            queue_buffer(fd, i);
+        }
+    });
 }
 
 RequeingPackage<DmaBuf> V4L2VideoBuffer::dequeue() {
+    return dequeue_frame().buffer;
+}
+
+VideoFrame V4L2VideoBuffer::dequeue_frame() {
     PRECONDITION(!m_device.expired(), "Device handle is already expired");
 
+    requeue_returned();
+
+    /* the user holds every buffer, a blocking dequeue would never return, sleep until one comes back */
+    while (m_returns && m_queued == 0 && m_user != 0) {
+        m_returns->wait();
+        requeue_returned();
+    }
+
     const auto device_instance = m_device.lock();
 
     auto image_buffer_info = device_instance->do_file_operation([this](int fd) {
+        if (is_mplane(m_buffer_type)) {
+            return dequeue_buffer_mplane(fd, m_buffer_type, m_memory_type);
+        }
         return dequeue_buffer(fd, m_buffer_type, m_memory_type);
     });
 
-    auto package = std::move(m_buffers.at(image_buffer_info.index));
+    return take_frame(image_buffer_info);
+}
+
+std::optional<VideoFrame> V4L2VideoBuffer::try_dequeue_frame() {
+    PRECONDITION(!m_device.expired(), "Device handle is already expired");
+
+    requeue_returned();
 
-    return package;
+    const auto device_instance = m_device.lock();
+
+    auto image_buffer_info = device_instance->do_file_operation([this](int fd) {
+        if (is_mplane(m_buffer_type)) {
+            return try_dequeue_buffer_mplane(fd, m_buffer_type, m_memory_type);
+        }
+        return try_dequeue_buffer(fd, m_buffer_type, m_memory_type);
+    });
+
+    if (!image_buffer_info) {
+        return std::nullopt;
+    }
+
+    return take_frame(*image_buffer_info);
+}
+
+void V4L2VideoBuffer::take_back(RequeingPackage<DmaBuf> &&package) {
+    const auto index = package.index();
+
+    PRECONDITION(index < m_buffers.size(), "Requeued a package of another video buffer");
+    PRECONDITION(slot_state(index) == SlotState::User, "Requeued a buffer that was not handed out");
+
+    m_buffers[index] = std::move(package);
+    set_slot_state(index, SlotState::Free);
+}
+
+void V4L2VideoBuffer::enqueue(RequeingPackage<DmaBuf> &&package) {
+    const auto index = package.index();
+
+    take_back(std::move(package));
+
+    /* called from the destructor of the package, a failing requeue must not escape */
+    if (const auto device_instance = m_device.lock()) {
+        try {
+            device_instance->do_file_operation([this, index](int fd) {
+                queue_buffer(fd, index);
+            });
+        } catch (const DeviceFileError &e) {
+            PLOGE << "Failed to requeue buffer " << index << ": " << e.what();
+        }
+    }
+}
+
+std::size_t V4L2VideoBuffer::requeue_returned() {
+    if (!m_returns) {
+        return 0;
+    }
+
+    std::uint32_t returned = 0;
+
+    m_returns->drain([this, &returned](RequeingPackage<DmaBuf> &&package) {
+        returned |= 1u << package.index();
+        take_back(std::move(package));
+    });
+
+    if (returned == 0) {
+        return 0;
+    }
+
+    const auto device_instance = m_device.lock();
+
+    if (!device_instance) {
+        return 0;
+    }
+
+    device_instance->do_file_operation([this, returned](int fd) {
+        for (auto pending = returned; pending != 0; pending &= pending - 1) {
+            queue_buffer(fd, static_cast<std::uint32_t>(std::countr_zero(pending)));
+        }
+    });
+
+    return static_cast<std::size_t>(std::popcount(returned));
 }
 
-void V4L2VideoBuffer::enqueue(RequeingPackage<DmaBuf> package) {
-    for (auto &buffer: m_buffers) {
-        if (buffer.is_empty()) {
-            buffer = std::move(package);
+std::vector<const DmaBuf *> V4L2VideoBuffer::buffers() const {
+    std::vector<const DmaBuf *> buffers;
+    buffers.reserve(m_buffers.size());
+
+    for (std::uint32_t i = 0; i < m_buffers.size(); i++) {
+        if (slot_state(i) != SlotState::User) {
+            buffers.push_back(&m_buffers[i].data());
         }
     }
 
-    throw std::runtime_error("Buffer is full");
+    return buffers;
 }
 
 void V4L2VideoBuffer::request_buffer() const {
@@ -87,17 +234,37 @@ void V4L2VideoBuffer::request_buffer() const {
 V4L2VideoBuffer::V4L2VideoBuffer(std::weak_ptr<DeviceFileHandle> device,
                                  const std::uint32_t buffer_type,
                                  const std::uint32_t memory_type,
-                                 const std::uint32_t buffer_sizes
+                                 const std::uint32_t buffer_sizes,
+                                 std::shared_ptr<DmaBufPool> pool,
+                                 const ReturnMode return_mode
 ) : m_device(std::move(device)),
     m_buffer_type(buffer_type),
     m_memory_type(memory_type),
     m_buffer_size(get_default_buffer_size(buffer_type)),
-    m_buffer_sizes(buffer_sizes) {
+    m_buffer_sizes(buffer_sizes),
+    m_pool(std::move(pool)) {
     PRECONDITION(memory_type == V4L2_MEMORY_DMABUF, "Currently only DMABUF memory type supported");
 
-    request_buffer();
+    if (return_mode == ReturnMode::Deferred) {
+        m_returns = std::make_shared<ReturnQueue<RequeingPackage<DmaBuf> > >(MAX_BUFFERS);
+    }
+}
+
+std::shared_ptr<V4L2VideoBuffer> V4L2VideoBuffer::create(std::weak_ptr<DeviceFileHandle> device,
+                                                         const std::uint32_t buffer_type,
+                                                         const std::uint32_t memory_type,
+                                                         const std::uint32_t buffer_sizes,
+                                                         std::shared_ptr<DmaBufPool> pool,
+                                                         const ReturnMode return_mode) {
+    std::shared_ptr<V4L2VideoBuffer> video_buffer{
+        new V4L2VideoBuffer{std::move(device), buffer_type, memory_type, buffer_sizes, std::move(pool), return_mode}
+    };
 
-    if (!is_output_buffer(m_buffer_type)) {
-        fill_buffer();
+    video_buffer->request_buffer();
+
+    if (!is_output_buffer(video_buffer->m_buffer_type)) {
+        video_buffer->fill_buffer();
     }
+
+    return video_buffer;
 }
@@ -0,0 +1,153 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include "virtual_device_backend.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+#include <plog/Log.h>
+#include <sys/ioctl.h>
+
+#include "exceptions.hpp"
+#include "v4l2_operations.hpp"
+
+static constexpr auto SYSTEM_HEAP_PATH = "/dev/dma_heap/system";
+
+static std::uint32_t device_caps(const v4l2_capability &cap) {
+    return cap.capabilities & V4L2_CAP_DEVICE_CAPS ? cap.device_caps : cap.capabilities;
+}
+
+static bool captures_fwht(int fd) {
+    v4l2_fmtdesc fmt = {};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+    for (fmt.index = 0; ::ioctl(fd, VIDIOC_ENUM_FMT, &fmt) == 0; fmt.index++) {
+        if (fmt.pixelformat == V4L2_PIX_FMT_FWHT) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+VirtualDeviceBackend::VirtualDeviceBackend() {
+    discover_devices();
+}
+
+void VirtualDeviceBackend::discover_devices() {
+    std::error_code error;
+
+    for (const auto &entry: std::filesystem::directory_iterator{"/dev", error}) {
+        const auto path = entry.path().string();
+
+        if (!entry.path().filename().string().starts_with("video")) {
+            continue;
+        }
+
+        const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+
+        if (fd == -1) {
+            continue;
+        }
+
+        v4l2_capability cap = {};
+
+        if (::ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0) {
+            const auto driver = std::string{reinterpret_cast<const char *>(cap.driver)};
+            const auto caps = device_caps(cap);
+
+            if (m_camera_path.empty() && driver == "vivid" && caps & V4L2_CAP_VIDEO_CAPTURE) {
+                m_camera_path = path;
+            }
+
+            /* the decoders of vicodec share the driver name, the encoder produces FWHT */
+            if (m_encoder_path.empty() && driver == "vicodec" && caps & V4L2_CAP_VIDEO_M2M_MPLANE &&
+                captures_fwht(fd)) {
+                m_encoder_path = path;
+            }
+        }
+
+        ::close(fd);
+    }
+
+    if (m_camera_path.empty()) {
+        PLOGE << "No vivid capture device found";
+        throw DeviceFileError{"No vivid capture device found, load it with modprobe vivid"};
+    }
+
+    if (m_encoder_path.empty()) {
+        PLOGE << "No multiplanar vicodec encoder found";
+        throw DeviceFileError{"No vicodec encoder found, load it with modprobe vicodec multiplanar=1"};
+    }
+
+    PLOGI << "Virtual devices: camera " << m_camera_path << ", encoder " << m_encoder_path;
+}
+
+int VirtualDeviceBackend::open(const std::string &path, int flags) {
+    if (path.starts_with("/dev/dma_heap/")) {
+        return ::open(SYSTEM_HEAP_PATH, flags, 0);
+    }
+
+    if (path == ENCODER_DEVICE_PATH || path == m_encoder_path) {
+        const int fd = ::open(m_encoder_path.c_str(), flags, 0);
+
+        if (fd != -1) {
+            std::lock_guard lock{m_mutex};
+            m_encoder_fds.insert(fd);
+        }
+
+        return fd;
+    }
+
+    if (path.starts_with("/dev/video")) {
+        return ::open(m_camera_path.c_str(), flags, 0);
+    }
+
+    return ::open(path.c_str(), flags, 0);
+}
+
+int VirtualDeviceBackend::close(int fd) {
+    {
+        std::lock_guard lock{m_mutex};
+        m_encoder_fds.erase(fd);
+    }
+
+    return ::close(fd);
+}
+
+int VirtualDeviceBackend::ioctl(int fd, unsigned long request, void *arg) {
+    bool is_encoder;
+    {
+        std::lock_guard lock{m_mutex};
+        is_encoder = m_encoder_fds.contains(fd);
+    }
+
+    if (is_encoder && request == VIDIOC_S_FMT) {
+        auto *fmt = static_cast<v4l2_format *>(arg);
+
+        if (fmt->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE && fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_H264) {
+            fmt->fmt.pix.pixelformat = V4L2_PIX_FMT_FWHT;
+        }
+    }
+
+    const int result = ::ioctl(fd, request, arg);
+
+    if (result == -1 && is_encoder && request == VIDIOC_S_PARM && errno == ENOTTY) {
+        return 0;
+    }
+
+    return result;
+}
+
+const std::string &VirtualDeviceBackend::camera_path() const {
+    return m_camera_path;
+}
+
+const std::string &VirtualDeviceBackend::encoder_path() const {
+    return m_encoder_path;
+}
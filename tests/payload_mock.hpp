@@ -0,0 +1,37 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#ifndef PAYLOAD_MOCK_HPP
+#define PAYLOAD_MOCK_HPP
+
+#include <string>
+#include <utility>
+
+/**
+ * A move only payload whose content tells the packages apart.
+ */
+class PayloadMock {
+private:
+  std::string data;
+
+public:
+  explicit PayloadMock(std::string data) : data(std::move(data)) {}
+
+  PayloadMock(const PayloadMock &other) = delete;
+
+  PayloadMock(PayloadMock &&other) noexcept : data(std::move(other.data)) {}
+
+  PayloadMock &operator=(const PayloadMock &other) = delete;
+
+  PayloadMock &operator=(PayloadMock &&other) noexcept {
+    if (this == &other)
+      return *this;
+    data = std::move(other.data);
+    return *this;
+  }
+
+  [[nodiscard]] std::string get_data() const { return data; }
+};
+
+#endif //PAYLOAD_MOCK_HPP
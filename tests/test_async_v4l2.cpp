@@ -0,0 +1,142 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <coroutine>
+#include <optional>
+
+#include "async_v4l2.hpp"
+#include "fake_device_backend.hpp"
+
+using namespace std::chrono_literals;
+
+class TestAsyncV4L2 : public ::testing::Test {
+protected:
+  EventReactor reactor;
+
+  void SetUp() override {
+    FakeDeviceBackend::Latencies latencies;
+    latencies.frame_interval = 1ms;
+    latencies.encode = 200us;
+
+    set_device_backend(std::make_shared<FakeDeviceBackend>(latencies, 5));
+  }
+
+  void TearDown() override {
+    set_device_backend(nullptr);
+  }
+
+  template<class Done>
+  void run_until(Done done) {
+    const auto deadline = std::chrono::steady_clock::now() + 5s;
+    while (!done() && std::chrono::steady_clock::now() < deadline) {
+      reactor.run_once(100);
+    }
+  }
+};
+
+/* starts the task without handing it over, so the test can destroy it while it is suspended */
+template<class T>
+static void start(Task<T> &task) {
+  task.await_suspend(std::noop_coroutine()).resume();
+}
+
+static Task<void> capture_frames(AsyncCamera &camera, std::size_t count, std::size_t &captured) {
+  std::optional<std::uint32_t> previous;
+
+  for (std::size_t i = 0; i < count; i++) {
+    const auto frame = co_await camera.next();
+    EXPECT_GT(frame.info.bytesused, 0);
+    if (previous) {
+      EXPECT_GT(frame.info.sequence, *previous);
+    }
+    previous = frame.info.sequence;
+    captured++;
+  }
+}
+
+static Task<void> encode_frames(AsyncCamera &camera, AsyncEncoder &encoder, std::size_t count,
+                                std::size_t &keyframes, std::size_t &encoded) {
+  for (std::size_t i = 0; i < count; i++) {
+    auto frame = co_await camera.next();
+    const auto timestamp = frame.info.timestamp;
+
+    const auto nal = co_await encoder.encode(std::move(frame));
+    EXPECT_GT(nal.info.bytesused, 0);
+    EXPECT_EQ(nal.info.timestamp.tv_sec, timestamp.tv_sec);
+    EXPECT_EQ(nal.info.timestamp.tv_usec, timestamp.tv_usec);
+    keyframes += (nal.info.flags & V4L2_BUF_FLAG_KEYFRAME) != 0;
+    encoded++;
+  }
+}
+
+static Task<void> wait_for_frame(AsyncCamera &camera, bool &resumed) {
+  co_await camera.next();
+  resumed = true;
+}
+
+TEST_F(TestAsyncV4L2, CameraResumesOnEveryFrame) {
+  AsyncCamera camera{reactor, "/dev/video0"};
+  std::size_t captured = 0;
+
+  co_spawn(capture_frames(camera, 20, captured));
+  run_until([&captured] { return captured == 20; });
+
+  ASSERT_EQ(captured, 20);
+}
+
+TEST_F(TestAsyncV4L2, EncoderReturnsFramesInOrder) {
+  AsyncCamera camera{reactor, "/dev/video0"};
+  AsyncEncoder encoder{reactor, 2};
+  std::size_t keyframes = 0;
+  std::size_t encoded = 0;
+
+  co_spawn(encode_frames(camera, encoder, 20, keyframes, encoded));
+  run_until([&encoded] { return encoded == 20; });
+
+  ASSERT_EQ(encoded, 20);
+  ASSERT_EQ(keyframes, 4);
+}
+
+TEST_F(TestAsyncV4L2, EncodersShareTheOutputBuffer) {
+  AsyncCamera camera{reactor, "/dev/video0"};
+  AsyncEncoder encoder{reactor, 1};
+  std::size_t keyframes = 0;
+  std::size_t encoded = 0;
+
+  /* more encode calls than output buffers, the ones waiting for a free buffer must be woken when it is reclaimed */
+  for (int i = 0; i < 3; i++) {
+    co_spawn(encode_frames(camera, encoder, 5, keyframes, encoded));
+  }
+  run_until([&encoded] { return encoded == 15; });
+
+  ASSERT_EQ(encoded, 15);
+  ASSERT_EQ(keyframes, 3);
+}
+
+TEST_F(TestAsyncV4L2, DestroyedTaskStopsWaiting) {
+  /* slow enough that no frame is filled before the first task suspends */
+  FakeDeviceBackend::Latencies latencies;
+  latencies.frame_interval = 20ms;
+  set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+
+  AsyncCamera camera{reactor, "/dev/video0"};
+  bool abandoned_resumed = false;
+  bool resumed = false;
+
+  {
+    auto abandoned = wait_for_frame(camera, abandoned_resumed);
+    start(abandoned);
+    ASSERT_FALSE(abandoned_resumed);
+  }
+
+  /* the frame wakes only the task that still waits, the destroyed one is gone from the device */
+  co_spawn(wait_for_frame(camera, resumed));
+  run_until([&resumed] { return resumed; });
+
+  ASSERT_TRUE(resumed);
+  ASSERT_FALSE(abandoned_resumed);
+}
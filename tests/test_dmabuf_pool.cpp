@@ -0,0 +1,172 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+#include <linux/videodev2.h>
+
+#include "dmabuf_pool.hpp"
+#include "fake_device_backend.hpp"
+#include "v4l2_operations.hpp"
+#include "v4l2_streamer.hpp"
+#include "v4l2_video_buffer.hpp"
+
+using namespace std::chrono_literals;
+
+TEST(TestDmaBufPool, SmallSizesRoundToPages) {
+  const auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+
+  ASSERT_EQ(DmaBufPool::size_class(1), page_size);
+  ASSERT_EQ(DmaBufPool::size_class(page_size), page_size);
+  ASSERT_EQ(DmaBufPool::size_class(page_size + 1), 2 * page_size);
+}
+
+TEST(TestDmaBufPool, LargeSizesRoundToQuarterPowersOfTwo) {
+  constexpr std::size_t MiB = 1024 * 1024;
+
+  ASSERT_EQ(DmaBufPool::size_class(1 * MiB), 1 * MiB);
+  ASSERT_EQ(DmaBufPool::size_class(1 * MiB + 1), 1 * MiB + MiB / 4);
+  /* 640x480 YUYV */
+  ASSERT_EQ(DmaBufPool::size_class(614400), 640 * 1024);
+  /* 1920x1080 YUYV */
+  ASSERT_EQ(DmaBufPool::size_class(4147200), 4 * MiB);
+}
+
+TEST(TestDmaBufPool, SizeClassBoundsWaste) {
+  for (std::size_t size = 64 * 1024; size < 64 * 1024 * 1024; size = size * 9 / 7) {
+    const auto size_class = DmaBufPool::size_class(size);
+
+    ASSERT_GE(size_class, size);
+    ASSERT_LE(size_class, size + size / 4 + 4096);
+  }
+}
+
+class TestDmaBufPoolRecycling : public ::testing::Test {
+protected:
+  std::shared_ptr<DmaBufPool> pool;
+
+  void SetUp() override {
+    FakeDeviceBackend::Latencies latencies;
+    latencies.frame_interval = 1ms;
+    latencies.encode = 200us;
+    set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+    pool = DmaBufPool::create();
+  }
+
+  void TearDown() override {
+    pool.reset();
+    set_device_backend(nullptr);
+  }
+};
+
+TEST_F(TestDmaBufPoolRecycling, DestroyedBufferReturnsToThePool) {
+  int fd;
+
+  {
+    const auto buffer = pool->acquire(100000);
+    ASSERT_EQ(buffer.get_size(), DmaBufPool::size_class(100000));
+    ASSERT_EQ(pool->free_buffers(), 0);
+    fd = buffer.get_fd();
+  }
+
+  ASSERT_EQ(pool->free_buffers(), 1);
+
+  /* a different size of the same class gets the same buffer */
+  const auto buffer = pool->acquire(DmaBufPool::size_class(100000) - 1);
+  ASSERT_EQ(buffer.get_fd(), fd);
+  ASSERT_EQ(pool->free_buffers(), 0);
+
+  /* another class allocates */
+  const auto other = pool->acquire(1000000);
+  ASSERT_NE(other.get_fd(), fd);
+}
+
+TEST_F(TestDmaBufPoolRecycling, BufferOutlivingThePoolIsFreed) {
+  auto buffer = pool->acquire(4096);
+  pool.reset();
+
+  /* destroying the buffer at the end of the scope frees it instead of recycling it */
+  ASSERT_GT(buffer.get_fd(), 0);
+}
+
+TEST_F(TestDmaBufPoolRecycling, ReservePreWarmsTheSizeClass) {
+  pool->reserve(3, 614400);
+  ASSERT_EQ(pool->free_buffers(), 3);
+
+  /* free buffers count towards the reservation */
+  pool->reserve(2, 614400);
+  ASSERT_EQ(pool->free_buffers(), 3);
+
+  const auto buffers = pool->acquire(3, 614400);
+  ASSERT_EQ(pool->free_buffers(), 0);
+}
+
+TEST_F(TestDmaBufPoolRecycling, TrimFreesOnlyUnusedBuffers) {
+  pool->reserve(3, 4096);
+  auto used = pool->acquire(4096);
+
+  pool->trim();
+  ASSERT_EQ(pool->free_buffers(), 0);
+
+  /* the buffer in use still belongs to the pool */
+  {
+    const auto returned = std::move(used);
+  }
+  ASSERT_EQ(pool->free_buffers(), 1);
+}
+
+TEST_F(TestDmaBufPoolRecycling, VideoBuffersAreRecycledAcrossLifetimes) {
+  const auto camera = std::make_shared<DeviceFileHandle>("/dev/video0");
+  const auto fmt = camera->do_file_operation(set_camera_format);
+
+  {
+    const auto buffers = V4L2VideoBuffer::create(camera, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_DMABUF,
+                                                 fmt.fmt.pix.sizeimage, pool);
+    ASSERT_EQ(pool->free_buffers(), 0);
+  }
+
+  ASSERT_EQ(pool->free_buffers(), 8);
+
+  {
+    const auto buffers = V4L2VideoBuffer::create(camera, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_DMABUF,
+                                                 fmt.fmt.pix.sizeimage, pool);
+    /* nothing was allocated */
+    ASSERT_EQ(pool->free_buffers(), 0);
+  }
+
+  ASSERT_EQ(pool->free_buffers(), 8);
+}
+
+TEST_F(TestDmaBufPoolRecycling, RestartedStreamerReusesTheBuffers) {
+  std::size_t pooled;
+
+  {
+    V4L2Streamer streamer{"/dev/video0", 640, 480, 2, V4L2Streamer::IoMode::Blocking, pool};
+    streamer.start_streaming();
+    for (int i = 0; i < 5; i++) {
+      streamer.next_frame();
+    }
+    streamer.flush();
+  }
+
+  /* camera and encoder buffers */
+  pooled = pool->free_buffers();
+  ASSERT_GT(pooled, 8);
+
+  {
+    V4L2Streamer streamer{"/dev/video0", 640, 480, 2, V4L2Streamer::IoMode::Blocking, pool};
+    ASSERT_EQ(pool->free_buffers(), 0);
+
+    streamer.start_streaming();
+    for (int i = 0; i < 5; i++) {
+      streamer.next_frame();
+    }
+    streamer.flush();
+
+    ASSERT_EQ(streamer.frames_encoded(), 5);
+  }
+
+  ASSERT_EQ(pool->free_buffers(), pooled);
+}
@@ -0,0 +1,164 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "event_reactor.hpp"
+
+class Pipe {
+  int fds[2]{-1, -1};
+
+public:
+  Pipe() { EXPECT_EQ(pipe(fds), 0); }
+
+  int read_end() const { return fds[0]; }
+
+  int write_end() const { return fds[1]; }
+
+  ~Pipe() {
+    close(fds[0]);
+    close(fds[1]);
+  }
+};
+
+TEST(TestEventReactor, DispatchesOnlyReadyFds) {
+  EventReactor reactor;
+  Pipe ready;
+  Pipe idle;
+
+  std::size_t ready_calls = 0;
+  std::size_t idle_calls = 0;
+
+  reactor.add(ready.read_end(), EPOLLIN,
+              [&ready_calls](std::uint32_t events) {
+                ASSERT_TRUE(events & EPOLLIN);
+                ready_calls++;
+              });
+  reactor.add(idle.read_end(), EPOLLIN,
+              [&idle_calls](std::uint32_t) { idle_calls++; });
+
+  ASSERT_EQ(write(ready.write_end(), "x", 1), 1);
+
+  ASSERT_EQ(reactor.run_once(0), 1);
+  ASSERT_EQ(ready_calls, 1);
+  ASSERT_EQ(idle_calls, 0);
+}
+
+TEST(TestEventReactor, HandlerCanRemoveItself) {
+  EventReactor reactor;
+  Pipe pipe;
+
+  std::size_t calls = 0;
+
+  reactor.add(pipe.read_end(), EPOLLIN,
+              [&reactor, &pipe, &calls](std::uint32_t) {
+                calls++;
+                reactor.remove(pipe.read_end());
+              });
+
+  ASSERT_EQ(write(pipe.write_end(), "x", 1), 1);
+
+  reactor.run_once(0);
+  ASSERT_EQ(reactor.run_once(0), 0);
+  ASSERT_EQ(calls, 1);
+}
+
+TEST(TestEventReactor, RunStopsFromHandler) {
+  EventReactor reactor;
+  Pipe pipe;
+
+  reactor.add(pipe.read_end(), EPOLLIN,
+              [&reactor](std::uint32_t) { reactor.stop(); });
+
+  ASSERT_EQ(write(pipe.write_end(), "x", 1), 1);
+
+  reactor.run();
+}
+
+TEST(TestEventReactor, DropsEventsOfAReplacedRegistration) {
+  EventReactor reactor;
+  Pipe first;
+  Pipe second;
+  int fresh[2]{-1, -1};
+
+  std::size_t calls = 0;
+  bool fresh_called = false;
+
+  /* whichever handler runs first replaces the other fd by an idle pipe under the same number */
+  const auto replace = [&](int other) {
+    calls++;
+    reactor.remove(other);
+    ASSERT_EQ(pipe(fresh), 0);
+    ASSERT_EQ(dup2(fresh[0], other), other);
+    close(fresh[0]);
+    reactor.add(other, EPOLLIN, [&fresh_called](std::uint32_t) { fresh_called = true; });
+  };
+
+  reactor.add(first.read_end(), EPOLLIN, [&](std::uint32_t) { replace(second.read_end()); });
+  reactor.add(second.read_end(), EPOLLIN, [&](std::uint32_t) { replace(first.read_end()); });
+
+  ASSERT_EQ(write(first.write_end(), "x", 1), 1);
+  ASSERT_EQ(write(second.write_end(), "x", 1), 1);
+
+  ASSERT_EQ(reactor.run_once(0), 1);
+  ASSERT_EQ(calls, 1);
+  ASSERT_FALSE(fresh_called);
+
+  close(fresh[1]);
+}
+
+TEST(TestEventReactor, DisarmsFdOnPersistentError) {
+  EventReactor reactor;
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+
+  /* the write end of a pipe without readers reports EPOLLERR until it is closed */
+  close(fds[0]);
+
+  std::size_t errors = 0;
+  reactor.add(fds[1], EPOLLIN, [&errors](std::uint32_t events) {
+    ASSERT_TRUE(events & EPOLLERR);
+    errors++;
+  });
+
+  ASSERT_EQ(reactor.run_once(0), 1);
+  ASSERT_FALSE(reactor.armed(fds[1]));
+  ASSERT_EQ(reactor.run_once(0), 0);
+  ASSERT_EQ(errors, 1);
+
+  reactor.modify(fds[1], EPOLLIN);
+  ASSERT_TRUE(reactor.armed(fds[1]));
+  ASSERT_EQ(reactor.run_once(0), 1);
+  ASSERT_EQ(errors, 2);
+
+  reactor.remove(fds[1]);
+  close(fds[1]);
+}
+
+TEST(TestEventReactor, HandlerRearmsFdOnError) {
+  EventReactor reactor;
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  close(fds[0]);
+
+  /* like a streamer that queues a buffer while handling the error of its empty queue */
+  std::size_t errors = 0;
+  reactor.add(fds[1], EPOLLIN, [&reactor, &errors, fd = fds[1]](std::uint32_t events) {
+    ASSERT_TRUE(events & EPOLLERR);
+    ASSERT_FALSE(reactor.armed(fd));
+    errors++;
+    reactor.modify(fd, EPOLLIN);
+  });
+
+  ASSERT_EQ(reactor.run_once(0), 1);
+  ASSERT_TRUE(reactor.armed(fds[1]));
+  ASSERT_EQ(reactor.run_once(0), 1);
+  ASSERT_EQ(errors, 2);
+
+  reactor.remove(fds[1]);
+  close(fds[1]);
+}
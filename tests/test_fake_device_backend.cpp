@@ -0,0 +1,157 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+#include <poll.h>
+#include <linux/videodev2.h>
+
+#include "encoded_sink.hpp"
+#include "event_reactor.hpp"
+#include "fake_device_backend.hpp"
+#include "v4l2_operations.hpp"
+#include "v4l2_streamer.hpp"
+
+using namespace std::chrono_literals;
+
+class TestFakeDeviceBackend : public ::testing::Test {
+protected:
+  void SetUp() override {
+    FakeDeviceBackend::Latencies latencies;
+    latencies.frame_interval = 1ms;
+    latencies.encode = 200us;
+
+    set_device_backend(std::make_shared<FakeDeviceBackend>(latencies, 5));
+  }
+
+  void TearDown() override {
+    set_device_backend(nullptr);
+  }
+};
+
+class CountingSink : public IEncodedSink {
+public:
+  std::size_t frames{0};
+  std::size_t keyframes{0};
+
+  void consume(EncodedFrame &&frame) override {
+    frames++;
+    keyframes += frame.is_keyframe();
+    ASSERT_GT(frame.data().size(), 0);
+  }
+};
+
+TEST_F(TestFakeDeviceBackend, CameraFillsBuffersOnTheFrameGrid) {
+  DeviceFileHandle camera{"/dev/video0"};
+
+  auto fmt = camera.do_file_operation(set_camera_format);
+  ASSERT_EQ(fmt.fmt.pix.sizeimage, 640 * 480 * 2);
+
+  auto device = std::make_shared<DeviceFileHandle>(std::move(camera));
+  auto buffers = V4L2VideoBuffer::create(device, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_DMABUF,
+                                         fmt.fmt.pix.sizeimage);
+
+  device->do_file_operation(stream_on_capture);
+
+  auto first = buffers->dequeue_frame();
+  auto second = buffers->dequeue_frame();
+
+  const auto to_us = [](const timeval &time) { return time.tv_sec * 1000000 + time.tv_usec; };
+
+  ASSERT_NE(first.info.index, second.info.index);
+  ASSERT_NEAR(to_us(second.info.timestamp) - to_us(first.info.timestamp), 1000, 1);
+
+  device->do_file_operation(stream_off_capture);
+}
+
+TEST_F(TestFakeDeviceBackend, StreamerEncodesEveryFrame) {
+  auto sink = std::make_shared<CountingSink>();
+
+  V4L2Streamer streamer{"/dev/video0", 640, 480, 2};
+  streamer.set_sink(sink);
+  streamer.start_streaming();
+
+  for (int i = 0; i < 10; i++) {
+    streamer.next_frame();
+  }
+
+  streamer.flush();
+
+  ASSERT_EQ(streamer.frames_encoded(), 10);
+  ASSERT_EQ(sink->frames, 10);
+  ASSERT_EQ(sink->keyframes, 2);
+  ASSERT_EQ(streamer.latency(LatencyStage::EndToEnd).count(), 10);
+  ASSERT_GE(streamer.latency(LatencyStage::EncoderQueueToOutputDequeue).percentile(50.0), 200000);
+}
+
+TEST_F(TestFakeDeviceBackend, NonBlockingDequeueReportsEmptyQueue) {
+  auto camera = std::make_shared<DeviceFileHandle>("/dev/video0", O_RDWR | O_NONBLOCK);
+
+  auto fmt = camera->do_file_operation(set_camera_format);
+  auto buffers = V4L2VideoBuffer::create(camera, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_DMABUF,
+                                         fmt.fmt.pix.sizeimage);
+
+  camera->do_file_operation(stream_on_capture);
+
+  ASSERT_FALSE(buffers->try_dequeue_frame().has_value());
+
+  std::this_thread::sleep_for(2ms);
+
+  auto frame = buffers->try_dequeue_frame();
+  ASSERT_TRUE(frame.has_value());
+  ASSERT_EQ(frame->info.bytesused, fmt.fmt.pix.sizeimage);
+  ASSERT_EQ(frame->info.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK, V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC);
+
+  camera->do_file_operation(stream_off_capture);
+}
+
+TEST_F(TestFakeDeviceBackend, CameraPollsInOnceAFrameIsFilled) {
+  auto camera = std::make_shared<DeviceFileHandle>("/dev/video0", O_RDWR | O_NONBLOCK);
+
+  auto fmt = camera->do_file_operation(set_camera_format);
+  auto buffers = V4L2VideoBuffer::create(camera, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_DMABUF,
+                                         fmt.fmt.pix.sizeimage);
+
+  const auto poll_device = [&camera](int timeout_ms) {
+    return camera->do_file_operation([timeout_ms](int fd) {
+      pollfd event{fd, POLLIN | POLLOUT, 0};
+      EXPECT_NE(poll(&event, 1, timeout_ms), -1);
+      return event.revents;
+    });
+  };
+
+  camera->do_file_operation(stream_on_capture);
+  ASSERT_EQ(poll_device(0), 0);
+
+  /* the camera has no output queue, it never polls out */
+  ASSERT_EQ(poll_device(1000), POLLIN);
+  ASSERT_TRUE(buffers->try_dequeue_frame().has_value());
+
+  camera->do_file_operation(stream_off_capture);
+  ASSERT_EQ(poll_device(0), 0);
+}
+
+TEST_F(TestFakeDeviceBackend, NonBlockingStreamerRunsOnAReactor) {
+  auto sink = std::make_shared<CountingSink>();
+  EventReactor reactor;
+
+  /* output buffers only come back on POLLOUT, the encoder would stall without it */
+  V4L2Streamer streamer{"/dev/video0", 640, 480, 2, V4L2Streamer::IoMode::NonBlocking};
+  streamer.set_sink(sink);
+  streamer.attach(reactor);
+  streamer.start_streaming();
+
+  const auto deadline = std::chrono::steady_clock::now() + 5s;
+  while (streamer.frames_encoded() < 30 && std::chrono::steady_clock::now() < deadline) {
+    reactor.run_once(100);
+  }
+
+  streamer.detach();
+
+  ASSERT_GE(streamer.frames_encoded(), 30);
+  ASSERT_EQ(sink->frames, streamer.frames_encoded());
+  ASSERT_GT(sink->keyframes, 0);
+}
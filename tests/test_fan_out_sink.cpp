@@ -0,0 +1,115 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "fake_device_backend.hpp"
+#include "fan_out_sink.hpp"
+#include "return_queue.hpp"
+#include "shared_package.hpp"
+#include "v4l2_streamer.hpp"
+
+using namespace std::chrono_literals;
+
+TEST(TestSharedPackage, LastReferenceRequeues) {
+  auto queue = std::make_shared<ReturnQueue<RequeingPackage<int>>>(4);
+
+  auto shared = SharedPackage<RequeingPackage<int>>::create(RequeingPackage<int>::create(7).with_queue(queue));
+  auto copy = shared;
+
+  ASSERT_EQ(shared.use_count(), 2);
+  ASSERT_EQ(copy.data().data(), 7);
+
+  shared = SharedPackage<RequeingPackage<int>>{};
+  ASSERT_FALSE(queue->try_dequeue().has_value());
+
+  std::thread consumer{[copy = std::move(copy)] {}};
+  consumer.join();
+
+  auto returned = queue->try_dequeue();
+  ASSERT_TRUE(returned.has_value());
+  ASSERT_EQ(returned->data(), 7);
+}
+
+class HoldingConsumer : public ISharedEncodedSink {
+public:
+  std::vector<SharedEncodedFrame> frames;
+
+  void consume(SharedEncodedFrame &&frame) override { frames.push_back(std::move(frame)); }
+};
+
+class ThreadedConsumer : public ISharedEncodedSink {
+public:
+  std::vector<std::thread> threads;
+  std::atomic<std::size_t> bytes{0};
+
+  void consume(SharedEncodedFrame &&frame) override {
+    threads.emplace_back([this, frame = std::move(frame)] { bytes += frame.data().size(); });
+  }
+
+  void join() {
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    threads.clear();
+  }
+};
+
+class TestFanOutSink : public ::testing::Test {
+protected:
+  void SetUp() override {
+    FakeDeviceBackend::Latencies latencies;
+    latencies.frame_interval = 1ms;
+    latencies.encode = 200us;
+
+    set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+  }
+
+  void TearDown() override { set_device_backend(nullptr); }
+};
+
+TEST_F(TestFanOutSink, EveryConsumerSeesEveryFrame) {
+  auto fan_out = std::make_shared<FanOutSink>(3);
+  auto holding = std::make_shared<HoldingConsumer>();
+  auto threaded = std::make_shared<ThreadedConsumer>();
+
+  const auto holding_id = fan_out->add_consumer(holding);
+  const auto threaded_id = fan_out->add_consumer(threaded);
+
+  V4L2Streamer streamer{"/dev/video0", 640, 480};
+  streamer.set_sink(fan_out);
+  streamer.start_streaming();
+
+  for (int i = 0; i < 3; i++) {
+    streamer.next_frame();
+  }
+  threaded->join();
+
+  ASSERT_EQ(holding->frames.size(), 3);
+  ASSERT_GT(threaded->bytes, 0);
+
+  ASSERT_EQ(fan_out->lag(holding_id).outstanding, 3);
+  ASSERT_TRUE(fan_out->is_lagging(holding_id));
+  ASSERT_EQ(fan_out->lag(threaded_id).outstanding, 0);
+  ASSERT_EQ(fan_out->lag(threaded_id).hold_time.count, 3);
+  ASSERT_FALSE(fan_out->is_lagging(threaded_id));
+
+  /* the threaded consumer is done, the buffers go back to the encoder with the last consumer */
+  holding->frames.clear();
+
+  ASSERT_EQ(fan_out->lag(holding_id).outstanding, 0);
+  ASSERT_EQ(fan_out->lag(holding_id).max_outstanding, 3);
+
+  for (int i = 0; i < 10; i++) {
+    streamer.next_frame();
+    holding->frames.clear();
+  }
+  threaded->join();
+
+  ASSERT_EQ(fan_out->lag(holding_id).delivered, 13);
+  ASSERT_EQ(fan_out->lag(threaded_id).delivered, 13);
+}
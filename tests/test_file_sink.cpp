@@ -0,0 +1,137 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "exceptions.hpp"
+#include "fake_device_backend.hpp"
+#include "file_sink.hpp"
+#include "return_queue.hpp"
+
+static constexpr std::uint32_t BUFFER_COUNT{4};
+static constexpr std::uint32_t BUFFER_SIZE{8192};
+
+static std::vector<std::uint8_t> read_file(const std::filesystem::path &path) {
+  std::ifstream file{path, std::ios::binary};
+  return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+class TestFileSink : public ::testing::Test {
+protected:
+  std::filesystem::path path;
+  std::shared_ptr<ReturnQueue<RequeingPackage<DmaBuf>>> returns;
+  /* buffers neither a frame nor the sink holds, indexed by their package index */
+  std::vector<std::optional<RequeingPackage<DmaBuf>>> buffers;
+  /* everything handed to the sink */
+  std::vector<std::uint8_t> written;
+
+  void SetUp() override {
+    set_device_backend(std::make_shared<FakeDeviceBackend>());
+    path = std::filesystem::path{testing::TempDir()} / "test_file_sink.h264";
+    returns = std::make_shared<ReturnQueue<RequeingPackage<DmaBuf>>>(BUFFER_COUNT);
+
+    auto allocated = allocate_dma_bufs(BUFFER_COUNT, BUFFER_SIZE);
+    for (std::uint32_t i = 0; i < BUFFER_COUNT; i++) {
+      buffers.emplace_back(RequeingPackage<DmaBuf>::create(std::move(allocated[i])).with_queue(returns).with_index(i));
+    }
+  }
+
+  void TearDown() override {
+    buffers.clear();
+    returns.reset();
+    std::filesystem::remove(path);
+    set_device_backend(nullptr);
+  }
+
+  /* a package left in the queue would return itself once more when it goes out of scope */
+  std::size_t take_back() {
+    return returns->drain([this](RequeingPackage<DmaBuf> &&package) {
+      const auto index = package.index();
+      buffers[index].emplace(std::move(package));
+    });
+  }
+
+  EncodedFrame frame(std::size_t number, std::uint32_t flags = 0) {
+    take_back();
+
+    const auto free_buffer = std::ranges::find_if(buffers, [](const auto &buffer) { return buffer.has_value(); });
+    EXPECT_NE(free_buffer, buffers.end());
+
+    const auto size = static_cast<std::uint32_t>(1000 + number * 997 % (BUFFER_SIZE - 1000));
+    {
+      const DmaBufAccess access{(*free_buffer)->data(), DmaBufAccess::Mode::Write};
+      for (std::uint32_t offset = 0; offset < size; offset++) {
+        const auto value = static_cast<std::uint8_t>((number * 13 + offset) & 0xff);
+        access.writable_data()[offset] = static_cast<std::byte>(value);
+        written.push_back(value);
+      }
+    }
+
+    const timeval timestamp{static_cast<time_t>(number), 0};
+    const BufferInfo info{(*free_buffer)->index(), timestamp, size, V4L2_FIELD_NONE, flags, 0};
+    auto package = std::move(**free_buffer);
+    free_buffer->reset();
+    return EncodedFrame{VideoFrame{std::move(package), info}};
+  }
+
+  bool all_buffers_back() {
+    take_back();
+    return std::ranges::all_of(buffers, [](const auto &buffer) { return buffer.has_value(); });
+  }
+};
+
+TEST_F(TestFileSink, WritesFramesInOrder) {
+  {
+    FileSink sink{path.string()};
+
+    for (std::size_t number = 0; number < 20; number++) {
+      sink.consume(frame(number));
+    }
+  }
+
+  ASSERT_EQ(read_file(path), written);
+  /* the sink drops every frame once it is written */
+  ASSERT_TRUE(all_buffers_back());
+}
+
+TEST_F(TestFileSink, EncodedFrameExposesTheBitstream) {
+  {
+    const auto keyframe = frame(3, V4L2_BUF_FLAG_KEYFRAME);
+
+    ASSERT_TRUE(keyframe.is_keyframe());
+    ASSERT_EQ(keyframe.timestamp().tv_sec, 3);
+    ASSERT_EQ(keyframe.data().size(), keyframe.info().bytesused);
+    ASSERT_TRUE(std::ranges::equal(keyframe.data(), written, [](std::byte byte, std::uint8_t value) {
+      return static_cast<std::uint8_t>(byte) == value;
+    }));
+    ASSERT_FALSE(all_buffers_back());
+  }
+
+  ASSERT_TRUE(all_buffers_back());
+
+  const auto delta = frame(4);
+  ASSERT_FALSE(delta.is_keyframe());
+}
+
+TEST_F(TestFileSink, UnopenableFileThrows) {
+  ASSERT_THROW(FileSink{(path / "missing" / "file.h264").string()}, DeviceFileError);
+}
+
+TEST_F(TestFileSink, FailedWriteThrows) {
+  /* every write to /dev/full fails with ENOSPC */
+  FileSink sink{"/dev/full"};
+
+  ASSERT_THROW(sink.consume(frame(0)), DeviceFileError);
+
+  /* the failed frame went back all the same */
+  ASSERT_EQ(take_back(), 1);
+}
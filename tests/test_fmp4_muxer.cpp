@@ -0,0 +1,249 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "fake_device_backend.hpp"
+#include "fmp4_muxer.hpp"
+#include "return_queue.hpp"
+
+static const std::vector<std::uint8_t> SPS = {0x67, 0x42, 0xc0, 0x1f, 0x95, 0xa8, 0x14};
+static const std::vector<std::uint8_t> PPS = {0x68, 0xce, 0x38, 0x80};
+
+struct Box {
+  std::string type;
+  std::vector<std::uint8_t> payload;
+};
+
+static std::uint32_t read_u32(const std::uint8_t *at) {
+  return static_cast<std::uint32_t>(at[0]) << 24 | at[1] << 16 | at[2] << 8 | at[3];
+}
+
+static std::uint64_t read_u64(const std::uint8_t *at) {
+  return static_cast<std::uint64_t>(read_u32(at)) << 32 | read_u32(at + 4);
+}
+
+static std::vector<Box> parse_boxes(const std::uint8_t *data, std::size_t size) {
+  std::vector<Box> boxes;
+
+  for (std::size_t offset = 0; offset + 8 <= size;) {
+    const auto box_size = read_u32(data + offset);
+    EXPECT_GE(box_size, 8);
+    EXPECT_LE(offset + box_size, size);
+    if (box_size < 8 || offset + box_size > size) {
+      break;
+    }
+
+    boxes.push_back({std::string(reinterpret_cast<const char *>(data + offset + 4), 4),
+                     std::vector<std::uint8_t>(data + offset + 8, data + offset + box_size)});
+    offset += box_size;
+  }
+  return boxes;
+}
+
+static std::vector<Box> parse_boxes(const std::vector<std::uint8_t> &data) {
+  return parse_boxes(data.data(), data.size());
+}
+
+static const Box *child(const std::vector<Box> &boxes, const std::string &type) {
+  for (const auto &box : boxes) {
+    if (box.type == type) {
+      return &box;
+    }
+  }
+  return nullptr;
+}
+
+static std::vector<std::uint8_t> read_file(const std::string &path) {
+  std::ifstream file{path, std::ios::binary};
+  return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+class TestFmp4Muxer : public ::testing::Test {
+protected:
+  std::string path;
+  std::shared_ptr<ReturnQueue<RequeingPackage<DmaBuf>>> queue;
+
+  void SetUp() override {
+    set_device_backend(std::make_shared<FakeDeviceBackend>());
+    path = testing::TempDir() + "test_fmp4_muxer.mp4";
+    queue = std::make_shared<ReturnQueue<RequeingPackage<DmaBuf>>>(8);
+  }
+
+  void TearDown() override {
+    queue.reset();
+    set_device_backend(nullptr);
+    std::remove(path.c_str());
+  }
+
+  /* Annex-B access unit with 4 byte start codes, a slice of slice_size bytes */
+  EncodedFrame frame(bool idr, std::uint32_t slice_size, long timestamp_us) {
+    std::vector<std::uint8_t> bitstream;
+    auto append = [&bitstream](const std::vector<std::uint8_t> &unit) {
+      bitstream.insert(bitstream.end(), {0, 0, 0, 1});
+      bitstream.insert(bitstream.end(), unit.begin(), unit.end());
+    };
+
+    append({0x09, 0xf0});
+    if (idr) {
+      append(SPS);
+      append(PPS);
+    }
+    std::vector<std::uint8_t> slice(slice_size, 0x5a);
+    slice[0] = idr ? 0x65 : 0x41;
+    append(slice);
+
+    auto buffers = allocate_dma_bufs(1, static_cast<std::uint32_t>(bitstream.size()));
+    {
+      const DmaBufAccess access{buffers[0], DmaBufAccess::Mode::Write};
+      std::memcpy(access.writable_data().data(), bitstream.data(), bitstream.size());
+    }
+
+    const BufferInfo info{0, {timestamp_us / 1000000, timestamp_us % 1000000},
+                          static_cast<std::uint32_t>(bitstream.size()), 0,
+                          idr ? static_cast<std::uint32_t>(V4L2_BUF_FLAG_KEYFRAME) : 0};
+    return EncodedFrame{VideoFrame{RequeingPackage<DmaBuf>::create(std::move(buffers[0])).with_queue(queue), info}};
+  }
+};
+
+TEST_F(TestFmp4Muxer, WritesInitSegmentAndOneFragmentPerFrame) {
+  {
+    Fmp4Muxer muxer{path, 640, 480};
+
+    /* joins the stream between two IDR pictures */
+    muxer.consume(frame(false, 100, 1000000));
+    muxer.consume(frame(true, 300, 1033000));
+    muxer.consume(frame(false, 100, 1066000));
+    muxer.consume(frame(false, 120, 1100000));
+    muxer.consume(frame(true, 200, 1133000));
+
+    ASSERT_EQ(muxer.frames_dropped(), 1);
+    ASSERT_EQ(muxer.frames_written(), 3);
+
+    /* the dropped and the written frames went back to their queue, the last one is held */
+    std::vector<RequeingPackage<DmaBuf>> returned;
+    queue->drain([&returned](RequeingPackage<DmaBuf> &&buffer) { returned.push_back(std::move(buffer)); });
+    ASSERT_EQ(returned.size(), 4);
+
+    muxer.flush();
+    ASSERT_EQ(muxer.frames_written(), 4);
+  }
+
+  const auto file = read_file(path);
+  const auto boxes = parse_boxes(file);
+
+  std::vector<std::string> types;
+  for (const auto &box : boxes) {
+    types.push_back(box.type);
+  }
+  ASSERT_EQ(types, (std::vector<std::string>{"ftyp", "moov", "styp", "moof", "mdat", "moof", "mdat", "moof", "mdat",
+                                             "styp", "moof", "mdat"}));
+
+  /* the avcC carries the parameter sets */
+  const auto moov = parse_boxes(child(boxes, "moov")->payload);
+  const auto trak = parse_boxes(child(moov, "trak")->payload);
+  const auto mdia = parse_boxes(child(trak, "mdia")->payload);
+  const auto minf = parse_boxes(child(mdia, "minf")->payload);
+  const auto stbl = parse_boxes(child(minf, "stbl")->payload);
+  const auto &stsd = child(stbl, "stsd")->payload;
+  /* full box header and entry count, the avc1 sample entry has 78 bytes before its child boxes */
+  const auto avc1 = parse_boxes(stsd.data() + 8, stsd.size() - 8);
+  ASSERT_EQ(avc1[0].type, "avc1");
+  const auto avcc = parse_boxes(avc1[0].payload.data() + 78, avc1[0].payload.size() - 78);
+  ASSERT_EQ(avcc[0].type, "avcC");
+
+  std::vector<std::uint8_t> expected_avcc = {1, 0x42, 0xc0, 0x1f, 0xff, 0xe1, 0, static_cast<std::uint8_t>(SPS.size())};
+  expected_avcc.insert(expected_avcc.end(), SPS.begin(), SPS.end());
+  expected_avcc.insert(expected_avcc.end(), {1, 0, static_cast<std::uint8_t>(PPS.size())});
+  expected_avcc.insert(expected_avcc.end(), PPS.begin(), PPS.end());
+  ASSERT_EQ(avcc[0].payload, expected_avcc);
+
+  const std::uint64_t decode_times[] = {0, 33000, 67000, 100000};
+  const std::uint32_t durations[] = {33000, 34000, 33000, 33000};
+  const std::uint32_t slice_sizes[] = {300, 100, 120, 200};
+
+  std::size_t fragment = 0;
+  for (std::size_t i = 0; i < boxes.size(); i++) {
+    if (boxes[i].type != "moof") {
+      continue;
+    }
+
+    const auto moof = parse_boxes(boxes[i].payload);
+    const auto mfhd = child(moof, "mfhd");
+    ASSERT_EQ(read_u32(mfhd->payload.data() + 4), fragment + 1);
+
+    const auto traf = parse_boxes(child(moof, "traf")->payload);
+    ASSERT_EQ(read_u64(child(traf, "tfdt")->payload.data() + 4), decode_times[fragment]);
+
+    const auto *trun = child(traf, "trun")->payload.data();
+    ASSERT_EQ(read_u32(trun + 4), 1);
+    /* the data offset points behind the mdat header */
+    ASSERT_EQ(read_u32(trun + 8), boxes[i].payload.size() + 16);
+    ASSERT_EQ(read_u32(trun + 12), durations[fragment]);
+    ASSERT_EQ(read_u32(trun + 20), fragment == 0 || fragment == 3 ? 0x02000000 : 0x01010000);
+
+    /* only the slice, length prefixed, parameter sets and delimiters are left out */
+    const auto &mdat = boxes[i + 1].payload;
+    ASSERT_EQ(read_u32(trun + 16), mdat.size());
+    ASSERT_EQ(mdat.size(), 4 + slice_sizes[fragment]);
+    ASSERT_EQ(read_u32(mdat.data()), slice_sizes[fragment]);
+    ASSERT_EQ(mdat[4], fragment == 0 || fragment == 3 ? 0x65 : 0x41);
+
+    fragment++;
+  }
+
+  ASSERT_EQ(fragment, 4);
+}
+
+TEST_F(TestFmp4Muxer, WritesNothingWithoutIdr) {
+  {
+    Fmp4Muxer muxer{path, 640, 480};
+
+    muxer.consume(frame(false, 100, 0));
+    muxer.consume(frame(false, 100, 33333));
+
+    ASSERT_EQ(muxer.frames_dropped(), 2);
+    ASSERT_EQ(muxer.bytes_written(), 0);
+  }
+
+  ASSERT_TRUE(read_file(path).empty());
+}
+
+TEST_F(TestFmp4Muxer, KeepsTheDurationWhenTimestampsGoBackwards) {
+  {
+    Fmp4Muxer muxer{path, 640, 480};
+
+    muxer.consume(frame(true, 100, 1000000));
+    muxer.consume(frame(false, 100, 1033000));
+    /* e.g. the driver restarted its clock */
+    muxer.consume(frame(false, 100, 900000));
+    muxer.consume(frame(false, 100, 933000));
+    muxer.flush();
+
+    ASSERT_EQ(muxer.frames_written(), 4);
+  }
+
+  const auto boxes = parse_boxes(read_file(path));
+
+  std::vector<std::uint64_t> decode_times;
+  std::vector<std::uint32_t> durations;
+  for (const auto &box : boxes) {
+    if (box.type != "moof") {
+      continue;
+    }
+
+    const auto traf = parse_boxes(child(parse_boxes(box.payload), "traf")->payload);
+    decode_times.push_back(read_u64(child(traf, "tfdt")->payload.data() + 4));
+    durations.push_back(read_u32(child(traf, "trun")->payload.data() + 12));
+  }
+
+  ASSERT_EQ(durations, (std::vector<std::uint32_t>{33000, 33000, 33000, 33000}));
+  ASSERT_EQ(decode_times, (std::vector<std::uint64_t>{0, 33000, 66000, 99000}));
+}
@@ -0,0 +1,187 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "fake_device_backend.hpp"
+#include "format_converter.hpp"
+#include "v4l2_streamer.hpp"
+
+using namespace std::chrono_literals;
+
+static v4l2_pix_format yuyv_format(std::uint32_t width, std::uint32_t height, std::uint32_t bytesperline = 0) {
+  v4l2_pix_format format = {};
+  format.width = width;
+  format.height = height;
+  format.pixelformat = V4L2_PIX_FMT_YUYV;
+  format.bytesperline = bytesperline;
+  return format;
+}
+
+static std::vector<std::uint8_t> random_bytes(std::size_t size) {
+  std::mt19937 random{42};
+  std::uniform_int_distribution<int> byte{0, 255};
+
+  std::vector<std::uint8_t> bytes(size);
+  for (auto &value : bytes) {
+    value = static_cast<std::uint8_t>(byte(random));
+  }
+  return bytes;
+}
+
+TEST(TestFormatKernels, EveryKernelMatchesScalar) {
+  /* not a multiple of any vector width, so the scalar tail runs as well */
+  constexpr std::size_t WIDTH = 16 * 7 + 6;
+
+  const auto top = random_bytes(WIDTH * 4);
+  const auto *bottom = top.data() + WIDTH * 2;
+
+  const auto &scalar = scalar_format_kernels();
+
+  std::vector<std::uint8_t> expected_luma(WIDTH * 2);
+  std::vector<std::uint8_t> expected_uv(WIDTH);
+  std::vector<std::uint8_t> expected_u(WIDTH / 2);
+  std::vector<std::uint8_t> expected_v(WIDTH / 2);
+
+  scalar.yuyv_to_nv12(top.data(), bottom, expected_luma.data(), expected_luma.data() + WIDTH, expected_uv.data(),
+                      WIDTH);
+  scalar.yuyv_to_i420(top.data(), bottom, expected_luma.data(), expected_luma.data() + WIDTH, expected_u.data(),
+                      expected_v.data(), WIDTH);
+
+  for (const auto *kernels : supported_format_kernels()) {
+    std::vector<std::uint8_t> luma(WIDTH * 2);
+    std::vector<std::uint8_t> uv(WIDTH);
+    std::vector<std::uint8_t> u(WIDTH / 2);
+    std::vector<std::uint8_t> v(WIDTH / 2);
+
+    kernels->yuyv_to_nv12(top.data(), bottom, luma.data(), luma.data() + WIDTH, uv.data(), WIDTH);
+    ASSERT_EQ(luma, expected_luma) << kernels->name;
+    ASSERT_EQ(uv, expected_uv) << kernels->name;
+
+    std::ranges::fill(luma, 0);
+    kernels->yuyv_to_i420(top.data(), bottom, luma.data(), luma.data() + WIDTH, u.data(), v.data(), WIDTH);
+    ASSERT_EQ(luma, expected_luma) << kernels->name;
+    ASSERT_EQ(u, expected_u) << kernels->name;
+    ASSERT_EQ(v, expected_v) << kernels->name;
+  }
+}
+
+TEST(TestFormatConverter, Nv12Layout) {
+  /* 4 x 2 pixels, the chroma of both rows is averaged and rounded up */
+  const std::vector<std::uint8_t> yuyv{
+    10, 100, 11, 200, 12, 50, 13, 60,
+    20, 101, 21, 202, 22, 51, 23, 70,
+  };
+
+  FormatConverter converter{yuyv_format(4, 2), V4L2_PIX_FMT_NV12, 1};
+  ASSERT_EQ(converter.target_size(), 12);
+
+  std::vector<std::uint8_t> nv12(converter.target_size());
+  converter.convert(yuyv.data(), nv12.data());
+
+  const std::vector<std::uint8_t> expected{10, 11, 12, 13, 20, 21, 22, 23, 101, 201, 51, 65};
+  ASSERT_EQ(nv12, expected);
+}
+
+TEST(TestFormatConverter, I420Layout) {
+  const std::vector<std::uint8_t> yuyv{
+    10, 100, 11, 200, 12, 50, 13, 60,
+    20, 101, 21, 202, 22, 51, 23, 70,
+  };
+
+  FormatConverter converter{yuyv_format(4, 2), V4L2_PIX_FMT_YUV420, 1};
+
+  std::vector<std::uint8_t> i420(converter.target_size());
+  converter.convert(yuyv.data(), i420.data());
+
+  const std::vector<std::uint8_t> expected{10, 11, 12, 13, 20, 21, 22, 23, 101, 51, 201, 65};
+  ASSERT_EQ(i420, expected);
+}
+
+TEST(TestFormatConverter, TilesMatchSingleThread) {
+  /* padded rows, the stride is larger than the pixels */
+  constexpr std::uint32_t WIDTH = 640;
+  constexpr std::uint32_t HEIGHT = 482;
+  constexpr std::uint32_t BYTESPERLINE = WIDTH * 2 + 64;
+
+  const auto yuyv = random_bytes(std::size_t{BYTESPERLINE} * HEIGHT);
+
+  for (const auto target_format : {V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUV420}) {
+    FormatConverter single{yuyv_format(WIDTH, HEIGHT, BYTESPERLINE), target_format, 1};
+    FormatConverter tiled{yuyv_format(WIDTH, HEIGHT, BYTESPERLINE), target_format, 4};
+    ASSERT_EQ(tiled.threads(), 4);
+
+    std::vector<std::uint8_t> expected(single.target_size());
+    single.convert(yuyv.data(), expected.data());
+
+    for (int frame = 0; frame < 3; frame++) {
+      std::vector<std::uint8_t> converted(tiled.target_size());
+      tiled.convert(yuyv.data(), converted.data());
+      ASSERT_EQ(converted, expected);
+    }
+  }
+}
+
+TEST(TestFormatConverter, ConvertsDmaBufs) {
+  set_device_backend(std::make_shared<FakeDeviceBackend>());
+
+  {
+    FormatConverter converter{yuyv_format(64, 16), V4L2_PIX_FMT_NV12, 2};
+
+    auto source = allocate_dma_bufs(1, 64 * 16 * 2);
+    auto target = allocate_dma_bufs(1, static_cast<std::uint32_t>(converter.target_size()));
+    const auto yuyv = random_bytes(64 * 16 * 2);
+
+    {
+      const DmaBufAccess access{source[0], DmaBufAccess::Mode::Write};
+      std::memcpy(access.writable_data().data(), yuyv.data(), yuyv.size());
+    }
+
+    converter.convert(source[0], target[0]);
+
+    std::vector<std::uint8_t> expected(converter.target_size());
+    converter.convert(yuyv.data(), expected.data());
+
+    const DmaBufAccess access{target[0], DmaBufAccess::Mode::Read};
+    ASSERT_EQ(std::memcmp(access.data().data(), expected.data(), expected.size()), 0);
+  }
+
+  set_device_backend(nullptr);
+}
+
+TEST(TestFormatConverter, StreamerConvertsOnlyWhenFormatsDiffer) {
+  FakeDeviceBackend::Latencies latencies;
+  latencies.frame_interval = 1ms;
+  latencies.encode = 200us;
+
+  {
+    set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+
+    V4L2Streamer streamer{"/dev/video0", 640, 480};
+    ASSERT_EQ(streamer.encoder_input_format(), V4L2_PIX_FMT_YUYV);
+  }
+
+  {
+    auto backend = std::make_shared<FakeDeviceBackend>(latencies);
+    backend->set_encoder_input_formats({V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUV420});
+    set_device_backend(backend);
+
+    V4L2Streamer streamer{"/dev/video0", 640, 480, 2};
+    ASSERT_EQ(streamer.encoder_input_format(), V4L2_PIX_FMT_NV12);
+
+    streamer.start_streaming();
+    for (int i = 0; i < 6; i++) {
+      streamer.next_frame();
+    }
+    streamer.flush();
+
+    ASSERT_EQ(streamer.frames_encoded(), 6);
+  }
+
+  set_device_backend(nullptr);
+}
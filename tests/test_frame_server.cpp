@@ -0,0 +1,341 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fake_device_backend.hpp"
+#include "frame_server.hpp"
+#include "return_queue.hpp"
+#include "v4l2_streamer.hpp"
+
+using namespace std::chrono_literals;
+
+static constexpr std::uint32_t BUFFER_SIZE{4096};
+
+static std::string socket_path() {
+  return "/tmp/test_frame_server_" + std::to_string(getpid()) + ".sock";
+}
+
+static std::byte pattern(std::uint32_t buffer, std::size_t offset) {
+  return static_cast<std::byte>((buffer * 31 + offset * 7) & 0xff);
+}
+
+/* the subscriber waits for the hello, which the server only sends while it is serviced */
+static std::unique_ptr<FrameSubscriber> subscribe(FrameServer &server, const std::string &path) {
+  std::unique_ptr<FrameSubscriber> subscriber;
+  std::thread connecting{[&subscriber, &path] { subscriber = std::make_unique<FrameSubscriber>(path); }};
+
+  const auto subscribers = server.subscribers();
+  while (server.subscribers() == subscribers) {
+    server.service();
+    std::this_thread::sleep_for(1ms);
+  }
+
+  connecting.join();
+  return subscriber;
+}
+
+class TestFrameServer : public ::testing::Test {
+protected:
+  std::shared_ptr<ReturnQueue<RequeingPackage<DmaBuf>>> queue;
+  std::vector<const DmaBuf *> shared;
+  std::vector<int> fds;
+  /* buffers not handed to the server, by index */
+  std::vector<std::optional<RequeingPackage<DmaBuf>>> parked;
+
+  void SetUp() override {
+    set_device_backend(std::make_shared<FakeDeviceBackend>());
+    queue = std::make_shared<ReturnQueue<RequeingPackage<DmaBuf>>>(8);
+
+    auto buffers = allocate_dma_bufs(3, BUFFER_SIZE);
+    for (std::uint32_t i = 0; i < buffers.size(); i++) {
+      const DmaBufAccess access{buffers[i], DmaBufAccess::Mode::Write};
+      for (std::size_t offset = 0; offset < BUFFER_SIZE; offset++) {
+        access.writable_data()[offset] = pattern(i, offset);
+      }
+      fds.push_back(buffers[i].get_fd());
+    }
+
+    parked.reserve(buffers.size());
+    for (auto &buffer : buffers) {
+      parked.emplace_back(RequeingPackage<DmaBuf>::create(std::move(buffer)).with_queue(queue));
+      shared.push_back(&parked.back()->data());
+    }
+  }
+
+  void TearDown() override {
+    /* without the queue the packages are dropped for good */
+    queue.reset();
+    parked.clear();
+    set_device_backend(nullptr);
+  }
+
+  EncodedFrame frame(std::uint32_t index, std::uint32_t bytesused) {
+    const BufferInfo info{index, {index, 0}, bytesused, 0, 0};
+    EncodedFrame frame{VideoFrame{std::move(*parked[index]), info}};
+    parked[index].reset();
+    return frame;
+  }
+
+  std::vector<std::uint32_t> returned() {
+    std::vector<std::uint32_t> indices;
+    queue->drain([this, &indices](RequeingPackage<DmaBuf> &&package) {
+      const auto index = static_cast<std::uint32_t>(std::ranges::find(fds, package.data().get_fd()) - fds.begin());
+      indices.push_back(index);
+      parked[index].emplace(std::move(package));
+    });
+    return indices;
+  }
+};
+
+TEST_F(TestFrameServer, KeepsFramesUntilTheSubscriberReleasesThem) {
+  const auto path = socket_path();
+  FrameServer server{path};
+  server.prepare(shared);
+
+  auto subscriber = subscribe(server, path);
+  ASSERT_EQ(subscriber->buffer_count(), 3);
+  ASSERT_EQ(subscriber->format().pixelformat, V4L2_PIX_FMT_H264);
+
+  server.consume(frame(1, 1000));
+  ASSERT_EQ(server.frames_held(), 1);
+
+  auto received = subscriber->receive(1s);
+  ASSERT_TRUE(received.has_value());
+  ASSERT_EQ(received->info.index, 1);
+  ASSERT_EQ(received->info.timestamp.tv_sec, 1);
+  ASSERT_EQ(received->data.size(), 1000);
+  for (std::size_t offset = 0; offset < received->data.size(); offset++) {
+    ASSERT_EQ(received->data[offset], pattern(1, offset));
+  }
+
+  server.service();
+  ASSERT_TRUE(returned().empty());
+
+  subscriber->release(*received);
+  server.service();
+
+  ASSERT_EQ(returned(), std::vector<std::uint32_t>{1});
+  ASSERT_EQ(server.frames_held(), 0);
+  ASSERT_EQ(server.frames_published(), 1);
+}
+
+TEST_F(TestFrameServer, ReturnsFramesNobodySubscribedTo) {
+  const auto path = socket_path();
+  FrameServer server{path};
+  server.prepare(shared);
+
+  server.consume(frame(0, 100));
+
+  ASSERT_EQ(returned(), std::vector<std::uint32_t>{0});
+  ASSERT_EQ(server.frames_published(), 0);
+}
+
+TEST_F(TestFrameServer, SkipsSubscriberHoldingTooManyFrames) {
+  const auto path = socket_path();
+  FrameServer::Config config;
+  config.max_outstanding = 2;
+  FrameServer server{path, config};
+  server.prepare(shared);
+
+  auto subscriber = subscribe(server, path);
+
+  server.consume(frame(0, 100));
+  server.consume(frame(1, 100));
+  server.consume(frame(2, 100));
+
+  /* the third frame went to nobody and was returned at once */
+  ASSERT_EQ(returned(), std::vector<std::uint32_t>{2});
+  ASSERT_EQ(server.frames_skipped(), 1);
+  ASSERT_EQ(server.frames_held(), 2);
+
+  const auto first = subscriber->try_receive();
+  const auto second = subscriber->try_receive();
+  ASSERT_TRUE(first.has_value());
+  ASSERT_TRUE(second.has_value());
+  ASSERT_FALSE(subscriber->try_receive().has_value());
+
+  subscriber->release(*first);
+  server.consume(frame(2, 100));
+
+  ASSERT_EQ(returned(), std::vector<std::uint32_t>{0});
+  ASSERT_EQ(server.frames_held(), 2);
+  ASSERT_EQ(subscriber->try_receive()->info.index, 2);
+}
+
+TEST_F(TestFrameServer, ReleasesFramesOfDisconnectedSubscribers) {
+  const auto path = socket_path();
+  FrameServer server{path};
+  server.prepare(shared);
+
+  auto subscriber = subscribe(server, path);
+  auto other = subscribe(server, path);
+  ASSERT_EQ(server.subscribers(), 2);
+
+  server.consume(frame(0, 100));
+  other->release(*other->receive(1s));
+  server.service();
+  ASSERT_TRUE(returned().empty());
+
+  subscriber.reset();
+  server.service();
+
+  ASSERT_EQ(server.subscribers(), 1);
+  ASSERT_EQ(returned(), std::vector<std::uint32_t>{0});
+}
+
+TEST_F(TestFrameServer, SubscriberInAnotherProcessReadsFrames) {
+  const auto path = socket_path();
+  FrameServer server{path};
+  server.prepare(shared);
+
+  const pid_t child = fork();
+  ASSERT_NE(child, -1);
+
+  if (child == 0) {
+    int status = 0;
+    {
+      FrameSubscriber subscriber{path};
+
+      for (std::uint32_t i = 0; i < 3; i++) {
+        const auto received = subscriber.receive(5s);
+        if (!received || received->info.index != i || received->data.size() != 500 + i) {
+          status = 1;
+          break;
+        }
+        for (std::size_t offset = 0; offset < received->data.size(); offset++) {
+          if (received->data[offset] != pattern(i, offset)) {
+            status = 2;
+          }
+        }
+        subscriber.release(*received);
+      }
+    }
+    _exit(status);
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + 5s;
+  while (server.subscribers() == 0 && std::chrono::steady_clock::now() < deadline) {
+    server.service();
+    std::this_thread::sleep_for(1ms);
+  }
+  ASSERT_EQ(server.subscribers(), 1);
+
+  for (std::uint32_t i = 0; i < 3; i++) {
+    server.consume(frame(i, 500 + i));
+
+    while (server.frames_held() > 0 && std::chrono::steady_clock::now() < deadline) {
+      server.service();
+      std::this_thread::sleep_for(1ms);
+    }
+    ASSERT_EQ(returned(), std::vector<std::uint32_t>{i});
+  }
+
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(WEXITSTATUS(status), 0);
+}
+
+TEST(TestFrameServerStreaming, StreamerSharesCameraFrames) {
+  FakeDeviceBackend::Latencies latencies;
+  latencies.frame_interval = 1ms;
+  latencies.encode = 200us;
+  set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+
+  {
+    const auto path = socket_path();
+    auto server = std::make_shared<FrameServer>(path);
+
+    V4L2Streamer streamer{"/dev/video0", 640, 480};
+    streamer.set_camera_sink(server);
+
+    auto subscriber = subscribe(*server, path);
+    ASSERT_EQ(subscriber->format().pixelformat, V4L2_PIX_FMT_YUYV);
+
+    std::atomic<bool> streaming{true};
+    std::size_t frames = 0;
+
+    std::thread reading{[&subscriber, &streaming, &frames] {
+      while (streaming) {
+        if (auto received = subscriber->receive(10ms)) {
+          EXPECT_EQ(received->data.size(), 640 * 480 * 2);
+          frames++;
+          subscriber->release(*received);
+        }
+      }
+    }};
+
+    streamer.start_streaming();
+    for (int i = 0; i < 30; i++) {
+      streamer.next_frame();
+    }
+
+    streaming = false;
+    reading.join();
+
+    /* frames the subscriber still held were skipped, the camera never ran out of buffers */
+    ASSERT_EQ(streamer.frames_encoded(), 30);
+    ASSERT_GT(server->frames_published(), 0);
+    ASSERT_GE(server->frames_published() + server->frames_skipped(), 30);
+    ASSERT_LE(frames, server->frames_published());
+  }
+
+  set_device_backend(nullptr);
+}
+
+TEST(TestFrameServerStreaming, BlockingStreamerWaitsForLateReleases) {
+  FakeDeviceBackend::Latencies latencies;
+  latencies.frame_interval = 1ms;
+  latencies.encode = 200us;
+  set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+
+  {
+    const auto path = socket_path();
+    auto server = std::make_shared<FrameServer>(path);
+
+    /* the subscriber keeps frames longer than the encoder, seven frames in the encoder and two older ones with the
+     * subscriber leave no camera buffer for the driver */
+    V4L2Streamer streamer{"/dev/video0", 640, 480, 7};
+    streamer.set_camera_sink(server);
+
+    auto subscriber = subscribe(*server, path);
+
+    std::atomic<bool> streaming{true};
+    std::size_t frames = 0;
+
+    std::thread reading{[&subscriber, &streaming, &frames] {
+      while (streaming) {
+        if (auto received = subscriber->receive(10ms)) {
+          std::this_thread::sleep_for(20ms);
+          frames++;
+          subscriber->release(*received);
+        }
+      }
+    }};
+
+    streamer.start_streaming();
+    for (int i = 0; i < 30; i++) {
+      streamer.next_frame();
+    }
+    streamer.flush();
+
+    streaming = false;
+    reading.join();
+
+    ASSERT_EQ(streamer.frames_encoded(), 30);
+    ASSERT_GT(frames, 0);
+  }
+
+  set_device_backend(nullptr);
+}
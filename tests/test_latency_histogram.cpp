@@ -0,0 +1,74 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include "latency_histogram.hpp"
+
+TEST(TestLatencyHistogram, EmptyHistogramReportsZero) {
+  LatencyHistogram histogram;
+
+  ASSERT_EQ(histogram.count(), 0);
+  ASSERT_EQ(histogram.percentile(99.0), 0);
+  ASSERT_EQ(histogram.min(), 0);
+  ASSERT_EQ(histogram.max(), 0);
+}
+
+TEST(TestLatencyHistogram, SmallValuesAreExact) {
+  LatencyHistogram histogram;
+
+  for (std::uint64_t value = 1; value <= 50; value++) {
+    histogram.record(value);
+  }
+
+  ASSERT_EQ(histogram.percentile(50.0), 25);
+  ASSERT_EQ(histogram.percentile(100.0), 50);
+  ASSERT_EQ(histogram.min(), 1);
+  ASSERT_EQ(histogram.mean(), 25);
+}
+
+TEST(TestLatencyHistogram, BucketsBoundRelativeError) {
+  for (std::uint64_t value = 1; value < (std::uint64_t{1} << 36); value = value * 3 / 2 + 1) {
+    const auto highest = LatencyHistogram::bucket_highest_value(LatencyHistogram::bucket_index(value));
+
+    ASSERT_GE(highest, value);
+    ASSERT_LE(highest - value, value / 64);
+  }
+}
+
+TEST(TestLatencyHistogram, PercentilesOfUniformMicroseconds) {
+  LatencyHistogram histogram;
+
+  for (std::uint64_t us = 1; us <= 10000; us++) {
+    histogram.record(us * 1000);
+  }
+
+  const auto summary = histogram.summary();
+
+  ASSERT_EQ(summary.count, 10000);
+  ASSERT_NEAR(summary.p50_ns, 5000000, 5000000 / 64);
+  ASSERT_NEAR(summary.p99_ns, 9900000, 9900000 / 64);
+  ASSERT_NEAR(summary.p999_ns, 9990000, 9990000 / 64);
+  ASSERT_EQ(summary.max_ns, 10000000);
+}
+
+TEST(TestLatencyHistogram, HugeValuesAreClamped) {
+  LatencyHistogram histogram;
+
+  histogram.record(UINT64_MAX / 2);
+
+  ASSERT_EQ(histogram.count(), 1);
+  ASSERT_EQ(histogram.percentile(50.0), (std::uint64_t{1} << LatencyHistogram::MAX_MAGNITUDE) - 1);
+  ASSERT_EQ(histogram.max(), UINT64_MAX / 2);
+}
+
+TEST(TestLatencyHistogram, ResetClearsEverything) {
+  LatencyHistogram histogram;
+
+  histogram.record(1000);
+  histogram.reset();
+
+  ASSERT_EQ(histogram.count(), 0);
+  ASSERT_EQ(histogram.percentile(50.0), 0);
+}
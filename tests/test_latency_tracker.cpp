@@ -0,0 +1,120 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include "latency_tracker.hpp"
+
+/* a frame the sensor finished ago_us before now, as the camera reports it */
+static BufferInfo camera_frame(std::uint64_t ago_us, std::uint32_t flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+  const auto sensor_us = LatencyTracker::now_ns() / 1000 - ago_us;
+  const timeval timestamp{static_cast<time_t>(sensor_us / 1000000), static_cast<suseconds_t>(sensor_us % 1000000)};
+
+  return BufferInfo{0, timestamp, 1000, V4L2_FIELD_NONE, flags, 0};
+}
+
+/* the encoder copies the timestamp of the output buffer to the capture buffer */
+static BufferInfo encoded_frame(const BufferInfo &camera_info) {
+  return BufferInfo{1, camera_info.timestamp, 100, V4L2_FIELD_NONE, V4L2_BUF_FLAG_TIMESTAMP_COPY, 0};
+}
+
+static std::uint64_t count(const LatencyTracker &tracker, LatencyStage stage) {
+  return tracker.histogram(stage).count();
+}
+
+TEST(TestLatencyTracker, RecordsEveryStageOfAFrame) {
+  auto tracker = std::make_shared<LatencyTracker>();
+  const auto camera_info = camera_frame(1000);
+
+  tracker->camera_dequeued(camera_info);
+  tracker->encoder_queued(camera_info);
+  tracker->output_dequeued(camera_info);
+  tracker->capture_dequeued(encoded_frame(camera_info));
+
+  for (std::size_t stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+    ASSERT_EQ(count(*tracker, static_cast<LatencyStage>(stage)), 1) << stage;
+  }
+
+  /* the sensor timestamp is a millisecond old, so is the whole way to the sink */
+  ASSERT_GE(tracker->histogram(LatencyStage::EndToEnd).max(), 1000000);
+}
+
+TEST(TestLatencyTracker, MatchesFramesByTimestamp) {
+  auto tracker = std::make_shared<LatencyTracker>();
+  const auto first = camera_frame(2000);
+  const auto second = camera_frame(1000);
+
+  tracker->camera_dequeued(first);
+  tracker->camera_dequeued(second);
+  tracker->encoder_queued(second);
+  tracker->encoder_queued(first);
+  tracker->output_dequeued(second);
+
+  {
+    const auto release = tracker->capture_dequeued(encoded_frame(second));
+    ASSERT_EQ(count(*tracker, LatencyStage::OutputDequeueToCaptureDequeue), 1);
+    ASSERT_EQ(count(*tracker, LatencyStage::CaptureDequeueToSinkRelease), 0);
+  }
+
+  ASSERT_EQ(count(*tracker, LatencyStage::SensorToCameraDequeue), 2);
+  ASSERT_EQ(count(*tracker, LatencyStage::CameraDequeueToEncoderQueue), 2);
+  ASSERT_EQ(count(*tracker, LatencyStage::EncoderQueueToOutputDequeue), 1);
+  ASSERT_EQ(count(*tracker, LatencyStage::CaptureDequeueToSinkRelease), 1);
+  ASSERT_EQ(count(*tracker, LatencyStage::EndToEnd), 1);
+
+  /* the first frame was dequeued from the capture queue before its output buffer */
+  tracker->capture_dequeued(encoded_frame(first));
+  tracker->output_dequeued(first);
+
+  ASSERT_EQ(count(*tracker, LatencyStage::EncoderQueueToOutputDequeue), 1);
+  ASSERT_EQ(count(*tracker, LatencyStage::OutputDequeueToCaptureDequeue), 1);
+  ASSERT_EQ(count(*tracker, LatencyStage::EndToEnd), 2);
+}
+
+TEST(TestLatencyTracker, NonMonotonicTimestampIsNotRecorded) {
+  auto tracker = std::make_shared<LatencyTracker>();
+  const auto camera_info = camera_frame(1000, V4L2_BUF_FLAG_TIMESTAMP_UNKNOWN);
+
+  tracker->camera_dequeued(camera_info);
+  tracker->encoder_queued(camera_info);
+  tracker->output_dequeued(camera_info);
+  tracker->capture_dequeued(encoded_frame(camera_info));
+
+  /* the timestamp still matches the frame through the encoder, it only can't be compared to the clock */
+  ASSERT_EQ(count(*tracker, LatencyStage::SensorToCameraDequeue), 0);
+  ASSERT_EQ(count(*tracker, LatencyStage::CameraDequeueToEncoderQueue), 1);
+  ASSERT_EQ(count(*tracker, LatencyStage::EncoderQueueToOutputDequeue), 1);
+  ASSERT_EQ(count(*tracker, LatencyStage::OutputDequeueToCaptureDequeue), 1);
+  ASSERT_EQ(count(*tracker, LatencyStage::CaptureDequeueToSinkRelease), 1);
+  ASSERT_EQ(count(*tracker, LatencyStage::EndToEnd), 0);
+}
+
+TEST(TestLatencyTracker, UnknownFramesOnlyRecordTheSinkRelease) {
+  auto tracker = std::make_shared<LatencyTracker>();
+  const auto camera_info = camera_frame(1000);
+
+  tracker->encoder_queued(camera_info);
+  tracker->output_dequeued(camera_info);
+  tracker->capture_dequeued(encoded_frame(camera_info));
+
+  for (std::size_t stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+    const auto expected = static_cast<LatencyStage>(stage) == LatencyStage::CaptureDequeueToSinkRelease ? 1 : 0;
+    ASSERT_EQ(count(*tracker, static_cast<LatencyStage>(stage)), expected) << stage;
+  }
+}
+
+TEST(TestLatencyTracker, ReleaseAfterTrackerIsGoneIsDropped) {
+  auto tracker = std::make_shared<LatencyTracker>();
+  const auto camera_info = camera_frame(1000);
+
+  tracker->camera_dequeued(camera_info);
+  auto release = tracker->capture_dequeued(encoded_frame(camera_info));
+  std::weak_ptr<LatencyTracker> weak = tracker;
+
+  tracker.reset();
+
+  ASSERT_TRUE(weak.expired());
+}
@@ -0,0 +1,148 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "fake_device_backend.hpp"
+#include "motion_detector.hpp"
+#include "v4l2_streamer.hpp"
+
+using namespace std::chrono_literals;
+
+static v4l2_pix_format yuyv_format(std::uint32_t width, std::uint32_t height) {
+  v4l2_pix_format format = {};
+  format.width = width;
+  format.height = height;
+  format.pixelformat = V4L2_PIX_FMT_YUYV;
+  format.bytesperline = width * 2;
+  return format;
+}
+
+/* uniform grey frame with a bright square, luma only so chroma stays neutral */
+static std::vector<std::uint8_t> frame(std::uint32_t width, std::uint32_t height, std::uint32_t square_x = 0,
+                                       std::uint32_t square_y = 0, std::uint32_t square_size = 0) {
+  std::vector<std::uint8_t> yuyv(std::size_t{width} * height * 2);
+
+  for (std::uint32_t y = 0; y < height; y++) {
+    for (std::uint32_t x = 0; x < width; x++) {
+      const bool inside = x >= square_x && x < square_x + square_size && y >= square_y && y < square_y + square_size;
+      yuyv[(std::size_t{y} * width + x) * 2] = inside ? 200 : 60;
+      yuyv[(std::size_t{y} * width + x) * 2 + 1] = 128;
+    }
+  }
+
+  return yuyv;
+}
+
+TEST(TestMotionKernels, BestKernelsMatchScalar) {
+  const auto &scalar = scalar_motion_kernels();
+  const auto &best = best_motion_kernels();
+
+  constexpr std::size_t SAMPLES = 16 * 13;
+
+  std::mt19937 random{42};
+  std::uniform_int_distribution<int> byte{0, 255};
+
+  std::vector<std::uint8_t> yuyv(SAMPLES * 4);
+  for (auto &value : yuyv) {
+    value = static_cast<std::uint8_t>(byte(random));
+  }
+
+  std::vector<std::uint8_t> scalar_luma(SAMPLES);
+  std::vector<std::uint8_t> best_luma(SAMPLES);
+  scalar.extract_luma(yuyv.data(), scalar_luma.data(), SAMPLES);
+  best.extract_luma(yuyv.data(), best_luma.data(), SAMPLES);
+
+  ASSERT_EQ(scalar_luma, best_luma);
+
+  std::vector<std::uint8_t> scalar_background(SAMPLES);
+  for (auto &value : scalar_background) {
+    value = static_cast<std::uint8_t>(byte(random));
+  }
+  auto best_background = scalar_background;
+
+  std::vector<std::uint16_t> scalar_changed(SAMPLES / MOTION_BLOCK_SIZE);
+  std::vector<std::uint16_t> best_changed(SAMPLES / MOTION_BLOCK_SIZE);
+
+  for (int round = 0; round < 3; round++) {
+    scalar.compare_row(scalar_luma.data(), scalar_background.data(), SAMPLES, 25, scalar_changed.data());
+    best.compare_row(best_luma.data(), best_background.data(), SAMPLES, 25, best_changed.data());
+  }
+
+  ASSERT_EQ(scalar_background, best_background);
+  ASSERT_EQ(scalar_changed, best_changed);
+}
+
+TEST(TestMotionDetector, StaticSceneHasNoMotion) {
+  MotionDetector detector;
+  detector.prepare(yuyv_format(640, 480));
+
+  const auto still = frame(640, 480, 100, 100, 64);
+
+  detector.process(still.data());
+  const auto &result = detector.process(still.data());
+
+  ASSERT_EQ(result.blocks_x, 20);
+  ASSERT_EQ(result.blocks_y, 15);
+  ASSERT_EQ(result.changed_blocks, 0);
+  ASSERT_EQ(result.score, 0.0);
+}
+
+TEST(TestMotionDetector, MovingSquareMarksItsBlocks) {
+  MotionDetector detector;
+  detector.prepare(yuyv_format(640, 480));
+
+  /* the square covers sampled blocks 2 to 3 horizontally and 1 to 2 vertically */
+  detector.process(frame(640, 480).data());
+  const auto &result = detector.process(frame(640, 480, 64, 32, 64).data());
+
+  ASSERT_EQ(result.changed_blocks, 4);
+  for (std::uint32_t y = 0; y < result.blocks_y; y++) {
+    for (std::uint32_t x = 0; x < result.blocks_x; x++) {
+      const bool expected = x >= 2 && x <= 3 && y >= 1 && y <= 2;
+      ASSERT_EQ(result.mask[y * result.blocks_x + x], expected) << x << ", " << y;
+    }
+  }
+  ASSERT_NEAR(result.score, 4.0 / 300.0, 1e-9);
+}
+
+class CountingObserver : public ICameraFrameObserver {
+public:
+  std::uint32_t width{0};
+  std::size_t frames{0};
+
+  void prepare(const v4l2_pix_format &format) override { width = format.width; }
+
+  void observe(const DmaBuf &, const BufferInfo &) override { frames++; }
+};
+
+TEST(TestMotionDetector, StreamerShowsEveryCameraFrame) {
+  FakeDeviceBackend::Latencies latencies;
+  latencies.frame_interval = 1ms;
+  latencies.encode = 200us;
+  set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+
+  {
+    auto observer = std::make_shared<CountingObserver>();
+    auto detector = std::make_shared<MotionDetector>();
+
+    V4L2Streamer streamer{"/dev/video0", 640, 480};
+    streamer.add_camera_observer(observer);
+    streamer.add_camera_observer(detector);
+    streamer.start_streaming();
+
+    for (int i = 0; i < 5; i++) {
+      streamer.next_frame();
+    }
+
+    ASSERT_EQ(observer->width, 640);
+    ASSERT_EQ(observer->frames, 5);
+    ASSERT_EQ(detector->last_result().changed_blocks, 0);
+  }
+
+  set_device_backend(nullptr);
+}
@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "nal_scanner.hpp"
+
+static void append(std::vector<std::byte> &bitstream, std::initializer_list<int> bytes) {
+  for (const auto value : bytes) {
+    bitstream.push_back(static_cast<std::byte>(value));
+  }
+}
+
+static std::vector<const std::byte *> all_start_codes(const StartCodeSearch &search,
+                                                      const std::vector<std::byte> &bitstream) {
+  std::vector<const std::byte *> positions;
+  const auto *end = bitstream.data() + bitstream.size();
+
+  for (const auto *position = search.find(bitstream.data(), end); position != end;
+       position = search.find(position + 1, end)) {
+    positions.push_back(position);
+  }
+  return positions;
+}
+
+TEST(TestNalScanner, SearchesFindTheSameStartCodes) {
+  std::mt19937 random{3};
+  /* mostly zeros and ones so that near misses like 00 00 00 and 00 01 are common */
+  std::discrete_distribution<int> byte{{6, 3, 1}};
+
+  for (const std::size_t size : {0, 1, 2, 3, 33, 34, 35, 65, 66, 67, 100, 130, 4099}) {
+    std::vector<std::byte> bitstream(size);
+    for (auto &value : bitstream) {
+      value = static_cast<std::byte>(byte(random) == 2 ? 0x65 : byte(random));
+    }
+
+    const auto expected = all_start_codes(memchr_start_code_search(), bitstream);
+    ASSERT_EQ(all_start_codes(best_start_code_search(), bitstream), expected) << size;
+  }
+}
+
+TEST(TestNalScanner, StartCodeAtTheVeryEnd) {
+  std::vector<std::byte> bitstream(64, std::byte{0x42});
+  append(bitstream, {0, 0, 1});
+
+  for (const auto *search : {&memchr_start_code_search(), &best_start_code_search()}) {
+    const auto *end = bitstream.data() + bitstream.size();
+    ASSERT_EQ(search->find(bitstream.data(), end), end - 3) << search->name;
+  }
+}
+
+TEST(TestNalScanner, IndexesAccessUnit) {
+  std::vector<std::byte> bitstream;
+  append(bitstream, {0, 0, 0, 1, 0x09, 0xf0});                   // AUD
+  append(bitstream, {0, 0, 0, 1, 0x67, 0x42, 0x00, 0x1f, 0x95}); // SPS
+  append(bitstream, {0, 0, 1, 0x68, 0xce, 0x38, 0x80});          // PPS, 3 byte start code
+  append(bitstream, {0, 0, 0, 1, 0x65, 0x88, 0x84, 0x00, 0x03}); // IDR slice
+  append(bitstream, {0, 0});                                     // trailing_zero_8bits
+
+  const auto units = index_nal_units(bitstream);
+
+  ASSERT_EQ(units.count, 4);
+  ASSERT_FALSE(units.truncated);
+
+  ASSERT_EQ(units.units[0].type, NalUnitType::AccessUnitDelimiter);
+  ASSERT_EQ(units.units[0].offset, 4);
+  ASSERT_EQ(units.units[0].size, 2);
+
+  ASSERT_EQ(units.units[1].type, NalUnitType::Sps);
+  ASSERT_EQ(units.units[1].offset, 10);
+  ASSERT_EQ(units.units[1].size, 5);
+  ASSERT_EQ(units.units[1].ref_idc, 3);
+
+  ASSERT_EQ(units.units[2].type, NalUnitType::Pps);
+  ASSERT_EQ(units.units[2].offset, 18);
+  ASSERT_EQ(units.units[2].size, 4);
+
+  ASSERT_EQ(units.units[3].type, NalUnitType::Idr);
+  ASSERT_EQ(units.units[3].offset, 26);
+  ASSERT_EQ(units.units[3].size, 5);
+
+  ASSERT_TRUE(units.has_idr());
+  ASSERT_EQ(units.find(NalUnitType::Pps), &units.units[2]);
+  ASSERT_EQ(units.find(NalUnitType::Sei), nullptr);
+}
+
+TEST(TestNalScanner, IgnoresBytesWithoutStartCode) {
+  std::vector<std::byte> bitstream;
+  append(bitstream, {0x12, 0x34, 0x00, 0x00, 0x02});
+
+  ASSERT_EQ(index_nal_units(bitstream).count, 0);
+  ASSERT_EQ(index_nal_units({}).count, 0);
+}
+
+TEST(TestNalScanner, TruncatesAtCapacity) {
+  std::vector<std::byte> bitstream;
+  for (std::size_t i = 0; i < MAX_NAL_UNITS + 8; i++) {
+    append(bitstream, {0, 0, 1, 0x41, 0x9a});
+  }
+
+  const auto units = index_nal_units(bitstream);
+
+  ASSERT_EQ(units.count, MAX_NAL_UNITS);
+  ASSERT_TRUE(units.truncated);
+  ASSERT_EQ(units.units[MAX_NAL_UNITS - 1].offset, (MAX_NAL_UNITS - 1) * 5 + 3);
+}
+
+TEST(TestNalScanner, CachesParameterSetsForLateJoiners) {
+  std::vector<std::byte> idr;
+  append(idr, {0, 0, 0, 1, 0x67, 0x42, 0x00, 0x1f});
+  append(idr, {0, 0, 0, 1, 0x68, 0xce, 0x38, 0x80});
+  append(idr, {0, 0, 0, 1, 0x65, 0x88, 0x84});
+
+  std::vector<std::byte> p_frame;
+  append(p_frame, {0, 0, 0, 1, 0x41, 0x9a, 0x02});
+
+  NalScanner scanner;
+  ASSERT_TRUE(scanner.parameter_sets().empty());
+
+  scanner.scan(idr);
+  scanner.scan(p_frame);
+
+  ASSERT_EQ(scanner.units().count, 1);
+  ASSERT_EQ(scanner.units().units[0].type, NalUnitType::Slice);
+  ASSERT_EQ(scanner.sps().size(), 4);
+  ASSERT_EQ(scanner.pps().size(), 4);
+  ASSERT_EQ(scanner.parameter_set_updates(), 1);
+
+  const std::vector<std::byte> expected(idr.begin(), idr.begin() + 16);
+  ASSERT_EQ(scanner.parameter_sets(), expected);
+
+  /* the same parameter sets with the next IDR are no update, a new SPS is */
+  scanner.scan(idr);
+  ASSERT_EQ(scanner.parameter_set_updates(), 1);
+
+  idr[7] = std::byte{0x28};
+  scanner.scan(idr);
+  ASSERT_EQ(scanner.parameter_set_updates(), 2);
+  ASSERT_EQ(scanner.sps()[3], std::byte{0x28});
+}
@@ -0,0 +1,140 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "payload_mock.hpp"
+#include "pooled_package.hpp"
+
+class PoolMock {
+public:
+  using Package = PooledPackage<PayloadMock, PoolMock>;
+
+private:
+  std::vector<std::optional<PayloadMock>> slots;
+  SlotGenerations generations{5};
+
+public:
+  void fill() {
+    for (int i = 0; i < 5; i++) {
+      slots.emplace_back(PayloadMock{"package_" + std::to_string(i)});
+    }
+  }
+
+  Package dequeue() {
+    for (std::uint32_t i = slots.size(); i-- > 0;) {
+      if (slots[i]) {
+        auto package = Package::create(*this, generations.hand_out(i), std::move(*slots[i]));
+        slots[i].reset();
+        return package;
+      }
+    }
+    throw std::runtime_error{"pool is empty"};
+  }
+
+  void enqueue(Package &&package) {
+    generations.take_back(package.slot());
+    slots[package.index()] = package.release();
+  }
+
+  std::size_t count_empty() {
+    std::size_t count = 0;
+    for (const auto &slot : slots) {
+      if (slot) {
+        count++;
+      }
+    }
+    return count;
+  }
+
+  [[nodiscard]] const std::optional<PayloadMock> &slot(std::uint32_t index) const { return slots[index]; }
+};
+
+TEST(TestPooledPackage, Initailization) {
+  PoolMock pool;
+  pool.fill();
+
+  auto package = pool.dequeue();
+
+  ASSERT_EQ(package.is_empty(), false);
+  ASSERT_EQ(package.data().get_data(), "package_4");
+  ASSERT_EQ(package.index(), 4);
+}
+
+TEST(TestPooledPackage, RequeueBehavior) {
+  PoolMock pool;
+  pool.fill();
+  {
+    auto package = pool.dequeue();
+
+    ASSERT_EQ(package.is_empty(), false);
+    ASSERT_EQ(package.data().get_data(), "package_4");
+    ASSERT_EQ(pool.count_empty(), 4);
+  }
+  ASSERT_EQ(pool.count_empty(), 5);
+  ASSERT_EQ(pool.slot(4)->get_data(), "package_4");
+}
+
+TEST(TestPooledPackage, MoveKeepsSlot) {
+  PoolMock pool;
+  pool.fill();
+
+  auto package = pool.dequeue();
+  auto moved = std::move(package);
+
+  ASSERT_TRUE(package.is_empty());
+  ASSERT_EQ(moved.index(), 4);
+  ASSERT_EQ(moved.slot().generation, 1);
+  ASSERT_EQ(pool.count_empty(), 4);
+}
+
+TEST(TestPooledPackage, MoveAssignReturnsPreviousValue) {
+  PoolMock pool;
+  pool.fill();
+
+  auto first = pool.dequeue();
+  auto second = pool.dequeue();
+
+  first = std::move(second);
+
+  ASSERT_EQ(first.data().get_data(), "package_3");
+  ASSERT_EQ(pool.count_empty(), 4);
+  ASSERT_EQ(pool.slot(4)->get_data(), "package_4");
+}
+
+TEST(TestPooledPackage, GenerationAdvancesPerHandOut) {
+  PoolMock pool;
+  pool.fill();
+
+  std::uint32_t generation;
+  {
+    auto package = pool.dequeue();
+    generation = package.slot().generation;
+  }
+
+  auto package = pool.dequeue();
+
+  ASSERT_EQ(package.index(), 4);
+  ASSERT_EQ(package.slot().generation, generation + 2);
+}
+
+#ifndef NDEBUG
+TEST(TestPooledPackageDeathTest, StalePackageIsDetected) {
+  SlotGenerations generations{1};
+
+  const auto stale = generations.hand_out(0);
+  generations.take_back(stale);
+  const auto current = generations.hand_out(0);
+
+  ASSERT_DEATH(generations.take_back(stale), "");
+
+  generations.take_back(current);
+}
+#endif
@@ -0,0 +1,121 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <vector>
+
+#include "mirrored_ring.hpp"
+#include "pre_event_buffer.hpp"
+
+using namespace std::chrono_literals;
+
+/* frames of 1000 bytes filled with their number, 30 fps, a keyframe every third frame */
+class TestPreEventBuffer : public ::testing::Test {
+protected:
+  static constexpr std::size_t FRAME_SIZE = 1000;
+
+  PreEventBuffer buffer{4096};
+
+  static std::vector<std::byte> frame_data(int number) {
+    return std::vector<std::byte>(FRAME_SIZE, static_cast<std::byte>(number));
+  }
+
+  void append(int number) {
+    const auto data = frame_data(number);
+    const timeval timestamp{0, number * 33333};
+    buffer.append(data, timestamp, number % 3 == 0);
+  }
+
+  static std::vector<std::byte> frames(int first, int last) {
+    std::vector<std::byte> expected;
+    for (int number = first; number <= last; number++) {
+      const auto data = frame_data(number);
+      expected.insert(expected.end(), data.begin(), data.end());
+    }
+    return expected;
+  }
+};
+
+TEST(TestMirroredRing, WrittenBytesAppearInBothHalves) {
+  MirroredRing ring{100};
+
+  ASSERT_EQ(ring.size(), static_cast<std::size_t>(sysconf(_SC_PAGESIZE)));
+
+  ring.data()[ring.size() - 1] = std::byte{1};
+  ring.data()[ring.size()] = std::byte{2};
+
+  ASSERT_EQ(ring.data()[2 * ring.size() - 1], std::byte{1});
+  ASSERT_EQ(ring.data()[0], std::byte{2});
+}
+
+TEST_F(TestPreEventBuffer, FramesBeforeTheFirstKeyframeAreDropped) {
+  for (int number = 1; number <= 3; number++) {
+    append(number);
+  }
+
+  ASSERT_EQ(buffer.dropped_frames(), 2);
+  ASSERT_EQ(buffer.buffered_frames(), 1);
+
+  const auto window = buffer.window(1s);
+  ASSERT_TRUE(std::ranges::equal(window, frames(3, 3)));
+}
+
+TEST_F(TestPreEventBuffer, OverwritesWholeGopsAndStaysBoundedByBytes) {
+  for (int number = 0; number < 20; number++) {
+    append(number);
+
+    ASSERT_LE(buffer.buffered_bytes(), buffer.capacity());
+  }
+
+  /* 4 frames fit, frame 18 is the newest keyframe */
+  ASSERT_EQ(buffer.buffered_frames(), 2);
+  ASSERT_TRUE(std::ranges::equal(buffer.window(1s), frames(18, 19)));
+}
+
+TEST_F(TestPreEventBuffer, WindowWrapsContiguously) {
+  for (int number = 0; number < 17; number++) {
+    append(number);
+  }
+
+  /* frames 15 to 16 cover bytes that wrap around the end of the ring */
+  ASSERT_EQ(buffer.buffered_frames(), 2);
+  ASSERT_TRUE(std::ranges::equal(buffer.window(1s), frames(15, 16)));
+}
+
+TEST_F(TestPreEventBuffer, WindowStartsAtTheKeyframeBeforeTheCutoff) {
+  PreEventBuffer large{64 * 1024};
+
+  for (int number = 0; number < 30; number++) {
+    const auto data = frame_data(number);
+    large.append(data, timeval{0, number * 33333}, number % 3 == 0);
+  }
+
+  /* frame 29 minus 60ms lies just after the keyframe 27 */
+  ASSERT_TRUE(std::ranges::equal(large.window(60ms), frames(27, 29)));
+  /* minus 130ms lies between the keyframes 24 and 27 */
+  ASSERT_TRUE(std::ranges::equal(large.window(130ms), frames(24, 29)));
+  /* more than stored starts at the oldest frame */
+  ASSERT_TRUE(std::ranges::equal(large.window(10s), frames(0, 29)));
+  ASSERT_EQ(large.buffered_duration(), 29 * 33333us);
+}
+
+TEST_F(TestPreEventBuffer, FlushWritesTheWindow) {
+  for (int number = 0; number < 17; number++) {
+    append(number);
+  }
+
+  const int fd = memfd_create("pre_event", MFD_CLOEXEC);
+  ASSERT_NE(fd, -1);
+
+  ASSERT_EQ(buffer.flush(fd, 1s), 2 * FRAME_SIZE);
+
+  std::vector<std::byte> written(2 * FRAME_SIZE);
+  ASSERT_EQ(pread(fd, written.data(), written.size(), 0), static_cast<ssize_t>(written.size()));
+  ASSERT_EQ(written, frames(15, 16));
+
+  close(fd);
+}
@@ -0,0 +1,200 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fake_device_backend.hpp"
+#include "preview_scaler.hpp"
+#include "v4l2_streamer.hpp"
+
+using namespace std::chrono_literals;
+
+static v4l2_pix_format yuyv_format(std::uint32_t width, std::uint32_t height) {
+  v4l2_pix_format format = {};
+  format.width = width;
+  format.height = height;
+  format.pixelformat = V4L2_PIX_FMT_YUYV;
+  format.bytesperline = width * 2;
+  return format;
+}
+
+static std::vector<std::uint8_t> random_frame(std::uint32_t width, std::uint32_t height) {
+  std::mt19937 random{7};
+  std::uniform_int_distribution<int> byte{0, 255};
+
+  std::vector<std::uint8_t> yuyv(std::size_t{width} * height * 2);
+  for (auto &value : yuyv) {
+    value = static_cast<std::uint8_t>(byte(random));
+  }
+  return yuyv;
+}
+
+/* rounded box mean straight from the definition */
+static std::vector<std::uint8_t> reference_scale(const std::vector<std::uint8_t> &yuyv, std::uint32_t width,
+                                                 std::uint32_t factor, std::uint32_t out_width,
+                                                 std::uint32_t out_height) {
+  std::vector<std::uint8_t> preview(std::size_t{out_width} * out_height * 2);
+  const std::uint32_t count = factor * factor;
+
+  auto pixel = [&](std::uint32_t x, std::uint32_t y, std::uint32_t byte) {
+    return yuyv[(std::size_t{y} * width + x) * 2 + byte];
+  };
+
+  for (std::uint32_t y = 0; y < out_height; y++) {
+    for (std::uint32_t x = 0; x < out_width; x++) {
+      std::uint32_t luma = 0;
+      std::uint32_t chroma = 0;
+
+      for (std::uint32_t row = 0; row < factor; row++) {
+        for (std::uint32_t column = 0; column < factor; column++) {
+          luma += pixel(x * factor + column, y * factor + row, 0);
+          /* U sits on the even pixels, V on the odd ones, each macro pixel of the output box counts once */
+          const std::uint32_t macro_pixel = x / 2 * factor + column;
+          chroma += pixel(macro_pixel * 2 + x % 2, y * factor + row, 1);
+        }
+      }
+
+      preview[(std::size_t{y} * out_width + x) * 2] = static_cast<std::uint8_t>((luma + count / 2) / count);
+      preview[(std::size_t{y} * out_width + x) * 2 + 1] = static_cast<std::uint8_t>((chroma + count / 2) / count);
+    }
+  }
+
+  return preview;
+}
+
+TEST(TestPreviewScaler, MatchesBoxFilter) {
+  /* 100 x 50 leaves partial boxes at the right and bottom edge for every factor */
+  const auto yuyv = random_frame(100, 50);
+
+  for (const std::uint32_t factor : {2u, 4u, 8u}) {
+    PreviewScaler::Config config;
+    config.factor = factor;
+
+    PreviewScaler scaler{config};
+    scaler.prepare(yuyv_format(100, 50));
+
+    ASSERT_EQ(scaler.preview_width(), 100 / (2 * factor) * 2);
+    ASSERT_EQ(scaler.preview_height(), 50 / factor);
+
+    PreviewFrame preview;
+    scaler.scale(yuyv.data(), preview);
+
+    ASSERT_EQ(preview.width, scaler.preview_width());
+    ASSERT_EQ(preview.height, scaler.preview_height());
+    ASSERT_EQ(preview.pixels, reference_scale(yuyv, 100, factor, preview.width, preview.height)) << factor;
+  }
+}
+
+TEST(TestPreviewScaler, SkipsFramesWhileEveryBufferIsHeld) {
+  set_device_backend(std::make_shared<FakeDeviceBackend>());
+
+  {
+    PreviewScaler::Config config;
+    config.factor = 2;
+    config.buffers = 2;
+
+    auto camera_buffers = allocate_dma_bufs(1, 64 * 32 * 2);
+
+    std::vector<PreviewScaler::Package> held;
+
+    PreviewScaler scaler{config};
+    scaler.prepare(yuyv_format(64, 32));
+    scaler.set_preview_handler([&held](PreviewScaler::Package &&package) {
+      ASSERT_EQ(package.data().width, 32);
+      held.push_back(std::move(package));
+    });
+
+    const BufferInfo info{0, {1, 0}, 64 * 32 * 2, 0, 0};
+
+    for (int i = 0; i < 3; i++) {
+      scaler.observe(camera_buffers[0], info);
+    }
+
+    ASSERT_EQ(held.size(), 2);
+    ASSERT_EQ(scaler.frames_skipped(), 1);
+    ASSERT_EQ(held[0].data().timestamp.tv_sec, 1);
+
+    /* a consumer thread drops its preview, the next frame reuses the buffer */
+    std::thread consumer{[package = std::move(held[0])]() mutable { auto dropped = std::move(package); }};
+    consumer.join();
+    held.erase(held.begin());
+
+    scaler.observe(camera_buffers[0], info);
+
+    ASSERT_EQ(held.size(), 2);
+    ASSERT_EQ(scaler.frames_skipped(), 1);
+
+    held.clear();
+  }
+
+  set_device_backend(nullptr);
+}
+
+TEST(TestPreviewScaler, StreamerDeliversEveryNthFrame) {
+  FakeDeviceBackend::Latencies latencies;
+  latencies.frame_interval = 1ms;
+  latencies.encode = 200us;
+  set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+
+  {
+    PreviewScaler::Config config;
+    config.factor = 8;
+    config.frame_divider = 3;
+
+    auto scaler = std::make_shared<PreviewScaler>(config);
+    std::size_t previews = 0;
+
+    scaler->set_preview_handler([&previews](PreviewScaler::Package &&package) {
+      ASSERT_EQ(package.data().width, 80);
+      ASSERT_EQ(package.data().height, 60);
+      previews++;
+    });
+
+    V4L2Streamer streamer{"/dev/video0", 640, 480};
+    streamer.add_camera_observer(scaler);
+    streamer.start_streaming();
+
+    for (int i = 0; i < 9; i++) {
+      streamer.next_frame();
+    }
+
+    ASSERT_EQ(previews, 3);
+    ASSERT_EQ(streamer.frames_encoded(), 9);
+  }
+
+  set_device_backend(nullptr);
+}
+
+TEST(TestPreviewScaler, PreviewOutlivesTheScaler) {
+  set_device_backend(std::make_shared<FakeDeviceBackend>());
+
+  {
+    auto camera_buffers = allocate_dma_bufs(1, 64 * 32 * 2);
+    std::optional<PreviewScaler::Package> held;
+
+    {
+      PreviewScaler::Config config;
+      config.factor = 2;
+
+      PreviewScaler scaler{config};
+      scaler.prepare(yuyv_format(64, 32));
+      scaler.set_preview_handler([&held](PreviewScaler::Package &&package) { held.emplace(std::move(package)); });
+      scaler.observe(camera_buffers[0], BufferInfo{0, {1, 0}, 64 * 32 * 2, 0, 0});
+    }
+
+    ASSERT_TRUE(held);
+    ASSERT_EQ(held->data().width, 32);
+
+    /* the consumer drops it after the scaler is gone */
+    std::thread consumer{[package = std::move(*held)]() mutable { auto dropped = std::move(package); }};
+    consumer.join();
+  }
+
+  set_device_backend(nullptr);
+}
@@ -0,0 +1,109 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <linux/videodev2.h>
+
+#include "fake_device_backend.hpp"
+#include "queue_monitor.hpp"
+#include "v4l2_streamer.hpp"
+
+using namespace std::chrono_literals;
+
+static constexpr std::uint64_t SECOND_NS{1000000000};
+
+static BufferInfo buffer(std::uint32_t sequence, std::uint64_t timestamp_ns = SECOND_NS,
+                         std::uint32_t flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+  const timeval timestamp{static_cast<time_t>(timestamp_ns / SECOND_NS),
+                          static_cast<suseconds_t>(timestamp_ns % SECOND_NS / 1000)};
+  return BufferInfo{0, timestamp, 0, V4L2_FIELD_NONE, flags, sequence};
+}
+
+TEST(TestQueueMonitor, CountsGapsInTheSequence) {
+  QueueMonitor monitor{10ms};
+
+  /* the first buffer after STREAMON may start anywhere */
+  monitor.record(buffer(5), SECOND_NS);
+  monitor.record(buffer(6), SECOND_NS);
+  monitor.record(buffer(9), SECOND_NS);
+  monitor.record(buffer(10), SECOND_NS);
+
+  const auto statistics = monitor.statistics();
+  ASSERT_EQ(statistics.buffers, 4);
+  ASSERT_EQ(statistics.dropped, 2);
+  ASSERT_EQ(statistics.errors, 0);
+  ASSERT_EQ(statistics.late, 0);
+}
+
+TEST(TestQueueMonitor, FollowsWrapAndRestartOfTheSequence) {
+  QueueMonitor monitor{10ms};
+
+  monitor.record(buffer(0xfffffffe), SECOND_NS);
+  monitor.record(buffer(1), SECOND_NS);
+  ASSERT_EQ(monitor.statistics().dropped, 2);
+
+  /* a new STREAMON starts over at zero */
+  monitor.restart_sequence();
+  monitor.record(buffer(0), SECOND_NS);
+  ASSERT_EQ(monitor.statistics().dropped, 2);
+
+  /* a sequence going backwards is not counted as four billion drops */
+  monitor.record(buffer(7), SECOND_NS);
+  monitor.record(buffer(3), SECOND_NS);
+  ASSERT_EQ(monitor.statistics().dropped, 8);
+}
+
+TEST(TestQueueMonitor, CountsErrorsAndLateBuffers) {
+  QueueMonitor monitor{10ms};
+
+  monitor.record(buffer(0, SECOND_NS, V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC | V4L2_BUF_FLAG_ERROR), SECOND_NS);
+  monitor.record(buffer(1, SECOND_NS), SECOND_NS + 10'000'000);
+  monitor.record(buffer(2, SECOND_NS), SECOND_NS + 10'001'000);
+  monitor.record(buffer(3, SECOND_NS, V4L2_BUF_FLAG_TIMESTAMP_COPY), SECOND_NS + 20'000'000);
+  /* an unknown time base is never late */
+  monitor.record(buffer(4, SECOND_NS, V4L2_BUF_FLAG_TIMESTAMP_UNKNOWN), SECOND_NS + 20'000'000);
+
+  auto statistics = monitor.statistics();
+  ASSERT_EQ(statistics.buffers, 5);
+  ASSERT_EQ(statistics.errors, 1);
+  ASSERT_EQ(statistics.late, 2);
+
+  monitor.reset();
+  statistics = monitor.statistics();
+  ASSERT_EQ(statistics.buffers, 0);
+  ASSERT_EQ(statistics.errors, 0);
+  ASSERT_EQ(statistics.late, 0);
+}
+
+TEST(TestQueueMonitorStreaming, StreamerCountsCameraDropsUnderLoad) {
+  FakeDeviceBackend::Latencies latencies;
+  /* the camera delivers much faster than the encoder takes its buffers back */
+  latencies.frame_interval = 1ms;
+  latencies.encode = 5ms;
+  set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+
+  {
+    V4L2Streamer streamer{"/dev/video0", 640, 480};
+
+    streamer.start_streaming();
+    for (int i = 0; i < 30; i++) {
+      streamer.next_frame();
+    }
+
+    const auto camera = streamer.queue_statistics(StreamQueue::CameraCapture);
+    ASSERT_GE(camera.buffers, 30);
+    ASSERT_GT(camera.dropped, 0);
+    ASSERT_EQ(camera.errors, 0);
+
+    const auto encoded = streamer.queue_statistics(StreamQueue::EncoderCapture);
+    ASSERT_EQ(encoded.buffers, streamer.frames_encoded());
+    ASSERT_EQ(encoded.dropped, 0);
+
+    streamer.reset_queue_statistics();
+    ASSERT_EQ(streamer.queue_statistics(StreamQueue::CameraCapture).buffers, 0);
+  }
+
+  set_device_backend(nullptr);
+}
@@ -7,31 +7,9 @@
 #include <utility>
 
 #include "indexed_queue.hpp"
+#include "payload_mock.hpp"
 #include "requeing_package.hpp"
 
-class PayloadMock {
-private:
-  std::string data;
-
-public:
-  explicit PayloadMock(std::string data) : data(std::move(data)) {}
-
-  PayloadMock(const PayloadMock &other) = delete;
-
-  PayloadMock(PayloadMock &&other) noexcept : data(std::move(other.data)) {}
-
-  PayloadMock &operator=(const PayloadMock &other) = delete;
-
-  PayloadMock &operator=(PayloadMock &&other) noexcept {
-    if (this == &other)
-      return *this;
-    data = std::move(other.data);
-    return *this;
-  }
-
-  [[nodiscard]] std::string get_data() const { return data; }
-};
-
 class RequeueMock : public IIndexedQueue<RequeingPackage<PayloadMock>>,
                     public std::enable_shared_from_this<RequeueMock> {
   std::vector<RequeingPackage<PayloadMock>> queue;
@@ -95,3 +73,15 @@ TEST(TestRequeue, RequeueBehavior) {
   }
   ASSERT_EQ(requeue->count_empty(), 5);
 }
+
+TEST(TestRequeue, IndexSurvivesMoves) {
+  std::shared_ptr<RequeueMock> requeue = std::make_shared<RequeueMock>();
+
+  RequeingPackage<PayloadMock> package =
+      RequeingPackage<PayloadMock>::create("indexed").with_queue(requeue).with_index(3);
+
+  auto moved = std::move(package);
+
+  ASSERT_EQ(moved.index(), 3);
+  ASSERT_TRUE(package.is_empty());
+}
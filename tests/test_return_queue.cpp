@@ -0,0 +1,137 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <poll.h>
+#include <thread>
+#include <vector>
+
+#include "requeing_package.hpp"
+#include "return_queue.hpp"
+
+TEST(TestReturnQueue, CapacityIsRoundedUp) {
+  ReturnQueue<int> queue{5};
+
+  ASSERT_EQ(queue.capacity(), 8);
+}
+
+TEST(TestReturnQueue, ReturnsInOrder) {
+  ReturnQueue<int> queue{4};
+
+  ASSERT_FALSE(queue.try_dequeue().has_value());
+
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 4; i++) {
+      queue.enqueue(round * 4 + i);
+    }
+
+    std::vector<int> drained;
+    ASSERT_EQ(queue.drain([&drained](int value) { drained.push_back(value); }), 4);
+    ASSERT_EQ(drained, (std::vector<int>{round * 4, round * 4 + 1, round * 4 + 2, round * 4 + 3}));
+  }
+}
+
+TEST(TestReturnQueue, ConcurrentProducers) {
+  constexpr int PRODUCERS = 4;
+  constexpr int VALUES_PER_PRODUCER = 100000;
+
+  ReturnQueue<int> queue{1024};
+  std::vector<std::thread> producers;
+
+  for (int producer = 0; producer < PRODUCERS; producer++) {
+    producers.emplace_back([&queue, producer] {
+      for (int i = 0; i < VALUES_PER_PRODUCER; i++) {
+        queue.enqueue(producer * VALUES_PER_PRODUCER + i);
+      }
+    });
+  }
+
+  /* each producer's values arrive in the order it pushed them */
+  std::vector<int> next(PRODUCERS, 0);
+  int received = 0;
+
+  while (received < PRODUCERS * VALUES_PER_PRODUCER) {
+    const auto value = queue.dequeue();
+    const auto producer = value / VALUES_PER_PRODUCER;
+
+    ASSERT_EQ(value % VALUES_PER_PRODUCER, next[producer]);
+    next[producer]++;
+    received++;
+  }
+
+  for (auto &producer : producers) {
+    producer.join();
+  }
+
+  ASSERT_FALSE(queue.try_dequeue().has_value());
+}
+
+TEST(TestReturnQueue, OwnerAndProducerSleepUntilWokenUp) {
+  constexpr int VALUES = 10000;
+
+  /* the smallest queue, the producer waits for the owner and the owner for the producer on nearly every value */
+  ReturnQueue<int> queue{1};
+  ASSERT_EQ(queue.capacity(), 2);
+
+  std::thread producer{[&queue]() {
+    for (int i = 0; i < VALUES; i++) {
+      queue.enqueue(int{i});
+    }
+  }};
+
+  for (int i = 0; i < VALUES; i++) {
+    ASSERT_EQ(queue.dequeue(), i);
+  }
+
+  producer.join();
+}
+
+TEST(TestReturnQueue, EventFdSignalsOnlyWhileTheOwnerWaits) {
+  ReturnQueue<int> queue{4};
+  pollfd event{queue.event_fd(), POLLIN, 0};
+
+  queue.enqueue(1);
+  ASSERT_EQ(poll(&event, 1, 0), 0);
+  /* the value is already there, the owner must not block */
+  ASSERT_FALSE(queue.prepare_wait());
+  queue.finish_wait();
+  ASSERT_EQ(queue.try_dequeue(), 1);
+
+  ASSERT_TRUE(queue.prepare_wait());
+  queue.enqueue(2);
+  ASSERT_EQ(poll(&event, 1, 0), 1);
+  queue.finish_wait();
+  ASSERT_EQ(poll(&event, 1, 0), 0);
+  ASSERT_EQ(queue.try_dequeue(), 2);
+}
+
+TEST(TestReturnQueue, PackagesDroppedOnOtherThreadsReturn) {
+  auto queue = std::make_shared<ReturnQueue<RequeingPackage<int>>>(8);
+  std::vector<std::thread> consumers;
+
+  for (int i = 0; i < 8; i++) {
+    RequeingPackage<int> package = RequeingPackage<int>::create(i).with_queue(queue).with_index(i);
+    consumers.emplace_back([package = std::move(package)] {
+      ASSERT_FALSE(package.is_empty());
+    });
+  }
+
+  for (auto &consumer : consumers) {
+    consumer.join();
+  }
+
+  std::vector<RequeingPackage<int>> returned;
+  ASSERT_EQ(queue->drain([&returned](RequeingPackage<int> &&package) { returned.push_back(std::move(package)); }),
+            8);
+
+  std::uint32_t indices = 0;
+  for (const auto &package : returned) {
+    ASSERT_EQ(package.data(), static_cast<int>(package.index()));
+    indices |= 1u << package.index();
+  }
+  ASSERT_EQ(indices, 0xffu);
+  ASSERT_FALSE(queue->try_dequeue().has_value());
+}
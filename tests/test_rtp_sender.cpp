@@ -0,0 +1,249 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fake_device_backend.hpp"
+#include "return_queue.hpp"
+#include "rtp_sender.hpp"
+
+using Nal = std::vector<std::uint8_t>;
+
+static const Nal SPS = {0x67, 0x42, 0xc0, 0x1f, 0x95, 0xa8, 0x14};
+static const Nal PPS = {0x68, 0xce, 0x38, 0x80};
+
+struct RtpPacket {
+  bool marker;
+  std::uint8_t payload_type;
+  std::uint16_t sequence_number;
+  std::uint32_t timestamp;
+  std::uint32_t ssrc;
+  Nal payload;
+};
+
+/* UDP socket on a free loopback port */
+class LoopbackReceiver {
+  int m_fd;
+  std::uint16_t m_port;
+
+public:
+  LoopbackReceiver() : m_fd(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    const int buffer_size = 8 << 20;
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    bind(m_fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+
+    socklen_t length = sizeof(address);
+    getsockname(m_fd, reinterpret_cast<sockaddr *>(&address), &length);
+    m_port = ntohs(address.sin_port);
+  }
+
+  ~LoopbackReceiver() { close(m_fd); }
+
+  [[nodiscard]] std::uint16_t port() const { return m_port; }
+
+  /* every packet that arrives within the timeout of the previous one */
+  std::vector<RtpPacket> receive() {
+    std::vector<RtpPacket> packets;
+    std::vector<std::uint8_t> buffer(65536);
+
+    pollfd descriptor{m_fd, POLLIN, 0};
+    while (poll(&descriptor, 1, 200) == 1) {
+      const auto size = recv(m_fd, buffer.data(), buffer.size(), 0);
+      if (size < 12) {
+        ADD_FAILURE() << "Short packet of " << size << " bytes";
+        break;
+      }
+
+      RtpPacket packet;
+      EXPECT_EQ(buffer[0], 0x80);
+      packet.marker = buffer[1] & 0x80;
+      packet.payload_type = buffer[1] & 0x7f;
+      packet.sequence_number = static_cast<std::uint16_t>(buffer[2] << 8 | buffer[3]);
+      packet.timestamp = static_cast<std::uint32_t>(buffer[4]) << 24 | buffer[5] << 16 | buffer[6] << 8 | buffer[7];
+      packet.ssrc = static_cast<std::uint32_t>(buffer[8]) << 24 | buffer[9] << 16 | buffer[10] << 8 | buffer[11];
+      packet.payload.assign(buffer.begin() + 12, buffer.begin() + size);
+      packets.push_back(std::move(packet));
+    }
+    return packets;
+  }
+};
+
+struct ReceivedFrame {
+  std::uint32_t timestamp;
+  std::vector<Nal> units;
+};
+
+/* RFC 6184 depacketizer for single NAL unit and FU-A packets */
+static std::vector<ReceivedFrame> depacketize(const std::vector<RtpPacket> &packets) {
+  std::vector<ReceivedFrame> frames;
+  bool frame_complete = true;
+  bool in_fragment = false;
+
+  for (std::size_t i = 0; i < packets.size(); i++) {
+    const auto &packet = packets[i];
+
+    if (i > 0) {
+      EXPECT_EQ(packet.sequence_number, static_cast<std::uint16_t>(packets[i - 1].sequence_number + 1));
+    }
+
+    if (frame_complete) {
+      frames.push_back({packet.timestamp, {}});
+      frame_complete = false;
+    }
+    auto &frame = frames.back();
+    EXPECT_EQ(packet.timestamp, frame.timestamp);
+
+    const auto type = packet.payload[0] & 0x1f;
+
+    if (type == 28) {
+      const auto fu_header = packet.payload[1];
+      const bool start = fu_header & 0x80;
+      const bool end = fu_header & 0x40;
+
+      EXPECT_EQ(start, !in_fragment);
+      if (start) {
+        frame.units.push_back({static_cast<std::uint8_t>((packet.payload[0] & 0xe0) | (fu_header & 0x1f))});
+      }
+      frame.units.back().insert(frame.units.back().end(), packet.payload.begin() + 2, packet.payload.end());
+      in_fragment = !end;
+    } else {
+      EXPECT_FALSE(in_fragment);
+      frame.units.push_back(packet.payload);
+    }
+
+    frame_complete = packet.marker;
+  }
+
+  EXPECT_TRUE(frame_complete);
+  return frames;
+}
+
+static Nal slice(bool idr, std::size_t size, std::uint32_t seed) {
+  std::mt19937 random{seed};
+  /* no zero bytes, so the slice data contains no start code */
+  std::uniform_int_distribution<int> byte{1, 255};
+
+  Nal unit(size);
+  for (auto &value : unit) {
+    value = static_cast<std::uint8_t>(byte(random));
+  }
+  unit[0] = idr ? 0x65 : 0x41;
+  return unit;
+}
+
+class TestRtpSender : public ::testing::Test {
+protected:
+  std::shared_ptr<ReturnQueue<RequeingPackage<DmaBuf>>> queue;
+
+  void SetUp() override {
+    set_device_backend(std::make_shared<FakeDeviceBackend>());
+    /* large enough for every frame of a test, nobody dequeues the returned buffers */
+    queue = std::make_shared<ReturnQueue<RequeingPackage<DmaBuf>>>(64);
+  }
+
+  void TearDown() override {
+    queue.reset();
+    set_device_backend(nullptr);
+  }
+
+  /* Annex-B access unit with an access unit delimiter in front of the units */
+  EncodedFrame frame(const std::vector<Nal> &units, long timestamp_us) {
+    std::vector<std::uint8_t> bitstream = {0, 0, 0, 1, 0x09, 0xf0};
+    for (const auto &unit : units) {
+      bitstream.insert(bitstream.end(), {0, 0, 0, 1});
+      bitstream.insert(bitstream.end(), unit.begin(), unit.end());
+    }
+
+    auto buffers = allocate_dma_bufs(1, static_cast<std::uint32_t>(bitstream.size()));
+    {
+      const DmaBufAccess access{buffers[0], DmaBufAccess::Mode::Write};
+      std::memcpy(access.writable_data().data(), bitstream.data(), bitstream.size());
+    }
+
+    const BufferInfo info{0, {timestamp_us / 1000000, timestamp_us % 1000000},
+                          static_cast<std::uint32_t>(bitstream.size()), 0, 0};
+    return EncodedFrame{VideoFrame{RequeingPackage<DmaBuf>::create(std::move(buffers[0])).with_queue(queue), info}};
+  }
+};
+
+TEST_F(TestRtpSender, LoopbackReceiverReassemblesFrames) {
+  for (const bool gso : {false, true}) {
+    for (const std::uint32_t max_payload : {1400u, 100u}) {
+      LoopbackReceiver receiver;
+
+      RtpSender::Config config;
+      config.gso = gso;
+      config.max_payload = max_payload;
+      RtpSender sender{"127.0.0.1", receiver.port(), config};
+
+      const auto idr = slice(true, 12000, 1);
+      const auto small = slice(false, 90, 2);
+      const auto large = slice(false, 3000, 3);
+      const auto second_idr = slice(true, 5000, 4);
+
+      sender.consume(frame({SPS, PPS, idr}, 1000000));
+      sender.consume(frame({small}, 1033333));
+      sender.consume(frame({large, small}, 1066666));
+      /* the encoder sent the parameter sets only once, the sender repeats them */
+      sender.consume(frame({second_idr}, 1100000));
+
+      const auto packets = receiver.receive();
+      ASSERT_EQ(packets.size(), sender.packets_sent()) << gso << " " << max_payload;
+
+      for (const auto &packet : packets) {
+        ASSERT_EQ(packet.payload_type, 96);
+        ASSERT_EQ(packet.ssrc, sender.ssrc());
+        ASSERT_LE(packet.payload.size(), max_payload);
+      }
+
+      const auto frames = depacketize(packets);
+      ASSERT_EQ(frames.size(), 4);
+
+      ASSERT_EQ(frames[0].units, (std::vector<Nal>{SPS, PPS, idr}));
+      ASSERT_EQ(frames[1].units, (std::vector<Nal>{small}));
+      ASSERT_EQ(frames[2].units, (std::vector<Nal>{large, small}));
+      ASSERT_EQ(frames[3].units, (std::vector<Nal>{SPS, PPS, second_idr}));
+
+      /* 90 kHz, 33333 us are 2999 ticks */
+      ASSERT_EQ(frames[1].timestamp - frames[0].timestamp, 2999);
+      ASSERT_EQ(frames[3].timestamp - frames[0].timestamp, 9000);
+
+      ASSERT_EQ(sender.frames_sent(), 4);
+      ASSERT_EQ(sender.frames_dropped(), 0);
+      /* one syscall per frame */
+      ASSERT_EQ(sender.send_calls(), 4);
+    }
+  }
+}
+
+TEST_F(TestRtpSender, DropsFramesWhileNobodyListens) {
+  std::uint16_t port;
+  {
+    LoopbackReceiver receiver;
+    port = receiver.port();
+  }
+
+  RtpSender sender{"127.0.0.1", port};
+
+  /* the first send triggers the ICMP port unreachable, a later one reports it */
+  for (int i = 0; i < 3; i++) {
+    sender.consume(frame({slice(false, 500, i)}, i * 33333));
+  }
+
+  ASSERT_GE(sender.frames_dropped(), 1);
+  ASSERT_EQ(sender.frames_sent() + sender.frames_dropped(), 3);
+}
@@ -0,0 +1,206 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fake_device_backend.hpp"
+#include "return_queue.hpp"
+#include "segmented_recorder.hpp"
+
+using namespace std::chrono_literals;
+
+static constexpr std::size_t FRAME_SIZE{5000};
+/* a keyframe every half second, a little slower than 30 fps so every other one is a full second after the segment
+ * start */
+static constexpr long FRAME_INTERVAL_US{33334};
+static constexpr std::size_t KEYFRAME_INTERVAL{15};
+
+static std::vector<std::uint8_t> read_file(const std::filesystem::path &path) {
+  std::ifstream file{path, std::ios::binary};
+  return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+class TestSegmentedRecorder : public ::testing::Test {
+protected:
+  std::filesystem::path directory;
+  std::shared_ptr<ReturnQueue<RequeingPackage<DmaBuf>>> queue;
+  /* everything handed to the recorder */
+  std::vector<std::uint8_t> recorded;
+
+  void SetUp() override {
+    set_device_backend(std::make_shared<FakeDeviceBackend>());
+    directory = std::filesystem::path{testing::TempDir()} / "test_segmented_recorder";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directory(directory);
+    /* large enough for every frame of a test, nobody dequeues the returned buffers */
+    queue = std::make_shared<ReturnQueue<RequeingPackage<DmaBuf>>>(256);
+  }
+
+  void TearDown() override {
+    queue.reset();
+    std::filesystem::remove_all(directory);
+    set_device_backend(nullptr);
+  }
+
+  EncodedFrame frame(std::size_t number, bool keyframe) {
+    std::mt19937 random{static_cast<std::uint32_t>(number)};
+    std::uniform_int_distribution<int> byte{0, 255};
+
+    std::vector<std::uint8_t> data(FRAME_SIZE + number % 7);
+    for (auto &value : data) {
+      value = static_cast<std::uint8_t>(byte(random));
+    }
+
+    auto buffers = allocate_dma_bufs(1, static_cast<std::uint32_t>(data.size()));
+    {
+      const DmaBufAccess access{buffers[0], DmaBufAccess::Mode::Write};
+      std::memcpy(access.writable_data().data(), data.data(), data.size());
+    }
+
+    const long timestamp_us = static_cast<long>(number) * FRAME_INTERVAL_US;
+    const BufferInfo info{0, {timestamp_us / 1000000, timestamp_us % 1000000}, static_cast<std::uint32_t>(data.size()),
+                          0, keyframe ? static_cast<std::uint32_t>(V4L2_BUF_FLAG_KEYFRAME) : 0u};
+    return EncodedFrame{VideoFrame{RequeingPackage<DmaBuf>::create(std::move(buffers[0])).with_queue(queue), info}};
+  }
+
+  void record(SegmentedRecorder &recorder, std::size_t first, std::size_t count) {
+    for (std::size_t number = first; number < first + count; number++) {
+      auto encoded = frame(number, number % KEYFRAME_INTERVAL == 0);
+      const auto data = encoded.data();
+      recorded.insert(recorded.end(), reinterpret_cast<const std::uint8_t *>(data.data()),
+                      reinterpret_cast<const std::uint8_t *>(data.data()) + data.size());
+
+      recorder.consume(std::move(encoded));
+      /* never drop frames because the test thread is faster than the disk */
+      recorder.flush();
+    }
+  }
+
+  std::vector<std::filesystem::path> segments() const {
+    std::vector<std::filesystem::path> paths;
+    for (const auto &entry : std::filesystem::directory_iterator{directory}) {
+      paths.push_back(entry.path());
+    }
+    std::ranges::sort(paths);
+    return paths;
+  }
+
+  static SegmentedRecorder::Config config() {
+    SegmentedRecorder::Config config;
+    config.segment_duration = 1s;
+    config.segment_size = 1 << 20;
+    config.staging_size = 64 << 10;
+    return config;
+  }
+};
+
+TEST_F(TestSegmentedRecorder, SegmentsStartOnKeyframesAfterTheDuration) {
+  {
+    SegmentedRecorder recorder{directory.string(), config()};
+    /* three seconds */
+    record(recorder, 0, 90);
+
+    ASSERT_EQ(recorder.frames_written(), 90);
+    ASSERT_EQ(recorder.frames_dropped(), 0);
+  }
+
+  const auto paths = segments();
+  ASSERT_EQ(paths.size(), 3);
+  ASSERT_EQ(paths[0].filename(), "segment-000000.h264");
+  ASSERT_EQ(paths[2].filename(), "segment-000002.h264");
+
+  std::vector<std::uint8_t> concatenated;
+
+  for (std::size_t i = 0; i < paths.size(); i++) {
+    const auto content = read_file(paths[i]);
+    /* no padding and no preallocation left over */
+    ASSERT_EQ(std::filesystem::file_size(paths[i]), content.size());
+
+    /* thirty frames each, the keyframes in the middle of a segment do not start a new one */
+    ASSERT_GE(content.size(), 30 * FRAME_SIZE);
+    ASSERT_LT(content.size(), 30 * (FRAME_SIZE + 7));
+
+    concatenated.insert(concatenated.end(), content.begin(), content.end());
+  }
+
+  ASSERT_EQ(concatenated, recorded);
+}
+
+TEST_F(TestSegmentedRecorder, SkipsFramesBeforeTheFirstKeyframe) {
+  {
+    SegmentedRecorder recorder{directory.string(), config()};
+
+    record(recorder, 10, 5);
+    recorded.clear();
+    record(recorder, 15, 5);
+
+    ASSERT_EQ(recorder.frames_written(), 5);
+    ASSERT_EQ(recorder.frames_dropped(), 5);
+  }
+
+  ASSERT_EQ(read_file(directory / "segment-000000.h264"), recorded);
+}
+
+TEST_F(TestSegmentedRecorder, DeletesOldestSegmentsOverBudget) {
+  auto limited = config();
+  limited.segment_size = 256 << 10;
+  limited.total_budget = 512 << 10;
+
+  {
+    SegmentedRecorder recorder{directory.string(), limited};
+    /* six segments of 150 kB */
+    record(recorder, 0, 180);
+
+    ASSERT_EQ(recorder.segments_written(), 5);
+  }
+
+  const auto paths = segments();
+  std::uintmax_t total = 0;
+  for (const auto &path : paths) {
+    total += std::filesystem::file_size(path);
+  }
+
+  ASSERT_LE(total, limited.total_budget);
+  ASSERT_EQ(paths.back().filename(), "segment-000005.h264");
+  ASSERT_FALSE(std::filesystem::exists(directory / "segment-000000.h264"));
+}
+
+TEST_F(TestSegmentedRecorder, ContinuesAfterEarlierRecording) {
+  {
+    SegmentedRecorder recorder{directory.string(), config()};
+    record(recorder, 0, 30);
+  }
+
+  {
+    SegmentedRecorder recorder{directory.string(), config()};
+    record(recorder, 0, 30);
+  }
+
+  const auto paths = segments();
+  ASSERT_EQ(paths.size(), 2);
+  ASSERT_EQ(paths[1].filename(), "segment-000001.h264");
+  ASSERT_EQ(read_file(paths[0]), read_file(paths[1]));
+}
+
+TEST_F(TestSegmentedRecorder, IgnoresSegmentNumbersOutOfRange) {
+  /* more digits than an unsigned 64 bit number holds */
+  std::ofstream{directory / "segment-99999999999999999999.h264"} << "foreign";
+
+  {
+    SegmentedRecorder recorder{directory.string(), config()};
+    record(recorder, 0, 30);
+  }
+
+  const auto paths = segments();
+  ASSERT_EQ(paths.size(), 2);
+  ASSERT_EQ(paths[0].filename(), "segment-000000.h264");
+}
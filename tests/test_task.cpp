@@ -0,0 +1,66 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <coroutine>
+#include <stdexcept>
+
+#include "task.hpp"
+
+class ManualEvent {
+  std::coroutine_handle<> waiter;
+
+public:
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> handle) { waiter = handle; }
+
+  void await_resume() const noexcept {}
+
+  void set() { std::exchange(waiter, {}).resume(); }
+};
+
+Task<int> add_after_event(ManualEvent &event, int a, int b) {
+  co_await event;
+  co_return a + b;
+}
+
+Task<void> store_sum(ManualEvent &event, int &result) {
+  result = co_await add_after_event(event, 20, 22);
+}
+
+Task<void> throw_immediately() {
+  throw std::runtime_error("failed");
+  co_return;
+}
+
+Task<void> catch_exception(bool &caught) {
+  try {
+    co_await throw_immediately();
+  } catch (const std::runtime_error &) {
+    caught = true;
+  }
+}
+
+TEST(TestTask, ResumesAwaitingCoroutineWithResult) {
+  ManualEvent event;
+  int result = 0;
+
+  co_spawn(store_sum(event, result));
+
+  ASSERT_EQ(result, 0);
+
+  event.set();
+
+  ASSERT_EQ(result, 42);
+}
+
+TEST(TestTask, PropagatesExceptions) {
+  bool caught = false;
+
+  co_spawn(catch_exception(caught));
+
+  ASSERT_TRUE(caught);
+}
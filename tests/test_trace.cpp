@@ -0,0 +1,122 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include "trace.hpp"
+
+static std::vector<std::pair<TraceRingHeader, std::vector<TraceEvent> > > read_trace(const std::string &path) {
+  std::ifstream file{path, std::ios::binary};
+
+  TraceFileHeader header = {};
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+
+  EXPECT_EQ(std::memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)), 0);
+  EXPECT_EQ(header.event_size, sizeof(TraceEvent));
+
+  std::vector<std::pair<TraceRingHeader, std::vector<TraceEvent> > > rings;
+
+  for (std::uint32_t i = 0; i < header.ring_count; i++) {
+    TraceRingHeader ring_header = {};
+    file.read(reinterpret_cast<char *>(&ring_header), sizeof(ring_header));
+
+    std::vector<TraceEvent> events(ring_header.event_count);
+    file.read(reinterpret_cast<char *>(events.data()),
+              static_cast<std::streamsize>(events.size() * sizeof(TraceEvent)));
+
+    rings.emplace_back(ring_header, std::move(events));
+  }
+
+  return rings;
+}
+
+TEST(TestTrace, ScopesOfEveryThreadAreDumped) {
+  if constexpr (SPICAM_TRACE_LEVEL == 0) {
+    GTEST_SKIP() << "tracing is compiled out";
+  }
+
+  std::thread worker{[] {
+    TraceScope trace{TraceOp::Qbuf, 3, 9, 2, 1234};
+  }};
+  worker.join();
+
+  {
+    TraceScope trace{TraceOp::Dqbuf, 4, 10};
+    trace.set_buffer(5, 4321);
+  }
+
+  const std::string path = ::testing::TempDir() + "test_trace.bin";
+  trace_dump(path);
+
+  const auto rings = read_trace(path);
+
+  ASSERT_EQ(rings.size(), 2);
+
+  std::vector<TraceEvent> events;
+  for (const auto &ring: rings) {
+    ASSERT_EQ(ring.second.size(), 1);
+    events.push_back(ring.second.front());
+  }
+
+  auto queued = std::ranges::find(events, TraceOp::Qbuf, &TraceEvent::op);
+  ASSERT_NE(queued, events.end());
+  ASSERT_EQ(queued->fd, 3);
+  ASSERT_EQ(queued->buffer_type, 9);
+  ASSERT_EQ(queued->index, 2);
+  ASSERT_EQ(queued->bytesused, 1234);
+
+  auto dequeued = std::ranges::find(events, TraceOp::Dqbuf, &TraceEvent::op);
+  ASSERT_NE(dequeued, events.end());
+  ASSERT_EQ(dequeued->index, 5);
+  ASSERT_EQ(dequeued->bytesused, 4321);
+  ASSERT_EQ(dequeued->result, TraceResult::Ok);
+}
+
+TEST(TestTrace, EmptyResultsNeedVerboseLevel) {
+  if constexpr (SPICAM_TRACE_LEVEL == 0) {
+    GTEST_SKIP() << "tracing is compiled out";
+  }
+
+  std::size_t recorded = 0;
+
+  std::thread worker{[] {
+    TraceScope trace{TraceOp::Dqbuf, 3, 9};
+    trace.set_result(TraceResult::Empty);
+  }};
+  worker.join();
+
+  const std::string path = ::testing::TempDir() + "test_trace_empty.bin";
+  trace_dump(path);
+
+  for (const auto &ring: read_trace(path)) {
+    recorded += std::ranges::count(ring.second, TraceResult::Empty, &TraceEvent::result);
+  }
+
+  ASSERT_EQ(recorded, SPICAM_TRACE_LEVEL >= 2 ? 1 : 0);
+}
+
+TEST(TestTrace, RingsOfExitedThreadsAreReclaimed) {
+  if constexpr (SPICAM_TRACE_LEVEL == 0) {
+    GTEST_SKIP() << "tracing is compiled out";
+  }
+
+  for (int i = 0; i < 100; i++) {
+    std::thread worker{[] {
+      TraceScope trace{TraceOp::Qbuf, 3, 9};
+    }};
+    worker.join();
+  }
+
+  const std::string path = ::testing::TempDir() + "test_trace_exited.bin";
+  trace_dump(path);
+
+  /* the test thread and the last threads that exited */
+  ASSERT_LE(read_trace(path).size(), 9);
+}
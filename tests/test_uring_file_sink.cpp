@@ -0,0 +1,141 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "exceptions.hpp"
+#include "fake_device_backend.hpp"
+#include "return_queue.hpp"
+#include "uring_file_sink.hpp"
+
+static constexpr std::uint32_t BUFFER_COUNT{4};
+static constexpr std::uint32_t BUFFER_SIZE{8192};
+
+static std::vector<std::uint8_t> read_file(const std::filesystem::path &path) {
+  std::ifstream file{path, std::ios::binary};
+  return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+class TestUringFileSink : public ::testing::Test {
+protected:
+  std::filesystem::path path;
+  std::shared_ptr<ReturnQueue<RequeingPackage<DmaBuf>>> returns;
+  /* buffers the sink does not hold, indexed by their package index */
+  std::vector<std::optional<RequeingPackage<DmaBuf>>> buffers;
+  /* everything handed to the sink */
+  std::vector<std::uint8_t> written;
+
+  void SetUp() override {
+    set_device_backend(std::make_shared<FakeDeviceBackend>());
+    path = std::filesystem::path{testing::TempDir()} / "test_uring_file_sink.h264";
+    returns = std::make_shared<ReturnQueue<RequeingPackage<DmaBuf>>>(BUFFER_COUNT);
+
+    auto allocated = allocate_dma_bufs(BUFFER_COUNT, BUFFER_SIZE);
+    for (std::uint32_t i = 0; i < BUFFER_COUNT; i++) {
+      buffers.emplace_back(RequeingPackage<DmaBuf>::create(std::move(allocated[i])).with_queue(returns).with_index(i));
+    }
+  }
+
+  void TearDown() override {
+    buffers.clear();
+    returns.reset();
+    std::filesystem::remove(path);
+    set_device_backend(nullptr);
+  }
+
+  std::vector<const DmaBuf *> prepared_buffers() const {
+    std::vector<const DmaBuf *> pointers;
+    for (const auto &buffer : buffers) {
+      pointers.push_back(&buffer->data());
+    }
+    return pointers;
+  }
+
+  /* a package left in the queue would return itself once more when it goes out of scope */
+  std::size_t take_back() {
+    return returns->drain([this](RequeingPackage<DmaBuf> &&package) {
+      const auto index = package.index();
+      buffers[index].emplace(std::move(package));
+    });
+  }
+
+  EncodedFrame frame(std::size_t number) {
+    take_back();
+
+    const auto free_buffer = std::ranges::find_if(buffers, [](const auto &buffer) { return buffer.has_value(); });
+    EXPECT_NE(free_buffer, buffers.end());
+
+    const auto size = static_cast<std::uint32_t>(1000 + number * 997 % (BUFFER_SIZE - 1000));
+    {
+      const DmaBufAccess access{(*free_buffer)->data(), DmaBufAccess::Mode::Write};
+      for (std::uint32_t offset = 0; offset < size; offset++) {
+        const auto value = static_cast<std::uint8_t>((number * 13 + offset) & 0xff);
+        access.writable_data()[offset] = static_cast<std::byte>(value);
+        written.push_back(value);
+      }
+    }
+
+    const BufferInfo info{(*free_buffer)->index(), {0, 0}, size, V4L2_FIELD_NONE, 0};
+    auto package = std::move(**free_buffer);
+    free_buffer->reset();
+    return EncodedFrame{VideoFrame{std::move(package), info}};
+  }
+};
+
+TEST_F(TestUringFileSink, WritesFramesInOrder) {
+  {
+    UringFileSink sink{path.string(), BUFFER_COUNT - 1};
+    sink.prepare(prepared_buffers());
+
+    for (std::size_t number = 0; number < 50; number++) {
+      sink.consume(frame(number));
+    }
+    sink.flush();
+  }
+
+  ASSERT_EQ(read_file(path), written);
+}
+
+TEST_F(TestUringFileSink, ReturnsEveryBufferAfterFlush) {
+  UringFileSink sink{path.string(), 2};
+  sink.prepare(prepared_buffers());
+
+  for (std::size_t number = 0; number < 10; number++) {
+    sink.consume(frame(number));
+  }
+  sink.flush();
+
+  /* the frames were dropped as their writes completed, the last ones are back */
+  take_back();
+  ASSERT_TRUE(std::ranges::all_of(buffers, [](const auto &buffer) { return buffer.has_value(); }));
+}
+
+TEST_F(TestUringFileSink, RejectsQueueDepthWithoutSpareBuffer) {
+  UringFileSink sink{path.string(), BUFFER_COUNT};
+
+  ASSERT_THROW(sink.prepare(prepared_buffers()), DeviceFileError);
+}
+
+TEST_F(TestUringFileSink, FailedWriteThrows) {
+  /* every write to /dev/full fails with ENOSPC */
+  UringFileSink sink{"/dev/full", 2};
+  sink.prepare(prepared_buffers());
+
+  ASSERT_THROW({
+    sink.consume(frame(0));
+    sink.flush();
+  }, DeviceFileError);
+
+  /* the failed frame went back all the same */
+  ASSERT_EQ(take_back(), 1);
+}
@@ -0,0 +1,118 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <linux/videodev2.h>
+
+#include "fake_device_backend.hpp"
+#include "v4l2_operations.hpp"
+#include "v4l2_video_buffer.hpp"
+
+class TestV4L2VideoBuffer : public ::testing::Test {
+protected:
+  std::shared_ptr<DeviceFileHandle> camera;
+  std::shared_ptr<V4L2VideoBuffer> buffers;
+
+  virtual V4L2VideoBuffer::ReturnMode return_mode() const { return V4L2VideoBuffer::ReturnMode::Immediate; }
+
+  void SetUp() override {
+    FakeDeviceBackend::Latencies latencies;
+    latencies.frame_interval = std::chrono::nanoseconds{0};
+
+    set_device_backend(std::make_shared<FakeDeviceBackend>(latencies));
+
+    camera = std::make_shared<DeviceFileHandle>("/dev/video0");
+    auto fmt = camera->do_file_operation(set_camera_format);
+    buffers = V4L2VideoBuffer::create(camera, V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_MEMORY_DMABUF,
+                                      fmt.fmt.pix.sizeimage, nullptr, return_mode());
+
+    camera->do_file_operation(stream_on_capture);
+  }
+
+  void TearDown() override {
+    camera->do_file_operation(stream_off_capture);
+    buffers.reset();
+    camera.reset();
+    set_device_backend(nullptr);
+  }
+};
+
+TEST_F(TestV4L2VideoBuffer, AllBuffersStartQueued) {
+  ASSERT_EQ(buffers->queued_buffers(), 8);
+
+  for (std::uint32_t i = 0; i < 8; i++) {
+    ASSERT_EQ(buffers->slot_state(i), V4L2VideoBuffer::SlotState::Queued);
+  }
+}
+
+TEST_F(TestV4L2VideoBuffer, DequeuedFrameIsOwnedByTheUser) {
+  auto frame = buffers->dequeue_frame();
+
+  ASSERT_EQ(frame.buffer.index(), frame.info.index);
+  ASSERT_EQ(buffers->slot_state(frame.info.index), V4L2VideoBuffer::SlotState::User);
+  ASSERT_EQ(buffers->queued_buffers(), 7);
+  ASSERT_EQ(buffers->buffers().size(), 7);
+}
+
+TEST_F(TestV4L2VideoBuffer, DroppedFrameReturnsToItsSlot) {
+  std::uint32_t index;
+  int fd;
+
+  {
+    auto frame = buffers->dequeue_frame();
+    index = frame.info.index;
+    fd = frame.buffer.data().get_fd();
+  }
+
+  ASSERT_EQ(buffers->slot_state(index), V4L2VideoBuffer::SlotState::Queued);
+  ASSERT_EQ(buffers->queued_buffers(), 8);
+
+  /* every other buffer was queued before, the requeued one comes last */
+  for (int i = 0; i < 7; i++) {
+    auto other = buffers->dequeue_frame();
+    ASSERT_NE(other.info.index, index);
+  }
+
+  auto frame = buffers->dequeue_frame();
+  ASSERT_EQ(frame.info.index, index);
+  ASSERT_EQ(frame.buffer.data().get_fd(), fd);
+}
+
+class TestV4L2VideoBufferDeferred : public TestV4L2VideoBuffer {
+protected:
+  V4L2VideoBuffer::ReturnMode return_mode() const override { return V4L2VideoBuffer::ReturnMode::Deferred; }
+};
+
+TEST_F(TestV4L2VideoBufferDeferred, FrameDroppedOnAnotherThreadIsRequeuedByTheOwner) {
+  auto frame = buffers->dequeue_frame();
+  const auto index = frame.info.index;
+
+  std::thread consumer{[frame = std::move(frame)] {}};
+  consumer.join();
+
+  ASSERT_EQ(buffers->slot_state(index), V4L2VideoBuffer::SlotState::User);
+
+  ASSERT_EQ(buffers->requeue_returned(), 1);
+  ASSERT_EQ(buffers->slot_state(index), V4L2VideoBuffer::SlotState::Queued);
+  ASSERT_EQ(buffers->queued_buffers(), 8);
+}
+
+TEST_F(TestV4L2VideoBufferDeferred, DequeueWaitsForReturnedBuffers) {
+  std::vector<VideoFrame> frames;
+  for (int i = 0; i < 8; i++) {
+    frames.push_back(buffers->dequeue_frame());
+  }
+
+  ASSERT_EQ(buffers->queued_buffers(), 0);
+
+  const auto index = frames.front().info.index;
+  std::thread consumer{[frame = std::move(frames.front())] {}};
+
+  auto frame = buffers->dequeue_frame();
+  consumer.join();
+
+  ASSERT_EQ(frame.info.index, index);
+}
@@ -0,0 +1,126 @@
+//
+// Copyright (c) 2024 Nico Schmidt
+//
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "trace.hpp"
+
+/**
+ * Decodes a binary trace written by trace_dump into one line per event, ordered by time, followed by a per
+ * operation summary.
+ */
+
+struct DecodedEvent {
+    std::uint32_t thread_id;
+    TraceEvent event;
+};
+
+struct OpSummary {
+    std::uint64_t count{0};
+    std::uint64_t total_ns{0};
+    std::uint32_t max_ns{0};
+};
+
+static const char *result_name(TraceResult result) {
+    switch (result) {
+        case TraceResult::Ok:
+            return "ok";
+        case TraceResult::Empty:
+            return "empty";
+        case TraceResult::Error:
+            return "error";
+        default:
+            return "unknown";
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <trace file>\n";
+        return 1;
+    }
+
+    std::ifstream file{argv[1], std::ios::binary};
+
+    if (!file) {
+        std::cerr << "Failed to open " << argv[1] << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+
+    TraceFileHeader header = {};
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+
+    if (!file || std::memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        std::cerr << argv[1] << " is not a trace file\n";
+        return 1;
+    }
+
+    if (header.version != TRACE_FILE_VERSION || header.event_size != sizeof(TraceEvent)) {
+        std::cerr << "Unsupported trace version " << header.version << " with event size " << header.event_size
+                << "\n";
+        return 1;
+    }
+
+    std::vector<DecodedEvent> events;
+
+    for (std::uint32_t ring = 0; ring < header.ring_count; ring++) {
+        TraceRingHeader ring_header = {};
+        file.read(reinterpret_cast<char *>(&ring_header), sizeof(ring_header));
+
+        std::vector<TraceEvent> ring_events(ring_header.event_count);
+        file.read(reinterpret_cast<char *>(ring_events.data()),
+                  static_cast<std::streamsize>(ring_events.size() * sizeof(TraceEvent)));
+
+        if (!file) {
+            std::cerr << "Trace file is truncated\n";
+            return 1;
+        }
+
+        for (const auto &event: ring_events) {
+            events.push_back({ring_header.thread_id, event});
+        }
+    }
+
+    std::ranges::sort(events, [](const auto &a, const auto &b) {
+        return a.event.timestamp_ns < b.event.timestamp_ns;
+    });
+
+    const auto start_ns = events.empty() ? 0 : events.front().event.timestamp_ns;
+
+    std::map<TraceOp, OpSummary> summaries;
+
+    std::cout << std::setw(14) << "time_us" << std::setw(8) << "tid" << std::setw(11) << "op"
+            << std::setw(5) << "fd" << std::setw(6) << "type" << std::setw(7) << "index"
+            << std::setw(10) << "bytes" << std::setw(11) << "dur_ns" << "  result\n";
+
+    for (const auto &[thread_id, event]: events) {
+        std::cout << std::setw(14) << std::fixed << std::setprecision(3)
+                << static_cast<double>(event.timestamp_ns - start_ns) / 1000.0
+                << std::setw(8) << thread_id << std::setw(11) << trace_op_name(event.op)
+                << std::setw(5) << event.fd << std::setw(6) << event.buffer_type << std::setw(7) << event.index
+                << std::setw(10) << event.bytesused << std::setw(11) << event.duration_ns
+                << "  " << result_name(event.result) << "\n";
+
+        auto &summary = summaries[event.op];
+        summary.count++;
+        summary.total_ns += event.duration_ns;
+        summary.max_ns = std::max(summary.max_ns, event.duration_ns);
+    }
+
+    std::cout << "\n" << std::setw(11) << "op" << std::setw(10) << "count" << std::setw(12) << "mean_ns"
+            << std::setw(12) << "max_ns" << "\n";
+
+    for (const auto &[op, summary]: summaries) {
+        std::cout << std::setw(11) << trace_op_name(op) << std::setw(10) << summary.count
+                << std::setw(12) << summary.total_ns / summary.count << std::setw(12) << summary.max_ns << "\n";
+    }
+
+    return 0;
+}